@@ -0,0 +1,85 @@
+--- Compares the native BPF filter with pflua on packets from a pcap file.
+--- The packets are loaded into memory once, no NIC is required.
+--- Example: ./build/libmoon examples/bpf-benchmark.lua trace.pcap "udp dst port 53" "tcp and (port 80 or port 443)"
+
+local lm        = require "libmoon"
+local memory    = require "memory"
+local pcap      = require "pcap"
+local log       = require "log"
+local pf        = require "pf"
+local bpffilter = require "bpffilter"
+
+function configure(parser)
+	parser:description("Benchmarks the native BPF filter against pflua.")
+	parser:argument("file", "pcap file to read packets from.")
+	parser:argument("filters", "BPF filter expressions."):args("+")
+	parser:option("-n --packets", "Maximum number of packets to load from the file."):convert(tonumber):default(100000)
+	parser:option("-t --time", "Run time per filter and method in seconds."):convert(tonumber):default(3)
+	parser:flag("-B --bpf", "Let pflua compile via libpcap instead of its native pipeline."):default(false)
+	return parser:parse()
+end
+
+local function loadPackets(file, maxPackets)
+	local mempool = memory.createMemPool{n = maxPackets + 2047}
+	local reader = pcap:newReader(file)
+	local batches = {}
+	local total = 0
+	while total < maxPackets do
+		local bufs = mempool:bufArray(math.min(64, maxPackets - total))
+		local n = reader:read(bufs)
+		if n == 0 then
+			break
+		end
+		batches[#batches + 1] = { bufs = bufs, n = n }
+		total = total + n
+	end
+	reader:close()
+	return batches, total
+end
+
+local function run(name, batches, total, time, func)
+	local matches = 0
+	local packets = 0
+	local start = lm.getTime()
+	while lm.running() and lm.getTime() - start < time do
+		matches = 0
+		for _, batch in ipairs(batches) do
+			matches = matches + func(batch.bufs, batch.n)
+		end
+		packets = packets + total
+	end
+	local elapsed = lm.getTime() - start
+	log:info("  %-8s %8.2f Mpps, %d/%d packets match", name, packets / elapsed / 10^6, matches, total)
+	return packets / elapsed
+end
+
+function master(args)
+	local batches, total = loadPackets(args.file, args.packets)
+	if total == 0 then
+		log:fatal("No packets in %s", args.file)
+	end
+	log:info("Loaded %d packets from %s", total, args.file)
+	for _, expr in ipairs(args.filters) do
+		log:info("Filter \"%s\":", expr)
+		local pfFilter = pf.compile_filter(expr, {bpf = args.bpf})
+		local pfRate = run("pflua", batches, total, args.time, function(bufs, n)
+			local matches = 0
+			for i = 1, n do
+				local buf = bufs[i]
+				if pfFilter(buf:getBytes(), buf:getSize()) then
+					matches = matches + 1
+				end
+			end
+			return matches
+		end)
+		local nativeFilter = bpffilter.compile(expr)
+		local nativeRate = run("native", batches, total, args.time, function(bufs, n)
+			return nativeFilter:matchBurst(bufs, n)
+		end)
+		log:info("  speedup %.2fx", nativeRate / pfRate)
+		nativeFilter:destroy()
+	end
+	for _, batch in ipairs(batches) do
+		batch.bufs:freeAll()
+	end
+end
@@ -20,6 +20,7 @@ local eth    = require "proto.ethernet"
 local log    = require "log"
 local pcap   = require "pcap"
 local pf     = require "pf"
+local bpffilter = require "bpffilter"
 
 function configure(parser)
 	parser:argument("devs", "Device(s) to use."):args(1)
@@ -29,6 +30,7 @@ function configure(parser)
 	parser:option("-t --threads", "Number of threads."):convert(tonumber):default(1)
 	parser:option("-o --output", "File to output statistics to.")
 	parser:flag("-B --bpf", "Use libpcap to compile BPF."):default(false)
+	parser:flag("-N --native", "Run the BPF filter natively on the whole batch instead of pflua."):default(false)
 	parser:flag("-V --vlans", "Keep vlan tags."):default(false)
 	parser:argument("filter", "A BPF filter expression."):args("*"):combine()
 	local args = parser:parse()
@@ -65,6 +67,7 @@ function dumper(queue, args, threadId, devId)
 	local handleArp = args.arp
 	-- default: show everything
 	local filter = args.filter and pf.compile_filter(args.filter, {bpf=args.bpf}) or function() return true end
+	local nativeFilter = args.filter and args.native and bpffilter.compile(args.filter)
 	local snapLen = args.snapLen
 	local writer
 	local captureCtr, filterCtr
@@ -87,9 +90,18 @@ function dumper(queue, args, threadId, devId)
 	while lm.running() do
 		local rx = queue:tryRecv(bufs, 100)
 		local batchTime = lm.getTime()
+		if nativeFilter then
+			nativeFilter:matchBurst(bufs, rx)
+		end
 		for i = 1, rx do
 			local buf = bufs[i]
-			if filter(buf:getBytes(), buf:getSize()) then
+			local match
+			if nativeFilter then
+				match = nativeFilter:matches(i)
+			else
+				match = filter(buf:getBytes(), buf:getSize())
+			end
+			if match then
 				if writer then
 					writer:writeBuf(batchTime, buf, snapLen)
 					captureCtr:countPacket(buf)
@@ -0,0 +1,69 @@
+--- Installs flow rules via rte_flow and counts matching packets.
+--- Rules that are not supported by the NIC are emulated in software,
+--- this can be tested with virtual devices, e.g., --vdev net_ring0 or net_null0 in dpdk-conf.lua
+--- Example: libmoon examples/flow-offload.lua 0 "ipv4 udp dport 53 -> drop count" "ipv4 src 10.0.0.0/8 -> mark 1 count"
+local lm      = require "libmoon"
+local device  = require "device"
+local stats   = require "stats"
+local memory  = require "memory"
+local log     = require "log"
+require "offload"
+
+-- PKT_RX_FDIR_ID
+local FDIR_ID_FLAG = bit.lshift(1ULL, 13)
+
+function configure(parser)
+	parser:description("Demonstrates the flow rule manager.")
+	parser:argument("dev", "Device to receive from."):args(1):convert(tonumber)
+	parser:argument("rules", "Rules, see lua/offload.lua for the syntax."):args("+")
+	parser:option("--threads -t", "Number of threads"):args(1):convert(tonumber):default(1)
+	parser:flag("--no-fallback", "Do not emulate unsupported rules in software."):target("noFallback")
+	return parser:parse()
+end
+
+function master(args)
+	local dev = device.config{ port = args.dev, rxQueues = args.threads, rssQueues = args.threads }
+	device.waitForLinks()
+	local manager = dev:newFlowManager(not args.noFallback)
+	local rules = manager:addRules(args.rules)
+	for i = 1, args.threads do
+		lm.startTask("rxTask", dev:getRxQueue(i - 1), manager)
+	end
+	lm.startSharedTask("statsTask", rules)
+	lm.waitForTasks()
+	manager:destroy()
+end
+
+function rxTask(queue, manager)
+	local bufs = memory.bufArray()
+	local marked = 0
+	while lm.running() do
+		local rx = queue:tryRecv(bufs, 100)
+		rx = manager:process(bufs, rx)
+		for i = 1, rx do
+			if bit.band(bufs[i].ol_flags, FDIR_ID_FLAG) ~= 0 then
+				marked = marked + 1
+			end
+		end
+		bufs:free(rx)
+	end
+	log:info("%s: received %d marked packets", queue, marked)
+end
+
+function statsTask(rules)
+	local counters = {}
+	for _, rule in ipairs(rules) do
+		if rule then
+			counters[#counters + 1] = stats:newFlowRuleCounter(rule)
+		end
+	end
+	while lm.running() do
+		for _, ctr in ipairs(counters) do
+			ctr:update()
+		end
+		lm.sleepMillisIdle(100)
+	end
+	for _, ctr in ipairs(counters) do
+		ctr:finalize()
+	end
+end
@@ -0,0 +1,65 @@
+--- Multi-core UDP packet generator using the native generator core (generator.lua)
+--- Example: ./build/libmoon examples/generator.lua 0 -t 4 -f 100000 --imix
+local lm        = require "libmoon"
+local device    = require "device"
+local stats     = require "stats"
+local log       = require "log"
+local generator = require "generator"
+
+-- set addresses here
+local DST_MAC  = "10:11:12:13:14:15"
+local SRC_IP   = "10.0.0.10"
+local DST_IP   = "10.1.0.10"
+local SRC_PORT = 1234
+local DST_PORT = 1234
+
+function configure(parser)
+	parser:description("Edit the source to modify constants like IPs and ports.")
+	parser:argument("dev", "Devices to use."):args("+"):convert(tonumber)
+	parser:option("-t --threads", "Number of threads (tx queues) per device."):args(1):convert(tonumber):default(1)
+	parser:option("-f --flows", "Number of flows, varies the source IP and the source port."):args(1):convert(tonumber):default(1000)
+	parser:option("-s --size", "Packet size without CRC."):args(1):convert(tonumber):default(60)
+	parser:flag("--imix", "Use the simple IMIX (7:4:1) packet sizes.")
+	parser:option("-r --rate", "Software rate control in Mbit/s per thread."):args(1):convert(tonumber)
+	parser:flag("--offload", "Use checksum offloading.")
+	return parser:parse()
+end
+
+function master(args)
+	for i, dev in ipairs(args.dev) do
+		args.dev[i] = device.config{
+			port = dev,
+			txQueues = args.threads,
+			rxQueues = 1
+		}
+	end
+	device.waitForLinks()
+
+	stats.startStatsTask{ txDevices = args.dev }
+
+	-- 256 source IPs, the rest of the flows are spread over the source ports
+	local ips = math.min(args.flows, 256)
+	for _, dev in ipairs(args.dev) do
+		local gen = generator.new{
+			ethSrc = dev,
+			ethDst = DST_MAC,
+			ip4Src = { min = SRC_IP, count = ips },
+			ip4Dst = DST_IP,
+			udpSrc = { min = SRC_PORT, count = math.ceil(args.flows / ips) },
+			udpDst = DST_PORT,
+			size = args.imix and generator.IMIX or args.size,
+			offload = args.offload,
+		}
+		log:info("%s on %s", tostring(gen), tostring(dev))
+		local queues = {}
+		for i = 1, args.threads do
+			local queue = dev:getTxQueue(i - 1)
+			if args.rate then
+				queue:setSoftwareRate{ mbit = args.rate }
+			end
+			queues[i] = queue
+		end
+		gen:startTasks(queues)
+	end
+	lm.waitForTasks()
+end
@@ -0,0 +1,41 @@
+--- Sends device counters to Graphite (or StatsD) once per second without blocking the task.
+--- Start a local collector to try it, e.g. "nc -lk 2003", and stop/restart it to see the writer reconnect.
+--- Example: ./build/libmoon examples/graphite.lua 0 1 -t localhost:2003
+
+local lm       = require "libmoon"
+local device   = require "device"
+local log      = require "log"
+local graphite = require "graphite"
+
+function configure(parser)
+	parser:description("Writes rx/tx counters of devices to a Graphite or StatsD collector.")
+	parser:argument("dev", "Devices to monitor."):args("+"):convert(tonumber)
+	parser:option("-t --target", "Collector host[:port]."):default("localhost")
+	parser:option("-p --protocol", "plaintext, pickle, or statsd."):default("plaintext")
+	parser:option("--prefix", "Prefix for all metric names."):default("libmoon")
+	return parser:parse()
+end
+
+function master(args)
+	local devs = {}
+	for i, id in ipairs(args.dev) do
+		devs[i] = device.config{port = id}
+	end
+	device.waitForLinks()
+	local writer = graphite.newBufferedWriter(args.target, {protocol = args.protocol, prefix = args.prefix})
+	while lm.running() do
+		for _, dev in ipairs(devs) do
+			local rxPkts, rxBytes = dev:getRxStats()
+			local txPkts, txBytes = dev:getTxStats()
+			writer:write(("port%d.rx.packets"):format(dev.id), rxPkts)
+			writer:write(("port%d.rx.bytes"):format(dev.id), rxBytes)
+			writer:write(("port%d.tx.packets"):format(dev.id), txPkts)
+			writer:write(("port%d.tx.bytes"):format(dev.id), txBytes)
+		end
+		writer:flush()
+		lm.sleepMillis(1000)
+	end
+	writer:close()
+	local stats = writer:getStats()
+	log:info("Sent %d batches (%d bytes), dropped %d, %d connects", stats.sent, stats.sentBytes, stats.dropped, stats.connects)
+end
@@ -28,6 +28,7 @@ function configure(parser)
 	parser:argument("dev", "Devices to use."):args("+"):convert(tonumber)
 	parser:option("-t --threads", "Number of threads per device."):args(1):convert(tonumber):default(1)
 	parser:option("-r --rate", "Transmit rate in Mbit/s per device."):args(1)
+	parser:flag("--crc-filler", "Pace with invalid-CRC filler frames instead of the NIC's rate limiter, requires ixgbe, igb, or i40e."):target("crcFiller")
 	parser:option("-w --webserver", "Start a REST API on the given port."):convert(tonumber)
 	parser:option("-o --output", "File to output statistics to")
 	parser:option("-s --seconds", "Stop after n seconds")
@@ -83,7 +84,9 @@ function master(args,...)
 	for i, dev in ipairs(args.dev) do
 		for i = 1, args.threads do
 			local queue = dev:getTxQueue(i - 1)
-			if args.rate then
+			if args.rate and args.crcFiller then
+				queue:setSoftwareRate{mbit = args.rate / args.threads, crcFiller = true}
+			elseif args.rate then
 				queue:setRate(args.rate / args.threads)
 			end
 			lm.startTask("txSlave", queue, DST_MAC)
@@ -10,6 +10,8 @@ function configure(parser)
 	parser:option("-t --threads", "Number of threads per device."):args(1):convert(tonumber):default(1)
 	parser:flag("-l --lacp", "Try to setup an LACP channel.")
 	parser:option("-o --output", "File to output statistics to")
+	parser:flag("-a --adaptive", "Back off when idle instead of busy polling, useful for low packet rates.")
+	parser:flag("-i --interrupts", "Use rx interrupts with --adaptive.")
 	return parser:parse()
 end
 
@@ -20,7 +22,8 @@ function master(args)
 			port = dev,
 			rxQueues = args.threads + (args.lacp and 1 or 0),
 			txQueues = args.threads + (args.lacp and 1 or 0),
-			rssQueues = args.threads
+			rssQueues = args.threads,
+			rxInterrupts = args.interrupts
 		}
 		-- last queue for lacp
 		if args.lacp then
@@ -41,7 +44,11 @@ function master(args)
 
 	for i, dev in ipairs(args.dev) do 
 		for i = 1, args.threads do
-			lm.startTask("reflector", dev:getRxQueue(i - 1), dev:getTxQueue(i - 1))
+			local rxQ = dev:getRxQueue(i - 1)
+			if args.adaptive then
+				rxQ:enableAdaptiveRx()
+			end
+			lm.startTask("reflector", rxQ, dev:getTxQueue(i - 1))
 		end
 	end
 	lm.waitForTasks()
@@ -64,5 +71,9 @@ function reflector(rxQ, txQ)
 		end
 		txQ:sendN(bufs, rx)
 	end
+	if rxQ.adaptive then
+		local stats = rxQ:getAdaptiveRxStats()
+		print(("%s: busy %.1f%%, %d sleeps, %d interrupts"):format(rxQ, stats.load * 100, stats.sleeps, stats.interrupts))
+	end
 end
 
@@ -0,0 +1,55 @@
+--- Receives and drops packets as fast as possible to compare per-packet and bulk freeing of mbufs.
+--- Use a null device to measure the CPU cost only, e.g. cli = { "--vdev", "net_null0" } in dpdk-conf.lua
+--- Example: ./build/libmoon examples/sink-benchmark.lua 0 -t 10
+local lm     = require "libmoon"
+local device = require "device"
+local memory = require "memory"
+local log    = require "log"
+local dpdkc  = require "dpdkc"
+
+function configure(parser)
+	parser:description("Benchmarks bufArray:free() against freeing each packet individually.")
+	parser:argument("dev", "Device to receive from."):convert(tonumber)
+	parser:option("-t --time", "Run time per method in seconds."):convert(tonumber):default(5)
+	parser:option("-b --burst", "Receive burst size."):convert(tonumber):default(64)
+	return parser:parse()
+end
+
+local function freePerPacket(bufs, n)
+	for i = 0, n - 1 do
+		dpdkc.rte_pktmbuf_free_export(bufs.array[i])
+	end
+end
+
+local function freeBulk(bufs, n)
+	bufs:free(n)
+end
+
+function master(args)
+	local dev = device.config{port = args.dev, rxDescs = 4096}
+	device.waitForLinks()
+	-- one method after the other, both use the same queue
+	local perPacket = lm.startTask("sinkTask", dev:getRxQueue(0), args.burst, args.time, false):wait()
+	local bulk = lm.startTask("sinkTask", dev:getRxQueue(0), args.burst, args.time, true):wait()
+	if perPacket == 0 or bulk == 0 then
+		log:fatal("No packets received on device %d", args.dev)
+	end
+	log:info("per-packet %8.2f Mpps", perPacket)
+	log:info("bulk       %8.2f Mpps (%+.1f%%)", bulk, (bulk / perPacket - 1) * 100)
+end
+
+function sinkTask(queue, burst, time, bulk)
+	local bufs = memory.bufArray(burst)
+	local free = bulk and freeBulk or freePerPacket
+	local packets = 0
+	local start = lm.getTime()
+	-- check the time only every 1024 bursts
+	while lm.running() and lm.getTime() - start < time do
+		for _ = 1, 1024 do
+			local rx = queue:tryRecv(bufs, 0)
+			packets = packets + rx
+			free(bufs, rx)
+		end
+	end
+	return packets / (lm.getTime() - start) / 10^6
+end
@@ -0,0 +1,21 @@
+--- Converts a recording of statsrecorder.lua to CSV, does not initialize DPDK.
+--- Example: ./build/libmoon examples/stats-to-csv.lua rates.bin rates.csv
+
+local dpdk          = require "dpdk"
+local log           = require "log"
+local statsrecorder = require "statsrecorder"
+
+dpdk.skipInit()
+
+function configure(parser)
+	parser:description("Converts a binary stats recording to CSV.")
+	parser:argument("input", "Recording written by statsrecorder.lua.")
+	parser:argument("output", "CSV file to write.")
+	parser:flag("-r --raw", "Write the counter values instead of the differences between samples.")
+	return parser:parse()
+end
+
+function master(args)
+	local n = statsrecorder.toCsv(args.input, args.output, args.raw)
+	log:info("Wrote %d samples to %s", n, args.output)
+end
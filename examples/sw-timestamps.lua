@@ -0,0 +1,69 @@
+--- Software rx timestamping with error bounds.
+--- Packets are stamped with the wall clock (or a PTP hardware clock) based on the TSC and the link speed,
+--- the printed error bound is the uncertainty of the estimate for each burst.
+--- Also works with virtual devices, e.g., replaying a pcap via
+---   cli = { "--vdev", "net_pcap0,rx_pcap=in.pcap,tx_pcap=/dev/null" }
+--- in dpdk-conf.lua, use --speed to set the link speed as net_pcap reports 10 Gbit/s.
+local lm     = require "libmoon"
+local device = require "device"
+local memory = require "memory"
+local pcap   = require "pcap"
+local ts     = require "timestamping"
+local log    = require "log"
+
+function configure(parser)
+	parser:description("Timestamps received packets in software.")
+	parser:argument("dev", "Device to receive from."):convert(tonumber)
+	parser:option("-f --file", "Write packets with their timestamps to a pcap file.")
+	parser:option("-p --ptp", "Use a PTP hardware clock, e.g., /dev/ptp0, instead of CLOCK_REALTIME.")
+	parser:option("-s --speed", "Link speed in Mbit/s, overrides the speed reported by the device."):convert(tonumber)
+	return parser:parse()
+end
+
+function master(args)
+	local dev = device.config{port = args.dev}
+	device.waitForLinks()
+	local clock = ts:newSoftwareClock(args.ptp)
+	lm.startTask("rxTask", dev:getRxQueue(0), clock, args)
+	-- follow NTP/PTP adjustments
+	while lm.running() do
+		lm.sleepMillisIdle(1000)
+		clock:calibrate()
+	end
+	lm.waitForTasks()
+	clock:destroy()
+end
+
+function rxTask(queue, clock, args)
+	local timestamper = ts:newSoftwareTimestamper(queue, clock, args.speed)
+	local writer = args.file and pcap:newWriter(args.file, 0)
+	local bufs = memory.bufArray()
+	local pkts, bursts, errSum, errMax = 0, 0, 0, 0
+	local lastPrint = lm.getTime()
+	while lm.running() do
+		local rx, err = timestamper:recv(bufs)
+		if err and err ~= math.huge then
+			bursts = bursts + 1
+			errSum = errSum + err
+			errMax = math.max(errMax, err)
+		end
+		pkts = pkts + rx
+		if writer then
+			for i = 1, rx do
+				writer:writeBuf(tonumber(bufs[i].udata64) / 10^9, bufs[i])
+			end
+		end
+		bufs:free(rx)
+		if lm.getTime() - lastPrint >= 1 then
+			lastPrint = lm.getTime()
+			if bursts > 0 then
+				log:info("%d packets, error bound avg %.1f ns, max %d ns, clock uncertainty %d ns",
+					pkts, errSum / bursts, errMax, clock:getUncertainty())
+			end
+		end
+	end
+	if writer then
+		writer:close()
+	end
+	timestamper:destroy()
+end
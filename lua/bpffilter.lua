@@ -0,0 +1,120 @@
+---------------------------------
+--- @file bpffilter.lua
+--- @brief Native classic BPF filters that run over a whole bufArray.
+--- The filter expression is compiled to BPF by libpcap (through pflua) once, the program is then validated and
+--- translated to a compact native form that runs in C, e.g.
+---   local filter = bpffilter.compile("udp dst port 53")
+---   local rx = queue:tryRecv(bufs, 100)
+---   filter:matchBurst(bufs, rx)
+---   for i = 1, rx do if filter:matches(i) then ... end end
+--- This is faster than pflua for complex expressions and does not add Lua traces per filter.
+--- Filters are read-only and can be passed to other tasks.
+---------------------------------
+
+local ffi     = require "ffi"
+local log     = require "log"
+local serpent = require "Serpent"
+local libmoon = require "libmoon"
+
+ffi.cdef[[
+	struct libmoon_bpf_insn {
+		uint16_t code;
+		uint8_t jt;
+		uint8_t jf;
+		uint32_t k;
+	};
+
+	struct libmoon_bpf_filter { };
+
+	struct libmoon_bpf_filter* libmoon_bpf_filter_create(const struct libmoon_bpf_insn* insns, uint32_t num_insns, int socket);
+	void libmoon_bpf_filter_delete(struct libmoon_bpf_filter* filter);
+	uint32_t libmoon_bpf_filter_run(struct libmoon_bpf_filter* filter, const uint8_t* data, uint32_t wire_len, uint32_t buf_len);
+	uint32_t libmoon_bpf_filter_burst(struct libmoon_bpf_filter* filter, struct rte_mbuf** bufs, uint32_t num_bufs, uint64_t* mask);
+]]
+
+local C = ffi.C
+local band, rshift = bit.band, bit.rshift
+
+local mod = {}
+
+local bpfFilter = {}
+bpfFilter.__index = bpfFilter
+mod.bpfFilter = bpfFilter
+
+--- Create a filter from BPF instructions.
+--- @param insns table of instructions, each instruction is a table { code, jt, jf, k } (e.g. the output of tcpdump -dd)
+---   or a cdata array of struct bpf_insn
+--- @param len number of instructions, only required for cdata arrays
+--- @param socket optional (default = socket of the calling thread) NUMA socket
+function mod.newFilter(insns, len, socket)
+	if type(insns) == "table" then
+		len = #insns
+		local cInsns = ffi.new("struct libmoon_bpf_insn[?]", len)
+		for i, insn in ipairs(insns) do
+			cInsns[i - 1].code, cInsns[i - 1].jt, cInsns[i - 1].jf, cInsns[i - 1].k = unpack(insn)
+		end
+		insns = cInsns
+	end
+	local filter = C.libmoon_bpf_filter_create(ffi.cast("struct libmoon_bpf_insn*", insns), len, socket or select(2, libmoon.getCore()))
+	if filter == nil then
+		log:fatal("Invalid BPF program with %s instructions", len)
+	end
+	return setmetatable({ filter = filter }, bpfFilter)
+end
+
+--- Compile a filter expression (pcap-filter syntax) with libpcap.
+--- @param expr the filter expression
+--- @param optimize optional (default = true) use the libpcap optimizer
+function mod.compile(expr, optimize)
+	local libpcap = require "pf.libpcap"
+	local prog = libpcap.compile(expr, "EN10MB", optimize ~= false)
+	local filter = mod.newFilter(prog.bf_insns, prog.bf_len)
+	filter.expr = expr
+	return filter
+end
+
+--- Run the filter on a bufArray, use :matches() to check the result for a packet.
+--- @param bufs the bufArray
+--- @param n number of packets
+--- @return number of matching packets
+function bpfFilter:matchBurst(bufs, n)
+	if not self.mask or self.maskSize < n then
+		self.maskSize = math.max(n, bufs.size)
+		self.mask = ffi.new("uint64_t[?]", math.ceil(self.maskSize / 64))
+	end
+	return C.libmoon_bpf_filter_burst(self.filter, bufs.array, n, self.mask)
+end
+
+--- Check if a packet matched in the last call to :matchBurst().
+--- @param i 1-based index of the packet in the bufArray
+function bpfFilter:matches(i)
+	i = i - 1
+	return band(rshift(self.mask[rshift(i, 6)], band(i, 63)), 1ULL) ~= 0
+end
+
+--- Run the filter on a single packet.
+function bpfFilter:match(buf)
+	return C.libmoon_bpf_filter_run(self.filter, buf:getBytes(), buf.pkt_len, buf.data_len) ~= 0
+end
+
+--- Run the filter on raw bytes, same signature as a pflua filter.
+function bpfFilter:matchBytes(data, len)
+	return C.libmoon_bpf_filter_run(self.filter, data, len, len) ~= 0
+end
+
+--- Free the filter, must not be used by any task at this point.
+function bpfFilter:destroy()
+	C.libmoon_bpf_filter_delete(self.filter)
+	self.filter = nil
+end
+
+function bpfFilter:__tostring()
+	return ("[BPFFilter: %s]"):format(self.expr or "custom program")
+end
+
+function bpfFilter:__serialize()
+	local obj = { filter = self.filter, expr = self.expr }
+	return "require 'bpffilter'; return " .. serpent.addMt(serpent.dumpRaw(obj), "require('bpffilter').bpfFilter"), true
+end
+
+return mod
@@ -0,0 +1,95 @@
+---------------------------------
+--- @file burstparser.lua
+--- @brief Parses the 5-tuples of a burst of packets into a structure of arrays.
+--- Handles up to two VLAN tags (802.1Q, 802.1ad) and IPv6 extension headers. The result can be used by several
+--- consumers (flow tables, filters, load distribution) without parsing the packets again, e.g.
+---   local keys = burstparser.newFlowKeys(bufs.size)
+---   keys:parse(bufs, rx)
+---   local flows = flowTable:lookupKeys(keys, true)
+---   for i = 0, rx - 1 do local port = keys.keys.dst_port[i] ... end
+--- The arrays in keys.keys are 0-based, fields: src_ip, dst_ip (uint8_t[16] in network byte order),
+--- src_port, dst_port (host byte order, 0 for fragments), proto, ip_version (0 for non-IP packets),
+--- l3_offset, l4_offset (0 if there is no L4 header), outer_vlan, inner_vlan (TCI, 0 if untagged),
+--- ptype (RTE_PTYPE_* flags), hash (flow table hash of the key).
+---------------------------------
+
+local ffi     = require "ffi"
+local log     = require "log"
+local libmoon = require "libmoon"
+-- for struct libmoon_flow_key
+require "flowtable"
+
+ffi.cdef[[
+	struct libmoon_flow_keys {
+		uint32_t capacity;
+		uint32_t num;
+		uint8_t (*src_ip)[16];
+		uint8_t (*dst_ip)[16];
+		uint16_t* src_port;
+		uint16_t* dst_port;
+		uint8_t* proto;
+		uint8_t* ip_version;
+		uint16_t* l3_offset;
+		uint16_t* l4_offset;
+		uint16_t* outer_vlan;
+		uint16_t* inner_vlan;
+		uint32_t* ptype;
+		uint32_t* hash;
+	};
+
+	struct libmoon_flow_keys* libmoon_flow_keys_create(uint32_t capacity, int socket);
+	void libmoon_flow_keys_delete(struct libmoon_flow_keys* keys);
+	uint32_t libmoon_parse_burst(struct libmoon_flow_keys* keys, struct rte_mbuf** bufs, uint32_t num_bufs);
+	void libmoon_flow_keys_get(struct libmoon_flow_keys* keys, uint32_t idx, struct libmoon_flow_key* key);
+]]
+
+local C = ffi.C
+
+local mod = {}
+
+local flowKeys = {}
+flowKeys.__index = flowKeys
+mod.flowKeys = flowKeys
+
+--- Create storage for the keys of a burst.
+--- @param size maximum number of packets per burst
+--- @param socket optional (default = socket of the calling thread) NUMA socket
+function mod.newFlowKeys(size, socket)
+	local keys = C.libmoon_flow_keys_create(size, socket or select(2, libmoon.getCore()))
+	if keys == nil then
+		log:fatal("Could not allocate flow keys for %s packets", size)
+	end
+	return setmetatable({ keys = ffi.gc(keys, C.libmoon_flow_keys_delete) }, flowKeys)
+end
+
+--- Parse a burst of packets, at most size packets are parsed.
+--- @param bufs the bufArray
+--- @param n number of packets
+--- @return number of IP packets
+function flowKeys:parse(bufs, n)
+	return C.libmoon_parse_burst(self.keys, bufs.array, n)
+end
+
+--- Get the number of packets of the last parsed burst.
+function flowKeys:size()
+	return self.keys.num
+end
+
+--- Get the flow key of a packet.
+--- @param i 0-based index of the packet
+--- @param key optional flowtable key to fill
+--- @return the key or nil for non-IP packets
+function flowKeys:getKey(i, key)
+	if self.keys.ip_version[i] == 0 then
+		return nil
+	end
+	key = key or ffi.new("struct libmoon_flow_key")
+	C.libmoon_flow_keys_get(self.keys, i, key)
+	return key
+end
+
+function flowKeys:__tostring()
+	return ("[FlowKeys: %d/%d packets]"):format(self.keys.num, self.keys.capacity)
+end
+
+return mod
@@ -49,7 +49,7 @@ function txQueue:__eq(other)
 end
 
 function txQueue:__serialize()
-	return ('local dev = require "device" return dev.get(%d):getTxQueue(%d)'):format(self.id, self.qid), true
+	return ('local dev = require "device" local queue = dev.get(%d):getTxQueue(%d) queue.paced = %s return queue'):format(self.id, self.qid, tostring(self.paced or false)), true
 end
 
 local rxQueue = {}
@@ -65,12 +65,119 @@ function rxQueue:__eq(other)
 end
 
 function rxQueue:__serialize()
-	return ('local dev = require "device" return dev.get(%d):getRxQueue(%d)'):format(self.id, self.qid), true
+	return ('local dev = require "device" local queue = dev.get(%d):getRxQueue(%d) queue.adaptive = %s return queue'):format(self.id, self.qid, tostring(self.adaptive or false)), true
 end
 
 
 local devices = namespaces:get()
 
+-- ethernet header + crc, mtu + overhead = frame size
+local ETHER_OVERHEAD = 18
+
+local fdirModes = {
+	["none"] = dpdk.RTE_FDIR_MODE_NONE,
+	["signature"] = dpdk.RTE_FDIR_MODE_SIGNATURE,
+	["perfect"] = dpdk.RTE_FDIR_MODE_PERFECT,
+	["perfect-mac-vlan"] = dpdk.RTE_FDIR_MODE_PERFECT_MAC_VLAN,
+	["perfect-tunnel"] = dpdk.RTE_FDIR_MODE_PERFECT_TUNNEL,
+}
+
+local fdirPballoc = {
+	[64] = dpdk.RTE_FDIR_PBALLOC_64K,
+	[128] = dpdk.RTE_FDIR_PBALLOC_128K,
+	[256] = dpdk.RTE_FDIR_PBALLOC_256K,
+}
+
+local fdirStatus = {
+	["none"] = dpdk.RTE_FDIR_NO_REPORT_STATUS,
+	["report"] = dpdk.RTE_FDIR_REPORT_STATUS,
+	["always"] = dpdk.RTE_FDIR_REPORT_STATUS_ALWAYS,
+}
+
+local fdirPayloads = {
+	["raw"] = dpdk.RTE_ETH_RAW_PAYLOAD,
+	["l2"] = dpdk.RTE_ETH_L2_PAYLOAD,
+	["l3"] = dpdk.RTE_ETH_L3_PAYLOAD,
+	["l4"] = dpdk.RTE_ETH_L4_PAYLOAD,
+}
+
+local function lookup(tbl, key, name)
+	local val = tbl[key]
+	if val == nil then
+		local valid = {}
+		for k in pairs(tbl) do
+			valid[#valid + 1] = tostring(k)
+		end
+		table.sort(valid)
+		log:fatal("Invalid value %s for %s, expected one of: %s", tostring(key), name, table.concat(valid, ", "))
+	end
+	return val
+end
+
+-- masks are in big endian
+local function toBe16(val)
+	return bit.rshift(bit.bswap(val or 0), 16)
+end
+
+local function ip4Mask(mask)
+	if type(mask) == "string" then
+		mask = parseIP4Address(mask) or log:fatal("Invalid IPv4 mask %s", mask)
+	end
+	return bit.bswap(mask or 0)
+end
+
+local function ip6Mask(mask, target)
+	if not mask then
+		return
+	end
+	local addr = parseIP6Address(mask) or log:fatal("Invalid IPv6 mask %s", mask)
+	for i = 0, 3 do
+		target[i] = bit.bswap(addr.uint32[3 - i])
+	end
+end
+
+local function buildFdirConfig(fdir)
+	local cfg = ffi.new("struct libmoon_fdir_config", {
+		mode = lookup(fdirModes, fdir.mode or "perfect", "fdir.mode"),
+		pballoc = lookup(fdirPballoc, fdir.pballoc or 64, "fdir.pballoc"),
+		status = lookup(fdirStatus, fdir.status or "report", "fdir.status"),
+		drop_queue = fdir.dropQueue or 63,
+		vlan_tci_mask = toBe16(fdir.vlanMask),
+		src_port_mask = toBe16(fdir.srcPortMask),
+		dst_port_mask = toBe16(fdir.dstPortMask),
+		mac_addr_byte_mask = fdir.macMask or 0,
+		tunnel_type_mask = fdir.tunnelTypeMask or 0,
+		tunnel_id_mask = bit.bswap(fdir.tunnelIdMask or 0),
+		src_ipv4_mask = ip4Mask(fdir.srcIpMask),
+		dst_ipv4_mask = ip4Mask(fdir.dstIpMask),
+		flex_payload_type = lookup(fdirPayloads, fdir.flexPayload or "raw", "fdir.flexPayload"),
+		flex_flow_type = fdir.flexFlowType and lookup(dpdk.flowTypes, fdir.flexFlowType, "fdir.flexFlowType") or 0,
+	})
+	ip6Mask(fdir.srcIp6Mask, cfg.src_ipv6_mask)
+	ip6Mask(fdir.dstIp6Mask, cfg.dst_ipv6_mask)
+	if not fdir.flexOffsets then
+		if fdir.flexMask then
+			log:fatal("fdir.flexMask requires fdir.flexOffsets")
+		end
+		-- keep the default flex bytes, the number of supported offsets is driver-specific (e.g., 2 on ixgbe)
+		return cfg
+	end
+	cfg.flex_custom = 1
+	local offsets = fdir.flexOffsets
+	local mask = fdir.flexMask or { 0xFF, 0xFF }
+	if #offsets > 16 or #mask > 16 then
+		log:fatal("At most 16 flex bytes are supported")
+	end
+	cfg.num_flex_offsets = #offsets
+	for i, v in ipairs(offsets) do
+		cfg.flex_offsets[i - 1] = v
+	end
+	for i, v in ipairs(mask) do
+		cfg.flex_mask[i - 1] = v
+	end
+	return cfg
+end
+
 --- Configure a device
 --- @param args A table containing the following named arguments
 ---   port Port to configure
@@ -80,15 +187,35 @@ local devices = namespaces:get()
 ---   rxDescs optional (default = 512)
 ---   txDescs optional (default = 1024)
 ---   numBufs optional (default max(2047, rxDescs * 2 -1))
----   bufSize optional (default = 2048)
+---   bufSize optional (default = 2048, or large enough for a full frame if scatterRx is disabled)
+---   mtu optional (default = driver default, usually 1500) MTU in bytes, values above 1500 enable jumbo frames.
+---   scatterRx optional (default = true if a full frame does not fit into bufSize) Receive large packets as chains of mbufs.
+---   multiSegTx optional (default = scatterRx) Allow sending chained mbufs, disabling this speeds up TX on some drivers.
+---   rxInterrupts optional (default = false) Enable rx interrupts, required for rxQueue:enableAdaptiveRx{interrupts = true}. Not supported by all drivers.
 ---   speed optional (default = 0/max) Speed in Mbit to negotiate (currently disabled due to DPDK changes)
 ---   dropEnable optional (default = true) Drop rx packets directly if no rx descriptors are available
 ---   rssQueues optional (default = 0) Number of queues to use for RSS
 ---   rssBaseQueue optional (default = 0) The first queue to use for RSS, packets will go to queues rssBaseQueue up to rssBaseQueue + rssQueues - 1
 ---   rssFunctions optional (default = all supported functions) Table with hash functions specified in dpdk.ETH_RSS_*
+---   rssKey optional (default = driver default) RSS hash key as table of bytes or string, length must match the key size of the device.
+---          See toeplitz.lua for predefined keys and dev:getToeplitz() to calculate the hash/queue in software.
 ---	  disableOffloads optional (default = false) Disable all offloading features, this significantly speeds up some drivers (e.g., ixgbe).
 ---                   set by default for drivers that do not support offloading (e.g., virtio)
 ---   stripVlan (default = true) Strip the VLAN tag on the NIC.
+---   fdir optional (default = perfect mode, flex bytes at offset 42 and 43) Flow director configuration, a table with the following optional fields.
+---        Omitted fields keep their default, note that timestamping relies on the default flex bytes on some NICs.
+---          mode (default = "perfect") One of "none", "signature", "perfect", "perfect-mac-vlan", "perfect-tunnel"
+---          pballoc (default = 64) Memory for filters in KB: 64, 128, or 256
+---          status (default = "report") Report matches in the mbuf: "none", "report", or "always"
+---          dropQueue (default = 63) Queue used to drop packets
+---          vlanMask, srcPortMask, dstPortMask, tunnelIdMask, macMask, tunnelTypeMask (default = 0) Masks as numbers in host byte order
+---          srcIpMask, dstIpMask, srcIp6Mask, dstIp6Mask (default = 0) IP masks as strings
+---          flexOffsets (default = driver default, the bytes at offset 42 and 43) Table of offsets for the flexible payload bytes,
+---                      the maximum number is driver-specific (e.g., 2 on ixgbe, 16 on i40e), an empty table disables flex bytes
+---          flexMask (default = {0xFF, 0xFF}) Table of up to 16 bytes, requires flexOffsets
+---          flexPayload (default = "raw") One of "raw", "l2", "l3", "l4"
+---          flexFlowType (default = driver-specific) The flow type for the flex mask, e.g., "ipv4-udp"
+---        The configuration is validated against the capabilities of the device, see dev:dumpFilters() and filter.lua for rules.
 function mod.config(args)
 	if not args or not args.port then
 		log:fatal("usage: device.config({ port = x, ... })")
@@ -110,7 +237,26 @@ function mod.config(args)
 	args.rxDescs = args.rxDescs or 512
 	args.txDescs = args.txDescs or 1024
 	args.numBufs = args.numBufs or math.max(2047, args.rxDescs * 2 - 1)
-	args.bufSize = args.bufSize or 2048
+	if args.mtu and args.mtu + ETHER_OVERHEAD > info.max_rx_pktlen then
+		log:fatal("device supports frames up to %d bytes, requested mtu %d", info.max_rx_pktlen, args.mtu)
+	end
+	-- frame size including a vlan tag
+	local frameSize = (args.mtu or 1500) + ETHER_OVERHEAD + 4
+	if args.bufSize then
+		if args.scatterRx == false and args.bufSize < frameSize then
+			log:fatal("bufSize %d is too small for mtu %d without scatterRx", args.bufSize, args.mtu or 1500)
+		end
+	elseif args.scatterRx then
+		args.bufSize = 2048
+	else
+		args.bufSize = math.max(2048, frameSize)
+	end
+	if args.scatterRx == nil then
+		args.scatterRx = args.bufSize < frameSize
+	end
+	if args.multiSegTx == nil then
+		args.multiSegTx = args.scatterRx
+	end
 	if args.rxQueues > info.max_rx_queues then
 		log:fatal("device supports only %d rx queues, requested %d", info.max_rx_queues, args.rxQueues)
 	end
@@ -155,6 +301,18 @@ function mod.config(args)
 	for i, v in ipairs(args.rssFunctions) do
 		rssMask = bit.bor(rssMask, v)
 	end
+	local rssKey, rssKeyLen = nil, 0
+	if args.rssKey then
+		local key = args.rssKey
+		if type(key) == "string" then
+			key = { key:byte(1, #key) }
+		end
+		if info.hash_key_size ~= 0 and #key ~= info.hash_key_size then
+			log:fatal("device expects an RSS key of %d bytes, got %d bytes", info.hash_key_size, #key)
+		end
+		rssKey, rssKeyLen = ffi.new("uint8_t[?]", #key, key), #key
+	end
+	local fdirConfig = args.fdir and buildFdirConfig(args.fdir)
 	if args.stripVlan == nil then
 		args.stripVlan = true
 	end
@@ -189,14 +347,28 @@ function mod.config(args)
 		drop_enable = args.dropEnable,
 		enable_rss = args.rssQueues > 1,
 		rss_mask = rssMask,
+		rss_key = rssKey,
+		rss_key_len = rssKeyLen,
+		fdir = fdirConfig,
 		disable_offloads = args.disableOffloads,
-		strip_vlan = args.stripVlan
+		strip_vlan = args.stripVlan,
+		mtu = args.mtu or 0,
+		enable_scatter = args.scatterRx,
+		multi_seg_tx = args.multiSegTx,
+		rx_interrupts = args.rxInterrupts or false
 	}))
 	if rc ~= 0 then
 	    log:fatal("Could not configure device %d: error %s", args.port, strError(rc))
 	end
+	if fdirConfig then
+		rc = dpdkc.fdir_validate_config(args.port, fdirConfig)
+		if rc ~= 0 then
+			log:fatal("Device %d does not support the requested flow director configuration: error %s", args.port, strError(rc))
+		end
+	end
 	local dev = mod.get(args.port)
 	dev.initialized = true
+	dev.rxInterrupts = args.rxInterrupts or false
 	if args.rssQueues > 1 then
 		dev:setRssQueues(args.rssQueues, args.rssBaseQueue)
 	end
@@ -225,6 +397,15 @@ struct rte_eth_rss_reta_entry64 {
 };
 
 int rte_eth_dev_rss_reta_update(uint8_t port, struct rte_eth_rss_reta_entry64* reta_conf, uint16_t reta_size);
+int rte_eth_dev_rss_reta_query(uint8_t port, struct rte_eth_rss_reta_entry64* reta_conf, uint16_t reta_size);
+
+struct rte_eth_rss_conf {
+	uint8_t* rss_key;
+	uint8_t rss_key_len;
+	uint64_t rss_hf;
+};
+
+int rte_eth_dev_rss_hash_conf_get(uint8_t port, struct rte_eth_rss_conf* rss_conf);
 ]]
 
 --- Setup RSS RETA table.
@@ -256,6 +437,55 @@ function dev:setRssQueues(n, baseQueue)
 	end
 end
 
+--- Get the RSS hash key currently used by the device.
+--- @return the key as table of bytes
+function dev:getRssKey()
+	local keySize = self:getInfo().hash_key_size
+	if keySize == 0 then
+		-- not all drivers report their key size
+		keySize = 52
+	end
+	local buf = ffi.new("uint8_t[?]", keySize)
+	local conf = ffi.new("struct rte_eth_rss_conf", { rss_key = buf, rss_key_len = keySize })
+	local ret = ffi.C.rte_eth_dev_rss_hash_conf_get(self.id, conf)
+	if ret ~= 0 then
+		log:fatal("Error reading RSS key: " .. strError(ret))
+	end
+	local key = {}
+	for i = 0, conf.rss_key_len - 1 do
+		key[#key + 1] = buf[i]
+	end
+	return key
+end
+
+--- Get the RSS redirection table of the device.
+--- @return the RETA as table of queue ids
+function dev:getRssReta()
+	local retaSize = self:getInfo().reta_size
+	if retaSize % 64 ~= 0 then
+		log:fatal("NYI: number of RETA entries is not a multiple of 64", retaSize)
+	end
+	local entries = ffi.new("struct rte_eth_rss_reta_entry64[?]", retaSize / 64)
+	for i = 0, retaSize / 64 - 1 do
+		entries[i].mask = 0xFFFFFFFFFFFFFFFFULL
+	end
+	local ret = ffi.C.rte_eth_dev_rss_reta_query(self.id, entries, retaSize)
+	if ret ~= 0 then
+		log:fatal("Error reading RETA table: " .. strError(ret))
+	end
+	local reta = {}
+	for i = 0, retaSize - 1 do
+		reta[#reta + 1] = entries[math.floor(i / 64)].reta[i % 64]
+	end
+	return reta
+end
+
+--- Get a software Toeplitz hasher with the RSS key and RETA of this device.
+--- This allows predicting the rx queue of flows, see toeplitz.lua.
+function dev:getToeplitz()
+	return require("toeplitz").new(self:getRssKey(), self:getRssReta())
+end
+
 function mod.get(id)
 	if type(id) ~= "number" then
 		log:fatal("bad argument #1, expected number, got " .. type(id))
@@ -445,6 +675,28 @@ function dev:removeMac(mac)
 	end
 end
 
+--- Get the current MTU of the device.
+function dev:getMtu()
+	local mtu = ffi.new("uint16_t[1]")
+	local rc = dpdkc.rte_eth_dev_get_mtu(self.id, mtu)
+	if rc ~= 0 then
+		log:warn("Could not get mtu of %s: %s", self, strError(rc))
+		return nil
+	end
+	return mtu[0]
+end
+
+--- Change the MTU of a configured device.
+--- Receiving frames larger than the mbufs of the rx queues requires the device to be configured with scatterRx.
+function dev:setMtu(mtu)
+	local rc = dpdkc.rte_eth_dev_set_mtu(self.id, mtu)
+	if rc ~= 0 then
+		log:warn("Could not set mtu of %s to %d: %s", self, mtu, strError(rc))
+		return false
+	end
+	return true
+end
+
 function dev:getInfo()
 	local info = ffi.new("struct rte_eth_dev_info")
 	dpdkc.rte_eth_dev_info_get(self.id, info)
@@ -685,6 +937,58 @@ function dev:getStats()
 	return stats
 end
 
+--- Get the names of the extended statistics (xstats) of the device.
+--- xstats include per-queue counters, missed packets, mbuf allocation failures, and driver-specific counters.
+--- The set of xstats can change when the device is configured, e.g. with the number of queues.
+--- @param patterns optional list of Lua patterns, only return names that match one of them
+--- @return list of names and list of their ids (0-based, as used by rte_eth_xstats_get_by_id)
+function dev:getXstatNames(patterns)
+	local n = ffi.C.rte_eth_xstats_get_names(self.id, nil, 0)
+	if n <= 0 then
+		return {}, {}
+	end
+	local buf = ffi.new("struct rte_eth_xstat_name[?]", n)
+	n = math.min(ffi.C.rte_eth_xstats_get_names(self.id, buf, n), n)
+	local names, ids = {}, {}
+	for i = 0, n - 1 do
+		local name = ffi.string(buf[i].name)
+		local match = not patterns
+		for _, pattern in ipairs(patterns or {}) do
+			if name:match(pattern) then
+				match = true
+				break
+			end
+		end
+		if match then
+			names[#names + 1] = name
+			ids[#ids + 1] = i
+		end
+	end
+	return names, ids
+end
+
+--- Get the current values of the extended statistics (xstats) of the device.
+--- Resolves all names on every call, use stats:newXstatsCounter() for periodic collection.
+--- @param patterns optional list of Lua patterns, only return xstats whose name matches one of them
+--- @return table mapping names to values
+function dev:getXstats(patterns)
+	local names, ids = self:getXstatNames(patterns)
+	local result = {}
+	if #ids == 0 then
+		return result
+	end
+	local idBuf = ffi.new("uint64_t[?]", #ids, ids)
+	local values = ffi.new("uint64_t[?]", #ids)
+	if ffi.C.rte_eth_xstats_get_by_id(self.id, idBuf, values, #ids) ~= #ids then
+		log:warn("Could not read xstats of device %d", self.id)
+		return result
+	end
+	for i, name in ipairs(names) do
+		result[name] = tonumber(values[i - 1])
+	end
+	return result
+end
+
 do
 	local stats
 	--- Get the total number of packets and bytes transmitted successfully.
@@ -733,16 +1037,16 @@ end
 
 --- Set the tx rate of a queue in Mbit/s.
 --- This sets the payload rate, not to the actual wire rate, i.e. preamble, SFD, and IFG are ignored.
+--- Falls back to software rate control (see txQueue:setSoftwareRate()) if the driver does not support per-queue rate limits.
 function txQueue:setRate(rate)
 	local rc = dpdkc.rte_eth_set_queue_rate_limit(self.id, self.qid, rate)
 	if rc == -E.NOTSUP then
-		-- fails if doing this from multiple threads
-		-- but that's okay since this is just a crude work-around and the app should be updated for the NIC
-		local dev = self.dev
-		dev.totalRate = dev.totalRate or 0
-		dev.totalRate = dev.totalRate + rate
-		log:warn("Per-queue rate limit is not supported on this device, setting per-device rate limit to %d Mbit/s instead (note: this may fail as well if the NIC doesn't support any rate limiting).", dev.totalRate)
-		dev:setRate(dev.totalRate)
+		if rate == 0 then
+			self:disableSoftwareRate()
+			return
+		end
+		log:info("Per-queue rate limit is not supported on this device, using software rate control on %s", self)
+		self:setSoftwareRate{mbit = rate}
 	elseif rc ~= 0 then
 		log:warn("Failed to set rate limiter on queue %s: %s", self, strError(rc))
 	end
@@ -753,15 +1057,144 @@ function txQueue:setRateMpps(rate, pktSize)
 	self:setRate(rate * (pktSize + 4) * 8)
 end
 
+ffi.cdef[[
+	struct libmoon_histogram;
+
+	struct libmoon_tx_rate_config {
+		double pps;
+		double bps;
+		uint8_t wire_rate;
+		uint8_t poisson;
+		uint16_t max_burst;
+		uint32_t max_lag_us;
+		struct mempool* filler_pool;
+		double link_bps;
+		uint16_t min_filler_size;
+		uint16_t max_filler_size;
+		struct libmoon_histogram* gap_histogram;
+	};
+
+	struct libmoon_tx_rate_stats {
+		uint64_t packets;
+		uint64_t bytes;
+		uint64_t bursts;
+		uint64_t wait_cycles;
+		uint64_t late;
+		uint64_t first_tsc;
+		uint64_t last_tsc;
+		uint64_t fillers;
+		uint64_t filler_bytes;
+		uint64_t filler_alloc_failed;
+	};
+
+	int libmoon_tx_rate_configure(uint8_t port_id, uint16_t queue_id, const struct libmoon_tx_rate_config* cfg);
+	uint32_t libmoon_tx_rate_send(uint8_t port_id, uint16_t queue_id, struct rte_mbuf** bufs, uint32_t num_bufs);
+	int libmoon_tx_rate_get_stats(uint8_t port_id, uint16_t queue_id, struct libmoon_tx_rate_stats* stats);
+]]
+
+--- Pace the packets sent via send(), sendN(), and sendSingle() in software, for NICs without hardware rate limiters.
+--- Each packet gets a TSC deadline and is sent once it has passed, the average rate is exact as long as the task keeps up.
+--- The task spins (or sleeps for longer gaps) inside send(), so use one queue per task and avoid trySend().
+--- @param args table with the following named arguments, either mpps or mbit is required
+---   mpps packet rate in Mpps
+---   mbit bit rate in Mbit/s based on the packet size incl. CRC, i.e. the same as setRate()
+---   wire optional (default = false) mbit includes preamble, SFD, and IFG (20 bytes per packet)
+---   poisson optional (default = false) use exponentially distributed inter-departure times (see poissonDelay())
+---   maxBurst optional (default = 32) maximum number of packets sent at once if the task falls behind
+---   maxLag optional (default = 100) if the task falls behind by more than this many microseconds it only catches up this much
+---     instead of sending everything it is behind at line rate, these events are counted as late in getSoftwareRateStats()
+---   crcFiller optional (default = false) fill the gaps between packets with frames with an invalid CRC instead of waiting.
+---     The NIC sends at line rate and the receiver drops the filler frames, this yields exact gaps even below a microsecond.
+---     The gaps are the byte delays from rateToByteDelay(), calculated natively for every packet.
+---     Requires a NIC that can send frames without CRC (ixgbe, igb, i40e). The link is fully utilized regardless of the rate.
+---   linkSpeed optional (default = current link speed) link speed in Mbit/s for crcFiller
+---   fillerPool optional (default = a new mempool) mempool for filler frames
+---   gapHistogram optional histogram (cf. histogram.lua) that records the gap before every packet in byte times for crcFiller
+function txQueue:setSoftwareRate(args)
+	if not args.mpps and not args.mbit then
+		log:fatal("Software rate control on %s requires mpps or mbit", self)
+	end
+	local fillerPool, linkBps
+	if args.crcFiller then
+		if not self.dev.crcPatch then
+			log:fatal("%s cannot send frames with an invalid CRC, crcFiller is not available", self.dev)
+		end
+		linkBps = (args.linkSpeed or self.dev:getLinkStatus().speed) * 10^6
+		if linkBps <= 0 then
+			log:fatal("Unknown link speed on %s, crcFiller requires linkSpeed", self.dev)
+		end
+		fillerPool = args.fillerPool or memory.createMemPool{n = 4095, socket = self.dev:getSocket()}
+		-- keep a reference, the pool is used from the task that sends
+		self.fillerPool = fillerPool
+	end
+	local rc = ffi.C.libmoon_tx_rate_configure(self.id, self.qid, ffi.new("struct libmoon_tx_rate_config", {
+		pps = args.mpps and args.mpps * 10^6 or 0,
+		bps = not args.mpps and args.mbit * 10^6 or 0,
+		wire_rate = args.wire or false,
+		poisson = args.poisson or false,
+		max_burst = args.maxBurst or 32,
+		max_lag_us = args.maxLag or 100,
+		filler_pool = fillerPool,
+		link_bps = linkBps or 0,
+		min_filler_size = self.dev.minPacketSize or 60,
+		gap_histogram = args.gapHistogram and args.gapHistogram.hist
+	}))
+	if rc ~= 0 then
+		log:fatal("Could not enable software rate control on %s: %s", self, strError(rc))
+	end
+	self.paced = (args.mpps or args.mbit) > 0
+end
+
+--- Stop pacing packets in software.
+function txQueue:disableSoftwareRate()
+	if self.paced then
+		ffi.C.libmoon_tx_rate_configure(self.id, self.qid, ffi.new("struct libmoon_tx_rate_config"))
+	end
+	self.paced = false
+end
+
+--- Get the rate achieved by the software rate control, measured from the first to the last burst.
+--- @return table with the fields packets, bytes (incl. CRC), bursts, late (times the task fell behind by more than maxLag), waitCycles, time (seconds), mpps, mbit,
+---   and for crcFiller fillers, fillerBytes (incl. framing), and fillerAllocFailed (gaps that were skipped because the pool was empty)
+function txQueue:getSoftwareRateStats()
+	local stats = ffi.new("struct libmoon_tx_rate_stats")
+	if ffi.C.libmoon_tx_rate_get_stats(self.id, self.qid, stats) ~= 0 then
+		return nil
+	end
+	local time = tonumber(stats.last_tsc - stats.first_tsc) / tonumber(dpdkc.rte_get_tsc_hz())
+	local packets, bytes = tonumber(stats.packets), tonumber(stats.bytes)
+	return {
+		packets = packets,
+		bytes = bytes,
+		bursts = tonumber(stats.bursts),
+		late = tonumber(stats.late),
+		waitCycles = tonumber(stats.wait_cycles),
+		time = time,
+		mpps = time > 0 and packets / time / 10^6 or 0,
+		mbit = time > 0 and bytes * 8 / time / 10^6 or 0,
+		fillers = tonumber(stats.fillers),
+		fillerBytes = tonumber(stats.filler_bytes),
+		fillerAllocFailed = tonumber(stats.filler_alloc_failed)
+	}
+end
+
 
 function txQueue:send(bufs)
 	self.used = true
+	if self.paced then
+		return ffi.C.libmoon_tx_rate_send(self.id, self.qid, bufs.array, bufs.size)
+	end
 	dpdkc.dpdk_send_all_packets(self.id, self.qid, bufs.array, bufs.size)
 	return bufs.size
 end
 
 function txQueue:sendSingle(buf)
 	self.used = true
+	if self.paced then
+		self.singleBuf = self.singleBuf or ffi.new("struct rte_mbuf*[1]")
+		self.singleBuf[0] = buf
+		return ffi.C.libmoon_tx_rate_send(self.id, self.qid, self.singleBuf, 1)
+	end
 	dpdkc.dpdk_send_single_packet(self.id, self.qid, buf)
 	return 1
 end
@@ -775,6 +1208,9 @@ end
 
 function txQueue:sendN(bufs, n)
 	self.used = true
+	if self.paced then
+		return ffi.C.libmoon_tx_rate_send(self.id, self.qid, bufs.array, n)
+	end
 	dpdkc.dpdk_send_all_packets(self.id, self.qid, bufs.array, n)
 	return n
 end
@@ -828,10 +1264,16 @@ function mod.cleanupDevices()
 	LIBMOON_IGNORE_BAD_NUMA_MAPPING = old
 end
 
+-- LIBMOON_RX_WAIT_FOREVER in rx_adaptive.h
+local RX_WAIT_FOREVER = 0xFFFFFFFF
+
 --- Receive packets from a rx queue.
 --- Returns as soon as at least one packet is available.
 function rxQueue:recv(bufArray, numpkts)
 	numpkts = numpkts or bufArray.size
+	if self.adaptive then
+		return ffi.C.libmoon_rx_adaptive_recv(self.id, self.qid, bufArray.array, math.min(bufArray.size, numpkts), RX_WAIT_FOREVER)
+	end
 	while libmoon.running() do
 		local rx = dpdkc.rte_eth_rx_burst_export(self.id, self.qid, bufArray.array, math.min(bufArray.size, numpkts))
 		if rx > 0 then
@@ -842,6 +1284,8 @@ function rxQueue:recv(bufArray, numpkts)
 end
 
 --- Receive packets from a rx queue and save timestamps in the udata64 field.
+--- Timestamps are TSC values estimated from the poll time and the link speed, the burst is assumed to be back-to-back at line rate.
+--- See timestamping.newSoftwareTimestamper() for wall clock timestamps with error bounds.
 --- Returns as soon as at least one packet is available.
 function rxQueue:recvWithTimestamps(bufArray, numpkts)
 	numpkts = numpkts or bufArray.size
@@ -856,9 +1300,103 @@ function txQueue:getMacAddr(number)
   return self.dev:getMac(number)
 end
 
+ffi.cdef[[
+	struct libmoon_rx_adaptive_config {
+		uint32_t idle_polls;
+		uint32_t max_sleep_us;
+		uint64_t busy_threshold_pps;
+		uint8_t use_interrupts;
+	};
+
+	struct libmoon_rx_queue_stats {
+		uint64_t busy_cycles;
+		uint64_t idle_cycles;
+		uint64_t polls;
+		uint64_t empty_polls;
+		uint64_t sleeps;
+		uint64_t interrupts;
+		uint64_t packets;
+	};
+
+	int libmoon_rx_adaptive_configure(uint8_t port_id, uint16_t queue_id, const struct libmoon_rx_adaptive_config* cfg);
+	int libmoon_rx_adaptive_disable(uint8_t port_id, uint16_t queue_id);
+	uint16_t libmoon_rx_adaptive_recv(uint8_t port_id, uint16_t queue_id, struct rte_mbuf** bufs, uint16_t num_bufs, uint32_t timeout_us);
+	int libmoon_rx_adaptive_get_stats(uint8_t port_id, uint16_t queue_id, struct libmoon_rx_queue_stats* stats);
+]]
+
+--- Enable adaptive polling for this queue, intended for queues with a low or bursty load.
+--- The queue is polled as usual while packets arrive, it backs off after a number of empty polls
+--- by sleeping with exponentially increasing times or by waiting for an rx interrupt.
+--- Pure polling is used as long as the packet rate is above busyThreshold.
+--- recv(), tryRecv(), and tryRecvIdle() use the adaptive mode once enabled. Use the queue from one task only.
+--- @param args optional table with the following named arguments
+---   idlePolls optional (default = 256) Consecutive empty polls before backing off
+---   maxSleep optional (default = 100) Maximum sleep time in microseconds
+---   busyThreshold optional (default = 100000) Packet rate in pps above which the queue never sleeps
+---   interrupts optional (default = true if the device was configured with rxInterrupts) Wait for rx interrupts instead of sleeping
+function rxQueue:enableAdaptiveRx(args)
+	args = args or {}
+	local interrupts = args.interrupts
+	if interrupts == nil then
+		interrupts = self.dev.rxInterrupts
+	elseif interrupts and not self.dev.rxInterrupts then
+		log:warn("%s: rx interrupts requested but the device was not configured with rxInterrupts", self)
+	end
+	local rc = ffi.C.libmoon_rx_adaptive_configure(self.id, self.qid, ffi.new("struct libmoon_rx_adaptive_config", {
+		idle_polls = args.idlePolls or 256,
+		max_sleep_us = args.maxSleep or 100,
+		busy_threshold_pps = args.busyThreshold or 100000,
+		use_interrupts = interrupts or false
+	}))
+	if rc ~= 0 then
+		log:fatal("Could not enable adaptive rx on %s: %s", self, strError(rc))
+	end
+	self.adaptive = true
+end
+
+--- Switch back to busy polling.
+--- Resets the backoff state, call it from the receiving task. The configuration and stats are kept.
+function rxQueue:disableAdaptiveRx()
+	if self.adaptive then
+		ffi.C.libmoon_rx_adaptive_disable(self.id, self.qid)
+	end
+	self.adaptive = false
+end
+
+--- Get the cycle accounting of an adaptive queue.
+--- Busy cycles are spent receiving and processing packets, idle cycles polling empty queues or sleeping.
+--- @return table with the fields busyCycles, idleCycles, polls, emptyPolls, sleeps, interrupts, packets, and load (busy fraction)
+function rxQueue:getAdaptiveRxStats()
+	local stats = ffi.new("struct libmoon_rx_queue_stats")
+	if ffi.C.libmoon_rx_adaptive_get_stats(self.id, self.qid, stats) ~= 0 then
+		return nil
+	end
+	local busy, idle = tonumber(stats.busy_cycles), tonumber(stats.idle_cycles)
+	return {
+		busyCycles = busy,
+		idleCycles = idle,
+		polls = tonumber(stats.polls),
+		emptyPolls = tonumber(stats.empty_polls),
+		sleeps = tonumber(stats.sleeps),
+		interrupts = tonumber(stats.interrupts),
+		packets = tonumber(stats.packets),
+		load = busy + idle > 0 and busy / (busy + idle) or 0
+	}
+end
+
+local function adaptiveRecvTimeout(queue, bufArray, maxWait)
+	-- 0 polls once without waiting
+	local timeout = maxWait == math.huge and RX_WAIT_FOREVER or math.max(math.min(maxWait, RX_WAIT_FOREVER - 1), 0)
+	return ffi.C.libmoon_rx_adaptive_recv(queue.id, queue.qid, bufArray.array, bufArray.size, timeout)
+end
+
 --- Receive packets from a rx queue with a timeout.
+--- @param maxWait optional (default = wait forever) timeout in microseconds, 0 receives a single burst without waiting
 function rxQueue:tryRecv(bufArray, maxWait)
 	maxWait = maxWait or math.huge
+	if self.adaptive then
+		return adaptiveRecvTimeout(self, bufArray, maxWait)
+	end
 	while maxWait >= 0 do
 		local rx = dpdkc.rte_eth_rx_burst_export(self.id, self.qid, bufArray.array, bufArray.size)
 		if rx > 0 then
@@ -878,6 +1416,9 @@ end
 --- Does not perform a busy wait, this is not suitable for high-throughput applications.
 function rxQueue:tryRecvIdle(bufArray, maxWait)
 	maxWait = maxWait or math.huge
+	if self.adaptive then
+		return adaptiveRecvTimeout(self, bufArray, maxWait)
+	end
 	while maxWait >= 0 do
 		local rx = dpdkc.rte_eth_rx_burst_export(self.id, self.qid, bufArray.array, bufArray.size)
 		if rx > 0 then
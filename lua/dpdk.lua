@@ -89,6 +89,44 @@ mod.ETH_RSS_IPV6_EX            = bit.lshift(1ULL, mod.RTE_ETH_FLOW_IPV6_EX)
 mod.ETH_RSS_IPV6_TCP_EX        = bit.lshift(1ULL, mod.RTE_ETH_FLOW_IPV6_TCP_EX)
 mod.ETH_RSS_IPV6_UDP_EX        = bit.lshift(1ULL, mod.RTE_ETH_FLOW_IPV6_UDP_EX)
 
+-- flow director config, see device.config()
+mod.RTE_FDIR_MODE_NONE             = 0
+mod.RTE_FDIR_MODE_SIGNATURE        = 1
+mod.RTE_FDIR_MODE_PERFECT          = 2
+mod.RTE_FDIR_MODE_PERFECT_MAC_VLAN = 3
+mod.RTE_FDIR_MODE_PERFECT_TUNNEL   = 4
+
+mod.RTE_FDIR_PBALLOC_64K  = 0
+mod.RTE_FDIR_PBALLOC_128K = 1
+mod.RTE_FDIR_PBALLOC_256K = 2
+
+mod.RTE_FDIR_NO_REPORT_STATUS     = 0
+mod.RTE_FDIR_REPORT_STATUS        = 1
+mod.RTE_FDIR_REPORT_STATUS_ALWAYS = 2
+
+mod.RTE_ETH_RAW_PAYLOAD = 1
+mod.RTE_ETH_L2_PAYLOAD  = 2
+mod.RTE_ETH_L3_PAYLOAD  = 3
+mod.RTE_ETH_L4_PAYLOAD  = 4
+
+--- Flow types by the names used by testpmd and fdir_get_infos()
+mod.flowTypes = {
+	["raw"]        = mod.RTE_ETH_FLOW_RAW,
+	["ipv4"]       = mod.RTE_ETH_FLOW_IPV4,
+	["ipv4-frag"]  = mod.RTE_ETH_FLOW_FRAG_IPV4,
+	["ipv4-tcp"]   = mod.RTE_ETH_FLOW_NONFRAG_IPV4_TCP,
+	["ipv4-udp"]   = mod.RTE_ETH_FLOW_NONFRAG_IPV4_UDP,
+	["ipv4-sctp"]  = mod.RTE_ETH_FLOW_NONFRAG_IPV4_SCTP,
+	["ipv4-other"] = mod.RTE_ETH_FLOW_NONFRAG_IPV4_OTHER,
+	["ipv6"]       = mod.RTE_ETH_FLOW_IPV6,
+	["ipv6-frag"]  = mod.RTE_ETH_FLOW_FRAG_IPV6,
+	["ipv6-tcp"]   = mod.RTE_ETH_FLOW_NONFRAG_IPV6_TCP,
+	["ipv6-udp"]   = mod.RTE_ETH_FLOW_NONFRAG_IPV6_UDP,
+	["ipv6-sctp"]  = mod.RTE_ETH_FLOW_NONFRAG_IPV6_SCTP,
+	["ipv6-other"] = mod.RTE_ETH_FLOW_NONFRAG_IPV6_OTHER,
+	["l2_payload"] = mod.RTE_ETH_FLOW_L2_PAYLOAD,
+}
+
 --- Do not call dpdk.init() automatically on startup.
 --- You must not call any DPDK functions prior to invoking libmoon.init().
 function mod.skipInit()
@@ -210,6 +210,29 @@ ffi.cdef[[
 		uint16_t nb_tx_queues; 
 	};
 
+	struct libmoon_fdir_config {
+		uint8_t mode;
+		uint8_t pballoc;
+		uint8_t status;
+		uint8_t drop_queue;
+		uint16_t vlan_tci_mask;
+		uint16_t src_port_mask;
+		uint16_t dst_port_mask;
+		uint8_t mac_addr_byte_mask;
+		uint8_t tunnel_type_mask;
+		uint32_t tunnel_id_mask;
+		uint32_t src_ipv4_mask;
+		uint32_t dst_ipv4_mask;
+		uint32_t src_ipv6_mask[4];
+		uint32_t dst_ipv6_mask[4];
+		uint8_t flex_payload_type;
+		uint8_t num_flex_offsets;
+		uint16_t flex_flow_type;
+		uint16_t flex_offsets[16];
+		uint8_t flex_mask[16];
+		uint8_t flex_custom;
+	};
+
 	struct libmoon_device_config {
 		uint32_t port;
 		struct mempool** mempools;
@@ -222,9 +245,56 @@ ffi.cdef[[
 		uint8_t disable_offloads;
 		uint8_t strip_vlan;
 		uint32_t rss_mask;
+		uint8_t* rss_key;
+		uint8_t rss_key_len;
+		struct libmoon_fdir_config* fdir;
+		uint16_t mtu;
+		uint8_t enable_scatter;
+		uint8_t multi_seg_tx;
+		uint8_t rx_interrupts;
 	};
 ]]
 
+-- per-core cycle accounting, see core_stats.h
+ffi.cdef[[
+	struct libmoon_core_stats {
+		uint64_t busy_cycles;
+		uint64_t idle_cycles;
+		uint64_t busy_calls;
+		uint64_t empty_calls;
+		uint64_t packets;
+		uint64_t last_tsc;
+		uint8_t last_busy;
+		char task_name[39];
+	} __attribute__((aligned(64)));
+
+	void libmoon_core_stats_task_start(const char* task_name);
+	void libmoon_core_stats_enable(uint8_t enabled);
+	int libmoon_core_stats_get(uint32_t lcore, struct libmoon_core_stats* stats);
+	uint32_t libmoon_core_stats_max_cores();
+]]
+
+-- xstats collection, see xstats.h
+ffi.cdef[[
+	struct libmoon_xstats { };
+
+	struct libmoon_xstats* libmoon_xstats_create(uint8_t port_id, const uint64_t* ids, uint32_t num_ids);
+	void libmoon_xstats_delete(struct libmoon_xstats* xstats);
+	uint32_t libmoon_xstats_count(struct libmoon_xstats* xstats);
+	const char* libmoon_xstats_name(struct libmoon_xstats* xstats, uint32_t idx);
+	double libmoon_xstats_update(struct libmoon_xstats* xstats);
+	const uint64_t* libmoon_xstats_values(struct libmoon_xstats* xstats);
+	const double* libmoon_xstats_rates(struct libmoon_xstats* xstats);
+]]
+
+-- latest values of the stats.lua counters for the REST API, see counter_table.h
+ffi.cdef[[
+	int libmoon_counter_table_register(uint32_t id, const char* name, const char* direction, int32_t device);
+	void libmoon_counter_table_update(uint32_t id, uint64_t packets, uint64_t bytes, double mpps, double mbit, double wire_mbit, double time);
+	uint32_t libmoon_counter_table_size();
+	size_t libmoon_counter_table_json(uint32_t id, char* buf, size_t len);
+]]
+
 -- dpdk functions and wrappers
 ffi.cdef[[
 	// eal init
@@ -242,6 +312,11 @@ ffi.cdef[[
 	struct mempool* init_mem(uint32_t nb_mbuf, uint32_t sock, uint32_t mbuf_size);
 	struct rte_mbuf* alloc_mbuf(struct mempool* mp);
 	void alloc_mbufs(struct mempool* mp, struct rte_mbuf* bufs[], uint32_t len, uint16_t pkt_len);
+	struct rte_mbuf* alloc_mbuf_chain(struct mempool* mp, uint32_t pkt_len);
+	uint32_t alloc_mbuf_chains(struct mempool* mp, struct rte_mbuf* bufs[], uint32_t len, uint32_t pkt_len);
+	void free_mbufs(struct rte_mbuf* bufs[], uint32_t len);
+	int linearize_mbufs(struct rte_mbuf* bufs[], uint32_t len);
+	uint32_t read_mbuf_chain(const struct rte_mbuf* buf, uint32_t offset, uint32_t len, uint8_t* dst);
 	void rte_pktmbuf_free_export(struct rte_mbuf* m);
 	uint16_t rte_mbuf_refcnt_read_export(struct rte_mbuf* m);
 	uint16_t rte_mbuf_refcnt_update_export(struct rte_mbuf* m, int16_t value);
@@ -253,6 +328,7 @@ ffi.cdef[[
 	void rte_eth_link_get(uint8_t port, struct rte_eth_link* link);
 	void rte_eth_link_get_nowait(uint8_t port, struct rte_eth_link* link);
 	int dpdk_configure_device(struct libmoon_device_config*);
+	int fdir_validate_config(uint32_t port_id, struct libmoon_fdir_config* cfg);
 	void get_mac_addr(int port, char* buf);
 	uint32_t dpdk_get_pci_id(uint8_t port);
 	uint32_t read_reg32(uint8_t port, uint32_t reg);
@@ -274,6 +350,8 @@ ffi.cdef[[
 	void rte_eth_dev_info_get(uint8_t port_id, struct rte_eth_dev_info* info);
 	void rte_eth_dev_stop(uint8_t port_id);
 	int rte_eth_dev_fw_version_get(uint8_t port_id, char* fw_version, size_t fw_size);
+	int rte_eth_dev_get_mtu(uint8_t port_id, uint16_t* mtu);
+	int rte_eth_dev_set_mtu(uint8_t port_id, uint16_t mtu);
 
 	// rx & tx
 	uint16_t rte_eth_rx_burst_export(uint8_t port_id, uint16_t queue_id, struct rte_mbuf** rx_pkts, uint16_t nb_pkts);
@@ -301,8 +379,17 @@ ffi.cdef[[
 	uint64_t rte_get_tsc_hz();
 
 	// lifecycle
+	struct libmoon_stop_token {
+		volatile uint32_t stop;
+		uint64_t task_id;
+		volatile uint64_t stop_tsc;
+		volatile uint64_t deadline;
+	} __attribute__((aligned(64)));
 	uint8_t is_running(uint32_t extra_time);
 	void set_runtime(uint32_t ms);
+	struct libmoon_stop_token* libmoon_get_stop_token(uint32_t lcore);
+	void libmoon_init_task_token(uint32_t lcore, uint64_t task_id);
+	int libmoon_stop_task(uint32_t lcore, uint64_t task_id, uint32_t delay);
 
 	// timestamping
 	uint16_t dpdk_receive_with_timestamps_software(uint8_t port_id, uint16_t queue_id, struct rte_mbuf** rx_pkts, uint16_t nb_pkts);
@@ -13,6 +13,7 @@ local dpdk     = require "dpdk"
 local mbitmask = require "bitmask"
 local log      = require "log"
 local generic  = require "filter_GenericFlowAPI"
+local serpent  = require "Serpent"
 
 mod.DROP = -1
 
@@ -414,6 +415,11 @@ struct rte_eth_fdir_info {
 
 int rte_eth_dev_filter_ctrl(uint8_t port_id, enum rte_filter_type filter_type, enum rte_filter_op filter_op, void * arg);
 void fdir_get_infos(uint32_t port_id);
+uint32_t fdir_alloc_rule_id(uint8_t port_id);
+void fdir_free_rule_id(uint8_t port_id, uint32_t rule_id);
+void fdir_count_hits(uint8_t port_id, struct rte_mbuf** bufs, uint32_t num_bufs);
+uint64_t fdir_get_hits(uint8_t port_id, uint32_t rule_id);
+void fdir_reset_hits(uint8_t port_id, uint32_t rule_id);
 
 ]]
 
@@ -526,3 +532,168 @@ function dev:fiveTupleFilter(filter, queue)
 	local err = C.rte_eth_dev_filter_ctrl(self.id, C.RTE_ETH_FILTER_NTUPLE, C.RTE_ETH_FILTER_ADD, filter)
 	return checkDpdkError(err, "setting 5tuple filter")
 end
+
+local fdirRule = {}
+fdirRule.__index = fdirRule
+
+-- FDIR_NO_RULE_ID in filter.h
+local FDIR_NO_RULE_ID = 0xFFFFFFFF
+
+local function be16(val)
+	return bit.rshift(bit.bswap(val or 0), 16)
+end
+
+local function ip4(addr)
+	if type(addr) == "string" then
+		addr = parseIP4Address(addr) or log:fatal("Invalid IPv4 address %s", addr)
+	end
+	return bit.bswap(addr or 0)
+end
+
+local function ip6(addr, target)
+	if not addr then
+		return
+	end
+	addr = parseIP6Address(addr) or log:fatal("Invalid IPv6 address %s", addr)
+	for i = 0, 3 do
+		target[i] = bit.bswap(addr.uint32[3 - i])
+	end
+end
+
+local function buildFdirFilter(self, rule, id)
+	local flowType = dpdk.flowTypes[rule.flowType] or log:fatal("Unknown flow type %s", tostring(rule.flowType))
+	local queue = rule.queue
+	if type(queue) == "table" then
+		if queue.dev.id ~= self.id then
+			log:fatal("Queue must belong to the device being configured")
+		end
+		queue = queue.qid
+	end
+	local filter = ffi.new("struct rte_eth_fdir_filter", {
+		soft_id = id,
+		input = {
+			flow_type = flowType,
+			flow_ext = {
+				vlan_tci = be16(rule.vlan),
+				flexbytes = rule.flexBytes or {},
+			},
+		},
+		action = {
+			rx_queue = queue == mod.DROP and 0 or queue,
+			behavior = queue == mod.DROP and C.RTE_ETH_FDIR_REJECT or C.RTE_ETH_FDIR_ACCEPT,
+			report_status = C.RTE_ETH_FDIR_REPORT_ID,
+		},
+	})
+	-- all IP based flow types share the layout of the 5-tuple
+	local flow = filter.input.flow
+	if rule.flowType:match("^ipv4") then
+		flow.udp4_flow.ip.src_ip = ip4(rule.srcIp)
+		flow.udp4_flow.ip.dst_ip = ip4(rule.dstIp)
+		flow.udp4_flow.src_port = be16(rule.srcPort)
+		flow.udp4_flow.dst_port = be16(rule.dstPort)
+	elseif rule.flowType:match("^ipv6") then
+		ip6(rule.srcIp, flow.udp6_flow.ip.src_ip)
+		ip6(rule.dstIp, flow.udp6_flow.ip.dst_ip)
+		flow.udp6_flow.src_port = be16(rule.srcPort)
+		flow.udp6_flow.dst_port = be16(rule.dstPort)
+	end
+	return filter
+end
+
+--- Add a flow director rule.
+--- Fields not covered by the masks configured in device.config are ignored by the NIC.
+--- @param rule a table containing the following fields
+---   flowType the flow type, e.g., "ipv4-udp", see dpdk.flowTypes
+---   srcIp, dstIp optional IPv4 or IPv6 (depending on the flow type) addresses as strings
+---   srcPort, dstPort optional L4 ports
+---   vlan optional VLAN TCI
+---   flexBytes optional table of flexible payload bytes to match
+---   queue the target queue (id or queue object) or filter.DROP
+---   id optional (default = lowest free id) soft id of the rule, reported in matching mbufs
+---      allocated ids are returned by rule:delete() and reused afterwards
+--- @return the rule, use rule:delete() to remove it and rule:getHits() to get the number of matching packets
+---         nil if the rule could not be added or all ids are in use
+function dev:addFdirRule(rule)
+	-- ids are allocated natively to be unique across tasks
+	local id = rule.id or C.fdir_alloc_rule_id(self.id)
+	if id == FDIR_NO_RULE_ID then
+		log:warn("Error adding fdir rule: no free rule id on device %d", self.id)
+		return nil
+	end
+	local filter = buildFdirFilter(self, rule, id)
+	local err = C.rte_eth_dev_filter_ctrl(self.id, C.RTE_ETH_FILTER_FDIR, C.RTE_ETH_FILTER_ADD, filter)
+	if err ~= 0 then
+		log:warn("Error adding fdir rule: %s", strError(err))
+		if not rule.id then
+			C.fdir_free_rule_id(self.id, id)
+		end
+		return nil
+	end
+	C.fdir_reset_hits(self.id, id)
+	-- queue objects can't be serialized as part of the rule
+	local args = {}
+	for k, v in pairs(rule) do
+		args[k] = v
+	end
+	args.queue = type(rule.queue) == "table" and rule.queue.qid or rule.queue
+	return setmetatable({ dev = self, id = id, args = args }, fdirRule)
+end
+
+--- Remove a flow director rule.
+function fdirRule:delete()
+	local filter = buildFdirFilter(self.dev, self.args, self.id)
+	local err = C.rte_eth_dev_filter_ctrl(self.dev.id, C.RTE_ETH_FILTER_FDIR, C.RTE_ETH_FILTER_DELETE, filter)
+	if err ~= 0 then
+		log:warn("Error deleting fdir rule: %s", strError(err))
+		return false
+	end
+	-- explicit ids are managed by the user
+	if not self.args.id then
+		C.fdir_free_rule_id(self.dev.id, self.id)
+	end
+	return true
+end
+
+--- Get the number of packets that matched this rule.
+--- Packets are counted in software, call dev:countFdirHits() on received packets.
+--- Only supported on i40e, other drivers do not report the rule id in the mbuf and the counter stays at 0.
+function fdirRule:getHits()
+	return tonumber(C.fdir_get_hits(self.dev.id, self.id))
+end
+
+function fdirRule:resetHits()
+	C.fdir_reset_hits(self.dev.id, self.id)
+end
+
+function fdirRule:__tostring()
+	return ("[FdirRule: dev=%d, id=%d]"):format(self.dev.id, self.id)
+end
+
+function fdirRule:__serialize()
+	return ("local filter = require 'filter' return setmetatable({ dev = require('device').get(%d), id = %d, args = %s }, filter.fdirRule)"):format(
+		self.dev.id, self.id, serpent.dumpRaw(self.args)
+	), true
+end
+
+mod.fdirRule = fdirRule
+
+--- Count fdir rule hits in a bufArray received from this device.
+--- The NIC reports the id of the matching rule in the mbuf, counters are shared between all queues.
+--- Only i40e reports rule ids, this does nothing (except for a warning) on other drivers.
+--- @param bufs the bufArray
+--- @param n optional (default = bufs.size) number of packets
+function dev:countFdirHits(bufs, n)
+	if self.fdirHitsUnsupported == nil then
+		self.fdirHitsUnsupported = not self:getDriverName():match("i40e")
+		if self.fdirHitsUnsupported then
+			log:warn("%s does not report fdir rule ids in received packets, rule hits can't be counted", self:getDriverName())
+		end
+	end
+	if self.fdirHitsUnsupported then
+		return
+	end
+	C.fdir_count_hits(self.id, bufs.array, n or bufs.size)
+end
+
+
+return mod
@@ -0,0 +1,263 @@
+---------------------------------
+--- @file flowtable.lua
+--- @brief Native 5-tuple flow table for stateful processing (NAT, per-flow stats, connection tracking).
+--- Values are fixed-size FFI structs that are zeroed when a flow is inserted, e.g.
+---   ffi.cdef[[ struct flow_state { uint64_t packets; uint64_t bytes; }; ]]
+---   local tbl = flowtable.newFlowTable{ size = 1000000, valueType = "struct flow_state", timeout = 30 }
+---   local flows = tbl:lookupBurst(bufs, rx, true)
+---   for i = 1, rx do local flow = flows[i - 1] if flow ~= nil then flow.packets = flow.packets + 1 end end
+--- Flows that were not seen for timeout seconds are removed by tbl:expire(), call it regularly.
+--- Per-core tables must only be used by one task. Tables created with shared = true can be passed to other tasks,
+--- lookups are lock-free, inserts and expiry are serialized. Values of shared flows are accessed concurrently,
+--- use atomics or a per-core table if several tasks modify them.
+---------------------------------
+
+local ffi     = require "ffi"
+local log     = require "log"
+local serpent = require "Serpent"
+local libmoon = require "libmoon"
+
+ffi.cdef[[
+	struct libmoon_flow_key {
+		uint8_t src_ip[16];
+		uint8_t dst_ip[16];
+		uint16_t src_port;
+		uint16_t dst_port;
+		uint8_t proto;
+		uint8_t ip_version;
+		uint16_t reserved;
+	};
+
+	struct libmoon_flow_table { };
+
+	struct libmoon_flow_table* libmoon_flow_table_create(uint32_t capacity, uint32_t value_size, uint32_t timeout, uint8_t shared, int socket);
+	void libmoon_flow_table_delete(struct libmoon_flow_table* table);
+	uint32_t libmoon_flow_table_count(struct libmoon_flow_table* table);
+	uint32_t libmoon_flow_table_capacity(struct libmoon_flow_table* table);
+	void* libmoon_flow_table_lookup(struct libmoon_flow_table* table, const struct libmoon_flow_key* key, uint32_t now);
+	void* libmoon_flow_table_insert(struct libmoon_flow_table* table, const struct libmoon_flow_key* key, uint32_t now, uint8_t* is_new);
+	int libmoon_flow_table_remove(struct libmoon_flow_table* table, const struct libmoon_flow_key* key);
+	uint32_t libmoon_flow_table_expire(struct libmoon_flow_table* table, uint32_t now, struct libmoon_flow_key* keys, void* values, uint32_t max_flows);
+	int libmoon_flow_key_from_mbuf(struct rte_mbuf* buf, struct libmoon_flow_key* key);
+	uint32_t libmoon_flow_table_lookup_burst(struct libmoon_flow_table* table, struct rte_mbuf** bufs, uint32_t num_bufs, void** values, uint32_t now, uint8_t insert);
+	struct libmoon_flow_keys;
+	uint32_t libmoon_flow_table_lookup_keys(struct libmoon_flow_table* table, struct libmoon_flow_keys* keys, void** values, uint32_t now, uint8_t insert);
+]]
+
+local C = ffi.C
+local band, rshift = bit.band, bit.rshift
+
+local mod = {}
+
+-- ticks are milliseconds
+local function now()
+	return math.floor(libmoon.getTime() * 1000) % 2^32
+end
+
+local flowKey = {}
+flowKey.__index = flowKey
+local keyType = ffi.typeof("struct libmoon_flow_key")
+
+local function writeAddress(str, dst)
+	local ip4 = parseIP4Address(str)
+	if ip4 then
+		for i = 0, 3 do
+			dst[i] = band(rshift(ip4, 24 - i * 8), 0xFF)
+		end
+		return 4
+	end
+	local ip6 = parseIP6Address(str) or log:fatal("Invalid address %s", str)
+	-- libmoon stores IPv6 addresses byte-reversed
+	for i = 0, 15 do
+		dst[i] = ip6.uint8[15 - i]
+	end
+	return 6
+end
+
+--- Create a flow key.
+--- @param args table with the named arguments src, dst (IP addresses as strings), srcPort, dstPort, proto (number)
+function mod.newKey(args)
+	local key = keyType()
+	key.ip_version = writeAddress(args.src, key.src_ip)
+	writeAddress(args.dst, key.dst_ip)
+	key.src_port = args.srcPort or 0
+	key.dst_port = args.dstPort or 0
+	key.proto = args.proto or 0
+	return key
+end
+
+--- Extract the flow key of a packet.
+--- @return the key or nil for non-IP packets
+function mod.keyFromPacket(buf, key)
+	key = key or keyType()
+	if C.libmoon_flow_key_from_mbuf(buf, key) ~= 0 then
+		return nil
+	end
+	return key
+end
+
+local function addressToString(addr, version)
+	if version == 4 then
+		return ("%d.%d.%d.%d"):format(addr[0], addr[1], addr[2], addr[3])
+	end
+	local parts = {}
+	for i = 0, 7 do
+		parts[#parts + 1] = ("%x"):format(addr[i * 2] * 256 + addr[i * 2 + 1])
+	end
+	return table.concat(parts, ":")
+end
+
+function flowKey:__tostring()
+	return ("%s:%d -> %s:%d proto %d"):format(
+		addressToString(self.src_ip, self.ip_version), self.src_port,
+		addressToString(self.dst_ip, self.ip_version), self.dst_port,
+		self.proto
+	)
+end
+
+ffi.metatype(keyType, flowKey)
+
+local flowTable = {}
+flowTable.__index = flowTable
+mod.flowTable = flowTable
+
+--- Create a new flow table.
+--- @param args table with the following named arguments
+--- @param args.size maximum number of flows
+--- @param args.valueType name of the FFI type stored per flow
+--- @param args.timeout optional (default = 30) remove flows that were not seen for this many seconds
+--- @param args.shared optional (default = false) allow concurrent use from multiple tasks
+--- @param args.socket optional (default = socket of the calling thread) NUMA socket
+function mod.newFlowTable(args)
+	local timeout = math.max(math.floor((args.timeout or 30) * 1000), 1)
+	local ft = C.libmoon_flow_table_create(args.size, ffi.sizeof(args.valueType), timeout, args.shared and 1 or 0, args.socket or select(2, libmoon.getCore()))
+	if ft == nil then
+		log:fatal("Could not create flow table with %s flows of type %s", args.size, args.valueType)
+	end
+	return setmetatable({
+		ft = ft,
+		valueType = args.valueType,
+		shared = args.shared or false
+	}, flowTable)
+end
+
+function flowTable:getPtrType()
+	if not self.ptrType then
+		self.ptrType = ffi.typeof("$*", ffi.typeof(self.valueType))
+	end
+	return self.ptrType
+end
+
+--- Look up (and optionally insert) the flows of received packets.
+--- @param bufs the bufArray
+--- @param n number of packets
+--- @param insert insert unknown flows
+--- @return 0-based array of value pointers (nil for non-IP packets, unknown flows, or if the table is full), number of new flows
+function flowTable:lookupBurst(bufs, n, insert)
+	self:allocValues(math.max(n, bufs.size))
+	local newFlows = C.libmoon_flow_table_lookup_burst(self.ft, bufs.array, n, self.valuesVoid, now(), insert and 1 or 0)
+	return self.values, newFlows
+end
+
+--- Look up (and optionally insert) the flows of a burst that was already parsed with burstparser.
+--- Avoids parsing and hashing the packets again if the keys are also used elsewhere.
+--- @param keys the flow keys returned by burstparser.newFlowKeys() after calling keys:parse()
+--- @param insert insert unknown flows
+--- @return same as lookupBurst
+function flowTable:lookupKeys(keys, insert)
+	self:allocValues(keys.keys.capacity)
+	local newFlows = C.libmoon_flow_table_lookup_keys(self.ft, keys.keys, self.valuesVoid, now(), insert and 1 or 0)
+	return self.values, newFlows
+end
+
+function flowTable:allocValues(n)
+	if not self.values or self.valuesSize < n then
+		self.valuesSize = n
+		self.values = ffi.new(ffi.typeof("$[?]", self:getPtrType()), self.valuesSize)
+		self.valuesVoid = ffi.cast("void**", self.values)
+	end
+end
+
+--- Look up a single flow.
+--- @return the value or nil
+function flowTable:lookup(key)
+	local value = C.libmoon_flow_table_lookup(self.ft, key, now())
+	if value == nil then
+		return nil
+	end
+	return ffi.cast(self:getPtrType(), value)
+end
+
+local isNew = ffi.new("uint8_t[1]")
+
+--- Look up a flow and insert it if it does not exist.
+--- @return the value (nil if the table is full), true if the flow is new
+function flowTable:insert(key)
+	local value = C.libmoon_flow_table_insert(self.ft, key, now(), isNew)
+	if value == nil then
+		return nil, false
+	end
+	return ffi.cast(self:getPtrType(), value), isNew[0] == 1
+end
+
+--- Remove a flow.
+--- @return true if the flow existed
+function flowTable:remove(key)
+	return C.libmoon_flow_table_remove(self.ft, key) == 1
+end
+
+local EXPIRE_BATCH = 64
+
+--- Remove flows that timed out.
+--- @param func optional, called as func(key, value) for each removed flow, the arguments are only valid during the call
+--- @return number of removed flows
+function flowTable:expire(func)
+	if not self.expiredKeys then
+		self.expiredKeys = ffi.new("struct libmoon_flow_key[?]", EXPIRE_BATCH)
+		self.expiredValues = ffi.new(ffi.typeof("$[?]", ffi.typeof(self.valueType)), EXPIRE_BATCH)
+	end
+	local t = now()
+	local total = 0
+	while true do
+		local n = C.libmoon_flow_table_expire(self.ft, t, self.expiredKeys, func and self.expiredValues or nil, EXPIRE_BATCH)
+		if func then
+			for i = 0, n - 1 do
+				func(self.expiredKeys[i], self.expiredValues[i])
+			end
+		end
+		total = total + n
+		if n < EXPIRE_BATCH then
+			return total
+		end
+	end
+end
+
+--- Get the number of flows.
+function flowTable:count()
+	return C.libmoon_flow_table_count(self.ft)
+end
+
+--- Get the maximum number of flows.
+function flowTable:capacity()
+	return C.libmoon_flow_table_capacity(self.ft)
+end
+
+--- Free the table, must not be used by any task at this point.
+function flowTable:destroy()
+	C.libmoon_flow_table_delete(self.ft)
+	self.ft = nil
+end
+
+function flowTable:__tostring()
+	return ("[FlowTable: %d/%d flows%s]"):format(self:count(), self:capacity(), self.shared and ", shared" or "")
+end
+
+function flowTable:__serialize()
+	if not self.shared then
+		log:warn("Passing per-core flow table %s to another task, create it with shared = true", self)
+	end
+	local obj = { ft = self.ft, valueType = self.valueType, shared = self.shared }
+	return "require 'flowtable'; return " .. serpent.addMt(serpent.dumpRaw(obj), "require('flowtable').flowTable"), true
+end
+
+return mod
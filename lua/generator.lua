@@ -0,0 +1,251 @@
+---------------------------------
+--- @file generator.lua
+--- @brief Native multi-core UDP/IPv4 packet generator.
+--- The flows are the cartesian product of the values of all varying fields, each tx queue gets a worker
+--- running on its own core that sends a disjoint slice of the flows. Workers only write the varying fields,
+--- lengths, and checksums into packets from a private, pre-filled mempool, e.g.
+---   local gen = generator.new{ethDst = "10:11:12:13:14:15", ip4Src = {min = "10.0.0.1", count = 1000}, udpDst = {53, 80, 443}, size = generator.IMIX}
+---   gen:startTasks{dev:getTxQueue(0), dev:getTxQueue(1)}
+--- The software rate control of the queues (txQueue:setSoftwareRate()) applies to the workers.
+---------------------------------
+
+local ffi     = require "ffi"
+local log     = require "log"
+local serpent = require "Serpent"
+local libmoon = require "libmoon"
+local memory  = require "memory"
+require "utils"
+
+ffi.cdef[[
+	struct libmoon_generator { };
+	struct libmoon_generator_worker { };
+
+	struct libmoon_generator* libmoon_generator_create(const uint8_t* template, uint16_t max_size, uint8_t offload, uint8_t udp_checksum);
+	void libmoon_generator_delete(struct libmoon_generator* gen);
+	int libmoon_generator_set_range(struct libmoon_generator* gen, int field, uint64_t min, uint64_t count, uint64_t step);
+	int libmoon_generator_set_values(struct libmoon_generator* gen, int field, const uint64_t* values, uint32_t num_values);
+	int libmoon_generator_set_sizes(struct libmoon_generator* gen, const uint16_t* sizes, const uint32_t* weights, uint32_t num_sizes);
+	uint64_t libmoon_generator_num_flows(struct libmoon_generator* gen);
+
+	struct libmoon_generator_worker* libmoon_generator_worker_create(struct libmoon_generator* gen, uint32_t worker_id, uint32_t num_workers, uint32_t socket, uint32_t pool_size);
+	void libmoon_generator_worker_delete(struct libmoon_generator_worker* worker);
+	uint32_t libmoon_generator_worker_fill(struct libmoon_generator_worker* worker, struct rte_mbuf** bufs, uint32_t num_bufs);
+	uint64_t libmoon_generator_worker_run(struct libmoon_generator_worker* worker, uint8_t port_id, uint16_t queue_id, uint32_t burst_size);
+]]
+
+local C = ffi.C
+
+local mod = {}
+
+--- Simple IMIX (7:4:1) as packet sizes without CRC, i.e. the frame sizes of imixSize() in utils.lua minus 4 bytes.
+mod.IMIX = { sizes = {}, weights = {} }
+for i, size in ipairs(imixFrames.sizes) do
+	mod.IMIX.sizes[i] = size - 4
+	mod.IMIX.weights[i] = imixFrames.weights[i]
+end
+
+-- order of enum libmoon_generator_field
+local fields = {
+	{ name = "ip4Src", id = 0, type = "ip" },
+	{ name = "ip4Dst", id = 1, type = "ip" },
+	{ name = "udpSrc", id = 2, type = "port" },
+	{ name = "udpDst", id = 3, type = "port" },
+	{ name = "ethSrc", id = 4, type = "mac" },
+	{ name = "ethDst", id = 5, type = "mac" },
+}
+
+local generator = {}
+generator.__index = generator
+mod.generator = generator
+
+local worker = {}
+worker.__index = worker
+mod.worker = worker
+
+-- MAC as 48 bit number with the first byte as most significant byte
+local function macToNumber(mac)
+	local addr = parseMacAddress(mac) or log:fatal("Invalid MAC address %s", mac)
+	local n = 0
+	for i = 0, 5 do
+		n = n * 256 + addr.uint8[i]
+	end
+	return n
+end
+
+local function numberToMac(n)
+	local bytes = {}
+	for i = 6, 1, -1 do
+		bytes[i] = ("%02x"):format(n % 256)
+		n = math.floor(n / 256)
+	end
+	return table.concat(bytes, ":")
+end
+
+local function toNumber(field, value)
+	if type(value) == "number" then
+		return value
+	end
+	if field.type == "ip" then
+		local ip = parseIP4Address(value) or log:fatal("Invalid IPv4 address %s", value)
+		return ip < 0 and ip + 2^32 or ip
+	elseif field.type == "mac" then
+		return macToNumber(value)
+	end
+	log:fatal("Invalid value %s for %s", tostring(value), field.name)
+end
+
+-- a field is varying if it is a range {min = , count = , step = } or a list of values
+-- queues and devices (as ethSrc) are passed to fill() as they are
+local function isVarying(spec)
+	return type(spec) == "table" and getmetatable(spec) == nil
+end
+
+-- first value in the format expected by the fill() functions
+local function firstValue(field, spec)
+	if not isVarying(spec) then
+		return spec
+	end
+	local value = spec.min or spec[1]
+	if value == nil then
+		log:fatal("Empty value list for %s", field.name)
+	end
+	if field.type == "ip" and type(value) == "number" then
+		return ip4ToString(value)
+	elseif field.type == "mac" and type(value) == "number" then
+		return numberToMac(value)
+	end
+	return value
+end
+
+local function parseSizes(size)
+	if type(size) == "number" then
+		return { size }, nil
+	end
+	if size.sizes then
+		return size.sizes, size.weights
+	end
+	return size, nil
+end
+
+--- Create a generator.
+--- @param args table with the following named arguments
+--- @param args.ethSrc, args.ethDst, args.ip4Src, args.ip4Dst, args.udpSrc, args.udpDst the header fields, each is either
+---   a constant (anything the corresponding fill() function accepts, e.g. a tx queue as ethSrc),
+---   a range {min = , count = , step = 1}, or a list of values {v1, v2, ...}
+---   IPs and MACs in ranges can be strings or numbers (MACs with the first byte as most significant byte)
+---   the first varying field changes with every packet, the second one after all values of the first were used, etc.
+--- @param args.size optional (default = 60) packet size without CRC, a list of sizes, or {sizes = {...}, weights = {...}} (e.g. generator.IMIX)
+--- @param args.offload optional (default = false) use IP and UDP checksum offloading
+--- @param args.udpChecksum optional (default = true) calculate the UDP checksum in software if offloading is disabled
+function mod.new(args)
+	local sizes, weights = parseSizes(args.size or 60)
+	local maxSize = 0
+	for _, size in ipairs(sizes) do
+		maxSize = math.max(maxSize, size)
+	end
+	-- build the template with the usual fill() functions
+	local fillArgs = { pktLength = maxSize }
+	for _, field in ipairs(fields) do
+		fillArgs[field.name] = firstValue(field, args[field.name])
+	end
+	local mem = memory.createMemPool{ n = 63 }
+	local buf = mem:alloc(maxSize)
+	buf:getUdpPacket():fill(fillArgs)
+	local gen = C.libmoon_generator_create(ffi.cast("uint8_t*", buf:getData()), maxSize, args.offload and 1 or 0, args.udpChecksum == false and 0 or 1)
+	buf:free()
+	if gen == nil then
+		log:fatal("Could not create generator, invalid packet size?")
+	end
+	local obj = setmetatable({ gen = gen, offload = args.offload or false }, generator)
+	for _, field in ipairs(fields) do
+		local spec = args[field.name]
+		if isVarying(spec) then
+			local rc
+			if spec.min then
+				rc = C.libmoon_generator_set_range(gen, field.id, toNumber(field, spec.min), spec.count or 1, spec.step or 1)
+			else
+				local values = ffi.new("uint64_t[?]", #spec)
+				for i, v in ipairs(spec) do
+					values[i - 1] = toNumber(field, v)
+				end
+				rc = C.libmoon_generator_set_values(gen, field.id, values, #spec)
+			end
+			if rc ~= 0 then
+				log:fatal("Invalid values for %s", field.name)
+			end
+		end
+	end
+	local cSizes = ffi.new("uint16_t[?]", #sizes, sizes)
+	local cWeights = weights and ffi.new("uint32_t[?]", #weights, weights)
+	if weights and #weights ~= #sizes then
+		log:fatal("Generator needs one weight per packet size")
+	end
+	if C.libmoon_generator_set_sizes(gen, cSizes, cWeights, #sizes) ~= 0 then
+		log:fatal("Invalid packet sizes, sizes must be between 42 and the maximum size and weights must sum up to at most 4096")
+	end
+	return obj
+end
+
+--- Number of distinct flows (combinations of all field values).
+function generator:getNumFlows()
+	return tonumber(C.libmoon_generator_num_flows(self.gen))
+end
+
+--- Create worker id (starting at 0) of num workers to fill packets in a custom loop.
+--- @param poolSize optional (default = 4095) size of the worker's mempool
+--- @param socket optional (default = current socket) NUMA node of the mempool
+function generator:newWorker(id, num, poolSize, socket)
+	socket = socket or select(2, libmoon.getCore())
+	local w = C.libmoon_generator_worker_create(self.gen, id, num, socket, poolSize or 4095)
+	if w == nil then
+		log:fatal("Could not create generator worker %d/%d", id, num)
+	end
+	return setmetatable({ worker = w, id = id, num = num }, worker)
+end
+
+--- Start one task per tx queue that sends packets until libmoon is stopped.
+--- @param queues list of tx queues
+--- @param args optional table with the named arguments burst (default = 63) and poolSize (default = 4095)
+function generator:startTasks(queues, args)
+	args = args or {}
+	for i, queue in ipairs(queues) do
+		libmoon.startTask("__LM_GENERATOR_TASK", self, queue, i - 1, #queues, args.burst or 63, args.poolSize or 4095)
+	end
+end
+
+function generator:__tostring()
+	return ("[Generator: %d flows]"):format(self:getNumFlows())
+end
+
+function generator:__serialize()
+	return "require 'generator'; return " .. serpent.addMt(serpent.dumpRaw(self), "require('generator').generator"), true
+end
+
+--- Allocate and fill all buffers of a bufArray, the bufArray must not be allocated.
+--- @return number of filled packets, the size of the bufArray or 0 if the worker's mempool does not have enough free buffers
+function worker:fill(bufs)
+	return C.libmoon_generator_worker_fill(self.worker, bufs.array, bufs.size)
+end
+
+--- Generate and send packets until libmoon is stopped.
+--- @return number of sent packets
+function worker:run(queue, burst)
+	return tonumber(C.libmoon_generator_worker_run(self.worker, queue.id, queue.qid, burst or 63))
+end
+
+function worker:delete()
+	C.libmoon_generator_worker_delete(self.worker)
+end
+
+function worker:__tostring()
+	return ("[GeneratorWorker: %d/%d]"):format(self.id, self.num)
+end
+
+__LM_GENERATOR_TASK = function(gen, queue, id, num, burst, poolSize)
+	local w = gen:newWorker(id, num, poolSize)
+	local sent = w:run(queue, burst)
+	log:info("Generator worker %d/%d sent %d packets on %s", id, num, sent, tostring(queue))
+	w:delete()
+end
+
+return mod
@@ -1,10 +1,14 @@
 --- Output data to graphite
+--- mod.newWriter() writes each metric with a blocking write, mod.newBufferedWriter() batches metrics and never blocks.
 local mod = {}
 
-local log = require "log"
-local S   = require "syscall"
-local ffi = require "ffi"
-local C   = ffi.C
+local log     = require "log"
+local S       = require "syscall"
+local ffi     = require "ffi"
+local libmoon = require "libmoon"
+local C       = ffi.C
+
+local band, rshift = bit.band, bit.rshift
 
 ffi.cdef[[
 	struct hostent {
@@ -15,23 +19,30 @@ ffi.cdef[[
 	    uint8_t **h_addr_list;
 	};
 	struct hostent *gethostbyname(const char *name);
-]]
 
-local writer = {}
-writer.__index = writer
+	struct libmoon_metric_sink { };
 
---- Create a new TCP writer that feeds Graphite via the plaintext protocol.
--- @param target, destination host and port
--- @param prefix, prefix that will be prepended to each metric name
-function mod.newWriter(target, prefix)
-	local obj = setmetatable({
-		prefix = prefix
-	}, writer)
-	obj:connect(target)
-	return obj
-end
+	struct libmoon_metric_sink_stats {
+		uint64_t records;
+		uint64_t sent_records;
+		uint64_t sent_bytes;
+		uint64_t dropped_records;
+		uint64_t connects;
+		uint64_t errors;
+		uint32_t queued_records;
+		uint32_t queued_bytes;
+		uint8_t connected;
+	};
 
-function writer:connect(target)
+	struct libmoon_metric_sink* libmoon_metric_sink_create(const char* ip, uint16_t port, uint8_t udp, uint8_t lines, uint32_t max_bytes);
+	void libmoon_metric_sink_delete(struct libmoon_metric_sink* sink);
+	uint32_t libmoon_metric_sink_push(struct libmoon_metric_sink* sink, const char* data, uint32_t len);
+	uint32_t libmoon_metric_sink_flush(struct libmoon_metric_sink* sink, uint64_t now);
+	void libmoon_metric_sink_get_stats(struct libmoon_metric_sink* sink, struct libmoon_metric_sink_stats* stats);
+]]
+
+-- returns ip and port
+local function resolve(target, defaultPort)
 	local host, port, ip
 	if target:match(":") then
 		host, port = target:match("^([^:]+):([^:]+)$")
@@ -46,12 +57,30 @@ function writer:connect(target)
 		ip = host
 	else
 		local hostEnt = C.gethostbyname(host)
-		if not hostEnt or hostEnt.h_length < 1 then
+		if hostEnt == nil or hostEnt.h_length < 1 then
 			log:fatal("could not resolve %s", host)
 		end
 		ip = ("%d.%d.%d.%d"):format(hostEnt.h_addr_list[0][0], hostEnt.h_addr_list[0][1], hostEnt.h_addr_list[0][2], hostEnt.h_addr_list[0][3])
 	end
-	port = tonumber(port or "") or 2003
+	return ip, tonumber(port or "") or defaultPort
+end
+
+local writer = {}
+writer.__index = writer
+
+--- Create a new TCP writer that feeds Graphite via the plaintext protocol.
+-- @param target, destination host and port
+-- @param prefix, prefix that will be prepended to each metric name
+function mod.newWriter(target, prefix)
+	local obj = setmetatable({
+		prefix = prefix
+	}, writer)
+	obj:connect(target)
+	return obj
+end
+
+function writer:connect(target)
+	local ip, port = resolve(target, 2003)
 	self.socket = S.socket("inet", "stream")
 	local sa = S.t.sockaddr_in(port, ip)
 	local ok, err = S.connect(self.socket, sa)
@@ -61,9 +90,9 @@ function writer:connect(target)
 end
 
 --- Write a data point to graphite.
+--- Blocks if the connection is slow and does not reconnect, see mod.newBufferedWriter().
 --- @param metric the metric name to write
 --- @param the value to write
--- TODO: check if socket died and try to reconnect
 function writer:write(metric, value)
 	local str = self.prefix and self.prefix .. "." or ""
 	str = str .. ("%s %.18f %d\n"):format(metric, tonumber(value) or 0, time())
@@ -71,5 +100,187 @@ function writer:write(metric, value)
 end
 
 
+local bufferedWriter = {}
+bufferedWriter.__index = bufferedWriter
+
+local defaultPorts = {
+	plaintext = 2003,
+	pickle = 2004,
+	statsd = 8125
+}
+
+-- StatsD runs over UDP, keep datagrams below the typical MTU
+local MAX_DATAGRAM = 1400
+
+--- Create a writer that batches metrics and sends them without ever blocking the calling task.
+--- Batches are queued in C and sent from a non-blocking socket whenever :write() or :flush() is called
+--- after the flush interval. Lost TCP connections are re-established with exponential backoff (0.5 to 30 seconds),
+--- the oldest batches are dropped if the queue is full while the collector is unreachable.
+--- A batch that was partially sent when the connection broke is continued after reconnecting, without sending lines twice.
+--- Data that was in flight when the connection broke may be lost.
+--- @param target destination host and optional port, default port depends on the protocol
+--- @param args optional table with the following named arguments
+--- @param args.prefix optional prefix that will be prepended to each metric name
+--- @param args.protocol optional (default = "plaintext") "plaintext" (Graphite, TCP), "pickle" (Graphite, TCP),
+---   or "statsd" (gauges, UDP)
+--- @param args.interval optional (default = 1) flush interval in seconds
+--- @param args.batchSize optional (default = 500) maximum number of metrics per batch
+--- @param args.maxBuffer optional (default = 16 MiB) maximum number of queued bytes
+function mod.newBufferedWriter(target, args)
+	args = args or {}
+	local protocol = args.protocol or "plaintext"
+	if not defaultPorts[protocol] then
+		log:fatal("unsupported protocol %s, use plaintext, pickle, or statsd", protocol)
+	end
+	local ip, port = resolve(target, defaultPorts[protocol])
+	local sink = C.libmoon_metric_sink_create(ip, port, protocol == "statsd" and 1 or 0, protocol == "pickle" and 0 or 1, args.maxBuffer or 16 * 1024 * 1024)
+	if sink == nil then
+		log:fatal("could not create metric sink for %s", target)
+	end
+	return setmetatable({
+		sink = ffi.gc(sink, C.libmoon_metric_sink_delete),
+		stats = ffi.new("struct libmoon_metric_sink_stats"),
+		prefix = args.prefix and args.prefix .. "." or "",
+		protocol = protocol,
+		interval = args.interval or 1,
+		batchSize = args.batchSize or 500,
+		nextFlush = 0,
+		names = {},
+		values = {},
+		times = {},
+		count = 0
+	}, bufferedWriter)
+end
+
+local function le32(n)
+	return string.char(band(n, 0xFF), band(rshift(n, 8), 0xFF), band(rshift(n, 16), 0xFF), band(rshift(n, 24), 0xFF))
+end
+
+local function be32(n)
+	return le32(n):reverse()
+end
+
+local doubleBytes = ffi.new("union { double d; uint8_t b[8]; }")
+local function beDouble(d)
+	doubleBytes.d = d
+	local b = doubleBytes.b
+	-- x86 is little endian
+	return string.char(b[7], b[6], b[5], b[4], b[3], b[2], b[1], b[0])
+end
+
+-- pickle protocol 2: a list of (path, (timestamp, value)) tuples, prefixed with the big endian length
+local function encodePickle(self)
+	local parts = { "\128\2(" }
+	for i = 1, self.count do
+		local name = self.names[i]
+		parts[#parts + 1] = "X" .. le32(#name) .. name .. "J" .. le32(self.times[i]) .. "G" .. beDouble(self.values[i]) .. "\134\134"
+	end
+	parts[#parts + 1] = "l."
+	local payload = table.concat(parts)
+	return { be32(#payload) .. payload }
+end
+
+local function encodePlaintext(self)
+	local lines = {}
+	for i = 1, self.count do
+		lines[i] = ("%s %.18f %d\n"):format(self.names[i], self.values[i], self.times[i])
+	end
+	return { table.concat(lines) }
+end
+
+local function encodeStatsd(self)
+	local datagrams = {}
+	local lines, size = {}, 0
+	for i = 1, self.count do
+		local line = ("%s:%s|g\n"):format(self.names[i], self.values[i])
+		if size + #line > MAX_DATAGRAM and #lines > 0 then
+			datagrams[#datagrams + 1] = table.concat(lines)
+			lines, size = {}, 0
+		end
+		lines[#lines + 1] = line
+		size = size + #line
+	end
+	if #lines > 0 then
+		datagrams[#datagrams + 1] = table.concat(lines)
+	end
+	return datagrams
+end
+
+local encoders = {
+	plaintext = encodePlaintext,
+	pickle = encodePickle,
+	statsd = encodeStatsd
+}
+
+-- moves the current batch to the queue in C
+function bufferedWriter:pushBatch()
+	if self.count == 0 then
+		return
+	end
+	for _, record in ipairs(encoders[self.protocol](self)) do
+		C.libmoon_metric_sink_push(self.sink, record, #record)
+	end
+	self.count = 0
+end
+
+--- Queue a data point, never blocks.
+--- @param metric the metric name to write
+--- @param value the value to write
+--- @param timestamp optional (default = now) unix timestamp in seconds, ignored by StatsD
+function bufferedWriter:write(metric, value, timestamp)
+	local i = self.count + 1
+	self.names[i] = self.prefix .. metric
+	self.values[i] = tonumber(value) or 0
+	self.times[i] = math.floor(timestamp or time())
+	self.count = i
+	if i >= self.batchSize then
+		self:pushBatch()
+	end
+	if libmoon.getTime() >= self.nextFlush then
+		self:flush()
+	end
+end
+
+--- Send queued batches without blocking, also (re-)connects if necessary.
+--- Call this regularly if no metrics are written for a while.
+--- @return number of batches that are still queued
+function bufferedWriter:flush()
+	local now = libmoon.getTime()
+	self.nextFlush = now + self.interval
+	self:pushBatch()
+	return C.libmoon_metric_sink_flush(self.sink, now * 1000)
+end
+
+--- Try to send everything that is queued, blocks for up to timeout seconds.
+--- @param timeout optional (default = 1) seconds
+function bufferedWriter:close(timeout)
+	local deadline = libmoon.getTime() + (timeout or 1)
+	while self:flush() > 0 and libmoon.getTime() < deadline do
+		libmoon.sleepMillisIdle(10)
+	end
+	local stats = self:getStats()
+	if stats.queued > 0 or stats.dropped > 0 then
+		log:warn("Graphite writer lost %d batches", stats.queued + stats.dropped)
+	end
+end
+
+--- Get the counters of the writer.
+--- @return table with batches, sent, sentBytes, dropped, connects, errors, queued, queuedBytes, and connected
+function bufferedWriter:getStats()
+	C.libmoon_metric_sink_get_stats(self.sink, self.stats)
+	local s = self.stats
+	return {
+		batches = tonumber(s.records),
+		sent = tonumber(s.sent_records),
+		sentBytes = tonumber(s.sent_bytes),
+		dropped = tonumber(s.dropped_records),
+		connects = tonumber(s.connects),
+		errors = tonumber(s.errors),
+		queued = s.queued_records,
+		queuedBytes = s.queued_bytes,
+		connected = s.connected ~= 0
+	}
+end
+
 return mod
 
@@ -1,14 +1,54 @@
 --- Histogram, typically used for latencies
+--- Backed by a native log-linear (HDR) histogram: recording is O(1) and memory is bounded,
+--- values below 2^precision (default 1024) are stored exactly, larger ones with a relative error below 2^-(precision - 1).
+--- Values are integers (e.g. nanoseconds), fractional parts are truncated.
 
 local histogram = {}
 histogram.__index = histogram
 
-local serpent = require "Serpent"
+local ffi = require "ffi"
 local log = require "log"
 
-function histogram:create()
+ffi.cdef[[
+	struct libmoon_histogram { };
+
+	struct libmoon_histogram_summary {
+		uint64_t count;
+		int64_t sum;
+		int64_t min;
+		int64_t max;
+		double avg;
+		double std_dev;
+	};
+
+	struct libmoon_histogram* libmoon_histogram_create(uint8_t precision);
+	void libmoon_histogram_delete(struct libmoon_histogram* h);
+	void libmoon_histogram_reset(struct libmoon_histogram* h);
+	void libmoon_histogram_record(struct libmoon_histogram* h, int64_t value);
+	void libmoon_histogram_record_n(struct libmoon_histogram* h, int64_t value, uint64_t count);
+	uint8_t libmoon_histogram_get_precision(struct libmoon_histogram* h);
+	uint64_t libmoon_histogram_count(struct libmoon_histogram* h);
+	void libmoon_histogram_get_summary(struct libmoon_histogram* h, struct libmoon_histogram_summary* summary);
+	int64_t libmoon_histogram_percentile(struct libmoon_histogram* h, double percentile);
+	void libmoon_histogram_percentiles(struct libmoon_histogram* h, const double* percentiles, int64_t* results, uint32_t num);
+	uint32_t libmoon_histogram_next_bucket(struct libmoon_histogram* h, uint32_t idx, int64_t* value, uint64_t* count);
+	void libmoon_histogram_merge(struct libmoon_histogram* dst, struct libmoon_histogram* src);
+	size_t libmoon_histogram_serialize(struct libmoon_histogram* h, uint8_t* buf, size_t len);
+	int libmoon_histogram_deserialize(struct libmoon_histogram* h, const uint8_t* buf, size_t len);
+]]
+
+local C = ffi.C
+
+--- Create a new histogram.
+--- @param precision optional number of bits for exactly stored values (2 to 16, default 10)
+---   Memory grows with 2^precision: about 225 kB per histogram at the default of 10 and 12.8 MB at 16.
+function histogram:create(precision)
+	local hist = C.libmoon_histogram_create(precision or 0)
+	if hist == nil then
+		log:fatal("Could not create histogram with precision %s", precision)
+	end
 	local histo = setmetatable({}, histogram)
-	histo.histo = {}
+	histo.hist = ffi.gc(hist, C.libmoon_histogram_delete)
 	histo.dirty = true
 	return histo
 end
@@ -17,90 +57,67 @@ histogram.new = histogram.create
 
 setmetatable(histogram, { __call = histogram.create })
 
+--- Add a value.
+--- Negative values are counted as 0 in the buckets (and therefore in percentiles),
+--- min, average and standard deviation use the actual value.
 function histogram:update(k)
 	if not k then return end
-	self.histo[k] = (self.histo[k] or 0) +1
+	C.libmoon_histogram_record(self.hist, k)
 	self.dirty = true
 end
 
-function histogram:calc()
-	self.sortedHisto = {}
-	self.sum = 0
-	self.numSamples = 0
-
-	for k, v in pairs(self.histo) do
-		table.insert(self.sortedHisto, { k = k, v = v })
-		self.numSamples = self.numSamples + v
-		self.sum = self.sum + k * v
-	end
-	self.avg = self.sum / self.numSamples
-	local stdDevSum = 0
-	for k, v in pairs(self.histo) do
-		stdDevSum = stdDevSum + v * (k - self.avg)^2
-	end
-	self.stdDev = (stdDevSum / (self.numSamples - 1)) ^ 0.5
-
-	table.sort(self.sortedHisto, function(e1, e2) return e1.k < e2.k end)
-	if #self.sortedHisto > 0 then
-		local maxCell = self.sortedHisto[#self.sortedHisto]
-		self.maximum = maxCell.k
-		local minCell = self.sortedHisto[1]
-		self.minimum = minCell.k
-
-		-- TODO: this is obviously not entirely correct for numbers not divisible by 4
-		-- however, it doesn't really matter for the number of samples we usually use
-		local quartSamples = self.numSamples / 4
-
-		self.quarts = {}
-
-		local idx = 0
-		for _, p in ipairs(self.sortedHisto) do
-			-- TODO: inefficient
-			for _ = 1, p.v do
-				if not self.quarts[1] and idx >= quartSamples then
-					self.quarts[1] = p.k
-				elseif not self.quarts[2] and idx >= quartSamples * 2 then
-					self.quarts[2] = p.k
-				elseif not self.quarts[3] and idx >= quartSamples * 3 then
-					self.quarts[3] = p.k
-					break
-				end
-				idx = idx + 1
-			end
-		end
+--- Add a value multiple times, negative values are handled like in update().
+function histogram:updateN(k, n)
+	C.libmoon_histogram_record_n(self.hist, k, n)
+	self.dirty = true
+end
 
-		for i = 1, 3 do
-			if not self.quarts[i] then
-				self.quarts[i] = 0/0
-			end
-		end
+--- Add all samples from another histogram, e.g. from a different task.
+function histogram:merge(other)
+	C.libmoon_histogram_merge(self.hist, other.hist)
+	self.dirty = true
+end
+
+--- Remove all samples.
+function histogram:reset()
+	C.libmoon_histogram_reset(self.hist)
+	self.dirty = true
+end
+
+local summary = ffi.new("struct libmoon_histogram_summary")
+local quartPercentiles = ffi.new("double[3]", 25, 50, 75)
+local quartResults = ffi.new("int64_t[3]")
+
+function histogram:calc()
+	C.libmoon_histogram_get_summary(self.hist, summary)
+	self.numSamples = tonumber(summary.count)
+	self.sum = tonumber(summary.sum)
+	self.avg = summary.avg
+	self.stdDev = summary.std_dev
+	if self.numSamples > 0 then
+		self.minimum = tonumber(summary.min)
+		self.maximum = tonumber(summary.max)
+		C.libmoon_histogram_percentiles(self.hist, quartPercentiles, quartResults, 3)
+		self.quarts = { tonumber(quartResults[0]), tonumber(quartResults[1]), tonumber(quartResults[2]) }
 	else
+		self.minimum = nil
+		self.maximum = nil
 		self.quarts = {0/0, 0/0, 0/0} -- NaN
 	end
-
 	self.dirty = false
 end
 
 --- Calculate the nth percentile
 --- @param percentile (range 0 to 100)
+--- @return the value (middle of the bucket), negative samples are reported as 0
 function histogram:percentile(percentile)
-	if self.dirty then self:calc() end
-
-	if percentile > 100 or percentile < 0 then 
+	if percentile > 100 or percentile < 0 then
 		error("invalid argument")
 	end
-
-	local targetSamples = self.numSamples * percentile / 100
-	local idx = 0
-	for _, p in ipairs(self.sortedHisto) do
-		-- TODO: inefficient
-		for _ = 1, p.v do
-			if idx >= self.numSamples * percentile / 100 then
-				return p.k
-			end
-			idx = idx + 1
-		end
+	if C.libmoon_histogram_count(self.hist) == 0 then
+		return nil
 	end
+	return tonumber(C.libmoon_histogram_percentile(self.hist, percentile))
 end
 
 function histogram:totals()
@@ -117,13 +134,13 @@ end
 
 function histogram:min()
 	if self.dirty then self:calc() end
-	
+
 	return self.minimum
 end
 
 function histogram:max()
 	if self.dirty then self:calc() end
-	
+
 	return self.maximum
 end
 
@@ -135,7 +152,7 @@ end
 
 function histogram:quartiles()
 	if self.dirty then self:calc() end
-	
+
 	return unpack(self.quarts)
 end
 
@@ -145,15 +162,20 @@ function histogram:median()
 	return self.quarts[2]
 end
 
+--- Iterate over all non-empty buckets in ascending order.
+--- Each entry is a table { k = value, v = count }, k is the middle of the bucket.
 function histogram:samples()
-	local i = 0
-	if self.dirty then self:calc() end
-	local n = #self.sortedHisto
+	local idx = 0
+	local value = ffi.new("int64_t[1]")
+	local count = ffi.new("uint64_t[1]")
 	return function()
-		if not self.dirty then
-			i = i + 1
-			if i <= n then return self.sortedHisto[i] end
+		if idx == nil then return end
+		idx = C.libmoon_histogram_next_bucket(self.hist, idx, value, count)
+		if idx == 0 then
+			idx = nil
+			return
 		end
+		return { k = tonumber(value[0]), v = tonumber(count[0]) }
 	end
 end
 
@@ -165,14 +187,13 @@ function histogram:print(prefix)
 end
 
 function histogram:save(file)
-	if self.dirty then self:calc() end
 	local close = false
 	if type(file) ~= "userdata" then
 		log:info("Saving histogram to '%s'", file)
 		file = io.open(file, "w+")
 		close = true
 	end
-	for i, v in ipairs(self.sortedHisto) do
+	for v in self:samples() do
 		file:write(("%s,%s\n"):format(v.k, v.v))
 	end
 	if close then
@@ -180,10 +201,26 @@ function histogram:save(file)
 	end
 end
 
+--- Get a compact binary representation of the histogram, see histogram.deserialize().
+function histogram:serialize()
+	local size = C.libmoon_histogram_serialize(self.hist, nil, 0)
+	local buf = ffi.new("uint8_t[?]", size)
+	C.libmoon_histogram_serialize(self.hist, buf, size)
+	return ffi.string(buf, size)
+end
+
+--- Create a histogram from the output of histogram:serialize().
+function histogram.deserialize(data)
+	-- precision is stored after the magic and version
+	local histo = histogram:create(data:byte(6))
+	if C.libmoon_histogram_deserialize(histo.hist, data, #data) ~= 0 then
+		log:fatal("Invalid serialized histogram")
+	end
+	return histo
+end
 
 function histogram:__serialize()
-	return "require 'histogram'; return " .. serpent.addMt(serpent.dumpRaw(self), "require('histogram')"), true
+	return ("require 'histogram'; return require('histogram').deserialize(%q)"):format(self:serialize()), true
 end
 
 return histogram
-
@@ -0,0 +1,236 @@
+---------------------------------
+--- @file hsscanner.lua
+--- @brief Native Hyperscan scanning of whole bursts, matches are recorded in C without calling back into Lua.
+--- Requires libmoon to be built with Hyperscan (cmake finds it automatically), e.g.
+---   local hs = require "hs"
+---   local db = hs.init(hs.HS_MODE_BLOCK, hs.parse_from_file("patterns.txt"))
+---   local scanner = hsscanner.newScanner(db)
+---   local matches = scanner:scanBurst(bufs, rx)
+---   for i = 1, rx do if scanner:matches(i) then ... end end
+--- Each lcore uses its own copy of the scratch space, a scanner can be shared by all tasks.
+--- Stream tables (mod.newStreamTable()) keep a Hyperscan stream per TCP/UDP flow to find matches that span packets.
+---------------------------------
+
+local ffi     = require "ffi"
+local log     = require "log"
+local serpent = require "Serpent"
+local libmoon = require "libmoon"
+
+ffi.cdef[[
+	struct libmoon_hs_scanner { };
+
+	struct libmoon_hs_scanner* libmoon_hs_scanner_create(const struct hs_database* db);
+	void libmoon_hs_scanner_delete(struct libmoon_hs_scanner* scanner);
+	int32_t libmoon_hs_scan_burst(struct libmoon_hs_scanner* scanner, struct rte_mbuf** bufs, uint32_t num_bufs, uint32_t offset, uint64_t* mask, uint32_t* ids, uint64_t* counts, uint32_t max_id, uint8_t all_matches);
+	uint64_t libmoon_hs_scanner_errors(struct libmoon_hs_scanner* scanner);
+
+	struct libmoon_hs_stream_table { };
+
+	struct libmoon_hs_stream_stats {
+		uint64_t flows;
+		uint64_t closed;
+		uint64_t expired;
+		uint64_t evicted;
+		uint64_t matches;
+		uint64_t errors;
+		uint32_t active_flows;
+		uint32_t state_size;
+	};
+
+	struct libmoon_hs_stream_table* libmoon_hs_stream_table_create(const struct hs_database* db, uint32_t max_flows, uint32_t timeout, uint32_t state_size, int socket);
+	void libmoon_hs_stream_table_delete(struct libmoon_hs_stream_table* table);
+	int32_t libmoon_hs_stream_scan_burst(struct libmoon_hs_stream_table* table, struct rte_mbuf** bufs, uint32_t num_bufs, uint32_t now, uint64_t* mask, uint32_t* ids);
+	uint32_t libmoon_hs_stream_table_expire(struct libmoon_hs_stream_table* table, uint32_t now);
+	void libmoon_hs_stream_table_get_stats(struct libmoon_hs_stream_table* table, struct libmoon_hs_stream_stats* stats);
+]]
+
+local C = ffi.C
+local band, rshift = bit.band, bit.rshift
+
+local mod = {}
+
+-- requiring hs loads libhs.so and throws if Hyperscan is not installed, so it is only loaded on first use
+local hsLoaded
+
+--- Check if Hyperscan is installed and libmoon was built with Hyperscan support.
+function mod.isAvailable()
+	if hsLoaded == nil then
+		hsLoaded = (pcall(require, "hs"))
+	end
+	return hsLoaded and (pcall(function() return C.libmoon_hs_scanner_create end))
+end
+
+local scanner = {}
+scanner.__index = scanner
+mod.scanner = scanner
+
+--- Create a scanner for a block mode database.
+--- @param db the database, e.g. from hs.init(), must stay valid while the scanner is used
+--- @param args optional table with the following named arguments
+--- @param args.offset optional (default = 0) skip this many bytes at the start of each packet, e.g. headers
+--- @param args.allMatches optional (default = false) keep scanning a packet after its first match, only useful with counts
+--- @param args.maxId optional (default = no counters) count matches per pattern id up to this id
+function mod.newScanner(db, args)
+	if not mod.isAvailable() then
+		log:fatal("Hyperscan is not available, install it and rebuild libmoon")
+	end
+	args = args or {}
+	local s = C.libmoon_hs_scanner_create(db)
+	if s == nil then
+		log:fatal("Could not allocate Hyperscan scratch space")
+	end
+	return setmetatable({
+		scanner = s,
+		db = db,
+		offset = args.offset or 0,
+		allMatches = args.allMatches or false,
+		maxId = args.maxId
+	}, scanner)
+end
+
+function scanner:allocResults(n)
+	if not self.mask or self.resultSize < n then
+		self.resultSize = n
+		self.mask = ffi.new("uint64_t[?]", math.ceil(n / 64))
+		self.ids = ffi.new("uint32_t[?]", n)
+	end
+	if self.maxId and not self.counts then
+		self.counts = ffi.new("uint64_t[?]", self.maxId + 1)
+	end
+end
+
+--- Scan a burst of packets.
+--- @param bufs the bufArray
+--- @param n number of packets
+--- @return number of matching packets
+function scanner:scanBurst(bufs, n)
+	self:allocResults(math.max(n, bufs.size))
+	local matches = C.libmoon_hs_scan_burst(self.scanner, bufs.array, n, self.offset, self.mask, self.ids, self.counts, self.maxId or 0, self.allMatches and 1 or 0)
+	if matches < 0 then
+		log:fatal("Hyperscan scanner used from a thread that is not an lcore")
+	end
+	return matches
+end
+
+--- Check if a packet matched in the last call to :scanBurst().
+--- @param i 1-based index of the packet in the bufArray
+function scanner:matches(i)
+	i = i - 1
+	return band(rshift(self.mask[rshift(i, 6)], band(i, 63)), 1ULL) ~= 0
+end
+
+--- Get the id of the first pattern that matched a packet in the last call to :scanBurst().
+--- @param i 1-based index of the packet in the bufArray
+--- @return the id or nil
+function scanner:getMatchId(i)
+	local id = self.ids[i - 1]
+	return id ~= 0xFFFFFFFF and id or nil
+end
+
+--- Get the number of matches of a pattern since the scanner was created (or passed to this task).
+--- Requires args.maxId.
+function scanner:getCount(id)
+	return self.counts and tonumber(self.counts[id]) or 0
+end
+
+--- Get the number of failed scans of all tasks.
+function scanner:getErrors()
+	return tonumber(C.libmoon_hs_scanner_errors(self.scanner))
+end
+
+--- Free the scanner, must not be used by any task at this point. Does not free the database.
+function scanner:destroy()
+	C.libmoon_hs_scanner_delete(self.scanner)
+	self.scanner = nil
+end
+
+function scanner:__tostring()
+	return ("[HyperscanScanner: offset %d]"):format(self.offset)
+end
+
+function scanner:__serialize()
+	-- results are per task
+	local obj = { scanner = self.scanner, db = self.db, offset = self.offset, allMatches = self.allMatches, maxId = self.maxId }
+	return "require 'hsscanner'; return " .. serpent.addMt(serpent.dumpRaw(obj), "require('hsscanner').scanner"), true
+end
+
+local streamTable = {}
+streamTable.__index = streamTable
+mod.streamTable = streamTable
+
+-- ticks are milliseconds, same as in flowtable.lua
+local function now()
+	return math.floor(libmoon.getTime() * 1000) % 2^32
+end
+
+--- Create a table of per-flow streams, scans the TCP/UDP payload of each packet in the context of its flow.
+--- Streams are opened on the first packet of a flow and closed on TCP FIN/RST. Their state is stored compressed,
+--- the least recently used flow is evicted if the table is full.
+--- A table must only be used by one task, create one table per core.
+--- @param args table with the following named arguments
+--- @param args.db database compiled with hs.HS_MODE_STREAM, must stay valid while the table is used
+--- @param args.size maximum number of flows
+--- @param args.timeout optional (default = 30) remove flows that were not seen for this many seconds
+--- @param args.stateSize optional (default = uncompressed stream size) bytes reserved per flow,
+---   flows whose compressed state is larger are restarted
+--- @param args.socket optional (default = socket of the calling thread) NUMA socket
+function mod.newStreamTable(args)
+	if not mod.isAvailable() then
+		log:fatal("Hyperscan is not available, install it and rebuild libmoon")
+	end
+	local timeout = math.max(math.floor((args.timeout or 30) * 1000), 1)
+	local t = C.libmoon_hs_stream_table_create(args.db, args.size, timeout, args.stateSize or 0, args.socket or select(2, libmoon.getCore()))
+	if t == nil then
+		log:fatal("Could not create stream table with %s flows, is the database compiled in stream mode?", args.size)
+	end
+	return setmetatable({ table = t, stats = ffi.new("struct libmoon_hs_stream_stats") }, streamTable)
+end
+
+streamTable.allocResults = scanner.allocResults
+streamTable.matches = scanner.matches
+streamTable.getMatchId = scanner.getMatchId
+
+--- Scan a burst of packets.
+--- @param bufs the bufArray
+--- @param n number of packets
+--- @return number of packets that raised a match
+function streamTable:scanBurst(bufs, n)
+	self:allocResults(math.max(n, bufs.size))
+	return C.libmoon_hs_stream_scan_burst(self.table, bufs.array, n, now(), self.mask, self.ids)
+end
+
+--- Remove flows that timed out, call this regularly.
+--- @return number of removed flows
+function streamTable:expire()
+	return C.libmoon_hs_stream_table_expire(self.table, now())
+end
+
+--- Get the counters of the table.
+--- @return table with flows, closed, expired, evicted, matches, errors, activeFlows, and memory (bytes of stream state)
+function streamTable:getStats()
+	C.libmoon_hs_stream_table_get_stats(self.table, self.stats)
+	local s = self.stats
+	return {
+		flows = tonumber(s.flows),
+		closed = tonumber(s.closed),
+		expired = tonumber(s.expired),
+		evicted = tonumber(s.evicted),
+		matches = tonumber(s.matches),
+		errors = tonumber(s.errors),
+		activeFlows = s.active_flows,
+		memory = s.active_flows * s.state_size
+	}
+end
+
+--- Free the table.
+function streamTable:destroy()
+	C.libmoon_hs_stream_table_delete(self.table)
+	self.table = nil
+end
+
+function streamTable:__tostring()
+	local stats = self:getStats()
+	return ("[HyperscanStreamTable: %d active flows]"):format(stats.activeFlows)
+end
+
+return mod
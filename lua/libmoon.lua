@@ -115,6 +115,14 @@ function task:isRunning()
 	return dpdkc.rte_eal_get_lcore_state(self.core) == dpdkc.RUNNING
 end
 
+--- Request this task to stop, libmoon.running() returns false in the task afterwards while other tasks keep running.
+--- @param delay optional (default = 0) delay in milliseconds
+--- @return false if the task already finished
+function task:stop(delay)
+	checkCore()
+	return dpdkc.libmoon_stop_task(self.core, self.id, delay or 0) == 0
+end
+
 local function findDevices(result, ...)
 	if select("#", ...) <= 1 then
 		local arg = ...
@@ -205,6 +213,7 @@ function mod.startTaskOnCore(core, ...)
 	local args = serpent.dump({ task.id, ... })
 	local buf = ffi.new("char[?]", #args + 1)
 	ffi.copy(buf, args)
+	dpdkc.libmoon_init_task_token(core, task.id)
 	dpdkc.launch_lua_core(core, buf)
 	return task
 end
@@ -263,10 +272,24 @@ function mod.setRuntime(time)
 	dpdkc.set_runtime(time * 1000)
 end
 
---- Returns false once the app receives SIGTERM or SIGINT, the time set via setRuntime expires, or when a thread calls libmoon.stop().
+-- stop token of the current task, all tokens are stopped when the whole app stops
+local stopToken
+
+--- Returns false once the app receives SIGTERM or SIGINT, the time set via setRuntime expires, when a thread calls libmoon.stop(),
+--- or when the master stops the current task via task:stop().
+--- Without extraTime this is a single load that is compiled inline, it is cheap enough to be called for every batch.
 -- @param extraTime additional time in milliseconds before false will be returned (e.g. to keep an rx task running longer than a tx task in a loopback test)
 function mod.running(extraTime)
-	return dpdkc.is_running(extraTime or 0) == 1 -- luajit-2.0.3 does not like bool return types (TRACE NYI: unsupported C function type)
+	if not extraTime or extraTime == 0 then
+		stopToken = stopToken or dpdkc.libmoon_get_stop_token(dpdkc.get_current_core())
+		return stopToken.stop == 0
+	end
+	return dpdkc.is_running(extraTime) == 1 -- luajit-2.0.3 does not like bool return types (TRACE NYI: unsupported C function type)
+end
+
+--- Returns false once the whole app was stopped, ignores task:stop() for the current task.
+function mod.appRunning()
+	return dpdkc.libmoon_get_stop_token(-1).stop == 0
 end
 
 --- request all tasks to exit
@@ -1,10 +1,26 @@
 ---------------------------------
 --- @file log.lua
 --- @brief Logging module.
+--- Messages for the log file are passed as format id and arguments to a per-core ring in C,
+--- a background thread formats and writes them. Filtered messages are not formatted at all.
 --- @todo Docu
 ---------------------------------
 require "utils"
 
+local ffi = require "ffi"
+
+ffi.cdef[[
+	extern volatile uint8_t libmoon_log_file_level;
+	uint32_t libmoon_log_register_format(const char* format);
+	void libmoon_log_write(uint8_t level, uint32_t format, uint32_t num_args, const double* nums, const char* const* strs);
+	int libmoon_log_start(const char* path);
+	void libmoon_log_set_file_level(uint8_t level);
+	void libmoon_log_flush();
+	uint64_t libmoon_log_dropped();
+]]
+
+local C = ffi.C
+
 local log = {}
 
 ------------------------------------------------------
@@ -48,19 +64,29 @@ end
 ---- File Logging
 ----------------------------------------------------
 
--- en- or disable file logging
-log.fileEnabled = false
+-- file level used by the C side if file logging is disabled, shared by all tasks
+local NO_LEVEL = 0xFF
+local MAX_ARGS = 8
+
+--- Check if logging to file is enabled, this is a global setting for all tasks.
+function log:fileEnabled()
+	return C.libmoon_log_file_level ~= NO_LEVEL
+end
 
 --- Enable logging to file
 function log:fileEnable()
-	self.fileEnabled = true
+	if C.libmoon_log_start(self.file) ~= 0 then
+		self:warn("Could not open log file '%s'", self.file)
+		return
+	end
+	C.libmoon_log_set_file_level(self.fileLevel)
 	self:info("Enabled logging to '" .. log.file .. "'")
 end
 
 --- Disable logging to file
 function log:fileDisable()
-	self.fileEnabled = false
-	self:info("Disabled logging to " .. log.file .. "'")
+	C.libmoon_log_set_file_level(NO_LEVEL)
+	self:info("Disabled logging to '" .. log.file .. "'")
 end
 
 -- current file log level 
@@ -69,7 +95,10 @@ log.fileLevel = log.DEBUG
 --- Set the file log level.
 --- @param level Set file log level to level. Default: DEBUG
 function log:setFileLevel(level)
-	self.fileLevel = self.level or self.DEBUG	
+	self.fileLevel = self[level] or self.DEBUG
+	if self:fileEnabled() then
+		C.libmoon_log_set_file_level(self.fileLevel)
+	end
 end
 
 --- path to log file
@@ -101,12 +130,63 @@ do
 	-- print("Logging to " .. log.file)
 end
 
+-- format ids are registered once per task
+local formatIds = {}
+local nums = ffi.new("double[?]", MAX_ARGS)
+local strs = ffi.new("const char*[?]", MAX_ARGS)
+-- keeps converted arguments alive until they are copied to the ring
+local anchors = {}
+
+local function formatId(fmt)
+	local id = formatIds[fmt]
+	if not id then
+		id = C.libmoon_log_register_format(fmt)
+		formatIds[fmt] = id
+	end
+	return id
+end
+
+local function writeRecord(level, fmt, ...)
+	local id = formatId(fmt)
+	local n = select("#", ...)
+	if id == 0xFFFFFFFF or n > MAX_ARGS then
+		-- too many distinct formats or arguments, format here instead
+		anchors[1] = fmt:format(...)
+		strs[0] = anchors[1]
+		C.libmoon_log_write(level, formatId("%s"), 1, nums, strs)
+		return
+	end
+	for i = 1, n do
+		local arg = select(i, ...)
+		-- 64 bit cdata integers are passed as numbers
+		arg = type(arg) == "cdata" and tonumber(arg) or arg
+		if type(arg) == "number" then
+			nums[i - 1] = arg
+			strs[i - 1] = nil
+		else
+			anchors[i] = type(arg) == "string" and arg or tostring(arg)
+			strs[i - 1] = anchors[i]
+		end
+	end
+	C.libmoon_log_write(level, id, n, nums, strs)
+end
+
 --- Write a message to the log file specified in log.file
+--- The message is written asynchronously, see log:flush().
 --- @param str Log message.
 function log:writeToLog(str)
-	local f = assert(io.open(self.file, "a"))
-	f:write(getTimeMicros() .. " "  .. str .. "\n")
-	f:close()
+	C.libmoon_log_start(self.file)
+	writeRecord(NO_LEVEL, "%s", str)
+end
+
+--- Wait until all messages logged by this task are written to the log file.
+function log:flush()
+	C.libmoon_log_flush()
+end
+
+--- Get the number of messages that were not written because a log ring was full.
+function log:getDropped()
+	return tonumber(C.libmoon_log_dropped())
 end
 
 
@@ -120,27 +200,24 @@ end
 --- @param str Log message
 --- @param args Formatting parameters
 function log:fatal(str, ...)
-	str = str:format(...)
-		
-	if self.fileEnabled then
-		self:writeToLog("[FATAL] " .. str)
+	if self.FATAL >= C.libmoon_log_file_level then
+		writeRecord(self.FATAL, str, ...)
+		C.libmoon_log_flush()
 	end
 	
-	error(red(str), 2)
+	error(red(str:format(...)), 2)
 end
 
 --- Log a message, level ERROR.
 --- @param str Log message
 --- @param args Formatting parameters
 function log:error(str, ...)
-	str = "[ERROR] " .. str:format(...)
-		
 	if self.ERROR >= self.level then
-		print(bred("%s", str))
+		print(bred("%s", "[ERROR] " .. str:format(...)))
 	end	
 
-	if self.fileEnabled and self.ERROR >= self.fileLevel then
-		self:writeToLog(str)
+	if self.ERROR >= C.libmoon_log_file_level then
+		writeRecord(self.ERROR, str, ...)
 	end
 end
 
@@ -148,14 +225,12 @@ end
 --- @param str Log message
 --- @param args Formatting parameters
 function log:warn(str, ...)
-	str = "[WARN]  " .. str:format(...)
-		
 	if self.WARN >= self.level then
-		print(yellow("%s", str))
+		print(yellow("%s", "[WARN]  " .. str:format(...)))
 	end	
 
-	if self.fileEnabled and self.WARN >= self.fileLevel then
-		self:writeToLog(str)
+	if self.WARN >= C.libmoon_log_file_level then
+		writeRecord(self.WARN, str, ...)
 	end
 end
 
@@ -163,14 +238,12 @@ end
 --- @param str Log message
 --- @param args Formatting parameters
 function log:info(str, ...)
-	str = "[INFO]  " .. str:format(...)
-		
 	if self.INFO >= self.level then
-		print(white("%s", str))
+		print(white("%s", "[INFO]  " .. str:format(...)))
 	end	
 
-	if self.fileEnabled and self.INFO >= self.fileLevel then
-		self:writeToLog(str)
+	if self.INFO >= C.libmoon_log_file_level then
+		writeRecord(self.INFO, str, ...)
 	end
 end
 
@@ -178,14 +251,12 @@ end
 --- @param str Log message
 --- @param args Formatting parameters
 function log:debug(str, ...)
-	str = "[DEBUG] " .. str:format(...)
-		
 	if self.DEBUG >= self.level then
-		print(green("%s", str))
+		print(green("%s", "[DEBUG] " .. str:format(...)))
 	end	
 
-	if self.fileEnabled and self.DEBUG >= self.fileLevel then
-		self:writeToLog(str)
+	if self.DEBUG >= C.libmoon_log_file_level then
+		writeRecord(self.DEBUG, str, ...)
 	end
 end
 
@@ -92,10 +92,13 @@ local function master(_, file, ...)
 		if not dpdk.init() then
 			log:fatal("Could not initialize DPDK")
 		end
+		dpdkc.libmoon_core_stats_task_start("master")
 	end
 	local result = xpcall(_G.master, getStackTrace, unpack(concatArrays(parsedArgs, args)))
 	-- stop devices if necessary (seems to be a problem with virtio attached via vhost user
 	device.cleanupDevices()
+	-- the log file is written asynchronously
+	log:flush()
 	-- exit program once the master task finishes
 	if not result then
 		os.exit(result)
@@ -125,12 +128,13 @@ local function slave(args)
 	--require("jit.dump").on()
 	LIBMOON_TASK_NAME = func
 	LIBMOON_TASK_ID = taskId
+	dpdkc.libmoon_core_stats_task_start(func)
 	local results = { select(2, xpcall(_G[func], getStackTrace, select(3, unpackAll(args)))) }
 	local vals = serpent.dump(results)
 	local buf = ffi.new("char[?]", #vals + 1)
 	ffi.copy(buf, vals)
 	ffi.C.task_store_result(taskId, buf)
-	if libmoon.running() then
+	if libmoon.appRunning() then
 		local ok, err = pcall(device.reclaimTxBuffers)
 		if ok then
 			memory.freeMemPools()
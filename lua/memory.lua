@@ -250,6 +250,13 @@ function mempool:alloc(l)
 	return r
 end
 
+--- Allocate a packet of size l, packets larger than a buffer of this mempool are chained.
+--- @return the mbuf or nil if the mempool is exhausted
+function mempool:allocChain(l)
+	local r = dpdkc.alloc_mbuf_chain(self, l)
+	return r ~= nil and r or nil
+end
+
 local bufArray = {}
 
 --- Create a new array of memory buffers (initialized to nil).
@@ -401,32 +408,55 @@ function bufArray:allocN(size, num)
 	dpdkc.alloc_mbufs(self.mem, self.array, self.size, size)
 end
 
+--- Allocates buffers from the memory pool and fills the array.
+--- Packets larger than a buffer of the memory pool are allocated as chains of mbufs, requires a device configured with multiSegTx.
+--- @param size	Size of every packet
+--- @return the number of allocated packets, less than the array size if the memory pool is exhausted
+function bufArray:allocChains(size)
+	return dpdkc.alloc_mbuf_chains(self.mem, self.array, self.size, size)
+end
+
+--- Copy chained packets into a single buffer, required for functions that access the packet data directly.
+--- @param n optional (default = bufArray.size) number of packets to linearize
+--- @return true if all packets fit into a single buffer
+function bufArray:linearize(n)
+	return dpdkc.linearize_mbufs(self.array, n or self.size) == 0
+end
+
+--- Count the segments of the first n packets.
+function bufArray:countSegments(n)
+	local segs = 0
+	for i = 0, (n or self.size) - 1 do
+		if self.array[i] ~= nil then
+			segs = segs + self.array[i].nb_segs
+		end
+	end
+	return segs
+end
+
 --- Free all buffers in the array. Stops when it encounters the first one that is null.
 function bufArray:freeAll()
+	local n = self.size
 	for i = 0, self.size - 1 do
 		if self.array[i] == nil then
-			return
+			n = i
+			break
 		end
-		dpdkc.rte_pktmbuf_free_export(self.array[i])
-		self.array[i] = nil
 	end
+	dpdkc.free_mbufs(self.array, n)
+	ffi.fill(self.array, n * ffi.sizeof("struct rte_mbuf*"))
 end
 
 --- Free the first n buffers.
+--- All buffers are freed with a single call, segments are returned to their mempools in bulk.
 function bufArray:free(n)
-	for i = 0, n - 1 do
-		if self.array[i] ~= nil then
-			dpdkc.rte_pktmbuf_free_export(self.array[i])
-		end
-	end
+	dpdkc.free_mbufs(self.array, n)
 end
 
 --- Free the all buffers after index n.
 function bufArray:freeAfter(n)
-	for i = n, self.size - 1 do
-		if self.array[i] ~= nil then
-			dpdkc.rte_pktmbuf_free_export(self.array[i])
-		end
+	if n < self.size then
+		dpdkc.free_mbufs(self.array + n, self.size - n)
 	end
 end
 
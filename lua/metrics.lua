@@ -0,0 +1,139 @@
+---------------------------------
+--- @file metrics.lua
+--- @brief Native Prometheus/OpenMetrics exporter running on a shared core.
+--- Device, queue, extended (xstats), and core counters are read directly from DPDK and C when a scrape arrives,
+--- nothing passes through Lua or a pipe, e.g.
+---   local exporter = metrics.newExporter{port = 9100}
+---   exporter:addDevice(dev)
+---   exporter:addCoreStats()
+---   exporter:addHistogram("libmoon_latency_seconds", hist, 1e-9, "Round trip latency")
+---   exporter:startTask()
+--- Metrics can also be added after the task was started.
+---------------------------------
+
+local ffi     = require "ffi"
+local log     = require "log"
+local serpent = require "Serpent"
+local libmoon = require "libmoon"
+require "histogram"
+
+ffi.cdef[[
+	struct libmoon_metrics_exporter { };
+
+	struct libmoon_metrics_exporter* libmoon_metrics_exporter_create(const char* bind_addr, uint16_t port);
+	void libmoon_metrics_exporter_delete(struct libmoon_metrics_exporter* exporter);
+	int libmoon_metrics_exporter_add_device(struct libmoon_metrics_exporter* exporter, uint8_t port_id);
+	void libmoon_metrics_exporter_add_core_stats(struct libmoon_metrics_exporter* exporter);
+	int libmoon_metrics_exporter_add_counter(struct libmoon_metrics_exporter* exporter, const char* name, const char* help, const char* labels, const volatile uint64_t* value, uint8_t is_gauge);
+	int libmoon_metrics_exporter_add_histogram(struct libmoon_metrics_exporter* exporter, const char* name, const char* help, struct libmoon_histogram* histogram, double scale);
+	int libmoon_metrics_exporter_poll(struct libmoon_metrics_exporter* exporter, int timeout_ms);
+	uint32_t libmoon_metrics_exporter_render(struct libmoon_metrics_exporter* exporter, char* buf, uint32_t len);
+]]
+
+local C = ffi.C
+
+local mod = {}
+
+local exporter = {}
+exporter.__index = exporter
+mod.exporter = exporter
+
+--- Create an exporter listening for scrapes on /metrics.
+--- @param args optional table with the following named arguments
+--- @param args.port optional (default = 9100) TCP port
+--- @param args.bind optional (default = all addresses) IPv4 address to listen on
+function mod.newExporter(args)
+	args = args or {}
+	local port = args.port or 9100
+	local e = C.libmoon_metrics_exporter_create(args.bind, port)
+	if e == nil then
+		log:fatal("Could not listen on %s:%d for the metrics exporter", args.bind or "*", port)
+	end
+	return setmetatable({ exporter = e, port = port }, exporter)
+end
+
+--- Export the port, per-queue, and extended stats of a device.
+function exporter:addDevice(dev)
+	if C.libmoon_metrics_exporter_add_device(self.exporter, dev.id) ~= 0 then
+		log:fatal("Could not add device %d to the metrics exporter", dev.id)
+	end
+	return self
+end
+
+--- Export the cycle accounting of all cores running tasks, see stats.setCoreAccounting().
+function exporter:addCoreStats()
+	C.libmoon_metrics_exporter_add_core_stats(self.exporter)
+	return self
+end
+
+--- Export a native 64 bit counter, e.g. a field of a struct updated by a task.
+--- @param name metric name, counters get a _total suffix
+--- @param ptr uint64_t* that must stay valid while the exporter is running
+--- @param args optional table with the following named arguments
+--- @param args.labels optional preformatted labels, e.g. 'queue="1"'
+--- @param args.help optional description
+--- @param args.gauge optional (default = false) export as gauge instead of counter
+function exporter:addCounter(name, ptr, args)
+	args = args or {}
+	if C.libmoon_metrics_exporter_add_counter(self.exporter, name, args.help, args.labels, ptr, args.gauge and 1 or 0) ~= 0 then
+		log:fatal("Too many counters in the metrics exporter")
+	end
+	return self
+end
+
+--- Export a histogram, buckets are powers of two of the recorded unit.
+--- The histogram is read while it is updated, it must not be garbage collected while the exporter is running.
+--- @param name metric name
+--- @param hist histogram object, cf. histogram.lua
+--- @param scale optional (default = 1) factor to convert values to the unit of the metric, e.g. 1e-9 for ns to seconds
+--- @param help optional description
+function exporter:addHistogram(name, hist, scale, help)
+	if C.libmoon_metrics_exporter_add_histogram(self.exporter, name, help, hist.hist, scale or 1) ~= 0 then
+		log:fatal("Too many histograms in the metrics exporter")
+	end
+	return self
+end
+
+--- Get all metrics as OpenMetrics text, mainly useful for debugging.
+function exporter:render()
+	local size = 65536
+	while true do
+		local buf = ffi.new("char[?]", size)
+		local len = C.libmoon_metrics_exporter_render(self.exporter, buf, size)
+		if len <= size then
+			return ffi.string(buf, len)
+		end
+		-- metrics may have been added in the meantime, retry with some headroom
+		size = len * 2
+	end
+end
+
+--- Serve scrapes, blocks until libmoon is stopped.
+function exporter:run()
+	log:info("Serving metrics on port %d", self.port)
+	while libmoon.running() do
+		if C.libmoon_metrics_exporter_poll(self.exporter, 100) < 0 then
+			log:error("Metrics exporter failed to poll its socket")
+			break
+		end
+	end
+end
+
+--- Start a shared task that serves scrapes.
+function exporter:startTask()
+	libmoon.startSharedTask("__LM_METRICS_TASK", self)
+end
+
+function exporter:__tostring()
+	return ("[MetricsExporter: port %d]"):format(self.port)
+end
+
+function exporter:__serialize()
+	return "require 'metrics'; return " .. serpent.addMt(serpent.dumpRaw(self), "require('metrics').exporter"), true
+end
+
+__LM_METRICS_TASK = function(e)
+	e:run()
+end
+
+return mod
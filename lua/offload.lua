@@ -0,0 +1,317 @@
+---------------------------------
+--- @file offload.lua
+--- @brief Flow rule manager based on rte_flow with a software fallback.
+--- Rules are given in a compact syntax, e.g.
+---   "ipv4 udp dst 10.0.0.0/8 dport 53 -> queue 2 count"
+---   "ipv6 tcp src fe80::/64 -> drop count"
+---   "ipv4 src 10.1.0.1 prio 1 -> mark 42"
+--- Match fields: ipv4, ipv6, tcp, udp, proto <n>, src <ip>[/prefix], dst <ip>[/prefix],
+--- sport <port>[/mask], dport <port>[/mask], prio <n> (lower values are matched first).
+--- Actions: queue <n>, drop, mark <id>, count (attach a packet counter).
+---
+--- Rules rejected by the NIC are emulated in software if the manager is created with software fallback:
+--- call manager:process(bufs, n) on received packets to apply them. Software drop rules free the packets,
+--- mark and queue rules set the fdir id in the mbuf (buf.hash.fdir.hi) as queue steering is impossible after reception.
+---------------------------------
+
+local ffi     = require "ffi"
+local log     = require "log"
+local serpent = require "Serpent"
+local device  = require "device"
+
+ffi.cdef[[
+	struct libmoon_flow_rule {
+		uint8_t ip_version;
+		uint8_t proto;
+		uint8_t action;
+		uint8_t count;
+		uint16_t queue;
+		uint16_t priority;
+		uint32_t mark;
+		uint16_t src_port;
+		uint16_t src_port_mask;
+		uint16_t dst_port;
+		uint16_t dst_port_mask;
+		uint8_t src_ip[16];
+		uint8_t src_ip_mask[16];
+		uint8_t dst_ip[16];
+		uint8_t dst_ip_mask[16];
+	};
+
+	struct libmoon_flow_manager { };
+
+	struct libmoon_flow_manager* libmoon_flow_manager_create(uint8_t port);
+	void libmoon_flow_manager_delete(struct libmoon_flow_manager* mgr);
+	uint32_t libmoon_flow_manager_add(struct libmoon_flow_manager* mgr, const struct libmoon_flow_rule* rules, uint32_t num_rules, int32_t* ids, uint8_t allow_sw);
+	uint32_t libmoon_flow_manager_remove(struct libmoon_flow_manager* mgr, const int32_t* ids, uint32_t num_ids);
+	int libmoon_flow_manager_is_offloaded(struct libmoon_flow_manager* mgr, int32_t id);
+	int libmoon_flow_manager_query(struct libmoon_flow_manager* mgr, int32_t id, uint64_t* pkts, uint64_t* bytes);
+	uint32_t libmoon_flow_manager_last_error(struct libmoon_flow_manager* mgr, char* buf, uint32_t len);
+	uint32_t libmoon_flow_manager_num_sw_rules(struct libmoon_flow_manager* mgr);
+	uint16_t libmoon_flow_manager_process(struct libmoon_flow_manager* mgr, struct rte_mbuf** bufs, uint16_t num_bufs);
+]]
+
+local C = ffi.C
+local band, rshift, lshift = bit.band, bit.rshift, bit.lshift
+
+local mod = {}
+
+-- must match flow_offload.h
+local ACTION_QUEUE = 0
+local ACTION_DROP  = 1
+local ACTION_MARK  = 2
+
+local IPPROTO_TCP = 6
+local IPPROTO_UDP = 17
+
+-- writes address and prefix mask in network byte order
+local function parseAddress(str, rule, addrField, maskField, lineForError)
+	local addr, prefix = str:match("^([^/]+)/?(%d*)$")
+	if not addr then
+		log:fatal("Invalid address %s in rule '%s'", str, lineForError)
+	end
+	local bytes = {}
+	local ip4 = parseIP4Address(addr)
+	if ip4 then
+		for i = 0, 3 do
+			bytes[i + 1] = band(rshift(ip4, 24 - i * 8), 0xFF)
+		end
+	else
+		local ip6 = parseIP6Address(addr) or log:fatal("Invalid address %s in rule '%s'", str, lineForError)
+		-- libmoon stores IPv6 addresses byte-reversed
+		for i = 0, 15 do
+			bytes[i + 1] = ip6.uint8[15 - i]
+		end
+	end
+	prefix = tonumber(prefix) or #bytes * 8
+	for i = 0, #bytes - 1 do
+		rule[addrField][i] = bytes[i + 1]
+		local bits = math.min(math.max(prefix - i * 8, 0), 8)
+		rule[maskField][i] = band(lshift(0xFF, 8 - bits), 0xFF)
+	end
+	return ip4 and 4 or 6
+end
+
+local function parsePort(str, lineForError)
+	local port, mask = str:match("^(%d+)/?(%w*)$")
+	port = tonumber(port)
+	if not port or port > 0xFFFF then
+		log:fatal("Invalid port %s in rule '%s'", str, lineForError)
+	end
+	return port, tonumber(mask) or 0xFFFF
+end
+
+--- Parse a rule in the compact syntax described above into a struct libmoon_flow_rule.
+function mod.parseRule(str)
+	local rule = ffi.new("struct libmoon_flow_rule")
+	local match, actions = str:match("^(.-)%->(.*)$")
+	if not match then
+		log:fatal("Missing '->' in rule '%s'", str)
+	end
+	local tokens = {}
+	for token in match:gmatch("%S+") do
+		tokens[#tokens + 1] = token
+	end
+	local i = 1
+	local function arg()
+		i = i + 1
+		return tokens[i] or log:fatal("Missing argument for %s in rule '%s'", tokens[i - 1], str)
+	end
+	while i <= #tokens do
+		local token = tokens[i]:lower()
+		if token == "ipv4" then
+			rule.ip_version = 4
+		elseif token == "ipv6" then
+			rule.ip_version = 6
+		elseif token == "tcp" then
+			rule.proto = IPPROTO_TCP
+		elseif token == "udp" then
+			rule.proto = IPPROTO_UDP
+		elseif token == "proto" then
+			rule.proto = tonumber(arg()) or log:fatal("Invalid protocol in rule '%s'", str)
+		elseif token == "src" then
+			rule.ip_version = parseAddress(arg(), rule, "src_ip", "src_ip_mask", str)
+		elseif token == "dst" then
+			rule.ip_version = parseAddress(arg(), rule, "dst_ip", "dst_ip_mask", str)
+		elseif token == "sport" then
+			rule.src_port, rule.src_port_mask = parsePort(arg(), str)
+		elseif token == "dport" then
+			rule.dst_port, rule.dst_port_mask = parsePort(arg(), str)
+		elseif token == "prio" then
+			rule.priority = tonumber(arg()) or log:fatal("Invalid priority in rule '%s'", str)
+		else
+			log:fatal("Unknown match '%s' in rule '%s'", tokens[i], str)
+		end
+		i = i + 1
+	end
+	local hasAction = false
+	tokens = {}
+	for token in actions:gmatch("%S+") do
+		tokens[#tokens + 1] = token
+	end
+	i = 1
+	while i <= #tokens do
+		local token = tokens[i]:lower()
+		if token == "queue" then
+			rule.action = ACTION_QUEUE
+			rule.queue = tonumber(arg()) or log:fatal("Invalid queue in rule '%s'", str)
+			hasAction = true
+		elseif token == "drop" then
+			rule.action = ACTION_DROP
+			hasAction = true
+		elseif token == "mark" then
+			rule.action = ACTION_MARK
+			rule.mark = tonumber(arg()) or log:fatal("Invalid mark in rule '%s'", str)
+			hasAction = true
+		elseif token == "count" then
+			rule.count = 1
+		else
+			log:fatal("Unknown action '%s' in rule '%s'", tokens[i], str)
+		end
+		i = i + 1
+	end
+	if not hasAction then
+		log:fatal("Rule '%s' needs one of the actions queue, drop, or mark", str)
+	end
+	return rule
+end
+
+local manager = {}
+manager.__index = manager
+mod.manager = manager
+
+local flowRule = {}
+flowRule.__index = flowRule
+mod.flowRule = flowRule
+
+--- Create a new rule manager for a device.
+--- The manager is shared between tasks when passed as an argument.
+--- @param dev the device
+--- @param softwareFallback optional (default = true) emulate rules rejected by the NIC in software
+function mod.newManager(dev, softwareFallback)
+	if softwareFallback == nil then
+		softwareFallback = true
+	end
+	return setmetatable({
+		mgr = C.libmoon_flow_manager_create(dev.id),
+		dev = dev,
+		softwareFallback = softwareFallback
+	}, manager)
+end
+
+--- Add multiple rules at once.
+--- @param rules table of rules in the compact syntax
+--- @return table of rule objects, entries are false for rules that could not be added
+function manager:addRules(rules)
+	local cRules = ffi.new("struct libmoon_flow_rule[?]", #rules)
+	for i, v in ipairs(rules) do
+		cRules[i - 1] = mod.parseRule(v)
+	end
+	local ids = ffi.new("int32_t[?]", #rules)
+	C.libmoon_flow_manager_add(self.mgr, cRules, #rules, ids, self.softwareFallback)
+	local result = {}
+	for i, v in ipairs(rules) do
+		local id = ids[i - 1]
+		if id < 0 then
+			log:warn("Could not add rule '%s': %s", v, self:getLastError())
+			result[i] = false
+		else
+			result[i] = setmetatable({ manager = self, id = id, rule = v }, flowRule)
+			if not result[i]:isOffloaded() then
+				log:info("Rule '%s' is not supported by %s (%s), using software fallback",
+					v, self.dev, self:getLastError())
+			end
+		end
+	end
+	return result
+end
+
+--- Get the last error message reported by the driver.
+function manager:getLastError()
+	local buf = ffi.new("char[256]")
+	C.libmoon_flow_manager_last_error(self.mgr, buf, 256)
+	return ffi.string(buf)
+end
+
+--- Add a single rule.
+--- @return the rule object or nil
+function manager:addRule(rule)
+	return self:addRules({ rule })[1] or nil
+end
+
+--- Remove multiple rules at once.
+--- Blocks until no task is still matching packets against removed software rules, the rule objects are invalid afterwards.
+function manager:removeRules(rules)
+	local ids = ffi.new("int32_t[?]", #rules)
+	for i, v in ipairs(rules) do
+		ids[i - 1] = v.id
+	end
+	return C.libmoon_flow_manager_remove(self.mgr, ids, #rules)
+end
+
+--- Apply software rules to received packets.
+--- @param bufs the bufArray
+--- @param n the number of received packets
+--- @return the number of remaining packets, dropped packets are freed and removed from the array
+function manager:process(bufs, n)
+	return C.libmoon_flow_manager_process(self.mgr, bufs.array, n)
+end
+
+--- Get the number of rules that are emulated in software.
+function manager:numSoftwareRules()
+	return C.libmoon_flow_manager_num_sw_rules(self.mgr)
+end
+
+--- Remove all rules and free the manager. Must not be used by other tasks at this point.
+function manager:destroy()
+	C.libmoon_flow_manager_delete(self.mgr)
+	self.mgr = nil
+end
+
+function manager:__tostring()
+	return ("[FlowManager: dev=%d]"):format(self.dev.id)
+end
+
+function manager:__serialize()
+	return "require 'offload'; return " .. serpent.addMt(serpent.dumpRaw(self), "require('offload').manager"), true
+end
+
+--- Remove the rule.
+function flowRule:destroy()
+	return self.manager:removeRules({ self }) == 1
+end
+
+--- Check if the rule is implemented by the NIC.
+function flowRule:isOffloaded()
+	return C.libmoon_flow_manager_is_offloaded(self.manager.mgr, self.id) == 1
+end
+
+local pktsBuf = ffi.new("uint64_t[1]")
+local bytesBuf = ffi.new("uint64_t[1]")
+
+--- Get the counters of the rule, requires the count action.
+--- @return packets, bytes (0 if the driver does not count bytes)
+function flowRule:getCounters()
+	local rc = C.libmoon_flow_manager_query(self.manager.mgr, self.id, pktsBuf, bytesBuf)
+	if rc ~= 0 then
+		log:warn("Could not query rule '%s': %s", self.rule, strError(rc))
+		return 0, 0
+	end
+	return tonumber(pktsBuf[0]), tonumber(bytesBuf[0])
+end
+
+function flowRule:__tostring()
+	return ("[FlowRule: %s]"):format(self.rule)
+end
+
+function flowRule:__serialize()
+	return "require 'offload'; return " .. serpent.addMt(serpent.dumpRaw(self), "require('offload').flowRule"), true
+end
+
+--- Create a rule manager for this device, see offload.lua.
+function device.__devicePrototype:newFlowManager(softwareFallback)
+	return mod.newManager(self, softwareFallback)
+end
+
+return mod
+
@@ -125,6 +125,34 @@ function pkt:getSize()
 	return self.pkt_len
 end
 
+--- Get the number of segments of a chained packet.
+function pkt:getNumSegments()
+	return self.nb_segs
+end
+
+--- Check if the packet consists of multiple segments.
+--- Functions that access the packet data (e.g., pkt:get()) only see the first segment.
+function pkt:isChained()
+	return self.nb_segs > 1
+end
+
+--- Copy a chained packet into its first segment.
+--- @return true if the packet fits into a single buffer
+function pkt:linearize()
+	return self.nb_segs == 1 or dpdkc.linearize_mbufs(ffi.new("struct rte_mbuf*[1]", self), 1) == 0
+end
+
+--- Copy bytes of a possibly chained packet.
+--- @param dst target buffer
+--- @param offset optional (default = 0) offset in the packet
+--- @param len optional (default = packet size - offset) number of bytes
+--- @return the number of bytes copied
+function pkt:readBytes(dst, offset, len)
+	offset = offset or 0
+	len = len or self.pkt_len - offset
+	return dpdkc.read_mbuf_chain(self, offset, len, dst)
+end
+
 --- Returns the packet data cast to the best fitting packet struct. 
 --- Starting with ethernet header.
 --- @return packet data as cdata of best fitting packet
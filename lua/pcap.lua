@@ -1,5 +1,7 @@
 --- Fast pcap IO, can write > 40 Gbit/s (to fs cache) and read > 30 Mpps (from fs cache).
 --- Read/write performance can saturate several NVMe SSDs from a single core.
+--- Packets larger than a buffer of the mempool are read into chains of mbufs, replaying them requires a tx device
+--- configured with multiSegTx = true (see device.config()).
 
 local mod = {}
 
@@ -116,6 +118,7 @@ end
 
 ffi.cdef[[
 	void libmoon_write_pcap(void* dst, const void* packet, uint32_t len, uint32_t orig_len, uint32_t ts_sec, uint32_t ts_usec);
+	uint32_t libmoon_write_pcap_mbuf(void* dst, const struct rte_mbuf* buf, uint32_t snap_len, uint32_t ts_sec, uint32_t ts_usec);
 ]]
 
 --- Write a packet to the pcap file
@@ -131,18 +134,34 @@ function writer:write(timestamp, data, len, origLen)
 	self.offset = self.offset + len + 16
 end
 
---- Write a mbuf to the pcap file
+--- Write a mbuf to the pcap file, chained mbufs are written as a single packet
 --- @param timestamp relative to the timestamp specified when creating the file
 --- @param snapLen truncate the packet to this size
 function writer:writeBuf(timestamp, buf, snapLen)
-	local size = buf:getSize()
-	snapLen = snapLen or size
-	self:write(timestamp, buf:getData(), min(size, snapLen), size)
+	local len = min(buf.pkt_len, snapLen or buf.pkt_len)
+	if self.offset + len + 16 >= self.size then
+		self:resize(self.size * 2)
+	end
+	local time = self.startTime + timestamp
+	local timeSec = math.floor(time)
+	local timeMicros = (time - timeSec) * 1000000
+	len = C.libmoon_write_pcap_mbuf(self.ptr + self.offset, buf, len, time, timeMicros)
+	self.offset = self.offset + len + 16
 end
 
 local reader = {}
 reader.__index = reader
 
+local chainWarned = false
+
+-- chains are dropped or rejected by tx queues without multiSegTx
+local function warnChain(buf)
+	if not chainWarned and buf.nb_segs > 1 then
+		chainWarned = true
+		log:warn("pcap contains packets that do not fit into a single buffer (%d bytes), they are read into chained mbufs which require multiSegTx = true to be sent", buf.pkt_len)
+	end
+end
+
 local function readHeader(ptr)
 	local hdr = headerPointer(ptr)
 	if hdr.magic_number == 0xd4c3b2a1 or hdr.magic_number == 0x4d3cb2a1 then
@@ -181,41 +200,48 @@ function mod:newReader(filename)
 end
 
 ffi.cdef[[
-	struct rte_mbuf* libmoon_read_pcap(struct mempool* mp, const void* pcap, uint64_t remaining, uint32_t mempool_buf_size);
-	uint32_t libmoon_read_pcap_batch(struct mempool* mp, struct rte_mbuf** bufs, uint32_t num_bufs, const void* pcap, uint64_t remaining, uint32_t mempool_buf_size);
+	struct rte_mbuf* libmoon_read_pcap(struct mempool* mp, const void* pcap, uint64_t remaining);
+	uint32_t libmoon_read_pcap_batch(struct mempool* mp, struct rte_mbuf** bufs, uint32_t num_bufs, const void* pcap, uint64_t remaining, uint64_t* read_bytes);
 ]]
 
 --- Read the next packet into a buf, the timestamp is stored in the udata64 field as microseconds.
 --- The buffer's packet size corresponds to the original packet size, cut off bytes are zero-filled.
+--- Packets that do not fit into a single buffer of the mempool are read into a chain of mbufs.
+--- @param mempoolBufSize ignored, only kept for compatibility
+--- @return the buf or nil at the end of the file or if the mempool is empty
 function reader:readSingle(mempool, mempoolBufSize)
-	mempoolBufSize = mempoolBufSize or 2048
 	local fileRemaining = self.size - self.offset
 	if fileRemaining < 32 then -- header size
 		return nil
 	end
-	local buf = C.libmoon_read_pcap(mempool, self.ptr + self.offset, fileRemaining, mempoolBufSize)
-	if buf then
-		self.offset = self.offset + buf.pkt_len + 16
-		-- chained mbufs not supported for now
-		buf.pkt_len = buf.data_len
+	local buf = C.libmoon_read_pcap(mempool, self.ptr + self.offset, fileRemaining)
+	if buf == nil then
+		-- mempool empty or truncated record, the next call tries the same record again
+		return nil
 	end
+	self.offset = self.offset + packetPointer(self.ptr + self.offset).incl_len + 16
+	warnChain(buf)
 	return buf
 end
 
+local readBytes = ffi.new("uint64_t[1]")
+
 --- Read a batch of packets into a bufArray, the timestamp is stored in the udata64 field as microseconds.
 --- The buffer's packet size corresponds to the original packet size, cut off bytes are zero-filled.
+--- Packets that do not fit into a single buffer of the mempool are read into a chain of mbufs.
+--- @param mempoolBufSize ignored, only kept for compatibility
 --- @return the number of packets read
 function reader:read(bufs, mempoolBufSize)
-	mempoolBufSize = mempoolBufSize or 2048
 	local fileRemaining = self.size - self.offset
 	if fileRemaining < 32 then -- header size
 		return 0
 	end
-	local numRead = C.libmoon_read_pcap_batch(bufs.mem, bufs.array, bufs.size, self.ptr + self.offset, fileRemaining, mempoolBufSize)
-	for i = 0, numRead - 1 do
-		self.offset = self.offset + bufs.array[i].pkt_len + 16
-		-- chained mbufs not supported for now
-		bufs.array[i].pkt_len = bufs.array[i].data_len
+	local numRead = C.libmoon_read_pcap_batch(bufs.mem, bufs.array, bufs.size, self.ptr + self.offset, fileRemaining, readBytes)
+	self.offset = self.offset + tonumber(readBytes[0])
+	if not chainWarned then
+		for i = 0, numRead - 1 do
+			warnChain(bufs.array[i])
+		end
 	end
 	return numRead
 end
@@ -0,0 +1,153 @@
+---------------------------------
+--- @file sketch.lua
+--- @brief Streaming quantile sketches (DDSketch) for per-flow latency and size distributions.
+--- A sketch set holds a fixed number of small sketches, e.g. one per flow, in bounded memory
+--- (~300 bytes per sketch with the defaults). Quantiles have a relative error of at most the configured accuracy
+--- as long as the values of a sketch span less than gamma^bins (~160x with the defaults), lower quantiles lose
+--- accuracy first if they span a larger range.
+--- Each set must only be written by a single task, use one set per core and merge them when querying.
+--- Queries can run concurrently from any task without stopping the data path.
+---------------------------------
+
+local ffi     = require "ffi"
+local log     = require "log"
+local serpent = require "Serpent"
+local libmoon = require "libmoon"
+
+ffi.cdef[[
+	struct libmoon_sketch_set { };
+
+	struct libmoon_sketch_stats {
+		uint64_t count;
+		uint64_t sum;
+		uint64_t max;
+	};
+
+	struct libmoon_sketch_set* libmoon_sketch_set_create(uint32_t num_sketches, double accuracy, uint16_t num_bins, int socket);
+	void libmoon_sketch_set_delete(struct libmoon_sketch_set* set);
+	void libmoon_sketch_set_reset(struct libmoon_sketch_set* set);
+	uint32_t libmoon_sketch_set_size(struct libmoon_sketch_set* set);
+	uint64_t libmoon_sketch_set_memory(struct libmoon_sketch_set* set);
+	void libmoon_sketch_insert(struct libmoon_sketch_set* set, uint32_t sketch, uint64_t value);
+	void libmoon_sketch_insert_bulk(struct libmoon_sketch_set* set, const uint32_t* sketches, const uint64_t* values, uint32_t num);
+	void libmoon_sketch_insert_latencies(struct libmoon_sketch_set* set, struct rte_mbuf** bufs, uint32_t num_bufs, const uint32_t* ids, uint64_t now);
+	void libmoon_sketch_insert_sizes(struct libmoon_sketch_set* set, struct rte_mbuf** bufs, uint32_t num_bufs, const uint32_t* ids);
+	int libmoon_sketch_query(struct libmoon_sketch_set** sets, uint32_t num_sets, uint32_t sketch, const double* quantiles, double* results, uint32_t num_quantiles, struct libmoon_sketch_stats* stats);
+]]
+
+local C = ffi.C
+
+local mod = {}
+
+local sketchSet = {}
+sketchSet.__index = sketchSet
+mod.sketchSet = sketchSet
+
+--- Create a new set of sketches.
+--- @param args table with the following named arguments
+--- @param args.size number of sketches (e.g. flows)
+--- @param args.accuracy optional (default = 0.02) relative accuracy of the quantiles
+--- @param args.bins optional (default = 128) number of bins per sketch, the memory per sketch is 2 * bins + 32 bytes
+--- @param args.socket optional (default = socket of the calling thread) NUMA socket
+function mod.newSketchSet(args)
+	local set = C.libmoon_sketch_set_create(args.size, args.accuracy or 0, args.bins or 0, args.socket or select(2, libmoon.getCore()))
+	if set == nil then
+		log:fatal("Could not create sketch set with %s sketches", args.size)
+	end
+	return setmetatable({ set = set, size = args.size }, sketchSet)
+end
+
+--- Add a value to a sketch.
+--- @param id the sketch, 0-based
+function sketchSet:insert(id, value)
+	C.libmoon_sketch_insert(self.set, id, value)
+end
+
+--- Add values from C arrays.
+--- @param ids uint32_t array of sketch ids
+--- @param values uint64_t array of values
+function sketchSet:insertBulk(ids, values, n)
+	C.libmoon_sketch_insert_bulk(self.set, ids, values, n)
+end
+
+--- Add the latency of received packets, i.e. the difference between now and the timestamp in the udata64 field.
+--- @param bufs the bufArray
+--- @param n number of packets
+--- @param now current time in the unit of the timestamps
+--- @param ids optional uint32_t array of sketch ids, uses the RSS hash modulo the number of sketches by default
+function sketchSet:insertLatencies(bufs, n, now, ids)
+	C.libmoon_sketch_insert_latencies(self.set, bufs.array, n, ids, now)
+end
+
+--- Add the sizes of packets.
+--- @param ids optional uint32_t array of sketch ids, uses the RSS hash modulo the number of sketches by default
+function sketchSet:insertSizes(bufs, n, ids)
+	C.libmoon_sketch_insert_sizes(self.set, bufs.array, n, ids)
+end
+
+--- Clear all sketches, must be called by the task that inserts values.
+function sketchSet:reset()
+	C.libmoon_sketch_set_reset(self.set)
+end
+
+--- Get the memory used by the set in bytes.
+function sketchSet:getMemory()
+	return tonumber(C.libmoon_sketch_set_memory(self.set))
+end
+
+--- Get quantiles of a sketch, see mod.query().
+function sketchSet:quantiles(id, quantiles)
+	return mod.query({ self }, id, quantiles)
+end
+
+--- Get a single quantile of a sketch.
+--- @param q quantile (range 0 to 1)
+function sketchSet:quantile(id, q)
+	return self:quantiles(id, { q })[1]
+end
+
+--- Get the number of samples, their sum, and the maximum of a sketch.
+function sketchSet:stats(id)
+	return select(2, mod.query({ self }, id, {}))
+end
+
+--- Free the set, must not be used by any task at this point.
+function sketchSet:destroy()
+	C.libmoon_sketch_set_delete(self.set)
+	self.set = nil
+end
+
+function sketchSet:__tostring()
+	return ("[SketchSet: %d sketches]"):format(self.size)
+end
+
+function sketchSet:__serialize()
+	return "require 'sketch'; return " .. serpent.addMt(serpent.dumpRaw(self), "require('sketch').sketchSet"), true
+end
+
+local stats = ffi.new("struct libmoon_sketch_stats")
+
+--- Query a sketch merged across multiple sets, e.g. the per-core sets of a flow.
+--- @param sets table of sketch sets with the same accuracy
+--- @param id the sketch
+--- @param quantiles table of quantiles (range 0 to 1)
+--- @return table of values (NaN for empty sketches), table with count, sum, and max
+function mod.query(sets, id, quantiles)
+	local cSets = ffi.new("struct libmoon_sketch_set*[?]", #sets)
+	for i, set in ipairs(sets) do
+		cSets[i - 1] = set.set
+	end
+	local cQuantiles = ffi.new("double[?]", #quantiles, quantiles)
+	local results = ffi.new("double[?]", #quantiles)
+	local rc = C.libmoon_sketch_query(cSets, #sets, id, cQuantiles, results, #quantiles, stats)
+	if rc ~= 0 then
+		log:fatal("Could not query sketch %d: %s", id, strError(rc))
+	end
+	local result = {}
+	for i = 1, #quantiles do
+		result[i] = results[i - 1]
+	end
+	return result, { count = tonumber(stats.count), sum = tonumber(stats.sum), max = tonumber(stats.max) }
+end
+
+return mod
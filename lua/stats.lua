@@ -7,7 +7,8 @@ local device    = require "device"
 local log       = require "log"
 local colors    = require "colors"
 local ns        = require "namespaces"
-local pipe      = require "pipe"
+local dpdkc     = require "dpdkc"
+local ffi       = require "ffi"
 
 mod.share = ns:get()
 mod.share.lock(function()
@@ -15,11 +16,9 @@ mod.share.lock(function()
 		return
 	end
 	mod.share.counterId = 0
-	mod.share.pipe = pipe:newSlowPipe()
 	mod.share.initialized = true
 end)
 
-local serverPipe = mod.share.pipe
 
 
 function mod.average(data)
@@ -83,7 +82,9 @@ end
 
 local colors = {
 	RX = "cyan",
-	TX = "blue"
+	TX = "blue",
+	Core = "yellow",
+	Xstats = "cyan"
 }
 local function getPlainUpdate(direction)
 	return function(stats, file, total, mpps, mbit, wireMbit)
@@ -140,6 +141,81 @@ local function getCsvFinal(direction)
 	end
 end
 
+local function plainCoreUpdate(stats, file, core, task, load, bursts, pktsPerBurst, emptyPolls)
+	file:write(("%s[Core %d: %s]%s Load: %.1f%%, %.0f bursts/s (%.1f packets per burst), %.0f empty polls/s\n"):format(
+		getColorCode(colors.Core), core, task, getColorCode(),
+		load, bursts, pktsPerBurst, emptyPolls
+	))
+	file:flush()
+end
+
+local function plainCoreFinal(stats, file, core, task, load, packets, bursts, emptyPolls)
+	file:write(("%s[Core %d: %s]%s Load: %.1f%% average, total %d packets in %d bursts, %d empty polls\n"):format(
+		getColorCode(colors.Core), core, task, getColorCode(),
+		load, packets, bursts, emptyPolls
+	))
+	file:flush()
+end
+
+local coreHeadersShown = {}
+local function csvCoreInit(stats, file)
+	if not coreHeadersShown[file] then
+		coreHeadersShown[file] = true
+		file:write("Time,Core,Task,Load,Bursts,PacketsPerBurst,EmptyPolls\n")
+	end
+end
+
+local function csvCoreUpdate(stats, file, core, task, load, bursts, pktsPerBurst, emptyPolls)
+	file:write(("%d,%d,%s,%s,%s,%s,%s\n"):format(time(), core, task, load, bursts, pktsPerBurst, emptyPolls))
+	file:flush()
+end
+
+local function csvCoreFinal(stats, file, core, task, load, packets, bursts, emptyPolls)
+	file:write(("%d,%d,%s,%s,%s,%s,%s\n"):format(time(), core, task, load, bursts, packets / math.max(bursts, 1), emptyPolls))
+	file:flush()
+end
+
+local function plainXstatsUpdate(stats, file, stat, value, rate)
+	-- only changing counters, a device has hundreds of xstats
+	if rate == 0 then
+		return
+	end
+	file:write(("%s[%s] %s%s: %.0f/s, total %d\n"):format(
+		getColorCode(colors.Xstats), stats.name, stat, getColorCode(),
+		rate, value
+	))
+	file:flush()
+end
+
+local function plainXstatsFinal(stats, file, stat, total, rate)
+	if total == 0 then
+		return
+	end
+	file:write(("%s[%s] %s%s: %.0f/s average, total %d\n"):format(
+		getColorCode(colors.Xstats), stats.name, stat, getColorCode(),
+		rate, total
+	))
+	file:flush()
+end
+
+local xstatsHeadersShown = {}
+local function csvXstatsInit(stats, file)
+	if not xstatsHeadersShown[file] then
+		xstatsHeadersShown[file] = true
+		file:write("Time,Device,Stat,Value,Rate\n")
+	end
+end
+
+local function csvXstatsUpdate(stats, file, stat, value, rate)
+	file:write(("%d,%s,%s,%s,%s\n"):format(time(), stats.name, stat, value, rate))
+	file:flush()
+end
+
+local function csvXstatsFinal(stats, file, stat, total, rate)
+	file:write(("%d,%s,%s,%s,%s\n"):format(time(), stats.name, stat, total, rate))
+	file:flush()
+end
+
 local formatters = {}
 formatters["plain"] = {
 	rxStatsInit = function() end, -- nothing for plain, machine-readable formats can print a header here
@@ -149,6 +225,14 @@ formatters["plain"] = {
 	txStatsInit = function() end,
 	txStatsUpdate = getPlainUpdate("TX"),
 	txStatsFinal = getPlainFinal("TX"),
+
+	coreStatsInit = function() end,
+	coreStatsUpdate = plainCoreUpdate,
+	coreStatsFinal = plainCoreFinal,
+
+	xstatsStatsInit = function() end,
+	xstatsStatsUpdate = plainXstatsUpdate,
+	xstatsStatsFinal = plainXstatsFinal,
 }
 
 formatters["CSV"] = {
@@ -159,6 +243,14 @@ formatters["CSV"] = {
 	txStatsInit = getCsvInit("TX"),
 	txStatsUpdate = getCsvUpdate("TX"),
 	txStatsFinal = getCsvFinal("TX"),
+
+	coreStatsInit = csvCoreInit,
+	coreStatsUpdate = csvCoreUpdate,
+	coreStatsFinal = csvCoreFinal,
+
+	xstatsStatsInit = csvXstatsInit,
+	xstatsStatsUpdate = csvXstatsUpdate,
+	xstatsStatsFinal = csvXstatsFinal,
 }
 formatters["csv"] = formatters["CSV"]
 
@@ -171,6 +263,14 @@ formatters["nil"] = {
 	txStatsInit = function() end,
 	txStatsUpdate = function() end,
 	txStatsFinal = function () end,
+
+	coreStatsInit = function() end,
+	coreStatsUpdate = function() end,
+	coreStatsFinal = function() end,
+
+	xstatsStatsInit = function() end,
+	xstatsStatsUpdate = function() end,
+	xstatsStatsFinal = function() end,
 }
 
 
@@ -204,6 +304,10 @@ local function newCounter(ctrType, name, dev, format, file, direction)
 	if not formatters[format] then
 		log:fatal("Unsupported output format " .. format)
 	end
+	-- latest values are published to the REST API through the native counter table
+	if dpdkc.libmoon_counter_table_register(id, name, direction, dev and dev.id or -1) ~= 0 then
+		log:warn("Counter %s is not available via the REST API, too many counters", name)
+	end
 	return {
 		name = name,
 		dev = dev,
@@ -233,7 +337,6 @@ local function printStats(self, statsType, event, ...)
 	end
 end
 
-local webserver
 local function updateCounter(self, time, pkts, bytes, dontPrint)
 	if not self.lastUpdate then
 		-- first call, save current stats but do not print anything
@@ -250,17 +353,7 @@ local function updateCounter(self, time, pkts, bytes, dontPrint)
 	self.total = pkts
 	self.totalBytes = bytes
 	if not dontPrint then
-		if not webserver then
-			webserver = require "webserver"
-		end
-		if webserver.running() then
-			serverPipe:send{
-				id = self.id, name = self.name, dev = self.dev and self.dev.id, dir = self.dir,
-				packets = self.total, bytes = self.totalBytes,
-				mpps = mpps, mbit = mbit, wireMbit = wireRate,
-				time = _G.time()
-			}
-		end
+		dpdkc.libmoon_counter_table_update(self.id, self.total, self.totalBytes, mpps, mbit, wireRate, _G.time())
 		self:print("Update", self.total, mpps, mbit, wireRate, self.totalBytes)
 	end
 	table.insert(self.mpps, mpps)
@@ -276,6 +369,17 @@ local function getStats(self)
 	return self.mpps, self.mbit, self.wireMbit, self.total, self.totalBytes
 end
 
+local function closeCounterFile(self)
+	if self.closeFile then
+		local file = openFiles[self.closeFile]
+		if file.refCount == 1 then
+			file.file:close()
+		else
+			file.refCount = file.refCount - 1
+		end
+	end
+end
+
 local function finalizeCounter(self, sleep)
 	-- wait for any remaining packets to arrive/be sent if necessary
 	libmoon.sleepMillis(sleep)
@@ -287,14 +391,7 @@ local function finalizeCounter(self, sleep)
 	mod.addStats(self.mbit, true)
 	mod.addStats(self.wireMbit, true)
 	self:print("Final")
-	if self.closeFile then
-		local file = openFiles[self.closeFile]
-		if file.refCount == 1 then
-			file.file:close()
-		else
-			file.refCount = file.refCount - 1
-		end
-	end
+	closeCounterFile(self)
 end
 
 
@@ -302,10 +399,12 @@ local rxCounter = {} -- base class
 local devRxCounter = setmetatable({}, rxCounter)
 local pktRxCounter = setmetatable({}, rxCounter)
 local manualRxCounter = setmetatable({}, rxCounter)
+local flowRuleRxCounter = setmetatable({}, rxCounter)
 rxCounter.__index = rxCounter
 devRxCounter.__index = devRxCounter
 pktRxCounter.__index = pktRxCounter
 manualRxCounter.__index = manualRxCounter
+flowRuleRxCounter.__index = flowRuleRxCounter
 
 --- Create a new rx counter using device statistics registers.
 --- @param name the name of the counter, included in the output. defaults to the device name
@@ -347,6 +446,22 @@ function mod:newManualRxCounter(name, format, file)
 	return setmetatable(obj, manualRxCounter)
 end
 
+--- Create a new rx counter that polls the counters of a flow rule (see offload.lua).
+--- The rule must have the count action.
+--- @param name the name of the counter, included in the output. defaults to the rule
+--- @param rule the flow rule to track
+--- @param format the output format, "CSV" and "plain" (default) are currently supported
+--- @param file the output file, defaults to standard out
+function mod:newFlowRuleCounter(name, rule, format, file)
+	if type(name) == "table" then
+		return self:newFlowRuleCounter(nil, name, rule, format)
+	end
+	name = name or tostring(rule):sub(2, -2)
+	local obj = newCounter("flowRule", name, rule.manager.dev, format, file, "rx")
+	obj.rule = rule
+	return setmetatable(obj, flowRuleRxCounter)
+end
+
 --- Base class
 function rxCounter:finalize(sleep)
 	finalizeCounter(self, sleep or self.sleep or 0)
@@ -397,6 +512,11 @@ function pktRxCounter:getThroughput()
 end
 
 
+--- Flow rule counter
+function flowRuleRxCounter:getThroughput()
+	return self.rule:getCounters()
+end
+
 --- Manual rx counter
 function manualRxCounter:update(pkts, bytes)
 	self.current = self.current + pkts
@@ -548,6 +668,166 @@ function manualTxCounter:getThroughput()
 	return pkts, bytes
 end
 
+local coreCounter = {}
+coreCounter.__index = coreCounter
+
+--- Create a counter that reports the load of all cores running tasks.
+--- Cycles are attributed to bursts handled by rx, tx, and pipe receive calls (busy) or to empty polls (idle),
+--- the time between two calls counts as busy if one of them handled packets.
+--- This is done by the native rx/tx/pipe functions, see core_stats.h.
+--- @param format the output format, "CSV" and "plain" (default) are currently supported
+--- @param file the output file, defaults to standard out
+function mod:newCoreCounter(format, file)
+	local obj = newCounter("core", "Cores", nil, format, file, "core")
+	obj.cores = {}
+	obj.first = {}
+	obj.maxCores = dpdkc.libmoon_core_stats_max_cores()
+	obj.buf = ffi.new("struct libmoon_core_stats")
+	return setmetatable(obj, coreCounter)
+end
+
+function coreCounter:print(event, ...)
+	printStats(self, "coreStats", event, ...)
+end
+
+local function readCoreStats(self, core)
+	local buf = self.buf
+	if dpdkc.libmoon_core_stats_get(core, buf) == 0 then
+		return nil
+	end
+	return {
+		busy = tonumber(buf.busy_cycles),
+		idle = tonumber(buf.idle_cycles),
+		bursts = tonumber(buf.busy_calls),
+		emptyPolls = tonumber(buf.empty_calls),
+		packets = tonumber(buf.packets),
+		task = ffi.string(buf.task_name)
+	}
+end
+
+local function getLoad(cur, last)
+	local busy = cur.busy - (last and last.busy or 0)
+	local idle = cur.idle - (last and last.idle or 0)
+	return busy + idle > 0 and busy / (busy + idle) * 100 or 0
+end
+
+function coreCounter:update()
+	local time = libmoon.getTime()
+	if self.lastUpdate and time <= self.lastUpdate + 1 then
+		return false
+	end
+	if not self.lastUpdate then
+		self:print("Init")
+	end
+	local elapsed = self.lastUpdate and time - self.lastUpdate
+	self.lastUpdate = time
+	for core = 0, self.maxCores - 1 do
+		local cur = readCoreStats(self, core)
+		if cur then
+			local last = self.cores[core]
+			if last and elapsed then
+				local bursts = cur.bursts - last.bursts
+				self:print("Update", core, cur.task, getLoad(cur, last), bursts / elapsed,
+					(cur.packets - last.packets) / math.max(bursts, 1), (cur.emptyPolls - last.emptyPolls) / elapsed)
+			end
+			self.first[core] = self.first[core] or last or cur
+			self.cores[core] = cur
+		end
+	end
+	return true
+end
+
+function coreCounter:finalize()
+	for core = 0, self.maxCores - 1 do
+		local cur = readCoreStats(self, core)
+		local first = self.first[core]
+		if cur and first then
+			self:print("Final", core, cur.task, getLoad(cur, first), cur.packets - first.packets,
+				cur.bursts - first.bursts, cur.emptyPolls - first.emptyPolls)
+		end
+	end
+	closeCounterFile(self)
+end
+
+local xstatsCounter = {}
+xstatsCounter.__index = xstatsCounter
+
+--- Create a counter that reports the extended statistics (xstats) of a device and their rates.
+--- xstats include per-queue packets, missed packets, mbuf allocation failures, and driver-specific counters
+--- like pause frames or MAC errors, see dev:getXstatNames().
+--- Names are resolved once, each update reads all values with a single call and computes the rates in C.
+--- The plain format only shows counters that changed.
+--- @param dev the device to track
+--- @param patterns optional list of Lua patterns, only xstats whose name matches one of them are reported. Default: all
+--- @param format the output format, "CSV" and "plain" (default) are currently supported
+--- @param file the output file, defaults to standard out
+function mod:newXstatsCounter(dev, patterns, format, file)
+	dev = dev and dev.dev or dev
+	if type(dev) ~= "table" then
+		log:fatal("Bad device")
+	end
+	local obj = newCounter("xstats", tostring(dev):sub(2, -2), dev, format, file, "xstats")
+	local _, ids = dev:getXstatNames(patterns)
+	local xstats = #ids > 0 and dpdkc.libmoon_xstats_create(dev.id, ffi.new("uint64_t[?]", #ids, ids), #ids)
+	if not xstats or xstats == nil then
+		log:warn("Device %d has no xstats%s", dev.id, patterns and " matching the patterns" or "")
+	else
+		obj.xstats = ffi.gc(xstats, dpdkc.libmoon_xstats_delete)
+	end
+	obj.names = {}
+	for i = 1, obj.xstats and dpdkc.libmoon_xstats_count(obj.xstats) or 0 do
+		obj.names[i] = ffi.string(dpdkc.libmoon_xstats_name(obj.xstats, i - 1))
+	end
+	return setmetatable(obj, xstatsCounter)
+end
+
+function xstatsCounter:print(event, ...)
+	printStats(self, "xstatsStats", event, ...)
+end
+
+function xstatsCounter:update()
+	local time = libmoon.getTime()
+	if not self.xstats or self.lastUpdate and time <= self.lastUpdate + 1 then
+		return false
+	end
+	self.lastUpdate = time
+	if dpdkc.libmoon_xstats_update(self.xstats) < 0 then
+		return false
+	end
+	local values = dpdkc.libmoon_xstats_values(self.xstats)
+	if not self.first then
+		self.first = {}
+		for i = 1, #self.names do
+			self.first[i] = tonumber(values[i - 1])
+		end
+		self.startTime = time
+		self:print("Init")
+		return false
+	end
+	local rates = dpdkc.libmoon_xstats_rates(self.xstats)
+	for i, name in ipairs(self.names) do
+		self:print("Update", name, tonumber(values[i - 1]), rates[i - 1])
+	end
+	return true
+end
+
+function xstatsCounter:finalize()
+	if self.first and dpdkc.libmoon_xstats_update(self.xstats) >= 0 then
+		local values = dpdkc.libmoon_xstats_values(self.xstats)
+		local elapsed = libmoon.getTime() - self.startTime
+		for i, name in ipairs(self.names) do
+			local total = tonumber(values[i - 1]) - self.first[i]
+			self:print("Final", name, total, elapsed > 0 and total / elapsed or 0)
+		end
+	end
+	closeCounterFile(self)
+end
+
+--- Enable or disable the per-core cycle accounting (enabled by default).
+function mod.setCoreAccounting(enabled)
+	dpdkc.libmoon_core_stats_enable(enabled)
+end
+
 --- Start a shared task that counts statistics
 --- @param args arguments as table
 ---    devices: list of devices to track both rx and tx stats
@@ -555,6 +835,9 @@ end
 ---    txDevices: list of devices to track tx stats
 ---    format: output format, cf. stats tracking documentation, default: plain
 ---    file: file to write to, default: stdout
+---    cores: also print the load of all cores running tasks, default: false
+---    xstats: also print the extended statistics of all devices, either true or a list of Lua patterns
+---            to select xstats by name, e.g. {"^rx_q%d+_packets$", "missed", "nombuf"}, default: false
 --- A device is either a normal device object or an table with the fields dev, format, and file.
 --- Alternative mode: just the devices as an array if you only want rx and tx stats with default settings
 function mod.startStatsTask(args)
@@ -608,6 +891,26 @@ local function statsTask(args)
 		end
 		table.insert(counters, mod:newDevTxCounter(dev, format, file))
 	end
+	if args.cores then
+		table.insert(counters, mod:newCoreCounter(args.format, args.file))
+	end
+	if args.xstats then
+		local patterns = type(args.xstats) == "table" and args.xstats or nil
+		local seen = {}
+		for i, dev in ipairs(concatArrays(args.rxDevices, args.txDevices)) do
+			local format = args.format
+			local file = args.file
+			if not dev.id then
+				format = dev.format
+				file = dev.file
+				dev = dev.dev
+			end
+			if not seen[dev.id] then
+				seen[dev.id] = true
+				table.insert(counters, mod:newXstatsCounter(dev, patterns, format, file))
+			end
+		end
+	end
 	while libmoon.running(200) do
 		for i, ctr in ipairs(counters) do
 			ctr:update()
@@ -0,0 +1,129 @@
+---------------------------------
+--- @file statsrecorder.lua
+--- @brief High-frequency counter sampling into a binary ring file, e.g. to find microbursts.
+--- A native loop on a shared core samples the counters at a fixed interval (default 100 us) into a mmap'd file
+--- of fixed size, the file always contains the latest samples. Memory use is constant, e.g.
+---   local rec = statsrecorder.newRecorder{file = "rates.bin", interval = 100, capacity = 10^7}
+---   rec:addDevice(dev)
+---   rec:addCores()
+---   rec:startTask()
+--- Use statsrecorder.toCsv() or examples/stats-to-csv.lua to convert the file.
+---------------------------------
+
+local ffi     = require "ffi"
+local log     = require "log"
+local serpent = require "Serpent"
+local libmoon = require "libmoon"
+
+ffi.cdef[[
+	struct libmoon_stats_recorder { };
+
+	struct libmoon_stats_recorder* libmoon_stats_recorder_create(uint64_t interval_ns);
+	void libmoon_stats_recorder_delete(struct libmoon_stats_recorder* recorder);
+	int libmoon_stats_recorder_add_counter(struct libmoon_stats_recorder* recorder, const char* name, const volatile uint64_t* value);
+	int libmoon_stats_recorder_add_device(struct libmoon_stats_recorder* recorder, uint8_t port_id);
+	int libmoon_stats_recorder_add_core(struct libmoon_stats_recorder* recorder, uint32_t lcore);
+	int libmoon_stats_recorder_start(struct libmoon_stats_recorder* recorder, const char* path, uint64_t capacity);
+	uint64_t libmoon_stats_recorder_run(struct libmoon_stats_recorder* recorder);
+	int64_t libmoon_stats_file_to_csv(const char* path, const char* csv_path, uint8_t deltas);
+]]
+
+local C = ffi.C
+
+local mod = {}
+
+local recorder = {}
+recorder.__index = recorder
+mod.recorder = recorder
+
+--- Create a recorder.
+--- @param args table with the following named arguments
+--- @param args.file output file
+--- @param args.interval optional (default = 100) sampling interval in microseconds
+--- @param args.capacity optional (default = 2^22) number of samples kept in the file,
+---   the file size is capacity * (number of columns + 1) * 8 bytes
+function mod.newRecorder(args)
+	if not args.file then
+		log:fatal("Stats recorder requires a file")
+	end
+	local interval = args.interval or 100
+	local r = C.libmoon_stats_recorder_create(interval * 1000)
+	if r == nil then
+		log:fatal("Could not create stats recorder")
+	end
+	return setmetatable({ recorder = r, file = args.file, interval = interval, capacity = args.capacity or 2^22 }, recorder)
+end
+
+local function check(rc, what)
+	if rc ~= 0 then
+		log:fatal("Could not add %s to the stats recorder, it was already started or has too many columns", what)
+	end
+end
+
+--- Record rx/tx packets and bytes and missed packets of a device.
+--- Reading the device stats can take several microseconds, depending on the driver.
+--- Also note that some drivers use clear-on-read registers that interact with dev:getRxStats()/getTxStats().
+function recorder:addDevice(dev)
+	check(C.libmoon_stats_recorder_add_device(self.recorder, dev.id), tostring(dev))
+	return self
+end
+
+--- Record the packets and busy cycles of a core, see stats.lua for the cycle accounting.
+function recorder:addCore(core)
+	check(C.libmoon_stats_recorder_add_core(self.recorder, core), "core " .. core)
+	return self
+end
+
+--- Record the packets and busy cycles of all cores that can run tasks.
+function recorder:addCores()
+	for _, core in ipairs(libmoon.config.cores) do
+		self:addCore(core)
+	end
+	return self
+end
+
+--- Record a native counter, e.g. a field of a struct updated by a task.
+--- @param name column name
+--- @param ptr uint64_t* that must stay valid while the recorder is running
+function recorder:addCounter(name, ptr)
+	check(C.libmoon_stats_recorder_add_counter(self.recorder, name, ptr), name)
+	return self
+end
+
+--- Create the file and start sampling on a shared core until libmoon is stopped.
+--- No columns can be added afterwards.
+function recorder:startTask()
+	if C.libmoon_stats_recorder_start(self.recorder, self.file, self.capacity) ~= 0 then
+		log:fatal("Could not create stats recorder file %s", self.file)
+	end
+	libmoon.startSharedTask("__LM_STATS_RECORDER_TASK", self)
+end
+
+function recorder:__tostring()
+	return ("[StatsRecorder: %s, %d us]"):format(self.file, self.interval)
+end
+
+function recorder:__serialize()
+	return "require 'statsrecorder'; return " .. serpent.addMt(serpent.dumpRaw(self), "require('statsrecorder').recorder"), true
+end
+
+--- Convert a recording to CSV, works while the recording is still running.
+--- @param file the recording
+--- @param csvFile output file
+--- @param raw optional (default = false) write the counter values instead of the differences between samples
+--- @return number of written samples
+function mod.toCsv(file, csvFile, raw)
+	local n = C.libmoon_stats_file_to_csv(file, csvFile, raw and 0 or 1)
+	if n < 0 then
+		log:fatal("Could not convert %s, is it a stats recorder file?", file)
+	end
+	return tonumber(n)
+end
+
+__LM_STATS_RECORDER_TASK = function(rec)
+	log:info("Recording stats every %d us to %s", rec.interval, rec.file)
+	local samples = C.libmoon_stats_recorder_run(rec.recorder)
+	log:info("Recorded %d samples to %s", tonumber(samples), rec.file)
+end
+
+return mod
@@ -11,6 +11,27 @@ local timer  = require "timer"
 local log    = require "log"
 local filter = require "filter"
 local libmoon = require "libmoon"
+local serpent = require "Serpent"
+
+ffi.cdef[[
+	struct libmoon_sw_clock { };
+	struct libmoon_sw_timestamper { };
+
+	struct libmoon_sw_clock* libmoon_sw_clock_create(const char* ptp_device);
+	void libmoon_sw_clock_delete(struct libmoon_sw_clock* clock);
+	int libmoon_sw_clock_calibrate(struct libmoon_sw_clock* clock);
+	uint64_t libmoon_sw_clock_tsc_to_ns(struct libmoon_sw_clock* clock, uint64_t tsc);
+	uint64_t libmoon_sw_clock_now(struct libmoon_sw_clock* clock);
+	uint64_t libmoon_sw_clock_get_uncertainty(struct libmoon_sw_clock* clock);
+	double libmoon_sw_clock_get_tsc_hz(struct libmoon_sw_clock* clock);
+
+	struct libmoon_sw_timestamper* libmoon_sw_timestamper_create(struct libmoon_sw_clock* clock, uint8_t port_id, uint16_t queue_id, uint32_t speed);
+	void libmoon_sw_timestamper_delete(struct libmoon_sw_timestamper* ts);
+	uint32_t libmoon_sw_timestamper_update_link(struct libmoon_sw_timestamper* ts);
+	uint16_t libmoon_sw_timestamper_recv(struct libmoon_sw_timestamper* ts, struct rte_mbuf** bufs, uint16_t num_bufs, uint64_t* error_ns);
+]]
+
+local C = ffi.C
 
 local timestamper = {}
 timestamper.__index = timestamper
@@ -178,5 +199,111 @@ function mod.syncClocks(dev1, dev2)
 	dev2:resetTimeCounters()
 end
 
-return mod
 
+local swClock = {}
+swClock.__index = swClock
+mod.swClock = swClock
+
+--- Create a clock that maps TSC values to wall clock time for software timestamping.
+--- The clock can be shared between tasks, call calibrate() regularly (e.g. once per second) from one of them
+--- to follow NTP or PTP adjustments of the clock.
+--- @param ptp optional path to a PTP hardware clock, e.g. /dev/ptp0, CLOCK_REALTIME is used by default
+function mod:newSoftwareClock(ptp)
+	local clock = C.libmoon_sw_clock_create(ptp)
+	if clock == nil then
+		log:fatal("Could not create software clock %s", ptp or "CLOCK_REALTIME")
+	end
+	return setmetatable({ clock = clock, ptp = ptp }, swClock)
+end
+
+--- Measure offset and frequency relative to the wall clock again.
+function swClock:calibrate()
+	local rc = C.libmoon_sw_clock_calibrate(self.clock)
+	if rc ~= 0 then
+		log:warn("Could not calibrate %s: %s", self, strError(rc))
+	end
+end
+
+--- Get the current time in nanoseconds.
+function swClock:now()
+	return C.libmoon_sw_clock_now(self.clock)
+end
+
+--- Convert a TSC value (e.g. from rxQueue:recvWithTimestamps()) to nanoseconds.
+function swClock:tscToNs(tsc)
+	return C.libmoon_sw_clock_tsc_to_ns(self.clock, tsc)
+end
+
+--- Get the uncertainty of the conversion in nanoseconds, i.e., the read jitter of the clock plus the drift since the last calibration.
+function swClock:getUncertainty()
+	return tonumber(C.libmoon_sw_clock_get_uncertainty(self.clock))
+end
+
+--- Get the measured TSC frequency.
+function swClock:getTscHz()
+	return C.libmoon_sw_clock_get_tsc_hz(self.clock)
+end
+
+--- Free the clock, must not be used by any task at this point.
+function swClock:destroy()
+	C.libmoon_sw_clock_delete(self.clock)
+	self.clock = nil
+end
+
+function swClock:__tostring()
+	return ("[SoftwareClock: %s]"):format(self.ptp or "CLOCK_REALTIME")
+end
+
+function swClock:__serialize()
+	return "require 'timestamping'; return " .. serpent.addMt(serpent.dumpRaw(self), "require('timestamping').swClock"), true
+end
+
+local swTimestamper = {}
+swTimestamper.__index = swTimestamper
+
+--- Create a software timestamper for a rx queue.
+--- Packets are stamped with the wall clock time in nanoseconds in the udata64 field.
+--- The estimate takes the link speed into account: a burst arrived after the previous poll that emptied the queue
+--- and before the end of the current one, packets within a burst are assumed to be back-to-back at line rate.
+--- Must be created and used by the receiving task.
+--- @param rxQueue the rx queue, also works with virtual devices like net_pcap
+--- @param clock the clock, see newSoftwareClock()
+--- @param speed optional link speed in Mbit/s, overrides the speed reported by the device (e.g., net_pcap always reports 10000),
+---   default: the reported speed or 10000 if the link is down
+function mod:newSoftwareTimestamper(rxQueue, clock, speed)
+	local ts = C.libmoon_sw_timestamper_create(clock.clock, rxQueue.id, rxQueue.qid, speed or 0)
+	if ts == nil then
+		log:fatal("Could not create software timestamper for %s", rxQueue)
+	end
+	return setmetatable({ ts = ts, rxQueue = rxQueue, clock = clock, errorBuf = ffi.new("uint64_t[1]") }, swTimestamper)
+end
+
+--- Receive packets and timestamp them.
+--- @return the number of packets, the error bound of the timestamps in nanoseconds (math.huge if unknown, nil if no packets were received)
+function swTimestamper:recv(bufs, numpkts)
+	numpkts = numpkts or bufs.size
+	local rx = C.libmoon_sw_timestamper_recv(self.ts, bufs.array, math.min(bufs.size, numpkts), self.errorBuf)
+	if rx == 0 then
+		-- the error buffer still holds the bound of the previous burst
+		return 0, nil
+	end
+	local err = self.errorBuf[0]
+	return rx, err == -1ULL and math.huge or tonumber(err)
+end
+
+--- Read the link speed again, e.g. after a link change.
+--- @return the link speed in Mbit/s
+function swTimestamper:updateLink()
+	return C.libmoon_sw_timestamper_update_link(self.ts)
+end
+
+function swTimestamper:destroy()
+	C.libmoon_sw_timestamper_delete(self.ts)
+	self.ts = nil
+end
+
+function swTimestamper:__tostring()
+	return ("[SoftwareTimestamper: %s]"):format(self.rxQueue)
+end
+
+return mod
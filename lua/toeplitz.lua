@@ -0,0 +1,221 @@
+---------------------------------
+--- @file toeplitz.lua
+--- @brief Software Toeplitz hash matching the RSS hash function of NICs.
+--- Use dev:getToeplitz() to get a hasher with the key and RETA of a configured device.
+--- This can be used to predict the rx queue of a flow or to generate flows that end up on a given queue.
+---------------------------------
+
+local ffi = require "ffi"
+local log = require "log"
+local serpent = require "Serpent"
+
+ffi.cdef[[
+	struct libmoon_toeplitz;
+	struct libmoon_toeplitz* libmoon_toeplitz_create(const uint8_t* key, uint32_t key_len);
+	void libmoon_toeplitz_delete(struct libmoon_toeplitz* ctx);
+	int libmoon_toeplitz_set_reta(struct libmoon_toeplitz* ctx, const uint16_t* reta, uint32_t reta_size);
+	uint32_t libmoon_toeplitz_hash(struct libmoon_toeplitz* ctx, const uint8_t* data, uint32_t len);
+	uint16_t libmoon_toeplitz_get_queue(struct libmoon_toeplitz* ctx, uint32_t hash);
+	void libmoon_toeplitz_hash_bufs(struct libmoon_toeplitz* ctx, struct rte_mbuf** bufs, uint32_t num_bufs, uint32_t flags, uint32_t* hashes);
+	void libmoon_toeplitz_queue_bufs(struct libmoon_toeplitz* ctx, struct rte_mbuf** bufs, uint32_t num_bufs, uint32_t flags, uint16_t* queues);
+	int32_t libmoon_toeplitz_find_field(struct libmoon_toeplitz* ctx, uint8_t* tuple, uint32_t tuple_len, uint32_t offset, uint16_t start, uint16_t queue);
+]]
+
+local C = ffi.C
+local band, rshift = bit.band, bit.rshift
+
+local mod = {}
+
+--- Include TCP/UDP ports in the hash (see hasher:hashBufs()).
+mod.L4_TCP = 1
+mod.L4_UDP = 2
+mod.L4_ALL = 3
+
+--- The default key from the Microsoft RSS specification, used by many drivers.
+mod.DEFAULT_KEY = {
+	0x6d, 0x5a, 0x56, 0xda, 0x25, 0x5b, 0x0e, 0xc2, 0x41, 0x67,
+	0x25, 0x3d, 0x43, 0xa3, 0x8f, 0xb0, 0xd0, 0xca, 0x2b, 0xcb,
+	0xae, 0x7b, 0x30, 0xb4, 0x77, 0xcb, 0x2d, 0xa3, 0x80, 0x30,
+	0xf2, 0x0c, 0x6a, 0x42, 0xb7, 0x3b, 0xbe, 0xac, 0x01, 0xfa
+}
+
+--- Key that maps both directions of a connection to the same queue.
+--- @param len optional (default = 40) Key length in bytes, must match the key size of the device.
+function mod.symmetricKey(len)
+	local key = {}
+	for i = 1, (len or 40) / 2 do
+		key[#key + 1] = 0x6d
+		key[#key + 1] = 0x5a
+	end
+	return key
+end
+
+local hasher = {}
+hasher.__index = hasher
+
+--- Create a new hasher.
+--- @param key Key as table of bytes or string, a key of n bytes can hash at most n - 4 input bytes
+---   (i.e., 40 bytes are required for IPv6 tuples with ports), longer inputs raise an error
+--- @param reta optional (default = single queue 0) Redirection table as table of queue ids, size must be a power of two
+function mod.new(key, reta)
+	if type(key) == "string" then
+		local tbl = {}
+		for i = 1, #key do
+			tbl[i] = key:byte(i)
+		end
+		key = tbl
+	end
+	local keyBuf = ffi.new("uint8_t[?]", #key, key)
+	local ctx = C.libmoon_toeplitz_create(keyBuf, #key)
+	if ctx == nil then
+		log:fatal("Invalid Toeplitz key length %d", #key)
+	end
+	local obj = setmetatable({
+		ctx = ffi.gc(ctx, C.libmoon_toeplitz_delete),
+		key = key,
+		-- the last 4 key bytes only contribute to the hash of the preceding input bytes
+		maxInputLen = math.min(#key - 4, 36),
+		tuple = ffi.new("uint8_t[36]")
+	}, hasher)
+	if reta then
+		obj:setReta(reta)
+	end
+	return obj
+end
+
+--- Set the redirection table.
+--- @param reta Table of queue ids, the size must be a power of two
+function hasher:setReta(reta)
+	local buf = ffi.new("uint16_t[?]", #reta, reta)
+	if C.libmoon_toeplitz_set_reta(self.ctx, buf, #reta) ~= 0 then
+		log:fatal("Invalid RETA size %d, must be a power of two <= 512", #reta)
+	end
+	self.reta = reta
+end
+
+-- tuples are built in network byte order: src ip, dst ip, src port, dst port
+local function putIP4(buf, offset, ip)
+	buf[offset] = rshift(ip, 24)
+	buf[offset + 1] = band(rshift(ip, 16), 0xFF)
+	buf[offset + 2] = band(rshift(ip, 8), 0xFF)
+	buf[offset + 3] = band(ip, 0xFF)
+end
+
+-- libmoon stores IPv6 addresses as byte-swapped 128 bit integers
+local function putIP6(buf, offset, ip)
+	for i = 0, 3 do
+		putIP4(buf, offset + i * 4, ip.uint32[3 - i])
+	end
+end
+
+local function putPort(buf, offset, port)
+	buf[offset] = rshift(port, 8)
+	buf[offset + 1] = band(port, 0xFF)
+end
+
+local function checkInputLen(self, len)
+	if len > self.maxInputLen then
+		log:fatal("Toeplitz key of %d bytes can only hash %d input bytes, got %d", #self.key, self.maxInputLen, len)
+	end
+end
+
+local function buildTuple(self, ip4, srcIP, dstIP, srcPort, dstPort)
+	local tuple = self.tuple
+	local len
+	if ip4 then
+		putIP4(tuple, 0, srcIP)
+		putIP4(tuple, 4, dstIP)
+		len = 8
+	else
+		putIP6(tuple, 0, srcIP)
+		putIP6(tuple, 16, dstIP)
+		len = 32
+	end
+	if srcPort then
+		putPort(tuple, len, srcPort)
+		putPort(tuple, len + 2, dstPort or 0)
+		len = len + 4
+	end
+	checkInputLen(self, len)
+	return tuple, len
+end
+
+--- Hash an IPv4 tuple, addresses are in the format returned by parseIP4Address().
+--- @param srcPort optional, hash only the IP addresses if not set
+--- @return the 32 bit hash value
+function hasher:hashIPv4(srcIP, dstIP, srcPort, dstPort)
+	return C.libmoon_toeplitz_hash(self.ctx, buildTuple(self, true, srcIP, dstIP, srcPort, dstPort))
+end
+
+--- Hash an IPv6 tuple, addresses are in the format returned by parseIP6Address().
+--- @param srcPort optional, hash only the IP addresses if not set
+--- @return the 32 bit hash value
+function hasher:hashIPv6(srcIP, dstIP, srcPort, dstPort)
+	return C.libmoon_toeplitz_hash(self.ctx, buildTuple(self, false, srcIP, dstIP, srcPort, dstPort))
+end
+
+--- Get the queue a hash is mapped to.
+function hasher:getQueue(hash)
+	return C.libmoon_toeplitz_get_queue(self.ctx, hash)
+end
+
+--- Hash all packets in a bufArray.
+--- @param bufs the bufArray
+--- @param hashes uint32_t array with at least bufs.size entries
+--- @param flags optional (default = toeplitz.L4_ALL) Protocols for which ports are hashed
+function hasher:hashBufs(bufs, hashes, flags)
+	-- IPv6 tuples (with ports) are the longest input
+	checkInputLen(self, (flags or mod.L4_ALL) ~= 0 and 36 or 32)
+	C.libmoon_toeplitz_hash_bufs(self.ctx, bufs.array, bufs.size, flags or mod.L4_ALL, hashes)
+end
+
+--- Calculate the rx queue of all packets in a bufArray.
+--- @param bufs the bufArray
+--- @param queues uint16_t array with at least bufs.size entries
+--- @param flags optional (default = toeplitz.L4_ALL) Protocols for which ports are hashed
+function hasher:getQueues(bufs, queues, flags)
+	checkInputLen(self, (flags or mod.L4_ALL) ~= 0 and 36 or 32)
+	C.libmoon_toeplitz_queue_bufs(self.ctx, bufs.array, bufs.size, flags or mod.L4_ALL, queues)
+end
+
+local function findPort(self, ip4, srcIP, dstIP, srcPort, dstPort, queue, field)
+	local tuple, len = buildTuple(self, ip4, srcIP, dstIP, srcPort, dstPort)
+	local offset = len - 4 + (field == "dst" and 2 or 0)
+	local start = field == "dst" and dstPort or srcPort
+	local port = C.libmoon_toeplitz_find_field(self.ctx, tuple, len, offset, start, queue)
+	return port >= 0 and port or nil
+end
+
+--- Find a source port such that the given IPv4 flow is received on the given queue.
+--- @param startPort the first port to try, the search wraps around at 65535
+--- @return the port or nil if the queue is not part of the RETA
+function hasher:craftSrcPortIPv4(srcIP, dstIP, startPort, dstPort, queue)
+	return findPort(self, true, srcIP, dstIP, startPort, dstPort, queue, "src")
+end
+
+--- Find a destination port such that the given IPv4 flow is received on the given queue.
+--- @return the port or nil if the queue is not part of the RETA
+function hasher:craftDstPortIPv4(srcIP, dstIP, srcPort, startPort, queue)
+	return findPort(self, true, srcIP, dstIP, srcPort, startPort, queue, "dst")
+end
+
+--- Find a source port such that the given IPv6 flow is received on the given queue.
+--- @return the port or nil if the queue is not part of the RETA
+function hasher:craftSrcPortIPv6(srcIP, dstIP, startPort, dstPort, queue)
+	return findPort(self, false, srcIP, dstIP, startPort, dstPort, queue, "src")
+end
+
+--- Find a destination port such that the given IPv6 flow is received on the given queue.
+--- @return the port or nil if the queue is not part of the RETA
+function hasher:craftDstPortIPv6(srcIP, dstIP, srcPort, startPort, queue)
+	return findPort(self, false, srcIP, dstIP, srcPort, startPort, queue, "dst")
+end
+
+function hasher:__serialize()
+	return ("local toeplitz = require 'toeplitz' return toeplitz.new(%s, %s)"):format(
+		serpent.dumpRaw(self.key), self.reta and serpent.dumpRaw(self.reta) or "nil"
+	), true
+end
+
+return mod
+
@@ -486,15 +486,22 @@ function deepCopy(orig)
 	return copy
 end
 
+--- Simple IMIX (7:4:1) frame sizes including the CRC, used by imixSize() and generator.IMIX.
+imixFrames = { sizes = { 68, 574, 1518 }, weights = { 7, 4, 1 } }
+
+local imixTotalWeight = 0
+for _, weight in ipairs(imixFrames.weights) do
+	imixTotalWeight = imixTotalWeight + weight
+end
+
 -- Generates a random packet size according to IMIX.
 function imixSize()
-	local rnum = math.random(12)
-	if rnum == 1 then         -- 1 in 12 : [1 - 10]   : 10 / 120
-		return 1518
-	elseif rnum <= 5 then     -- 4 in 12 : [11 - 50]  : 40 / 120
-		return 574
-	else                      -- 7 in 12 : [51 - 120] : 70 / 120
-		return 68
+	local rnum = math.random(imixTotalWeight)
+	for i, weight in ipairs(imixFrames.weights) do
+		if rnum <= weight then
+			return imixFrames.sizes[i]
+		end
+		rnum = rnum - weight
 	end
 end
 
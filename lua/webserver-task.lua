@@ -5,6 +5,7 @@ local turbo   = require "turbo"
 local libmoon = require "libmoon"
 local stats   = require "stats"
 local ffi     = require "ffi"
+local dpdkc   = require "dpdkc"
 local log     = require "log"
 
 local HTTPError = turbo.web.HTTPError
@@ -53,48 +54,34 @@ end
 
 local counterHandler = class("counterHandler", turbo.web.RequestHandler)
 
-local counters = {}
-local statsPipe = stats.share.pipe
-local function updateCounters()
+-- counters are read from the native counter table (see counter_table.h) and encoded to JSON there
+local jsonBufSize = 64 * 1024
+local jsonBuf = ffi.new("char[?]", jsonBufSize)
+local function counterJson(id)
 	while true do
-		local data = statsPipe:tryRecv()
-		if not data then
-			break
+		local len = tonumber(dpdkc.libmoon_counter_table_json(id, jsonBuf, jsonBufSize))
+		if len < jsonBufSize then
+			return ffi.string(jsonBuf, len)
 		end
-		counters[data.id] = counters[data.id] or {
-			id = data.id,
-			name = data.name,
-			direction = data.dir,
-			data = {}
-		}
-		table.insert(counters[data.id].data, data)
-		-- do not repeat these values for every entry
-		data.id = nil
-		data.name = nil
-		data.dir = nil
+		-- counters may be added between the two calls
+		jsonBufSize = len * 2
+		jsonBuf = ffi.new("char[?]", jsonBufSize)
 	end
 end
 
-local function counterInfo(id)
-	return counters[id] or {}
-end
-
-
 function counterHandler:get(id)
 	if id == "all" then
-		local result = {}
-		for i = 1, stats.numCounters() do
-			result[#result + 1] = counterInfo(i)
-		end
-		self:write(result)
+		self:set_header("Content-Type", "application/json")
+		self:write(counterJson(0))
 	elseif id == "num" then
 		self:write({num = stats.numCounters()})
 	elseif tonumber(id) then
 		local id = tonumber(id)
-		if id > stats.numCounters() then
+		if id < 1 or id > stats.numCounters() then
 			error(HTTPError(400, {message = ("there are only %d counters"):format(stats.numCounters())}))
 		end
-		self:write(counterInfo(id))
+		self:set_header("Content-Type", "application/json")
+		self:write(counterJson(id))
 	else
 		self:set_status(400)	
 	end
@@ -122,7 +109,6 @@ function mod.webserverTask(options, ...)
 	local application = turbo.web.Application:new(handlers)
 	application:listen(options.port, options.bind, {})
 	local ioloop = turbo.ioloop.instance()
-	ioloop:set_interval(500, updateCounters)
 	ioloop:set_interval(50, function()
 		if not libmoon.running() then
 			ioloop:close()
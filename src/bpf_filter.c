@@ -0,0 +1,380 @@
+#include <stdint.h>
+#include <string.h>
+
+#include <rte_config.h>
+#include <rte_common.h>
+#include <rte_malloc.h>
+#include <rte_mbuf.h>
+#include <rte_byteorder.h>
+#include <rte_prefetch.h>
+
+#include "bpf_filter.h"
+
+// classic BPF opcodes, see linux/filter.h
+#define BPF_CLASS(code) ((code) & 0x07)
+#define BPF_LD 0x00
+#define BPF_LDX 0x01
+#define BPF_ST 0x02
+#define BPF_STX 0x03
+#define BPF_ALU 0x04
+#define BPF_JMP 0x05
+#define BPF_RET 0x06
+#define BPF_MISC 0x07
+
+#define BPF_SIZE(code) ((code) & 0x18)
+#define BPF_W 0x00
+#define BPF_H 0x08
+#define BPF_B 0x10
+
+#define BPF_MODE(code) ((code) & 0xe0)
+#define BPF_IMM 0x00
+#define BPF_ABS 0x20
+#define BPF_IND 0x40
+#define BPF_MEM 0x60
+#define BPF_LEN 0x80
+#define BPF_MSH 0xa0
+
+#define BPF_OP(code) ((code) & 0xf0)
+#define BPF_ADD 0x00
+#define BPF_SUB 0x10
+#define BPF_MUL 0x20
+#define BPF_DIV 0x30
+#define BPF_OR 0x40
+#define BPF_AND 0x50
+#define BPF_LSH 0x60
+#define BPF_RSH 0x70
+#define BPF_NEG 0x80
+#define BPF_MOD 0x90
+#define BPF_XOR 0xa0
+
+#define BPF_JA 0x00
+#define BPF_JEQ 0x10
+#define BPF_JGT 0x20
+#define BPF_JGE 0x30
+#define BPF_JSET 0x40
+
+#define BPF_SRC(code) ((code) & 0x08)
+#define BPF_K 0x00
+#define BPF_X 0x08
+
+#define BPF_RVAL(code) ((code) & 0x18)
+#define BPF_A 0x10
+
+#define BPF_MISCOP(code) ((code) & 0xf8)
+#define BPF_TAX 0x00
+#define BPF_TXA 0x80
+
+#define BPF_MEMWORDS 16
+#define BPF_MAXINSNS 4096
+
+#define PREFETCH_OFFSET 4
+
+// the program is translated into a dense opcode per instruction and absolute jump targets,
+// this allows direct threaded dispatch (one indirect jump per instruction, no decoding at runtime)
+#define BPF_OPS(X) \
+	X(LD_W_ABS) X(LD_H_ABS) X(LD_B_ABS) X(LD_W_IND) X(LD_H_IND) X(LD_B_IND) \
+	X(LD_IMM) X(LD_MEM) X(LD_LEN) X(LDX_IMM) X(LDX_MEM) X(LDX_LEN) X(LDX_MSH) X(ST) X(STX) \
+	X(ADD_K) X(SUB_K) X(MUL_K) X(DIV_K) X(MOD_K) X(AND_K) X(OR_K) X(XOR_K) X(LSH_K) X(RSH_K) \
+	X(ADD_X) X(SUB_X) X(MUL_X) X(DIV_X) X(MOD_X) X(AND_X) X(OR_X) X(XOR_X) X(LSH_X) X(RSH_X) \
+	X(NEG) X(JA) X(JEQ_K) X(JGT_K) X(JGE_K) X(JSET_K) X(JEQ_X) X(JGT_X) X(JGE_X) X(JSET_X) \
+	X(RET_K) X(RET_A) X(TAX) X(TXA)
+
+#define OP_ENUM(name) OP_##name,
+enum bpf_op {
+	BPF_OPS(OP_ENUM)
+	NUM_OPS
+};
+
+struct insn {
+	uint32_t op;
+	uint32_t k;
+	uint32_t jt;
+	uint32_t jf;
+};
+
+struct libmoon_bpf_filter {
+	uint32_t num_insns;
+	struct insn insns[];
+};
+
+static int translate_ld(uint16_t code) {
+	switch (BPF_MODE(code)) {
+		case BPF_ABS:
+			return BPF_SIZE(code) == BPF_W ? OP_LD_W_ABS : BPF_SIZE(code) == BPF_H ? OP_LD_H_ABS : BPF_SIZE(code) == BPF_B ? OP_LD_B_ABS : -1;
+		case BPF_IND:
+			return BPF_SIZE(code) == BPF_W ? OP_LD_W_IND : BPF_SIZE(code) == BPF_H ? OP_LD_H_IND : BPF_SIZE(code) == BPF_B ? OP_LD_B_IND : -1;
+		case BPF_IMM:
+			return OP_LD_IMM;
+		case BPF_MEM:
+			return OP_LD_MEM;
+		case BPF_LEN:
+			return OP_LD_LEN;
+		default:
+			return -1;
+	}
+}
+
+static int translate_ldx(uint16_t code) {
+	switch (BPF_MODE(code)) {
+		case BPF_IMM:
+			return OP_LDX_IMM;
+		case BPF_MEM:
+			return OP_LDX_MEM;
+		case BPF_LEN:
+			return OP_LDX_LEN;
+		case BPF_MSH:
+			return BPF_SIZE(code) == BPF_B ? OP_LDX_MSH : -1;
+		default:
+			return -1;
+	}
+}
+
+static int translate_alu(uint16_t code) {
+	int x = BPF_SRC(code) == BPF_X;
+	switch (BPF_OP(code)) {
+		case BPF_ADD: return x ? OP_ADD_X : OP_ADD_K;
+		case BPF_SUB: return x ? OP_SUB_X : OP_SUB_K;
+		case BPF_MUL: return x ? OP_MUL_X : OP_MUL_K;
+		case BPF_DIV: return x ? OP_DIV_X : OP_DIV_K;
+		case BPF_MOD: return x ? OP_MOD_X : OP_MOD_K;
+		case BPF_AND: return x ? OP_AND_X : OP_AND_K;
+		case BPF_OR: return x ? OP_OR_X : OP_OR_K;
+		case BPF_XOR: return x ? OP_XOR_X : OP_XOR_K;
+		case BPF_LSH: return x ? OP_LSH_X : OP_LSH_K;
+		case BPF_RSH: return x ? OP_RSH_X : OP_RSH_K;
+		case BPF_NEG: return OP_NEG;
+		default: return -1;
+	}
+}
+
+static int translate_jmp(uint16_t code) {
+	int x = BPF_SRC(code) == BPF_X;
+	switch (BPF_OP(code)) {
+		case BPF_JA: return OP_JA;
+		case BPF_JEQ: return x ? OP_JEQ_X : OP_JEQ_K;
+		case BPF_JGT: return x ? OP_JGT_X : OP_JGT_K;
+		case BPF_JGE: return x ? OP_JGE_X : OP_JGE_K;
+		case BPF_JSET: return x ? OP_JSET_X : OP_JSET_K;
+		default: return -1;
+	}
+}
+
+static int translate(uint16_t code) {
+	switch (BPF_CLASS(code)) {
+		case BPF_LD:
+			return translate_ld(code);
+		case BPF_LDX:
+			return translate_ldx(code);
+		case BPF_ST:
+			return OP_ST;
+		case BPF_STX:
+			return OP_STX;
+		case BPF_ALU:
+			return translate_alu(code);
+		case BPF_JMP:
+			return translate_jmp(code);
+		case BPF_RET:
+			return BPF_RVAL(code) == BPF_K ? OP_RET_K : BPF_RVAL(code) == BPF_A ? OP_RET_A : -1;
+		case BPF_MISC:
+			return BPF_MISCOP(code) == BPF_TAX ? OP_TAX : BPF_MISCOP(code) == BPF_TXA ? OP_TXA : -1;
+		default:
+			return -1;
+	}
+}
+
+struct libmoon_bpf_filter* libmoon_bpf_filter_create(const struct libmoon_bpf_insn* insns, uint32_t num_insns, int socket) {
+	if (!num_insns || num_insns > BPF_MAXINSNS) {
+		return NULL;
+	}
+	struct libmoon_bpf_filter* filter = rte_malloc_socket("bpf_filter", sizeof(*filter) + num_insns * sizeof(struct insn), RTE_CACHE_LINE_SIZE, socket);
+	if (!filter) {
+		return NULL;
+	}
+	filter->num_insns = num_insns;
+	for (uint32_t pc = 0; pc < num_insns; pc++) {
+		const struct libmoon_bpf_insn* in = &insns[pc];
+		struct insn* out = &filter->insns[pc];
+		int op = translate(in->code);
+		if (op < 0) {
+			goto invalid;
+		}
+		out->op = op;
+		out->k = in->k;
+		out->jt = 0;
+		out->jf = 0;
+		switch (op) {
+			case OP_LD_MEM:
+			case OP_LDX_MEM:
+			case OP_ST:
+			case OP_STX:
+				if (in->k >= BPF_MEMWORDS) {
+					goto invalid;
+				}
+				break;
+			case OP_DIV_K:
+			case OP_MOD_K:
+				if (in->k == 0) {
+					goto invalid;
+				}
+				break;
+			case OP_LSH_K:
+			case OP_RSH_K:
+				if (in->k >= 32) {
+					goto invalid;
+				}
+				break;
+			case OP_JA:
+				// only forward jumps, this guarantees termination
+				if (in->k >= num_insns - pc - 1) {
+					goto invalid;
+				}
+				out->jt = pc + 1 + in->k;
+				break;
+			case OP_JEQ_K: case OP_JGT_K: case OP_JGE_K: case OP_JSET_K:
+			case OP_JEQ_X: case OP_JGT_X: case OP_JGE_X: case OP_JSET_X:
+				if (pc + 1 + in->jt >= num_insns || pc + 1 + in->jf >= num_insns) {
+					goto invalid;
+				}
+				out->jt = pc + 1 + in->jt;
+				out->jf = pc + 1 + in->jf;
+				break;
+		}
+	}
+	uint32_t last = filter->insns[num_insns - 1].op;
+	if (last != OP_RET_K && last != OP_RET_A) {
+		goto invalid;
+	}
+	return filter;
+invalid:
+	rte_free(filter);
+	return NULL;
+}
+
+void libmoon_bpf_filter_delete(struct libmoon_bpf_filter* filter) {
+	rte_free(filter);
+}
+
+static inline uint32_t load32(const uint8_t* data) {
+	uint32_t v;
+	memcpy(&v, data, sizeof(v));
+	return rte_be_to_cpu_32(v);
+}
+
+static inline uint16_t load16(const uint8_t* data) {
+	uint16_t v;
+	memcpy(&v, data, sizeof(v));
+	return rte_be_to_cpu_16(v);
+}
+
+static inline uint32_t run(const struct libmoon_bpf_filter* filter, const uint8_t* data, uint32_t wire_len, uint32_t buf_len) {
+#define OP_LABEL(name) &&op_##name,
+	static const void* const labels[NUM_OPS] = { BPF_OPS(OP_LABEL) };
+#undef OP_LABEL
+	const struct insn* insns = filter->insns;
+	const struct insn* pc = insns;
+	uint32_t A = 0;
+	uint32_t X = 0;
+	uint32_t mem[BPF_MEMWORDS] = {0};
+	uint64_t offset;
+#define NEXT() goto *labels[(++pc)->op]
+#define JUMP(target) do { pc = insns + (target); goto *labels[pc->op]; } while (0)
+#define LOAD(offs, size, expr) do { \
+		offset = (offs); \
+		if (unlikely(offset + (size) > buf_len)) { \
+			return 0; \
+		} \
+		A = (expr); \
+		NEXT(); \
+	} while (0)
+	goto *labels[pc->op];
+op_LD_W_ABS: LOAD(pc->k, 4, load32(data + offset));
+op_LD_H_ABS: LOAD(pc->k, 2, load16(data + offset));
+op_LD_B_ABS: LOAD(pc->k, 1, data[offset]);
+op_LD_W_IND: LOAD((uint64_t) X + pc->k, 4, load32(data + offset));
+op_LD_H_IND: LOAD((uint64_t) X + pc->k, 2, load16(data + offset));
+op_LD_B_IND: LOAD((uint64_t) X + pc->k, 1, data[offset]);
+op_LD_IMM: A = pc->k; NEXT();
+op_LD_MEM: A = mem[pc->k]; NEXT();
+op_LD_LEN: A = wire_len; NEXT();
+op_LDX_IMM: X = pc->k; NEXT();
+op_LDX_MEM: X = mem[pc->k]; NEXT();
+op_LDX_LEN: X = wire_len; NEXT();
+op_LDX_MSH:
+	if (unlikely(pc->k >= buf_len)) {
+		return 0;
+	}
+	X = (data[pc->k] & 0x0F) << 2;
+	NEXT();
+op_ST: mem[pc->k] = A; NEXT();
+op_STX: mem[pc->k] = X; NEXT();
+op_ADD_K: A += pc->k; NEXT();
+op_SUB_K: A -= pc->k; NEXT();
+op_MUL_K: A *= pc->k; NEXT();
+op_DIV_K: A /= pc->k; NEXT();
+op_MOD_K: A %= pc->k; NEXT();
+op_AND_K: A &= pc->k; NEXT();
+op_OR_K: A |= pc->k; NEXT();
+op_XOR_K: A ^= pc->k; NEXT();
+op_LSH_K: A <<= pc->k; NEXT();
+op_RSH_K: A >>= pc->k; NEXT();
+op_ADD_X: A += X; NEXT();
+op_SUB_X: A -= X; NEXT();
+op_MUL_X: A *= X; NEXT();
+op_DIV_X:
+	if (unlikely(!X)) {
+		return 0;
+	}
+	A /= X;
+	NEXT();
+op_MOD_X:
+	if (unlikely(!X)) {
+		return 0;
+	}
+	A %= X;
+	NEXT();
+op_AND_X: A &= X; NEXT();
+op_OR_X: A |= X; NEXT();
+op_XOR_X: A ^= X; NEXT();
+op_LSH_X: A = X < 32 ? A << X : 0; NEXT();
+op_RSH_X: A = X < 32 ? A >> X : 0; NEXT();
+op_NEG: A = -A; NEXT();
+op_JA: JUMP(pc->jt);
+op_JEQ_K: JUMP(A == pc->k ? pc->jt : pc->jf);
+op_JGT_K: JUMP(A > pc->k ? pc->jt : pc->jf);
+op_JGE_K: JUMP(A >= pc->k ? pc->jt : pc->jf);
+op_JSET_K: JUMP(A & pc->k ? pc->jt : pc->jf);
+op_JEQ_X: JUMP(A == X ? pc->jt : pc->jf);
+op_JGT_X: JUMP(A > X ? pc->jt : pc->jf);
+op_JGE_X: JUMP(A >= X ? pc->jt : pc->jf);
+op_JSET_X: JUMP(A & X ? pc->jt : pc->jf);
+op_RET_K: return pc->k;
+op_RET_A: return A;
+op_TAX: X = A; NEXT();
+op_TXA: A = X; NEXT();
+#undef NEXT
+#undef JUMP
+#undef LOAD
+}
+
+uint32_t libmoon_bpf_filter_run(struct libmoon_bpf_filter* filter, const uint8_t* data, uint32_t wire_len, uint32_t buf_len) {
+	return run(filter, data, wire_len, buf_len);
+}
+
+uint32_t libmoon_bpf_filter_burst(struct libmoon_bpf_filter* filter, struct rte_mbuf** bufs, uint32_t num_bufs, uint64_t* mask) {
+	uint32_t matches = 0;
+	memset(mask, 0, (num_bufs + 63) / 64 * sizeof(uint64_t));
+	for (uint32_t i = 0; i < RTE_MIN(num_bufs, (uint32_t) PREFETCH_OFFSET); i++) {
+		rte_prefetch0(rte_pktmbuf_mtod(bufs[i], void*));
+	}
+	for (uint32_t i = 0; i < num_bufs; i++) {
+		if (i + PREFETCH_OFFSET < num_bufs) {
+			rte_prefetch0(rte_pktmbuf_mtod(bufs[i + PREFETCH_OFFSET], void*));
+		}
+		struct rte_mbuf* buf = bufs[i];
+		if (run(filter, rte_pktmbuf_mtod(buf, const uint8_t*), buf->pkt_len, buf->data_len)) {
+			mask[i / 64] |= 1ULL << (i % 64);
+			matches++;
+		}
+	}
+	return matches;
+}
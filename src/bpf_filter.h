@@ -0,0 +1,41 @@
+#ifndef MG_BPF_FILTER_H
+#define MG_BPF_FILTER_H
+
+#include <stdint.h>
+#include <rte_config.h>
+#include <rte_mbuf.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// same layout as struct bpf_insn from libpcap/linux
+struct libmoon_bpf_insn {
+	uint16_t code;
+	uint8_t jt;
+	uint8_t jf;
+	uint32_t k;
+};
+
+// classic BPF program that is validated and translated once into a compact internal form
+// filters are read-only after creation and can be used by multiple threads
+struct libmoon_bpf_filter;
+
+// returns NULL if the program is invalid (unknown instructions, backwards or out of range jumps,
+// division by constant 0, invalid scratch memory index, or no return at the end)
+struct libmoon_bpf_filter* libmoon_bpf_filter_create(const struct libmoon_bpf_insn* insns, uint32_t num_insns, int socket);
+void libmoon_bpf_filter_delete(struct libmoon_bpf_filter* filter);
+
+// returns the snap length of the program, i.e. 0 if the packet is rejected
+// loads beyond buf_len reject the packet, wire_len is the value of BPF_LEN
+uint32_t libmoon_bpf_filter_run(struct libmoon_bpf_filter* filter, const uint8_t* data, uint32_t wire_len, uint32_t buf_len);
+
+// runs the filter on the first segment of each mbuf, bit i of the mask (64 bit words) is set if bufs[i] matches
+// returns the number of matching packets
+uint32_t libmoon_bpf_filter_burst(struct libmoon_bpf_filter* filter, struct rte_mbuf** bufs, uint32_t num_bufs, uint64_t* mask);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
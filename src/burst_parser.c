@@ -0,0 +1,243 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <netinet/in.h>
+
+#include <rte_config.h>
+#include <rte_common.h>
+#include <rte_malloc.h>
+#include <rte_mbuf.h>
+#include <rte_ether.h>
+#include <rte_ip.h>
+#include <rte_byteorder.h>
+#include <rte_prefetch.h>
+
+#include "burst_parser.h"
+
+#define MAX_VLAN_TAGS 2
+#define MAX_IPV6_EXT_HEADERS 8
+#define PREFETCH_OFFSET 4
+
+// pre-802.1ad QinQ
+#define ETHER_TYPE_QINQ_OLD 0x9100
+
+static inline bool is_vlan(uint16_t ether_type) {
+	return ether_type == rte_cpu_to_be_16(ETHER_TYPE_VLAN)
+		|| ether_type == rte_cpu_to_be_16(ETHER_TYPE_QINQ)
+		|| ether_type == rte_cpu_to_be_16(ETHER_TYPE_QINQ_OLD);
+}
+
+static inline bool is_ipv6_ext(uint8_t proto) {
+	return proto == IPPROTO_HOPOPTS
+		|| proto == IPPROTO_ROUTING
+		|| proto == IPPROTO_FRAGMENT
+		|| proto == IPPROTO_DSTOPTS
+		|| proto == IPPROTO_AH
+		|| proto == IPPROTO_MH;
+}
+
+static inline uint32_t get_l4_ptype(uint8_t proto) {
+	switch (proto) {
+		case IPPROTO_TCP:
+			return RTE_PTYPE_L4_TCP;
+		case IPPROTO_UDP:
+			return RTE_PTYPE_L4_UDP;
+		case IPPROTO_SCTP:
+			return RTE_PTYPE_L4_SCTP;
+		case IPPROTO_ICMP:
+		case IPPROTO_ICMPV6:
+			return RTE_PTYPE_L4_ICMP;
+		default:
+			return RTE_PTYPE_L4_NONFRAG;
+	}
+}
+
+// parses Ethernet, up to two VLAN tags, IPv4/IPv6 (including extension headers), and the ports of TCP/UDP/SCTP
+// ports are 0 for all fragments to get the same key for all fragments of a packet
+// returns 0 for IP packets, the L3 fields are valid even if the L4 header is truncated
+int libmoon_parse_packet(struct rte_mbuf* buf, struct libmoon_parsed_packet* result) {
+	uint8_t* data = rte_pktmbuf_mtod(buf, uint8_t*);
+	uint32_t len = buf->data_len;
+	uint32_t offset = sizeof(struct ether_hdr);
+	memset(result, 0, sizeof(*result));
+	if (len < offset) {
+		return -1;
+	}
+	uint16_t ether_type = ((struct ether_hdr*) data)->ether_type;
+	int tags = 0;
+	while (is_vlan(ether_type) && tags < MAX_VLAN_TAGS) {
+		if (len < offset + sizeof(struct vlan_hdr)) {
+			return -1;
+		}
+		struct vlan_hdr* vlan = (struct vlan_hdr*) (data + offset);
+		if (tags == 0) {
+			result->outer_vlan = rte_be_to_cpu_16(vlan->vlan_tci);
+		} else {
+			result->inner_vlan = rte_be_to_cpu_16(vlan->vlan_tci);
+		}
+		ether_type = vlan->eth_proto;
+		offset += sizeof(struct vlan_hdr);
+		tags++;
+	}
+	result->ptype = tags == 0 ? RTE_PTYPE_L2_ETHER : tags == 1 ? RTE_PTYPE_L2_ETHER_VLAN : RTE_PTYPE_L2_ETHER_QINQ;
+	struct libmoon_flow_key* key = &result->key;
+	bool fragment = false;
+	bool first_fragment = true;
+	uint8_t proto;
+	if (ether_type == rte_cpu_to_be_16(ETHER_TYPE_IPv4)) {
+		if (len < offset + sizeof(struct ipv4_hdr)) {
+			return -1;
+		}
+		struct ipv4_hdr* ip = (struct ipv4_hdr*) (data + offset);
+		uint32_t ihl = (ip->version_ihl & 0x0F) * 4;
+		if (ihl < sizeof(struct ipv4_hdr)) {
+			return -1;
+		}
+		result->l3_offset = offset;
+		result->ptype |= ihl > sizeof(struct ipv4_hdr) ? RTE_PTYPE_L3_IPV4_EXT : RTE_PTYPE_L3_IPV4;
+		key->ip_version = 4;
+		memcpy(key->src_ip, &ip->src_addr, 4);
+		memcpy(key->dst_ip, &ip->dst_addr, 4);
+		proto = ip->next_proto_id;
+		uint16_t frag = rte_be_to_cpu_16(ip->fragment_offset);
+		fragment = frag & (IPV4_HDR_MF_FLAG | IPV4_HDR_OFFSET_MASK);
+		first_fragment = !(frag & IPV4_HDR_OFFSET_MASK);
+		offset += ihl;
+	} else if (ether_type == rte_cpu_to_be_16(ETHER_TYPE_IPv6)) {
+		if (len < offset + sizeof(struct ipv6_hdr)) {
+			return -1;
+		}
+		struct ipv6_hdr* ip = (struct ipv6_hdr*) (data + offset);
+		result->l3_offset = offset;
+		result->ptype |= RTE_PTYPE_L3_IPV6;
+		key->ip_version = 6;
+		memcpy(key->src_ip, ip->src_addr, 16);
+		memcpy(key->dst_ip, ip->dst_addr, 16);
+		proto = ip->proto;
+		offset += sizeof(struct ipv6_hdr);
+		for (int i = 0; i < MAX_IPV6_EXT_HEADERS && is_ipv6_ext(proto); i++) {
+			if (len < offset + 8) {
+				// truncated, we don't know the L4 protocol
+				key->proto = proto;
+				return 0;
+			}
+			uint8_t* ext = data + offset;
+			result->ptype = (result->ptype & ~RTE_PTYPE_L3_MASK) | RTE_PTYPE_L3_IPV6_EXT;
+			if (proto == IPPROTO_FRAGMENT) {
+				fragment = true;
+				first_fragment = !(rte_be_to_cpu_16(*(uint16_t*) (ext + 2)) & 0xFFF8);
+				offset += 8;
+			} else if (proto == IPPROTO_AH) {
+				offset += (ext[1] + 2) * 4;
+			} else {
+				offset += (ext[1] + 1) * 8;
+			}
+			proto = ext[0];
+		}
+	} else {
+		return -1;
+	}
+	key->proto = proto;
+	if (fragment) {
+		result->ptype |= RTE_PTYPE_L4_FRAG;
+		if (!first_fragment) {
+			return 0;
+		}
+	} else {
+		result->ptype |= get_l4_ptype(proto);
+	}
+	if (len < offset + 4) {
+		return 0;
+	}
+	result->l4_offset = offset;
+	if (!fragment && (proto == IPPROTO_TCP || proto == IPPROTO_UDP || proto == IPPROTO_SCTP)) {
+		key->src_port = rte_be_to_cpu_16(*(uint16_t*) (data + offset));
+		key->dst_port = rte_be_to_cpu_16(*(uint16_t*) (data + offset + 2));
+	}
+	return 0;
+}
+
+struct libmoon_flow_keys* libmoon_flow_keys_create(uint32_t capacity, int socket) {
+	// all arrays in one allocation, sorted by alignment
+	size_t size = RTE_ALIGN(sizeof(struct libmoon_flow_keys), 16)
+		+ capacity * (16 + 16 + sizeof(uint32_t) * 2 + sizeof(uint16_t) * 6 + 2);
+	struct libmoon_flow_keys* keys = rte_zmalloc_socket("flow_keys", size, RTE_CACHE_LINE_SIZE, socket);
+	if (!keys) {
+		return NULL;
+	}
+	uint8_t* ptr = (uint8_t*) keys + RTE_ALIGN(sizeof(struct libmoon_flow_keys), 16);
+	keys->capacity = capacity;
+	keys->src_ip = (uint8_t (*)[16]) ptr;
+	ptr += capacity * 16;
+	keys->dst_ip = (uint8_t (*)[16]) ptr;
+	ptr += capacity * 16;
+	keys->ptype = (uint32_t*) ptr;
+	ptr += capacity * sizeof(uint32_t);
+	keys->hash = (uint32_t*) ptr;
+	ptr += capacity * sizeof(uint32_t);
+	keys->src_port = (uint16_t*) ptr;
+	ptr += capacity * sizeof(uint16_t);
+	keys->dst_port = (uint16_t*) ptr;
+	ptr += capacity * sizeof(uint16_t);
+	keys->l3_offset = (uint16_t*) ptr;
+	ptr += capacity * sizeof(uint16_t);
+	keys->l4_offset = (uint16_t*) ptr;
+	ptr += capacity * sizeof(uint16_t);
+	keys->outer_vlan = (uint16_t*) ptr;
+	ptr += capacity * sizeof(uint16_t);
+	keys->inner_vlan = (uint16_t*) ptr;
+	ptr += capacity * sizeof(uint16_t);
+	keys->proto = ptr;
+	ptr += capacity;
+	keys->ip_version = ptr;
+	return keys;
+}
+
+void libmoon_flow_keys_delete(struct libmoon_flow_keys* keys) {
+	rte_free(keys);
+}
+
+// returns the number of IP packets, at most capacity packets are parsed
+uint32_t libmoon_parse_burst(struct libmoon_flow_keys* keys, struct rte_mbuf** bufs, uint32_t num_bufs) {
+	uint32_t n = RTE_MIN(num_bufs, keys->capacity);
+	uint32_t num_ip = 0;
+	for (uint32_t i = 0; i < RTE_MIN(n, (uint32_t) PREFETCH_OFFSET); i++) {
+		rte_prefetch0(rte_pktmbuf_mtod(bufs[i], void*));
+	}
+	for (uint32_t i = 0; i < n; i++) {
+		if (i + PREFETCH_OFFSET < n) {
+			rte_prefetch0(rte_pktmbuf_mtod(bufs[i + PREFETCH_OFFSET], void*));
+		}
+		struct libmoon_parsed_packet pkt;
+		int rc = libmoon_parse_packet(bufs[i], &pkt);
+		memcpy(keys->src_ip[i], pkt.key.src_ip, 16);
+		memcpy(keys->dst_ip[i], pkt.key.dst_ip, 16);
+		keys->src_port[i] = pkt.key.src_port;
+		keys->dst_port[i] = pkt.key.dst_port;
+		keys->proto[i] = pkt.key.proto;
+		keys->ip_version[i] = pkt.key.ip_version;
+		keys->l3_offset[i] = pkt.l3_offset;
+		keys->l4_offset[i] = pkt.l4_offset;
+		keys->outer_vlan[i] = pkt.outer_vlan;
+		keys->inner_vlan[i] = pkt.inner_vlan;
+		keys->ptype[i] = pkt.ptype;
+		if (rc == 0) {
+			keys->hash[i] = libmoon_flow_key_hash(&pkt.key);
+			num_ip++;
+		} else {
+			keys->hash[i] = 0;
+		}
+	}
+	keys->num = n;
+	return num_ip;
+}
+
+void libmoon_flow_keys_get(struct libmoon_flow_keys* keys, uint32_t idx, struct libmoon_flow_key* key) {
+	memset(key, 0, sizeof(*key));
+	memcpy(key->src_ip, keys->src_ip[idx], 16);
+	memcpy(key->dst_ip, keys->dst_ip[idx], 16);
+	key->src_port = keys->src_port[idx];
+	key->dst_port = keys->dst_port[idx];
+	key->proto = keys->proto[idx];
+	key->ip_version = keys->ip_version[idx];
+}
@@ -0,0 +1,56 @@
+#ifndef MG_BURST_PARSER_H
+#define MG_BURST_PARSER_H
+
+#include <stdint.h>
+#include <rte_config.h>
+#include <rte_mbuf.h>
+
+#include "flow_table.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct libmoon_parsed_packet {
+	struct libmoon_flow_key key;
+	uint16_t l3_offset;
+	// 0 if there is no L4 header (non-first fragments, unknown protocols, truncated packets)
+	uint16_t l4_offset;
+	// vlan tci in host byte order, 0 if not present
+	uint16_t outer_vlan;
+	uint16_t inner_vlan;
+	// RTE_PTYPE_* flags
+	uint32_t ptype;
+};
+
+// flow keys of a burst as structure of arrays, index i corresponds to the i-th mbuf
+// ip_version is 0 for non-IP packets, hash is the flow table hash of the key (0 for non-IP packets)
+struct libmoon_flow_keys {
+	uint32_t capacity;
+	uint32_t num;
+	uint8_t (*src_ip)[16];
+	uint8_t (*dst_ip)[16];
+	uint16_t* src_port;
+	uint16_t* dst_port;
+	uint8_t* proto;
+	uint8_t* ip_version;
+	uint16_t* l3_offset;
+	uint16_t* l4_offset;
+	uint16_t* outer_vlan;
+	uint16_t* inner_vlan;
+	uint32_t* ptype;
+	uint32_t* hash;
+};
+
+int libmoon_parse_packet(struct rte_mbuf* buf, struct libmoon_parsed_packet* result);
+
+struct libmoon_flow_keys* libmoon_flow_keys_create(uint32_t capacity, int socket);
+void libmoon_flow_keys_delete(struct libmoon_flow_keys* keys);
+uint32_t libmoon_parse_burst(struct libmoon_flow_keys* keys, struct rte_mbuf** bufs, uint32_t num_bufs);
+void libmoon_flow_keys_get(struct libmoon_flow_keys* keys, uint32_t idx, struct libmoon_flow_key* key);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,45 @@
+#include <string.h>
+
+#include "core_stats.h"
+
+struct libmoon_core_stats libmoon_core_stats[RTE_MAX_LCORE];
+volatile uint8_t libmoon_core_stats_enabled = 1;
+
+// resets the state of the current lcore, called when a task starts
+void libmoon_core_stats_task_start(const char* task_name) {
+	unsigned lcore = rte_lcore_id();
+	if (lcore >= RTE_MAX_LCORE) {
+		return;
+	}
+	struct libmoon_core_stats* stats = &libmoon_core_stats[lcore];
+	stats->last_tsc = 0;
+	stats->last_busy = 0;
+	strncpy(stats->task_name, task_name, sizeof(stats->task_name) - 1);
+	stats->task_name[sizeof(stats->task_name) - 1] = '\0';
+}
+
+void libmoon_core_stats_enable(uint8_t enabled) {
+	libmoon_core_stats_enabled = enabled;
+}
+
+// copies the counters of an lcore, returns 0 if the lcore never called an instrumented function
+int libmoon_core_stats_get(uint32_t lcore, struct libmoon_core_stats* stats) {
+	if (lcore >= RTE_MAX_LCORE) {
+		return 0;
+	}
+	struct libmoon_core_stats* src = &libmoon_core_stats[lcore];
+	stats->busy_cycles = __atomic_load_n(&src->busy_cycles, __ATOMIC_RELAXED);
+	stats->idle_cycles = __atomic_load_n(&src->idle_cycles, __ATOMIC_RELAXED);
+	stats->busy_calls = __atomic_load_n(&src->busy_calls, __ATOMIC_RELAXED);
+	stats->empty_calls = __atomic_load_n(&src->empty_calls, __ATOMIC_RELAXED);
+	stats->packets = __atomic_load_n(&src->packets, __ATOMIC_RELAXED);
+	stats->last_tsc = 0;
+	stats->last_busy = 0;
+	memcpy(stats->task_name, src->task_name, sizeof(stats->task_name));
+	stats->task_name[sizeof(stats->task_name) - 1] = '\0';
+	return stats->busy_calls + stats->empty_calls > 0;
+}
+
+uint32_t libmoon_core_stats_max_cores() {
+	return RTE_MAX_LCORE;
+}
@@ -0,0 +1,70 @@
+#ifndef MG_CORE_STATS_H
+#define MG_CORE_STATS_H
+
+#include <stdint.h>
+#include <rte_config.h>
+#include <rte_common.h>
+#include <rte_branch_prediction.h>
+#include <rte_cycles.h>
+#include <rte_lcore.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// per-lcore cycle accounting for rx/tx/pipe calls
+// the time between two calls is busy if either call returned packets, idle otherwise
+struct libmoon_core_stats {
+	uint64_t busy_cycles;
+	uint64_t idle_cycles;
+	uint64_t busy_calls;
+	uint64_t empty_calls;
+	uint64_t packets;
+	uint64_t last_tsc;
+	uint8_t last_busy;
+	char task_name[39];
+} __rte_cache_aligned;
+
+extern struct libmoon_core_stats libmoon_core_stats[RTE_MAX_LCORE];
+extern volatile uint8_t libmoon_core_stats_enabled;
+
+void libmoon_core_stats_task_start(const char* task_name);
+void libmoon_core_stats_enable(uint8_t enabled);
+int libmoon_core_stats_get(uint32_t lcore, struct libmoon_core_stats* stats);
+uint32_t libmoon_core_stats_max_cores();
+
+// called by the instrumented functions with the number of packets (or objects) they handled
+static inline void libmoon_core_stats_record(uint32_t n) {
+	if (!libmoon_core_stats_enabled) {
+		return;
+	}
+	unsigned lcore = rte_lcore_id();
+	if (unlikely(lcore >= RTE_MAX_LCORE)) {
+		return;
+	}
+	struct libmoon_core_stats* stats = &libmoon_core_stats[lcore];
+	uint64_t now = rte_rdtsc();
+	// only the owning thread writes, atomic stores prevent torn reads in the stats task
+	if (likely(stats->last_tsc)) {
+		uint64_t delta = now - stats->last_tsc;
+		if (n || stats->last_busy) {
+			__atomic_store_n(&stats->busy_cycles, stats->busy_cycles + delta, __ATOMIC_RELAXED);
+		} else {
+			__atomic_store_n(&stats->idle_cycles, stats->idle_cycles + delta, __ATOMIC_RELAXED);
+		}
+	}
+	if (n) {
+		__atomic_store_n(&stats->busy_calls, stats->busy_calls + 1, __ATOMIC_RELAXED);
+		__atomic_store_n(&stats->packets, stats->packets + n, __ATOMIC_RELAXED);
+	} else {
+		__atomic_store_n(&stats->empty_calls, stats->empty_calls + 1, __ATOMIC_RELAXED);
+	}
+	stats->last_tsc = now;
+	stats->last_busy = n > 0;
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,178 @@
+#include <stdint.h>
+#include <inttypes.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+
+#include <rte_config.h>
+#include <rte_cycles.h>
+
+#include "counter_table.h"
+
+struct counter_slot {
+	// odd while the writer updates the slot
+	uint32_t seq;
+	uint8_t used;
+	struct libmoon_counter_snapshot data;
+} __attribute__((aligned(64)));
+
+static struct counter_slot counters[LIBMOON_MAX_COUNTERS + 1];
+static uint32_t max_id;
+
+static inline void write_begin(struct counter_slot* slot) {
+	__atomic_store_n(&slot->seq, slot->seq + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+static inline void write_end(struct counter_slot* slot) {
+	__atomic_store_n(&slot->seq, slot->seq + 1, __ATOMIC_RELEASE);
+}
+
+int libmoon_counter_table_register(uint32_t id, const char* name, const char* direction, int32_t device) {
+	if (id == 0 || id > LIBMOON_MAX_COUNTERS) {
+		return -1;
+	}
+	struct counter_slot* slot = &counters[id];
+	write_begin(slot);
+	memset(&slot->data, 0, sizeof(slot->data));
+	snprintf(slot->data.name, sizeof(slot->data.name), "%s", name);
+	snprintf(slot->data.direction, sizeof(slot->data.direction), "%s", direction);
+	slot->data.device = device;
+	write_end(slot);
+	__atomic_store_n(&slot->used, 1, __ATOMIC_RELEASE);
+	uint32_t cur = __atomic_load_n(&max_id, __ATOMIC_RELAXED);
+	while (cur < id && !__atomic_compare_exchange_n(&max_id, &cur, id, 1, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+	return 0;
+}
+
+void libmoon_counter_table_update(uint32_t id, uint64_t packets, uint64_t bytes, double mpps, double mbit, double wire_mbit, double time) {
+	if (id == 0 || id > LIBMOON_MAX_COUNTERS) {
+		return;
+	}
+	struct counter_slot* slot = &counters[id];
+	write_begin(slot);
+	slot->data.packets = packets;
+	slot->data.bytes = bytes;
+	slot->data.mpps = mpps;
+	slot->data.mbit = mbit;
+	slot->data.wire_mbit = wire_mbit;
+	slot->data.time = time;
+	slot->data.updates++;
+	write_end(slot);
+}
+
+int libmoon_counter_table_get(uint32_t id, struct libmoon_counter_snapshot* snapshot) {
+	if (id == 0 || id > LIBMOON_MAX_COUNTERS || !__atomic_load_n(&counters[id].used, __ATOMIC_ACQUIRE)) {
+		return -1;
+	}
+	struct counter_slot* slot = &counters[id];
+	while (1) {
+		uint32_t seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+		if (seq & 1) {
+			rte_pause();
+			continue;
+		}
+		memcpy(snapshot, &slot->data, sizeof(*snapshot));
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		if (__atomic_load_n(&slot->seq, __ATOMIC_RELAXED) == seq) {
+			return 0;
+		}
+		rte_pause();
+	}
+}
+
+uint32_t libmoon_counter_table_size() {
+	return __atomic_load_n(&max_id, __ATOMIC_ACQUIRE);
+}
+
+struct json_buf {
+	char* buf;
+	size_t len;
+	size_t pos;
+};
+
+static void __attribute__((format(printf, 2, 3))) append(struct json_buf* out, const char* fmt, ...) {
+	va_list ap;
+	va_start(ap, fmt);
+	int n = vsnprintf(out->pos < out->len ? out->buf + out->pos : NULL, out->pos < out->len ? out->len - out->pos : 0, fmt, ap);
+	va_end(ap);
+	if (n > 0) {
+		out->pos += n;
+	}
+}
+
+static inline void append_char(struct json_buf* out, char c) {
+	if (out->pos + 1 < out->len) {
+		out->buf[out->pos] = c;
+		out->buf[out->pos + 1] = 0;
+	}
+	out->pos++;
+}
+
+static void append_string(struct json_buf* out, const char* str, size_t max) {
+	append_char(out, '"');
+	for (size_t i = 0; i < max && str[i]; i++) {
+		unsigned char c = str[i];
+		if (c == '"' || c == '\\') {
+			append(out, "\\%c", c);
+		} else if (c < 0x20) {
+			append(out, "\\u%04x", c);
+		} else {
+			append_char(out, c);
+		}
+	}
+	append_char(out, '"');
+}
+
+static void append_double(struct json_buf* out, const char* key, double value) {
+	if (isfinite(value)) {
+		append(out, ",\"%s\":%.4f", key, value);
+	} else {
+		append(out, ",\"%s\":null", key);
+	}
+}
+
+static void append_counter(struct json_buf* out, uint32_t id) {
+	struct libmoon_counter_snapshot c;
+	if (libmoon_counter_table_get(id, &c)) {
+		append(out, "{}");
+		return;
+	}
+	append(out, "{\"id\":%u,\"name\":", id);
+	append_string(out, c.name, sizeof(c.name));
+	append(out, ",\"direction\":");
+	append_string(out, c.direction, sizeof(c.direction));
+	if (c.device >= 0) {
+		append(out, ",\"device\":%d", c.device);
+	} else {
+		append(out, ",\"device\":null");
+	}
+	append(out, ",\"updates\":%" PRIu64 ",\"packets\":%" PRIu64 ",\"bytes\":%" PRIu64, c.updates, c.packets, c.bytes);
+	append_double(out, "mpps", c.mpps);
+	append_double(out, "mbit", c.mbit);
+	append_double(out, "wireMbit", c.wire_mbit);
+	append_double(out, "time", c.time);
+	append(out, "}");
+}
+
+size_t libmoon_counter_table_json(uint32_t id, char* buf, size_t len) {
+	struct json_buf out = { .buf = buf, .len = len, .pos = 0 };
+	if (len) {
+		buf[0] = 0;
+	}
+	if (id) {
+		append_counter(&out, id);
+		return out.pos;
+	}
+	uint32_t num = libmoon_counter_table_size();
+	append(&out, "[");
+	for (uint32_t i = 1; i <= num; i++) {
+		if (i > 1) {
+			append(&out, ",");
+		}
+		append_counter(&out, i);
+	}
+	append(&out, "]");
+	return out.pos;
+}
@@ -0,0 +1,46 @@
+#ifndef MG_COUNTER_TABLE_H
+#define MG_COUNTER_TABLE_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// latest values of all rx/tx counters (stats.lua) in shared memory for the REST API
+// each counter is written by the task that owns it and protected by a seqlock, readers never block the writer
+
+#define LIBMOON_MAX_COUNTERS 4096
+#define LIBMOON_COUNTER_NAME_SIZE 64
+
+struct libmoon_counter_snapshot {
+	char name[LIBMOON_COUNTER_NAME_SIZE];
+	char direction[8];
+	// -1 if the counter is not associated with a device
+	int32_t device;
+	uint64_t packets;
+	uint64_t bytes;
+	double mpps;
+	double mbit;
+	double wire_mbit;
+	double time;
+	uint64_t updates;
+};
+
+// ids start at 1, returns -1 if the id is out of range
+int libmoon_counter_table_register(uint32_t id, const char* name, const char* direction, int32_t device);
+void libmoon_counter_table_update(uint32_t id, uint64_t packets, uint64_t bytes, double mpps, double mbit, double wire_mbit, double time);
+// consistent copy of a counter, returns -1 if the id is not registered
+int libmoon_counter_table_get(uint32_t id, struct libmoon_counter_snapshot* snapshot);
+// highest registered id
+uint32_t libmoon_counter_table_size();
+// encodes counter id (or all counters as an array if id is 0) as JSON, unregistered counters are encoded as {}
+// returns the length of the full output like snprintf, retry with a larger buffer if it is >= len
+size_t libmoon_counter_table_json(uint32_t id, char* buf, size_t len);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -9,10 +9,15 @@
 #include <rte_eth_ctrl.h>
 #include <rte_pci.h>
 
+#include <errno.h>
+
 #include "rdtsc.h"
 
 #include "device.h"
+#include "filter.h"
 #include "lifecycle.h"
+#include "core_stats.h"
+#include "timestamping_software.h"
 
 // default descriptors per queue
 #define DEFAULT_RX_DESCS 512
@@ -57,12 +62,53 @@ struct libmoon_device_config {
 	uint8_t disable_offloads;
 	uint8_t strip_vlan;
 	uint32_t rss_mask;
+	uint8_t* rss_key;
+	uint8_t rss_key_len;
+	struct libmoon_fdir_config* fdir;
+	uint16_t mtu;
+	uint8_t enable_scatter;
+	uint8_t multi_seg_tx;
+	uint8_t rx_interrupts;
 };
 
+static void apply_fdir_config(struct rte_fdir_conf* fdir_conf, struct libmoon_fdir_config* cfg) {
+	fdir_conf->mode = cfg->mode;
+	fdir_conf->pballoc = cfg->pballoc;
+	fdir_conf->status = cfg->status;
+	fdir_conf->drop_queue = cfg->drop_queue;
+	fdir_conf->mask.vlan_tci_mask = cfg->vlan_tci_mask;
+	fdir_conf->mask.ipv4_mask.src_ip = cfg->src_ipv4_mask;
+	fdir_conf->mask.ipv4_mask.dst_ip = cfg->dst_ipv4_mask;
+	memcpy(fdir_conf->mask.ipv6_mask.src_ip, cfg->src_ipv6_mask, sizeof(cfg->src_ipv6_mask));
+	memcpy(fdir_conf->mask.ipv6_mask.dst_ip, cfg->dst_ipv6_mask, sizeof(cfg->dst_ipv6_mask));
+	fdir_conf->mask.src_port_mask = cfg->src_port_mask;
+	fdir_conf->mask.dst_port_mask = cfg->dst_port_mask;
+	fdir_conf->mask.mac_addr_byte_mask = cfg->mac_addr_byte_mask;
+	fdir_conf->mask.tunnel_type_mask = cfg->tunnel_type_mask;
+	fdir_conf->mask.tunnel_id_mask = cfg->tunnel_id_mask;
+	if (!cfg->flex_custom) {
+		// keep the default flex payload
+		return;
+	}
+	if (cfg->num_flex_offsets) {
+		fdir_conf->flex_conf.flex_set[0].type = cfg->flex_payload_type;
+		memset(fdir_conf->flex_conf.flex_set[0].src_offset, 0, sizeof(fdir_conf->flex_conf.flex_set[0].src_offset));
+		memcpy(fdir_conf->flex_conf.flex_set[0].src_offset, cfg->flex_offsets, cfg->num_flex_offsets * sizeof(uint16_t));
+		// 0 means driver default, see comment on flow_type below
+		if (cfg->flex_flow_type) {
+			fdir_conf->flex_conf.flex_mask[0].flow_type = cfg->flex_flow_type;
+		}
+		memcpy(fdir_conf->flex_conf.flex_mask[0].mask, cfg->flex_mask, sizeof(cfg->flex_mask));
+	} else {
+		fdir_conf->flex_conf.nb_payloads = 0;
+		fdir_conf->flex_conf.nb_flexmasks = 0;
+	}
+}
+
 int dpdk_configure_device(struct libmoon_device_config* cfg) {
 	const char* driver = dpdk_get_driver_name(cfg->port);
 	bool is_i40e_device = strcmp("net_i40e", driver) == 0;
-	// TODO: make fdir configurable
+	// default fdir config, can be overriden by cfg->fdir
 	struct rte_fdir_conf fdir_conf = {
 		.mode = RTE_FDIR_MODE_PERFECT,
 		.pballoc = RTE_FDIR_PBALLOC_64K,
@@ -106,10 +152,15 @@ int dpdk_configure_device(struct libmoon_device_config* cfg) {
 		},
 		.drop_queue = 63,
 	};
+	if (cfg->fdir) {
+		apply_fdir_config(&fdir_conf, cfg->fdir);
+	}
 
+	// mtu = 0 keeps the standard frame size
+	uint32_t max_rx_pkt_len = cfg->mtu ? cfg->mtu + ETHER_HDR_LEN + ETHER_CRC_LEN : ETHER_MAX_LEN;
 	struct rte_eth_rss_conf rss_conf = {
-		.rss_key = NULL,
-		.rss_key_len = 0,
+		.rss_key = cfg->rss_key,
+		.rss_key_len = cfg->rss_key_len,
 		.rss_hf = cfg->rss_mask,
 	};
 	struct rte_eth_conf port_conf = {
@@ -119,7 +170,9 @@ int dpdk_configure_device(struct libmoon_device_config* cfg) {
 			.header_split = 0,
 			.hw_ip_checksum = !cfg->disable_offloads,
 			.hw_vlan_filter = 0,
-			.jumbo_frame = 0,
+			.jumbo_frame = max_rx_pkt_len > ETHER_MAX_LEN,
+			.enable_scatter = cfg->enable_scatter,
+			.max_rx_pkt_len = max_rx_pkt_len,
 			.hw_strip_crc = 1,
 			.hw_vlan_strip = cfg->strip_vlan ? 1 : 0,
 		},
@@ -131,10 +184,21 @@ int dpdk_configure_device(struct libmoon_device_config* cfg) {
 		.link_speeds = ETH_LINK_SPEED_AUTONEG,
     	.rx_adv_conf = {
 			.rss_conf = rss_conf,
-		}
+		},
+		.intr_conf = {
+			.rxq = cfg->rx_interrupts,
+		},
 	};
 	int rc = rte_eth_dev_configure(cfg->port, cfg->rx_queues, cfg->tx_queues, &port_conf);
 	if (rc) return rc;
+	if (cfg->mtu) {
+		// some drivers only look at max_rx_pkt_len, others only at the mtu
+		rc = rte_eth_dev_set_mtu(cfg->port, cfg->mtu);
+		if (rc && rc != -ENOTSUP) {
+			printf("could not set mtu %d\n", cfg->mtu);
+			return rc;
+		}
+	}
 	struct rte_eth_dev_info dev_info;
 	rte_eth_dev_info_get(cfg->port, &dev_info);
 	struct rte_eth_txconf tx_conf = {
@@ -143,7 +207,7 @@ int dpdk_configure_device(struct libmoon_device_config* cfg) {
 			.hthresh = dev_info.default_txconf.tx_thresh.hthresh,
 			.wthresh = dev_info.default_txconf.tx_thresh.wthresh,
 		},
-		.txq_flags = ETH_TXQ_FLAGS_NOMULTSEGS | (cfg->disable_offloads ? ETH_TXQ_FLAGS_NOOFFLOADS : 0),
+		.txq_flags = (cfg->multi_seg_tx ? 0 : ETH_TXQ_FLAGS_NOMULTSEGS) | (cfg->disable_offloads ? ETH_TXQ_FLAGS_NOOFFLOADS : 0),
 	};
 	for (int i = 0; i < cfg->tx_queues; i++) {
 		rc = rte_eth_tx_queue_setup(cfg->port, i, cfg->tx_descs ? cfg->tx_descs : DEFAULT_TX_DESCS, SOCKET_ID_ANY, &tx_conf);
@@ -235,11 +299,15 @@ uint32_t dpdk_get_rte_queue_stat_cntrs_num() {
 // the following functions are static inline function in header files
 // this is the easiest/least ugly way to make them available to luajit (#defining static before including the header breaks stuff)
 uint16_t rte_eth_rx_burst_export(uint8_t port_id, uint16_t queue_id, void* rx_pkts, uint16_t nb_pkts) {
-	return rte_eth_rx_burst(port_id, queue_id, rx_pkts, nb_pkts);
+	uint16_t rx = rte_eth_rx_burst(port_id, queue_id, rx_pkts, nb_pkts);
+	libmoon_core_stats_record(rx);
+	return rx;
 }
 
 uint16_t rte_eth_tx_burst_export(uint8_t port_id, uint16_t queue_id, void* tx_pkts, uint16_t nb_pkts) {
-	return rte_eth_tx_burst(port_id, queue_id, tx_pkts, nb_pkts);
+	uint16_t tx = rte_eth_tx_burst(port_id, queue_id, tx_pkts, nb_pkts);
+	libmoon_core_stats_record(tx);
+	return tx;
 }
 
 void dpdk_send_all_packets(uint8_t port_id, uint16_t queue_id, struct rte_mbuf** pkts, uint16_t num_pkts) {
@@ -247,6 +315,7 @@ void dpdk_send_all_packets(uint8_t port_id, uint16_t queue_id, struct rte_mbuf**
 	while (1) {
 		sent += rte_eth_tx_burst(port_id, queue_id, pkts + sent, num_pkts - sent);
 		if (sent >= num_pkts) {
+			libmoon_core_stats_record(num_pkts);
 			return;
 		}
 	}
@@ -258,6 +327,7 @@ void dpdk_send_single_packet(uint8_t port_id, uint16_t queue_id, struct rte_mbuf
 	while (1) {
 		sent = rte_eth_tx_burst(port_id, queue_id, &pkt, 1);
 		if (sent > 0) {
+			libmoon_core_stats_record(1);
 			return;
 		}
 	}
@@ -268,24 +338,27 @@ void dpdk_send_single_packet(uint8_t port_id, uint16_t queue_id, struct rte_mbuf
 uint16_t dpdk_try_send_single_packet(uint8_t port_id, uint16_t queue_id, struct rte_mbuf* pkt) {
 	uint16_t sent = 0;
 	sent = rte_eth_tx_burst(port_id, queue_id, &pkt, 1);
+	libmoon_core_stats_record(sent);
 	return sent;
 }
 
-// receive packets and save the tsc at the time of the rx call
+// receive packets and save the estimated tsc of their arrival in udata64
 // this prevents potential gc/jit pauses right between the rdtsc and rx calls
+// the packets arrived between the start of the last empty poll and the end of the successful one,
+// see timestamping_software.c for the estimation and libmoon_sw_timestamper_recv() for wall clock time and error bounds
 uint16_t dpdk_receive_with_timestamps_software(uint8_t port_id, uint16_t queue_id, struct rte_mbuf* rx_pkts[], uint16_t nb_pkts) {
-	uint32_t cycles_per_byte = rte_get_tsc_hz() / 10000000.0 / 0.8;
+	double cycles_per_byte = libmoon_sw_get_port_cycles_per_byte(port_id);
+	uint64_t drained = 0;
 	while (is_running(0)) {
-		uint64_t tsc = read_rdtsc();
+		uint64_t start = read_rdtsc();
 		uint16_t rx = rte_eth_rx_burst(port_id, queue_id, rx_pkts, nb_pkts);
-		uint16_t prev_pkt_size = 0;
-		for (int i = 0; i < rx; i++) {
-			rx_pkts[i]->udata64 = tsc + prev_pkt_size * cycles_per_byte;
-			prev_pkt_size = rx_pkts[i]->pkt_len + 24;
-		}
+		uint64_t end = read_rdtsc();
+		libmoon_core_stats_record(rx);
 		if (rx > 0) {
+			libmoon_sw_timestamp_burst(rx_pkts, rx, drained, end, cycles_per_byte);
 			return rx;
 		}
+		drained = start;
 	}
 	return 0;
 }
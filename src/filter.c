@@ -1,10 +1,15 @@
 #include <stdio.h>
 #include <stdint.h>
+#include <stdlib.h>
+#include <stdbool.h>
 #include <inttypes.h>
 
 #include <rte_config.h>
 #include <rte_common.h>
 #include <rte_ethdev.h>
+#include <rte_mbuf.h>
+
+#include "filter.h"
 
 // copy & pasted from dpdk test-pmd/config.c
 
@@ -196,3 +201,123 @@ void fdir_get_infos(uint32_t port_id) {
 	printf("  %s############################%s\n",
 	       fdir_stats_border, fdir_stats_border);
 }
+
+// checks if the device actually uses the requested configuration, some drivers silently ignore parts of it
+int fdir_validate_config(uint32_t port_id, struct libmoon_fdir_config* cfg) {
+	if (rte_eth_dev_filter_supported(port_id, RTE_ETH_FILTER_FDIR) < 0) {
+		if (cfg->mode == RTE_FDIR_MODE_NONE) {
+			return 0;
+		}
+		printf("FDIR is not supported on port %d\n", port_id);
+		return -ENOTSUP;
+	}
+	struct rte_eth_fdir_info fdir_info;
+	memset(&fdir_info, 0, sizeof(fdir_info));
+	int ret = rte_eth_dev_filter_ctrl(port_id, RTE_ETH_FILTER_FDIR, RTE_ETH_FILTER_INFO, &fdir_info);
+	if (ret) {
+		printf("could not read FDIR infos of port %d\n", port_id);
+		return ret;
+	}
+	if (fdir_info.mode != cfg->mode) {
+		printf("requested FDIR mode %d but port %d uses mode %d\n", cfg->mode, port_id, fdir_info.mode);
+		return -EINVAL;
+	}
+	if (cfg->mode == RTE_FDIR_MODE_NONE) {
+		return 0;
+	}
+	if (!cfg->flex_custom) {
+		// default flex payload, the driver-specific defaults in dpdk_configure_device() work on all supported NICs
+		return 0;
+	}
+	if (fdir_info.max_flexpayload && cfg->num_flex_offsets > fdir_info.max_flexpayload) {
+		printf("port %d supports only %"PRIu32" flex payload bytes, requested %d\n", port_id, fdir_info.max_flexpayload, cfg->num_flex_offsets);
+		return -EINVAL;
+	}
+	for (int i = 0; i < cfg->num_flex_offsets; i++) {
+		if (fdir_info.flex_payload_limit && cfg->flex_offsets[i] >= fdir_info.flex_payload_limit) {
+			printf("flex payload offset %d is beyond the limit of port %d (%d)\n", cfg->flex_offsets[i], port_id, fdir_info.flex_payload_limit);
+			return -EINVAL;
+		}
+	}
+	if (cfg->flex_flow_type != RTE_ETH_FLOW_UNKNOWN && !(fdir_info.flow_types_mask[0] & (1 << cfg->flex_flow_type))) {
+		printf("flow type %s is not supported for flex masks on port %d\n", flowtype_to_str(cfg->flex_flow_type), port_id);
+		return -EINVAL;
+	}
+	return 0;
+}
+
+// per-rule hit counters, indexed by the soft id reported by the NIC in the mbuf
+static uint64_t* fdir_hits[RTE_MAX_ETHPORTS];
+
+static uint64_t* get_hit_counters(uint8_t port_id) {
+	uint64_t* hits = __atomic_load_n(&fdir_hits[port_id], __ATOMIC_ACQUIRE);
+	if (unlikely(!hits)) {
+		uint64_t* new_hits = calloc(FDIR_MAX_RULE_ID, sizeof(uint64_t));
+		uint64_t* expected = NULL;
+		if (__atomic_compare_exchange_n(&fdir_hits[port_id], &expected, new_hits, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+			hits = new_hits;
+		} else {
+			// somebody else was faster
+			free(new_hits);
+			hits = expected;
+		}
+	}
+	return hits;
+}
+
+// rule ids in use per port, one bit per id, shared by all tasks
+static uint64_t fdir_used_ids[RTE_MAX_ETHPORTS][FDIR_MAX_RULE_ID / 64];
+
+uint32_t fdir_alloc_rule_id(uint8_t port_id) {
+	uint64_t* used = fdir_used_ids[port_id];
+	for (uint32_t i = 0; i < FDIR_MAX_RULE_ID / 64; i++) {
+		// ids below FDIR_FIRST_RULE_ID are never handed out
+		uint64_t reserved = i == 0 ? (1ULL << FDIR_FIRST_RULE_ID) - 1 : 0;
+		uint64_t cur = __atomic_load_n(&used[i], __ATOMIC_RELAXED);
+		while (~(cur | reserved)) {
+			uint32_t bit = __builtin_ctzll(~(cur | reserved));
+			if (__atomic_compare_exchange_n(&used[i], &cur, cur | (1ULL << bit), false, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+				uint32_t rule_id = i * 64 + bit;
+				// the id may have been used by a deleted rule before
+				__atomic_store_n(&get_hit_counters(port_id)[rule_id], 0, __ATOMIC_RELAXED);
+				return rule_id;
+			}
+		}
+	}
+	printf("all %d fdir rule ids of port %d are in use\n", FDIR_MAX_RULE_ID - FDIR_FIRST_RULE_ID, port_id);
+	return FDIR_NO_RULE_ID;
+}
+
+void fdir_free_rule_id(uint8_t port_id, uint32_t rule_id) {
+	if (rule_id < FDIR_FIRST_RULE_ID || rule_id >= FDIR_MAX_RULE_ID) {
+		return;
+	}
+	__atomic_fetch_and(&fdir_used_ids[port_id][rule_id / 64], ~(1ULL << (rule_id % 64)), __ATOMIC_RELAXED);
+}
+
+// requires RTE_FDIR_REPORT_STATUS (default) and rules with report_status = RTE_ETH_FDIR_REPORT_ID
+// only i40e reports the soft id (PKT_RX_FDIR_ID and hash.fdir.hi), packets from other drivers are never counted
+void fdir_count_hits(uint8_t port_id, struct rte_mbuf** bufs, uint32_t num_bufs) {
+	uint64_t* hits = get_hit_counters(port_id);
+	for (uint32_t i = 0; i < num_bufs; i++) {
+		struct rte_mbuf* buf = bufs[i];
+		if ((buf->ol_flags & PKT_RX_FDIR_ID) && buf->hash.fdir.hi < FDIR_MAX_RULE_ID) {
+			// counters are shared between all rx queues of a device
+			__atomic_fetch_add(&hits[buf->hash.fdir.hi], 1, __ATOMIC_RELAXED);
+		}
+	}
+}
+
+uint64_t fdir_get_hits(uint8_t port_id, uint32_t rule_id) {
+	if (rule_id >= FDIR_MAX_RULE_ID) {
+		return 0;
+	}
+	return __atomic_load_n(&get_hit_counters(port_id)[rule_id], __ATOMIC_RELAXED);
+}
+
+void fdir_reset_hits(uint8_t port_id, uint32_t rule_id) {
+	if (rule_id >= FDIR_MAX_RULE_ID) {
+		return;
+	}
+	__atomic_store_n(&get_hit_counters(port_id)[rule_id], 0, __ATOMIC_RELAXED);
+}
@@ -0,0 +1,58 @@
+#ifndef MG_FILTER_H
+#define MG_FILTER_H
+
+#include <stdint.h>
+#include <rte_config.h>
+#include <rte_mbuf.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// ids of fdir rules for which we count hits
+#define FDIR_MAX_RULE_ID 8192
+// ids below are reserved for internal filters (e.g., timestamping)
+#define FDIR_FIRST_RULE_ID 16
+// returned by fdir_alloc_rule_id() if all ids are in use
+#define FDIR_NO_RULE_ID UINT32_MAX
+
+// flat version of struct rte_fdir_conf that is easier to fill from lua
+// all masks are in big endian, like in struct rte_eth_fdir_masks
+struct libmoon_fdir_config {
+	uint8_t mode;
+	uint8_t pballoc;
+	uint8_t status;
+	uint8_t drop_queue;
+	uint16_t vlan_tci_mask;
+	uint16_t src_port_mask;
+	uint16_t dst_port_mask;
+	uint8_t mac_addr_byte_mask;
+	uint8_t tunnel_type_mask;
+	uint32_t tunnel_id_mask;
+	uint32_t src_ipv4_mask;
+	uint32_t dst_ipv4_mask;
+	uint32_t src_ipv6_mask[4];
+	uint32_t dst_ipv6_mask[4];
+	uint8_t flex_payload_type;
+	uint8_t num_flex_offsets;
+	uint16_t flex_flow_type;
+	uint16_t flex_offsets[16];
+	uint8_t flex_mask[16];
+	// 0 keeps the default flex payload configuration (2 bytes at offset 42), the flex fields above are ignored
+	uint8_t flex_custom;
+};
+
+void fdir_get_infos(uint32_t port_id);
+int fdir_validate_config(uint32_t port_id, struct libmoon_fdir_config* cfg);
+uint32_t fdir_alloc_rule_id(uint8_t port_id);
+void fdir_free_rule_id(uint8_t port_id, uint32_t rule_id);
+void fdir_count_hits(uint8_t port_id, struct rte_mbuf** bufs, uint32_t num_bufs);
+uint64_t fdir_get_hits(uint8_t port_id, uint32_t rule_id);
+void fdir_reset_hits(uint8_t port_id, uint32_t rule_id);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
+
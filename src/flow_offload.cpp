@@ -0,0 +1,547 @@
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <memory>
+#include <atomic>
+#include <mutex>
+#include <algorithm>
+
+#include <rte_config.h>
+#include <rte_cycles.h>
+#include <rte_lcore.h>
+#include <rte_ethdev.h>
+#include <rte_flow.h>
+#include <rte_mbuf.h>
+#include <rte_ether.h>
+#include <rte_ip.h>
+#include <rte_tcp.h>
+#include <rte_udp.h>
+#include <rte_byteorder.h>
+
+#include "flow_offload.h"
+
+// rte_flow rules with a software fallback for rules the NIC rejects.
+// Rules are never modified after creation. Software rules are matched by rx tasks through an immutable
+// snapshot of the active rules that is swapped on changes. Rx tasks register as readers of the current epoch,
+// a change bumps the epoch and waits for the readers of the old one before it frees the old snapshot and the
+// removed rules (grace period), so at most one snapshot per manager is alive outside of a change.
+
+namespace libmoon {
+	struct flow_rule_slot {
+		libmoon_flow_rule rule;
+		struct rte_flow* flow; // nullptr for software rules
+		bool active;
+		std::atomic<uint64_t> pkts;
+		std::atomic<uint64_t> bytes;
+	};
+
+	using flow_rule_snapshot = std::vector<flow_rule_slot*>;
+
+	// rx tasks in process() by epoch parity, one per lcore (the last one for all non-EAL threads) on its own cache line
+	struct flow_readers {
+		std::atomic<uint32_t> count[2];
+		uint8_t pad[RTE_CACHE_LINE_SIZE - 2 * sizeof(std::atomic<uint32_t>)];
+	};
+
+	// rule ids are the index in the rule table and a generation, ids of removed rules are reused with the next generation
+	const uint32_t ID_INDEX_BITS = 20;
+	const uint32_t ID_INDEX_MASK = (1 << ID_INDEX_BITS) - 1;
+	const uint32_t ID_GEN_MASK = (1 << (31 - ID_INDEX_BITS)) - 1;
+
+	// the fields of a packet that can be matched
+	struct flow_match_key {
+		uint8_t ip_version;
+		uint8_t proto;
+		uint16_t src_port;
+		uint16_t dst_port;
+		uint8_t src_ip[16];
+		uint8_t dst_ip[16];
+	};
+}
+
+using namespace libmoon;
+
+struct libmoon_flow_manager {
+	uint8_t port;
+	std::mutex lock;
+	// nullptr for removed rules
+	std::vector<std::unique_ptr<flow_rule_slot>> rules;
+	std::vector<uint32_t> generations;
+	std::vector<uint32_t> free_ids;
+	std::atomic<flow_rule_snapshot*> sw_rules;
+	std::unique_ptr<flow_rule_snapshot> snapshot;
+	std::atomic<uint64_t> epoch;
+	flow_readers readers[RTE_MAX_LCORE + 1];
+	std::string last_error;
+};
+
+static struct rte_flow* create_hw_rule(uint8_t port, const libmoon_flow_rule* r, std::string& error) {
+	struct rte_flow_attr attr;
+	memset(&attr, 0, sizeof(attr));
+	attr.priority = r->priority;
+	attr.ingress = 1;
+	struct rte_flow_item pattern[4];
+	memset(pattern, 0, sizeof(pattern));
+	struct rte_flow_item_ipv4 ip4_spec, ip4_mask;
+	struct rte_flow_item_ipv6 ip6_spec, ip6_mask;
+	struct rte_flow_item_udp udp_spec, udp_mask;
+	struct rte_flow_item_tcp tcp_spec, tcp_mask;
+	memset(&ip4_spec, 0, sizeof(ip4_spec));
+	memset(&ip4_mask, 0, sizeof(ip4_mask));
+	memset(&ip6_spec, 0, sizeof(ip6_spec));
+	memset(&ip6_mask, 0, sizeof(ip6_mask));
+	memset(&udp_spec, 0, sizeof(udp_spec));
+	memset(&udp_mask, 0, sizeof(udp_mask));
+	memset(&tcp_spec, 0, sizeof(tcp_spec));
+	memset(&tcp_mask, 0, sizeof(tcp_mask));
+	int n = 0;
+	// some NICs (e.g., ConnectX-4) require all layers to be present
+	pattern[n++].type = RTE_FLOW_ITEM_TYPE_ETH;
+	if (r->ip_version == 4) {
+		memcpy(&ip4_spec.hdr.src_addr, r->src_ip, 4);
+		memcpy(&ip4_mask.hdr.src_addr, r->src_ip_mask, 4);
+		memcpy(&ip4_spec.hdr.dst_addr, r->dst_ip, 4);
+		memcpy(&ip4_mask.hdr.dst_addr, r->dst_ip_mask, 4);
+		ip4_spec.hdr.next_proto_id = r->proto;
+		ip4_mask.hdr.next_proto_id = r->proto ? 0xFF : 0;
+		pattern[n].type = RTE_FLOW_ITEM_TYPE_IPV4;
+		pattern[n].spec = &ip4_spec;
+		pattern[n++].mask = &ip4_mask;
+	} else if (r->ip_version == 6) {
+		memcpy(ip6_spec.hdr.src_addr, r->src_ip, 16);
+		memcpy(ip6_mask.hdr.src_addr, r->src_ip_mask, 16);
+		memcpy(ip6_spec.hdr.dst_addr, r->dst_ip, 16);
+		memcpy(ip6_mask.hdr.dst_addr, r->dst_ip_mask, 16);
+		ip6_spec.hdr.proto = r->proto;
+		ip6_mask.hdr.proto = r->proto ? 0xFF : 0;
+		pattern[n].type = RTE_FLOW_ITEM_TYPE_IPV6;
+		pattern[n].spec = &ip6_spec;
+		pattern[n++].mask = &ip6_mask;
+	} else if (r->proto || r->src_port_mask || r->dst_port_mask) {
+		error = "matching L4 fields requires an IP version";
+		return nullptr;
+	}
+	if (r->proto == IPPROTO_UDP) {
+		udp_spec.hdr.src_port = rte_cpu_to_be_16(r->src_port);
+		udp_mask.hdr.src_port = rte_cpu_to_be_16(r->src_port_mask);
+		udp_spec.hdr.dst_port = rte_cpu_to_be_16(r->dst_port);
+		udp_mask.hdr.dst_port = rte_cpu_to_be_16(r->dst_port_mask);
+		pattern[n].type = RTE_FLOW_ITEM_TYPE_UDP;
+		pattern[n].spec = &udp_spec;
+		pattern[n++].mask = &udp_mask;
+	} else if (r->proto == IPPROTO_TCP) {
+		tcp_spec.hdr.src_port = rte_cpu_to_be_16(r->src_port);
+		tcp_mask.hdr.src_port = rte_cpu_to_be_16(r->src_port_mask);
+		tcp_spec.hdr.dst_port = rte_cpu_to_be_16(r->dst_port);
+		tcp_mask.hdr.dst_port = rte_cpu_to_be_16(r->dst_port_mask);
+		pattern[n].type = RTE_FLOW_ITEM_TYPE_TCP;
+		pattern[n].spec = &tcp_spec;
+		pattern[n++].mask = &tcp_mask;
+	} else if (r->src_port_mask || r->dst_port_mask) {
+		error = "ports can only be matched for TCP and UDP";
+		return nullptr;
+	}
+	pattern[n].type = RTE_FLOW_ITEM_TYPE_END;
+
+	struct rte_flow_action actions[4];
+	memset(actions, 0, sizeof(actions));
+	struct rte_flow_action_queue queue;
+	struct rte_flow_action_mark mark;
+	memset(&queue, 0, sizeof(queue));
+	memset(&mark, 0, sizeof(mark));
+	n = 0;
+	switch (r->action) {
+		case LIBMOON_FLOW_ACTION_QUEUE:
+			queue.index = r->queue;
+			actions[n].type = RTE_FLOW_ACTION_TYPE_QUEUE;
+			actions[n++].conf = &queue;
+			break;
+		case LIBMOON_FLOW_ACTION_DROP:
+			actions[n++].type = RTE_FLOW_ACTION_TYPE_DROP;
+			break;
+		case LIBMOON_FLOW_ACTION_MARK:
+			mark.id = r->mark;
+			actions[n].type = RTE_FLOW_ACTION_TYPE_MARK;
+			actions[n++].conf = &mark;
+			break;
+		default:
+			error = "unknown action";
+			return nullptr;
+	}
+	if (r->count) {
+		actions[n++].type = RTE_FLOW_ACTION_TYPE_COUNT;
+	}
+	actions[n].type = RTE_FLOW_ACTION_TYPE_END;
+
+	struct rte_flow_error flow_error;
+	memset(&flow_error, 0, sizeof(flow_error));
+	struct rte_flow* flow = nullptr;
+	if (rte_flow_validate(port, &attr, pattern, actions, &flow_error) == 0) {
+		flow = rte_flow_create(port, &attr, pattern, actions, &flow_error);
+	}
+	if (!flow) {
+		error = flow_error.message ? flow_error.message : "rule rejected by the driver";
+	}
+	return flow;
+}
+
+static inline bool parse_packet(struct rte_mbuf* buf, flow_match_key& key) {
+	uint8_t* data = rte_pktmbuf_mtod(buf, uint8_t*);
+	uint32_t len = buf->data_len;
+	uint32_t offset = sizeof(struct ether_hdr);
+	if (len < offset) {
+		return false;
+	}
+	uint16_t ether_type = ((struct ether_hdr*) data)->ether_type;
+	if (ether_type == rte_cpu_to_be_16(ETHER_TYPE_VLAN)) {
+		if (len < offset + sizeof(struct vlan_hdr)) {
+			return false;
+		}
+		ether_type = ((struct vlan_hdr*) (data + offset))->eth_proto;
+		offset += sizeof(struct vlan_hdr);
+	}
+	bool first_fragment = true;
+	if (ether_type == rte_cpu_to_be_16(ETHER_TYPE_IPv4)) {
+		if (len < offset + sizeof(struct ipv4_hdr)) {
+			return false;
+		}
+		struct ipv4_hdr* ip = (struct ipv4_hdr*) (data + offset);
+		key.ip_version = 4;
+		key.proto = ip->next_proto_id;
+		memcpy(key.src_ip, &ip->src_addr, 4);
+		memcpy(key.dst_ip, &ip->dst_addr, 4);
+		first_fragment = !(ip->fragment_offset & rte_cpu_to_be_16(0x1FFF));
+		offset += (ip->version_ihl & 0x0F) * 4;
+	} else if (ether_type == rte_cpu_to_be_16(ETHER_TYPE_IPv6)) {
+		if (len < offset + sizeof(struct ipv6_hdr)) {
+			return false;
+		}
+		struct ipv6_hdr* ip = (struct ipv6_hdr*) (data + offset);
+		key.ip_version = 6;
+		key.proto = ip->proto;
+		memcpy(key.src_ip, ip->src_addr, 16);
+		memcpy(key.dst_ip, ip->dst_addr, 16);
+		offset += sizeof(struct ipv6_hdr);
+	} else {
+		return false;
+	}
+	if ((key.proto == IPPROTO_TCP || key.proto == IPPROTO_UDP) && first_fragment && len >= offset + 4) {
+		key.src_port = rte_be_to_cpu_16(*(uint16_t*) (data + offset));
+		key.dst_port = rte_be_to_cpu_16(*(uint16_t*) (data + offset + 2));
+	} else {
+		key.src_port = 0;
+		key.dst_port = 0;
+	}
+	return true;
+}
+
+static inline bool match_ip(const uint8_t* addr, const uint8_t* rule, const uint8_t* mask, int len) {
+	for (int i = 0; i < len; i++) {
+		if ((addr[i] & mask[i]) != (rule[i] & mask[i])) {
+			return false;
+		}
+	}
+	return true;
+}
+
+static inline bool match_rule(const libmoon_flow_rule& r, const flow_match_key& key) {
+	if (r.ip_version && r.ip_version != key.ip_version) {
+		return false;
+	}
+	if (r.proto && r.proto != key.proto) {
+		return false;
+	}
+	if ((key.src_port & r.src_port_mask) != (r.src_port & r.src_port_mask)
+	||  (key.dst_port & r.dst_port_mask) != (r.dst_port & r.dst_port_mask)) {
+		return false;
+	}
+	int addr_len = key.ip_version == 4 ? 4 : 16;
+	return match_ip(key.src_ip, r.src_ip, r.src_ip_mask, addr_len) && match_ip(key.dst_ip, r.dst_ip, r.dst_ip_mask, addr_len);
+}
+
+static inline flow_readers& get_readers(libmoon_flow_manager* mgr) {
+	uint32_t lcore = rte_lcore_id();
+	return mgr->readers[lcore < RTE_MAX_LCORE ? lcore : RTE_MAX_LCORE];
+}
+
+// returns the epoch parity the reader registered for, the snapshot can be used until read_end()
+static inline uint32_t read_begin(flow_readers& readers, libmoon_flow_manager* mgr) {
+	while (true) {
+		uint32_t parity = mgr->epoch.load() & 1;
+		readers.count[parity].fetch_add(1);
+		// a concurrent change either waits for us or we see its new epoch and its new snapshot
+		if ((mgr->epoch.load() & 1) == parity) {
+			return parity;
+		}
+		readers.count[parity].fetch_sub(1, std::memory_order_release);
+	}
+}
+
+static inline void read_end(flow_readers& readers, uint32_t parity) {
+	readers.count[parity].fetch_sub(1, std::memory_order_release);
+}
+
+// waits until no rx task can use a snapshot that was replaced before the call, must be called with the lock held
+static void wait_for_readers(libmoon_flow_manager* mgr) {
+	uint32_t parity = mgr->epoch.fetch_add(1) & 1;
+	for (auto& readers: mgr->readers) {
+		while (readers.count[parity].load(std::memory_order_acquire)) {
+			rte_pause();
+		}
+	}
+}
+
+// must be called with the lock held, frees the old snapshot after the grace period
+static void publish_sw_rules(libmoon_flow_manager* mgr) {
+	auto snapshot = new flow_rule_snapshot();
+	for (auto& slot: mgr->rules) {
+		if (slot && slot->active && !slot->flow) {
+			snapshot->push_back(slot.get());
+		}
+	}
+	// lower priority values first, like rte_flow; stable to keep insertion order for equal priorities
+	std::stable_sort(snapshot->begin(), snapshot->end(), [](flow_rule_slot* a, flow_rule_slot* b) {
+		return a->rule.priority < b->rule.priority;
+	});
+	mgr->sw_rules.store(snapshot);
+	if (mgr->snapshot) {
+		wait_for_readers(mgr);
+	}
+	mgr->snapshot.reset(snapshot);
+}
+
+static flow_rule_slot* get_slot(libmoon_flow_manager* mgr, int32_t id) {
+	uint32_t index = (uint32_t) id & ID_INDEX_MASK;
+	if (id < 0 || index >= mgr->rules.size() || mgr->generations[index] != (uint32_t) id >> ID_INDEX_BITS) {
+		return nullptr;
+	}
+	return mgr->rules[index].get();
+}
+
+static int32_t alloc_id(libmoon_flow_manager* mgr) {
+	uint32_t index;
+	if (!mgr->free_ids.empty()) {
+		index = mgr->free_ids.back();
+		mgr->free_ids.pop_back();
+	} else if (mgr->rules.size() <= ID_INDEX_MASK) {
+		index = mgr->rules.size();
+		mgr->rules.emplace_back();
+		mgr->generations.push_back(0);
+	} else {
+		return -1;
+	}
+	return (int32_t) (mgr->generations[index] << ID_INDEX_BITS | index);
+}
+
+// the id can be reused afterwards, software rules must not be in the current snapshot
+static void free_id(libmoon_flow_manager* mgr, int32_t id) {
+	uint32_t index = (uint32_t) id & ID_INDEX_MASK;
+	mgr->rules[index].reset();
+	mgr->generations[index] = (mgr->generations[index] + 1) & ID_GEN_MASK;
+	mgr->free_ids.push_back(index);
+}
+
+extern "C" {
+
+	struct libmoon_flow_manager* libmoon_flow_manager_create(uint8_t port) {
+		auto mgr = new libmoon_flow_manager();
+		mgr->port = port;
+		std::lock_guard<std::mutex> lock(mgr->lock);
+		publish_sw_rules(mgr);
+		return mgr;
+	}
+
+	// removes all rules from the NIC, no rx task may use the manager at this point
+	void libmoon_flow_manager_delete(struct libmoon_flow_manager* mgr) {
+		for (auto& slot: mgr->rules) {
+			if (slot && slot->active && slot->flow) {
+				struct rte_flow_error error;
+				rte_flow_destroy(mgr->port, slot->flow, &error);
+			}
+		}
+		delete mgr;
+	}
+
+	// returns the number of created rules, ids[i] is set to -1 for rules that could not be created
+	// rules rejected by the NIC are emulated in software if allow_sw is set
+	uint32_t libmoon_flow_manager_add(struct libmoon_flow_manager* mgr, const struct libmoon_flow_rule* rules, uint32_t num_rules, int32_t* ids, uint8_t allow_sw) {
+		std::lock_guard<std::mutex> lock(mgr->lock);
+		uint32_t added = 0;
+		bool sw_changed = false;
+		for (uint32_t i = 0; i < num_rules; i++) {
+			std::string error;
+			struct rte_flow* flow = create_hw_rule(mgr->port, &rules[i], error);
+			if (!flow) {
+				mgr->last_error = error;
+				if (!allow_sw) {
+					ids[i] = -1;
+					continue;
+				}
+				sw_changed = true;
+			}
+			int32_t id = alloc_id(mgr);
+			if (id < 0) {
+				if (flow) {
+					struct rte_flow_error error;
+					rte_flow_destroy(mgr->port, flow, &error);
+				}
+				mgr->last_error = "too many rules";
+				ids[i] = -1;
+				continue;
+			}
+			auto slot = new flow_rule_slot();
+			slot->rule = rules[i];
+			slot->flow = flow;
+			slot->active = true;
+			slot->pkts = 0;
+			slot->bytes = 0;
+			ids[i] = id;
+			mgr->rules[id & ID_INDEX_MASK].reset(slot);
+			added++;
+		}
+		if (sw_changed) {
+			publish_sw_rules(mgr);
+		}
+		return added;
+	}
+
+	// returns the number of removed rules
+	uint32_t libmoon_flow_manager_remove(struct libmoon_flow_manager* mgr, const int32_t* ids, uint32_t num_ids) {
+		std::lock_guard<std::mutex> lock(mgr->lock);
+		uint32_t removed = 0;
+		bool sw_changed = false;
+		// software rules are freed once no rx task can use them anymore
+		std::vector<int32_t> sw_removed;
+		for (uint32_t i = 0; i < num_ids; i++) {
+			flow_rule_slot* slot = get_slot(mgr, ids[i]);
+			if (!slot || !slot->active) {
+				continue;
+			}
+			if (slot->flow) {
+				struct rte_flow_error error;
+				memset(&error, 0, sizeof(error));
+				if (rte_flow_destroy(mgr->port, slot->flow, &error)) {
+					mgr->last_error = error.message ? error.message : "could not destroy rule";
+					continue;
+				}
+				free_id(mgr, ids[i]);
+			} else {
+				sw_changed = true;
+				slot->active = false;
+				sw_removed.push_back(ids[i]);
+			}
+			removed++;
+		}
+		if (sw_changed) {
+			publish_sw_rules(mgr);
+		}
+		for (int32_t id: sw_removed) {
+			free_id(mgr, id);
+		}
+		return removed;
+	}
+
+	// returns 1 for rules in hardware, 0 for software rules, -1 for invalid or removed ids
+	int libmoon_flow_manager_is_offloaded(struct libmoon_flow_manager* mgr, int32_t id) {
+		std::lock_guard<std::mutex> lock(mgr->lock);
+		flow_rule_slot* slot = get_slot(mgr, id);
+		return slot ? slot->flow != nullptr : -1;
+	}
+
+	// reads the COUNT action of hardware rules or the software counters
+	int libmoon_flow_manager_query(struct libmoon_flow_manager* mgr, int32_t id, uint64_t* pkts, uint64_t* bytes) {
+		std::lock_guard<std::mutex> lock(mgr->lock);
+		flow_rule_slot* slot = get_slot(mgr, id);
+		if (!slot) {
+			return -EINVAL;
+		}
+		if (slot->flow && slot->active) {
+			if (!slot->rule.count) {
+				return -ENOTSUP;
+			}
+			struct rte_flow_query_count count;
+			memset(&count, 0, sizeof(count));
+			struct rte_flow_error error;
+			memset(&error, 0, sizeof(error));
+			int rc = rte_flow_query(mgr->port, slot->flow, RTE_FLOW_ACTION_TYPE_COUNT, &count, &error);
+			if (rc) {
+				mgr->last_error = error.message ? error.message : "could not query rule";
+				return rc;
+			}
+			// the counters are not reset on query, but not all drivers report bytes
+			slot->pkts.store(count.hits_set ? count.hits : 0, std::memory_order_relaxed);
+			slot->bytes.store(count.bytes_set ? count.bytes : 0, std::memory_order_relaxed);
+		}
+		*pkts = slot->pkts.load(std::memory_order_relaxed);
+		*bytes = slot->bytes.load(std::memory_order_relaxed);
+		return 0;
+	}
+
+	// the string is copied under the lock, it may be overwritten by any other call
+	uint32_t libmoon_flow_manager_last_error(struct libmoon_flow_manager* mgr, char* buf, uint32_t len) {
+		std::lock_guard<std::mutex> lock(mgr->lock);
+		if (len) {
+			snprintf(buf, len, "%s", mgr->last_error.c_str());
+		}
+		return mgr->last_error.size();
+	}
+
+	uint32_t libmoon_flow_manager_num_sw_rules(struct libmoon_flow_manager* mgr) {
+		std::lock_guard<std::mutex> lock(mgr->lock);
+		return mgr->snapshot->size();
+	}
+
+	// applies software rules to received packets: dropped packets are freed and removed from the array,
+	// mark and queue actions set the fdir id in the mbuf (queue actions can't be emulated after reception).
+	// returns the new number of packets in the array
+	uint16_t libmoon_flow_manager_process(struct libmoon_flow_manager* mgr, struct rte_mbuf** bufs, uint16_t num_bufs) {
+		flow_readers& readers = get_readers(mgr);
+		uint32_t parity = read_begin(readers, mgr);
+		flow_rule_snapshot* rules = mgr->sw_rules.load(std::memory_order_acquire);
+		if (rules->empty()) {
+			read_end(readers, parity);
+			return num_bufs;
+		}
+		uint16_t kept = 0;
+		flow_match_key key;
+		for (uint16_t i = 0; i < num_bufs; i++) {
+			struct rte_mbuf* buf = bufs[i];
+			bool drop = false;
+			if (parse_packet(buf, key)) {
+				for (flow_rule_slot* slot: *rules) {
+					if (!match_rule(slot->rule, key)) {
+						continue;
+					}
+					if (slot->rule.count) {
+						slot->pkts.fetch_add(1, std::memory_order_relaxed);
+						slot->bytes.fetch_add(buf->pkt_len, std::memory_order_relaxed);
+					}
+					switch (slot->rule.action) {
+						case LIBMOON_FLOW_ACTION_DROP:
+							drop = true;
+							break;
+						case LIBMOON_FLOW_ACTION_MARK:
+							buf->hash.fdir.hi = slot->rule.mark;
+							buf->ol_flags |= PKT_RX_FDIR | PKT_RX_FDIR_ID;
+							break;
+						case LIBMOON_FLOW_ACTION_QUEUE:
+							buf->hash.fdir.hi = slot->rule.queue;
+							buf->ol_flags |= PKT_RX_FDIR | PKT_RX_FDIR_ID;
+							break;
+					}
+					break;
+				}
+			}
+			if (drop) {
+				rte_pktmbuf_free(buf);
+			} else {
+				bufs[kept++] = buf;
+			}
+		}
+		read_end(readers, parity);
+		return kept;
+	}
+}
+
@@ -0,0 +1,54 @@
+#ifndef MG_FLOW_OFFLOAD_H
+#define MG_FLOW_OFFLOAD_H
+
+#include <stdint.h>
+#include <rte_config.h>
+#include <rte_mbuf.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define LIBMOON_FLOW_ACTION_QUEUE 0
+#define LIBMOON_FLOW_ACTION_DROP 1
+#define LIBMOON_FLOW_ACTION_MARK 2
+
+// compact description of a 5-tuple rule, filled by offload.lua
+// addresses are in network byte order, ports in host byte order
+struct libmoon_flow_rule {
+	uint8_t ip_version; // 0 = any, 4 or 6
+	uint8_t proto; // 0 = any
+	uint8_t action;
+	uint8_t count;
+	uint16_t queue;
+	uint16_t priority;
+	uint32_t mark;
+	uint16_t src_port;
+	uint16_t src_port_mask;
+	uint16_t dst_port;
+	uint16_t dst_port_mask;
+	uint8_t src_ip[16];
+	uint8_t src_ip_mask[16];
+	uint8_t dst_ip[16];
+	uint8_t dst_ip_mask[16];
+};
+
+struct libmoon_flow_manager;
+
+struct libmoon_flow_manager* libmoon_flow_manager_create(uint8_t port);
+void libmoon_flow_manager_delete(struct libmoon_flow_manager* mgr);
+uint32_t libmoon_flow_manager_add(struct libmoon_flow_manager* mgr, const struct libmoon_flow_rule* rules, uint32_t num_rules, int32_t* ids, uint8_t allow_sw);
+uint32_t libmoon_flow_manager_remove(struct libmoon_flow_manager* mgr, const int32_t* ids, uint32_t num_ids);
+int libmoon_flow_manager_is_offloaded(struct libmoon_flow_manager* mgr, int32_t id);
+int libmoon_flow_manager_query(struct libmoon_flow_manager* mgr, int32_t id, uint64_t* pkts, uint64_t* bytes);
+// copies the last error message to buf (truncated to len - 1 bytes), returns the length of the message
+uint32_t libmoon_flow_manager_last_error(struct libmoon_flow_manager* mgr, char* buf, uint32_t len);
+uint32_t libmoon_flow_manager_num_sw_rules(struct libmoon_flow_manager* mgr);
+uint16_t libmoon_flow_manager_process(struct libmoon_flow_manager* mgr, struct rte_mbuf** bufs, uint16_t num_bufs);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
+
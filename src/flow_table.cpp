@@ -0,0 +1,454 @@
+#include <cstdint>
+#include <cstring>
+#include <emmintrin.h>
+
+#include <rte_config.h>
+#include <rte_common.h>
+#include <rte_malloc.h>
+#include <rte_mbuf.h>
+#include <rte_prefetch.h>
+#include <rte_spinlock.h>
+
+#include "flow_table.h"
+#include "burst_parser.h"
+
+// Swiss table: each group has 16 control bytes that are matched with one SSE compare.
+// A control byte is either empty, deleted, or the upper 7 bits of the hash of the flow in the slot.
+// Groups are probed triangularly. Instead of tombstones every group counts the flows that were displaced past it
+// (like F14), a lookup stops at the first group without such flows and removed slots are empty right away.
+// Otherwise removing flows from full groups would leave deleted markers that are only reused but never become empty,
+// under churn misses would eventually probe the whole table.
+// Expiry uses a lazy timer wheel: flows are scheduled when inserted and only rescheduled
+// when their wheel slot is processed, lookups just update the last seen tick.
+
+namespace libmoon {
+	const uint32_t GROUP_SIZE = 16;
+	const uint8_t CTRL_EMPTY = 0x80;
+	const uint32_t NOT_FOUND = UINT32_MAX;
+	const uint32_t WHEEL_SIZE = 4096;
+	const uint32_t BURST_SIZE = 64;
+
+	struct flow_entry {
+		libmoon_flow_key key;
+		uint32_t last_seen;
+		// doubly linked timer wheel list, slot + 1, 0 terminates the list
+		uint32_t timer_prev;
+		uint32_t timer_next;
+		uint16_t timer_slot;
+		uint16_t reserved;
+		uint8_t value[] __attribute__((aligned(8)));
+	};
+}
+
+using namespace libmoon;
+
+struct libmoon_flow_table {
+	uint32_t group_mask;
+	uint32_t num_slots;
+	uint32_t capacity;
+	uint32_t count;
+	uint32_t entry_size;
+	uint32_t value_size;
+	uint32_t timeout;
+	uint32_t wheel_tick;
+	bool wheel_started;
+	bool shared;
+	// shared tables: serializes writers, readers use the per-group sequence numbers
+	rte_spinlock_t lock;
+	uint8_t* ctrl;
+	uint8_t* entries;
+	uint32_t* group_seq;
+	// number of flows per group that are stored in a later group of their probe sequence
+	uint32_t* overflow;
+	uint32_t wheel[WHEEL_SIZE];
+};
+
+static inline flow_entry* get_entry(libmoon_flow_table* table, uint32_t slot) {
+	return (flow_entry*) (table->entries + (size_t) slot * table->entry_size);
+}
+
+static inline uint8_t get_tag(uint32_t hash) {
+	return hash >> 25;
+}
+
+static inline uint32_t match_group(libmoon_flow_table* table, uint32_t group, uint8_t value) {
+	__m128i ctrl = _mm_load_si128((const __m128i*) (table->ctrl + group * GROUP_SIZE));
+	return _mm_movemask_epi8(_mm_cmpeq_epi8(ctrl, _mm_set1_epi8(value)));
+}
+
+static inline bool key_equal(const libmoon_flow_key* k1, const libmoon_flow_key* k2) {
+	return memcmp(k1, k2, sizeof(*k1)) == 0;
+}
+
+static inline uint32_t read_begin(libmoon_flow_table* table, uint32_t group) {
+	uint32_t seq;
+	while ((seq = __atomic_load_n(&table->group_seq[group], __ATOMIC_ACQUIRE)) & 1) {
+		rte_pause();
+	}
+	return seq;
+}
+
+static inline bool read_retry(libmoon_flow_table* table, uint32_t group, uint32_t seq) {
+	__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	return __atomic_load_n(&table->group_seq[group], __ATOMIC_RELAXED) != seq;
+}
+
+static inline void write_begin(libmoon_flow_table* table, uint32_t group) {
+	if (table->shared) {
+		__atomic_store_n(&table->group_seq[group], table->group_seq[group] + 1, __ATOMIC_RELAXED);
+		__atomic_thread_fence(__ATOMIC_RELEASE);
+	}
+}
+
+static inline void write_end(libmoon_flow_table* table, uint32_t group) {
+	if (table->shared) {
+		__atomic_store_n(&table->group_seq[group], table->group_seq[group] + 1, __ATOMIC_RELEASE);
+	}
+}
+
+template<bool shared>
+static inline uint32_t find(libmoon_flow_table* table, const libmoon_flow_key* key, uint32_t hash) {
+	uint8_t tag = get_tag(hash);
+	uint32_t group = hash & table->group_mask;
+	for (uint32_t probe = 1; probe <= table->group_mask + 1; probe++) {
+		uint32_t seq = shared ? read_begin(table, group) : 0;
+		uint32_t result = NOT_FOUND;
+		bool done = false;
+		uint32_t matches = match_group(table, group, tag);
+		while (matches) {
+			uint32_t slot = group * GROUP_SIZE + __builtin_ctz(matches);
+			if (key_equal(&get_entry(table, slot)->key, key)) {
+				result = slot;
+				done = true;
+				break;
+			}
+			matches &= matches - 1;
+		}
+		if (!done && !table->overflow[group]) {
+			done = true;
+		}
+		if (shared && read_retry(table, group, seq)) {
+			// a writer modified the group, try again
+			probe--;
+			continue;
+		}
+		if (done) {
+			return result;
+		}
+		group = (group + probe) & table->group_mask;
+	}
+	return NOT_FOUND;
+}
+
+static inline uint32_t find_free(libmoon_flow_table* table, uint32_t hash) {
+	uint32_t group = hash & table->group_mask;
+	for (uint32_t probe = 1; probe <= table->group_mask + 1; probe++) {
+		uint32_t free = match_group(table, group, CTRL_EMPTY);
+		if (free) {
+			return group * GROUP_SIZE + __builtin_ctz(free);
+		}
+		group = (group + probe) & table->group_mask;
+	}
+	return NOT_FOUND;
+}
+
+// adds delta to the overflow counters of all groups a flow with this hash skipped to get to its slot
+static inline void update_overflow(libmoon_flow_table* table, uint32_t hash, uint32_t slot, int32_t delta) {
+	uint32_t group = hash & table->group_mask;
+	for (uint32_t probe = 1; group != slot / GROUP_SIZE; probe++) {
+		write_begin(table, group);
+		table->overflow[group] += delta;
+		write_end(table, group);
+		group = (group + probe) & table->group_mask;
+	}
+}
+
+static inline void timer_add(libmoon_flow_table* table, uint32_t slot, uint32_t deadline) {
+	flow_entry* entry = get_entry(table, slot);
+	uint32_t wheel_slot = deadline & (WHEEL_SIZE - 1);
+	entry->timer_slot = wheel_slot;
+	entry->timer_prev = 0;
+	entry->timer_next = table->wheel[wheel_slot];
+	if (entry->timer_next) {
+		get_entry(table, entry->timer_next - 1)->timer_prev = slot + 1;
+	}
+	table->wheel[wheel_slot] = slot + 1;
+}
+
+static inline void timer_remove(libmoon_flow_table* table, uint32_t slot) {
+	flow_entry* entry = get_entry(table, slot);
+	if (entry->timer_prev) {
+		get_entry(table, entry->timer_prev - 1)->timer_next = entry->timer_next;
+	} else {
+		table->wheel[entry->timer_slot] = entry->timer_next;
+	}
+	if (entry->timer_next) {
+		get_entry(table, entry->timer_next - 1)->timer_prev = entry->timer_prev;
+	}
+}
+
+// caller holds the lock for shared tables
+static void* insert_locked(libmoon_flow_table* table, const libmoon_flow_key* key, uint32_t hash, uint32_t now, uint8_t* is_new) {
+	uint32_t slot = find<false>(table, key, hash);
+	if (slot != NOT_FOUND) {
+		flow_entry* entry = get_entry(table, slot);
+		__atomic_store_n(&entry->last_seen, now, __ATOMIC_RELAXED);
+		*is_new = 0;
+		return entry->value;
+	}
+	*is_new = 0;
+	if (table->count >= table->capacity) {
+		return nullptr;
+	}
+	slot = find_free(table, hash);
+	if (slot == NOT_FOUND) {
+		return nullptr;
+	}
+	uint32_t group = slot / GROUP_SIZE;
+	flow_entry* entry = get_entry(table, slot);
+	write_begin(table, group);
+	entry->key = *key;
+	entry->last_seen = now;
+	memset(entry->value, 0, table->value_size);
+	table->ctrl[slot] = get_tag(hash);
+	write_end(table, group);
+	update_overflow(table, hash, slot, 1);
+	timer_add(table, slot, now + table->timeout);
+	__atomic_store_n(&table->count, table->count + 1, __ATOMIC_RELAXED);
+	*is_new = 1;
+	return entry->value;
+}
+
+static void remove_slot(libmoon_flow_table* table, uint32_t slot, uint32_t hash) {
+	uint32_t group = slot / GROUP_SIZE;
+	timer_remove(table, slot);
+	write_begin(table, group);
+	table->ctrl[slot] = CTRL_EMPTY;
+	write_end(table, group);
+	// other flows keep the counters they need to be found non-zero
+	update_overflow(table, hash, slot, -1);
+	__atomic_store_n(&table->count, table->count - 1, __ATOMIC_RELAXED);
+}
+
+static inline void lock(libmoon_flow_table* table) {
+	if (table->shared) {
+		rte_spinlock_lock(&table->lock);
+	}
+}
+
+static inline void unlock(libmoon_flow_table* table) {
+	if (table->shared) {
+		rte_spinlock_unlock(&table->lock);
+	}
+}
+
+static inline void* lookup_hashed(libmoon_flow_table* table, const libmoon_flow_key* key, uint32_t hash, uint32_t now) {
+	uint32_t slot = table->shared ? find<true>(table, key, hash) : find<false>(table, key, hash);
+	if (slot == NOT_FOUND) {
+		return nullptr;
+	}
+	flow_entry* entry = get_entry(table, slot);
+	__atomic_store_n(&entry->last_seen, now, __ATOMIC_RELAXED);
+	return entry->value;
+}
+
+// looks up up to 64 hashed keys, valid is a bit mask of the keys to look up
+static uint32_t lookup_chunk(libmoon_flow_table* table, const libmoon_flow_key* keys, const uint32_t* hashes, uint64_t valid, uint32_t n, void** values, uint32_t now, uint8_t insert) {
+	// prefetch the control bytes of the first group
+	for (uint32_t i = 0; i < n; i++) {
+		if (valid & (1ULL << i)) {
+			rte_prefetch0(table->ctrl + (hashes[i] & table->group_mask) * GROUP_SIZE);
+		}
+	}
+	// prefetch the first candidate entry
+	for (uint32_t i = 0; i < n; i++) {
+		if (valid & (1ULL << i)) {
+			uint32_t group = hashes[i] & table->group_mask;
+			uint32_t matches = match_group(table, group, get_tag(hashes[i]));
+			if (matches) {
+				rte_prefetch0(get_entry(table, group * GROUP_SIZE + __builtin_ctz(matches)));
+			}
+		}
+	}
+	uint64_t missing = 0;
+	for (uint32_t i = 0; i < n; i++) {
+		values[i] = (valid & (1ULL << i)) ? lookup_hashed(table, &keys[i], hashes[i], now) : nullptr;
+		if (insert && !values[i] && (valid & (1ULL << i))) {
+			missing |= 1ULL << i;
+		}
+	}
+	uint32_t new_flows = 0;
+	if (missing) {
+		// one lock for all new flows of the burst
+		lock(table);
+		for (uint32_t i = 0; i < n; i++) {
+			if (missing & (1ULL << i)) {
+				uint8_t is_new;
+				values[i] = insert_locked(table, &keys[i], hashes[i], now, &is_new);
+				new_flows += is_new;
+			}
+		}
+		unlock(table);
+	}
+	return new_flows;
+}
+
+extern "C" {
+
+	struct libmoon_flow_table* libmoon_flow_table_create(uint32_t capacity, uint32_t value_size, uint32_t timeout, uint8_t shared, int socket) {
+		if (!capacity || capacity > (1U << 30) || !timeout) {
+			return nullptr;
+		}
+		// max load factor of 7/8
+		uint64_t num_slots = GROUP_SIZE;
+		while (num_slots * 7 / 8 < capacity) {
+			num_slots *= 2;
+		}
+		libmoon_flow_table* table = (libmoon_flow_table*) rte_zmalloc_socket("flow_table", sizeof(libmoon_flow_table), RTE_CACHE_LINE_SIZE, socket);
+		if (!table) {
+			return nullptr;
+		}
+		table->num_slots = num_slots;
+		table->group_mask = num_slots / GROUP_SIZE - 1;
+		table->capacity = capacity;
+		table->value_size = value_size;
+		table->entry_size = RTE_ALIGN(sizeof(flow_entry) + value_size, 8);
+		table->timeout = timeout;
+		table->shared = shared;
+		rte_spinlock_init(&table->lock);
+		table->ctrl = (uint8_t*) rte_malloc_socket("flow_table_ctrl", num_slots, RTE_CACHE_LINE_SIZE, socket);
+		table->entries = (uint8_t*) rte_malloc_socket("flow_table_entries", num_slots * table->entry_size, RTE_CACHE_LINE_SIZE, socket);
+		if (shared) {
+			table->group_seq = (uint32_t*) rte_zmalloc_socket("flow_table_seq", (table->group_mask + 1) * sizeof(uint32_t), RTE_CACHE_LINE_SIZE, socket);
+		}
+		table->overflow = (uint32_t*) rte_zmalloc_socket("flow_table_overflow", (table->group_mask + 1) * sizeof(uint32_t), RTE_CACHE_LINE_SIZE, socket);
+		if (!table->ctrl || !table->entries || !table->overflow || (shared && !table->group_seq)) {
+			libmoon_flow_table_delete(table);
+			return nullptr;
+		}
+		memset(table->ctrl, CTRL_EMPTY, num_slots);
+		return table;
+	}
+
+	void libmoon_flow_table_delete(struct libmoon_flow_table* table) {
+		rte_free(table->ctrl);
+		rte_free(table->entries);
+		rte_free(table->group_seq);
+		rte_free(table->overflow);
+		rte_free(table);
+	}
+
+	uint32_t libmoon_flow_table_count(struct libmoon_flow_table* table) {
+		return __atomic_load_n(&table->count, __ATOMIC_RELAXED);
+	}
+
+	uint32_t libmoon_flow_table_capacity(struct libmoon_flow_table* table) {
+		return table->capacity;
+	}
+
+	void* libmoon_flow_table_lookup(struct libmoon_flow_table* table, const struct libmoon_flow_key* key, uint32_t now) {
+		return lookup_hashed(table, key, libmoon_flow_key_hash(key), now);
+	}
+
+	void* libmoon_flow_table_insert(struct libmoon_flow_table* table, const struct libmoon_flow_key* key, uint32_t now, uint8_t* is_new) {
+		lock(table);
+		void* value = insert_locked(table, key, libmoon_flow_key_hash(key), now, is_new);
+		unlock(table);
+		return value;
+	}
+
+	int libmoon_flow_table_remove(struct libmoon_flow_table* table, const struct libmoon_flow_key* key) {
+		lock(table);
+		uint32_t hash = libmoon_flow_key_hash(key);
+		uint32_t slot = find<false>(table, key, hash);
+		if (slot != NOT_FOUND) {
+			remove_slot(table, slot, hash);
+		}
+		unlock(table);
+		return slot != NOT_FOUND;
+	}
+
+	uint32_t libmoon_flow_table_expire(struct libmoon_flow_table* table, uint32_t now, struct libmoon_flow_key* keys, void* values, uint32_t max_flows) {
+		lock(table);
+		if (!table->wheel_started || (int32_t) (now - table->wheel_tick) >= (int32_t) WHEEL_SIZE) {
+			// check every wheel slot once
+			table->wheel_tick = now - WHEEL_SIZE + 1;
+			table->wheel_started = true;
+		}
+		uint32_t expired = 0;
+		while ((int32_t) (now - table->wheel_tick) >= 0) {
+			uint32_t wheel_slot = table->wheel_tick & (WHEEL_SIZE - 1);
+			uint32_t cur = table->wheel[wheel_slot];
+			while (cur) {
+				uint32_t slot = cur - 1;
+				flow_entry* entry = get_entry(table, slot);
+				cur = entry->timer_next;
+				uint32_t deadline = __atomic_load_n(&entry->last_seen, __ATOMIC_RELAXED) + table->timeout;
+				if ((int32_t) (deadline - now) <= 0) {
+					if (expired == max_flows) {
+						// continue with this wheel slot on the next call
+						unlock(table);
+						return expired;
+					}
+					if (keys) {
+						keys[expired] = entry->key;
+					}
+					if (values) {
+						memcpy((uint8_t*) values + (size_t) expired * table->value_size, entry->value, table->value_size);
+					}
+					expired++;
+					remove_slot(table, slot, libmoon_flow_key_hash(&entry->key));
+				} else if ((deadline & (WHEEL_SIZE - 1)) != wheel_slot) {
+					timer_remove(table, slot);
+					timer_add(table, slot, deadline);
+				}
+			}
+			table->wheel_tick++;
+		}
+		unlock(table);
+		return expired;
+	}
+
+	int libmoon_flow_key_from_mbuf(struct rte_mbuf* buf, struct libmoon_flow_key* key) {
+		struct libmoon_parsed_packet pkt;
+		int rc = libmoon_parse_packet(buf, &pkt);
+		*key = pkt.key;
+		return rc;
+	}
+
+	uint32_t libmoon_flow_table_lookup_burst(struct libmoon_flow_table* table, struct rte_mbuf** bufs, uint32_t num_bufs, void** values, uint32_t now, uint8_t insert) {
+		libmoon_flow_key keys[BURST_SIZE];
+		uint32_t hashes[BURST_SIZE];
+		uint32_t new_flows = 0;
+		for (uint32_t base = 0; base < num_bufs; base += BURST_SIZE) {
+			uint32_t n = RTE_MIN(num_bufs - base, BURST_SIZE);
+			uint64_t valid = 0;
+			for (uint32_t i = 0; i < n; i++) {
+				if (libmoon_flow_key_from_mbuf(bufs[base + i], &keys[i]) == 0) {
+					hashes[i] = libmoon_flow_key_hash(&keys[i]);
+					valid |= 1ULL << i;
+				}
+			}
+			new_flows += lookup_chunk(table, keys, hashes, valid, n, values + base, now, insert);
+		}
+		return new_flows;
+	}
+
+	uint32_t libmoon_flow_table_lookup_keys(struct libmoon_flow_table* table, struct libmoon_flow_keys* flow_keys, void** values, uint32_t now, uint8_t insert) {
+		libmoon_flow_key keys[BURST_SIZE];
+		uint32_t new_flows = 0;
+		for (uint32_t base = 0; base < flow_keys->num; base += BURST_SIZE) {
+			uint32_t n = RTE_MIN(flow_keys->num - base, BURST_SIZE);
+			uint64_t valid = 0;
+			// the hashes were already calculated by the parser
+			for (uint32_t i = 0; i < n; i++) {
+				if (flow_keys->ip_version[base + i]) {
+					libmoon_flow_keys_get(flow_keys, base + i, &keys[i]);
+					valid |= 1ULL << i;
+				}
+			}
+			new_flows += lookup_chunk(table, keys, flow_keys->hash + base, valid, n, values + base, now, insert);
+		}
+		return new_flows;
+	}
+}
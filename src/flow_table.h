@@ -0,0 +1,64 @@
+#ifndef MG_FLOW_TABLE_H
+#define MG_FLOW_TABLE_H
+
+#include <stdint.h>
+#include <rte_config.h>
+#include <rte_mbuf.h>
+#include <rte_hash_crc.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// ip addresses in network byte order (ipv4 in the first 4 bytes), ports in host byte order
+// unused bytes must be zero
+struct libmoon_flow_key {
+	uint8_t src_ip[16];
+	uint8_t dst_ip[16];
+	uint16_t src_port;
+	uint16_t dst_port;
+	uint8_t proto;
+	uint8_t ip_version;
+	uint16_t reserved;
+};
+
+#define LIBMOON_FLOW_KEY_HASH_SEED 0x6d6f6f6e
+
+static inline uint32_t libmoon_flow_key_hash(const struct libmoon_flow_key* key) {
+	return rte_hash_crc(key, sizeof(*key), LIBMOON_FLOW_KEY_HASH_SEED);
+}
+
+// open addressing hash table with 16-slot groups and SIMD tag matching (Swiss table layout)
+// values are fixed-size slots that are zeroed on insert, pointers to them stay valid until the flow is removed
+// flows that were not looked up for timeout ticks are removed by libmoon_flow_table_expire()
+// the unit of the ticks (now and timeout) is up to the caller, e.g. milliseconds
+// per-core tables must only be used by one thread, shared tables can be used by all threads:
+// lookups are lock-free, inserts/removals/expiry are serialized
+struct libmoon_flow_table;
+
+struct libmoon_flow_table* libmoon_flow_table_create(uint32_t capacity, uint32_t value_size, uint32_t timeout, uint8_t shared, int socket);
+void libmoon_flow_table_delete(struct libmoon_flow_table* table);
+uint32_t libmoon_flow_table_count(struct libmoon_flow_table* table);
+uint32_t libmoon_flow_table_capacity(struct libmoon_flow_table* table);
+
+void* libmoon_flow_table_lookup(struct libmoon_flow_table* table, const struct libmoon_flow_key* key, uint32_t now);
+// returns the existing or a new zeroed value, NULL if the table is full
+void* libmoon_flow_table_insert(struct libmoon_flow_table* table, const struct libmoon_flow_key* key, uint32_t now, uint8_t* is_new);
+int libmoon_flow_table_remove(struct libmoon_flow_table* table, const struct libmoon_flow_key* key);
+// removes up to max_flows expired flows and copies their keys and values (if not NULL) to the arrays
+uint32_t libmoon_flow_table_expire(struct libmoon_flow_table* table, uint32_t now, struct libmoon_flow_key* keys, void* values, uint32_t max_flows);
+
+// see libmoon_parse_packet() for the details
+int libmoon_flow_key_from_mbuf(struct rte_mbuf* buf, struct libmoon_flow_key* key);
+// looks up (or inserts) the flows of a burst of packets, values[i] is NULL for non-IP packets and unknown flows
+// returns the number of new flows
+uint32_t libmoon_flow_table_lookup_burst(struct libmoon_flow_table* table, struct rte_mbuf** bufs, uint32_t num_bufs, void** values, uint32_t now, uint8_t insert);
+// same for keys from libmoon_parse_burst(), reuses the hashes calculated by the parser
+struct libmoon_flow_keys;
+uint32_t libmoon_flow_table_lookup_keys(struct libmoon_flow_table* table, struct libmoon_flow_keys* keys, void** values, uint32_t now, uint8_t insert);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,426 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <rte_config.h>
+#include <rte_common.h>
+#include <rte_byteorder.h>
+#include <rte_mbuf.h>
+#include <rte_mempool.h>
+
+#include "generator.h"
+#include "memory.h"
+#include "tx_rate.h"
+#include "lifecycle.h"
+
+#define IP_OFFSET 14
+#define UDP_OFFSET 34
+#define PAYLOAD_OFFSET 42
+#define IP_LEN_OFFSET (IP_OFFSET + 2)
+#define IP_CSUM_OFFSET (IP_OFFSET + 10)
+#define UDP_LEN_OFFSET (UDP_OFFSET + 4)
+#define UDP_CSUM_OFFSET (UDP_OFFSET + 6)
+#define IPPROTO_UDP_NUM 17
+#define MAX_BURST 256
+
+struct field {
+	uint64_t min;
+	uint64_t count;
+	uint64_t step;
+	// NULL for ranges
+	uint64_t* values;
+};
+
+struct libmoon_generator {
+	uint8_t* template;
+	uint16_t max_size;
+	uint8_t offload;
+	uint8_t udp_checksum;
+	struct field fields[LIBMOON_GENERATOR_NUM_FIELDS];
+	uint16_t* sizes;
+	uint32_t num_sizes;
+	// sums of the 16 bit words of the payload, payload_sum[i] covers the first 2 * i bytes
+	uint32_t* payload_sum;
+	// sum of the IP header without lengths, checksum, and addresses
+	uint32_t ip_base;
+};
+
+struct libmoon_generator_worker {
+	struct libmoon_generator* gen;
+	struct rte_mempool* pool;
+	uint64_t first_flow;
+	uint64_t end_flow;
+	uint64_t flow;
+	uint64_t digits[LIBMOON_GENERATOR_NUM_FIELDS];
+	uint64_t values[LIBMOON_GENERATOR_NUM_FIELDS];
+	// contribution of the current value to the checksums
+	uint32_t csum[LIBMOON_GENERATOR_NUM_FIELDS];
+	// fields with more than one value, all other fields are pre-filled in the mempool
+	uint8_t varying[LIBMOON_GENERATOR_NUM_FIELDS];
+	uint8_t num_varying;
+	uint32_t size_idx;
+};
+
+static inline uint16_t read16(const uint8_t* p) {
+	return (p[0] << 8) | p[1];
+}
+
+static inline void write16(uint8_t* p, uint16_t val) {
+	p[0] = val >> 8;
+	p[1] = val;
+}
+
+static inline uint16_t fold(uint64_t sum) {
+	while (sum >> 16) {
+		sum = (sum & 0xFFFF) + (sum >> 16);
+	}
+	return sum;
+}
+
+struct libmoon_generator* libmoon_generator_create(const uint8_t* template, uint16_t max_size, uint8_t offload, uint8_t udp_checksum) {
+	if (max_size < PAYLOAD_OFFSET) {
+		return NULL;
+	}
+	struct libmoon_generator* gen = calloc(1, sizeof(*gen));
+	if (!gen) {
+		return NULL;
+	}
+	gen->template = malloc(max_size);
+	gen->payload_sum = malloc(((max_size - PAYLOAD_OFFSET) / 2 + 1) * sizeof(uint32_t));
+	gen->sizes = malloc(sizeof(uint16_t));
+	if (!gen->template || !gen->payload_sum || !gen->sizes) {
+		libmoon_generator_delete(gen);
+		return NULL;
+	}
+	memcpy(gen->template, template, max_size);
+	gen->max_size = max_size;
+	gen->offload = offload;
+	gen->udp_checksum = udp_checksum;
+	for (int i = 0; i < LIBMOON_GENERATOR_NUM_FIELDS; i++) {
+		gen->fields[i].count = 1;
+	}
+	// the template defines the initial values
+	gen->fields[LIBMOON_GENERATOR_IP_SRC].min = rte_be_to_cpu_32(*(uint32_t*) (template + IP_OFFSET + 12));
+	gen->fields[LIBMOON_GENERATOR_IP_DST].min = rte_be_to_cpu_32(*(uint32_t*) (template + IP_OFFSET + 16));
+	gen->fields[LIBMOON_GENERATOR_UDP_SRC].min = read16(template + UDP_OFFSET);
+	gen->fields[LIBMOON_GENERATOR_UDP_DST].min = read16(template + UDP_OFFSET + 2);
+	for (int i = 0; i < 6; i++) {
+		gen->fields[LIBMOON_GENERATOR_ETH_DST].min = gen->fields[LIBMOON_GENERATOR_ETH_DST].min << 8 | template[i];
+		gen->fields[LIBMOON_GENERATOR_ETH_SRC].min = gen->fields[LIBMOON_GENERATOR_ETH_SRC].min << 8 | template[6 + i];
+	}
+	gen->sizes[0] = max_size;
+	gen->num_sizes = 1;
+	uint32_t sum = 0;
+	gen->payload_sum[0] = 0;
+	for (uint32_t i = 1; i <= (uint32_t) (max_size - PAYLOAD_OFFSET) / 2; i++) {
+		sum += read16(template + PAYLOAD_OFFSET + (i - 1) * 2);
+		gen->payload_sum[i] = sum;
+	}
+	for (int i = IP_OFFSET; i < UDP_OFFSET; i += 2) {
+		if (i != IP_LEN_OFFSET && i != IP_CSUM_OFFSET && i < IP_OFFSET + 12) {
+			gen->ip_base += read16(template + i);
+		}
+	}
+	return gen;
+}
+
+void libmoon_generator_delete(struct libmoon_generator* gen) {
+	for (int i = 0; i < LIBMOON_GENERATOR_NUM_FIELDS; i++) {
+		free(gen->fields[i].values);
+	}
+	free(gen->template);
+	free(gen->payload_sum);
+	free(gen->sizes);
+	free(gen);
+}
+
+static uint64_t field_mask(enum libmoon_generator_field field) {
+	switch (field) {
+		case LIBMOON_GENERATOR_IP_SRC:
+		case LIBMOON_GENERATOR_IP_DST:
+			return 0xFFFFFFFF;
+		case LIBMOON_GENERATOR_UDP_SRC:
+		case LIBMOON_GENERATOR_UDP_DST:
+			return 0xFFFF;
+		default:
+			return 0xFFFFFFFFFFFF;
+	}
+}
+
+// the number of flows must fit into 63 bits
+static int check_flows(struct libmoon_generator* gen, enum libmoon_generator_field field, uint64_t count) {
+	if (field >= LIBMOON_GENERATOR_NUM_FIELDS || !count) {
+		return -1;
+	}
+	unsigned __int128 flows = count;
+	for (int i = 0; i < LIBMOON_GENERATOR_NUM_FIELDS; i++) {
+		if (i != (int) field) {
+			flows *= gen->fields[i].count;
+		}
+	}
+	return flows >> 63 ? -1 : 0;
+}
+
+int libmoon_generator_set_range(struct libmoon_generator* gen, enum libmoon_generator_field field, uint64_t min, uint64_t count, uint64_t step) {
+	if (check_flows(gen, field, count)) {
+		return -1;
+	}
+	struct field* f = &gen->fields[field];
+	free(f->values);
+	f->values = NULL;
+	f->min = min & field_mask(field);
+	f->count = count;
+	f->step = step;
+	return 0;
+}
+
+int libmoon_generator_set_values(struct libmoon_generator* gen, enum libmoon_generator_field field, const uint64_t* values, uint32_t num_values) {
+	if (check_flows(gen, field, num_values)) {
+		return -1;
+	}
+	uint64_t* copy = malloc(num_values * sizeof(uint64_t));
+	if (!copy) {
+		return -1;
+	}
+	for (uint32_t i = 0; i < num_values; i++) {
+		copy[i] = values[i] & field_mask(field);
+	}
+	struct field* f = &gen->fields[field];
+	free(f->values);
+	f->values = copy;
+	f->min = copy[0];
+	f->count = num_values;
+	f->step = 0;
+	return 0;
+}
+
+int libmoon_generator_set_sizes(struct libmoon_generator* gen, const uint16_t* sizes, const uint32_t* weights, uint32_t num_sizes) {
+	uint32_t total = 0;
+	for (uint32_t i = 0; i < num_sizes; i++) {
+		if (sizes[i] < PAYLOAD_OFFSET || sizes[i] > gen->max_size) {
+			return -1;
+		}
+		total += weights ? weights[i] : 1;
+	}
+	if (!total || total > LIBMOON_GENERATOR_MAX_SIZES) {
+		return -1;
+	}
+	uint16_t* pattern = malloc(total * sizeof(uint16_t));
+	int64_t* current = calloc(num_sizes, sizeof(int64_t));
+	if (!pattern || !current) {
+		free(pattern);
+		free(current);
+		return -1;
+	}
+	// smooth weighted round robin, spreads out the sizes instead of sending them in blocks
+	for (uint32_t n = 0; n < total; n++) {
+		uint32_t best = 0;
+		for (uint32_t i = 0; i < num_sizes; i++) {
+			current[i] += weights ? weights[i] : 1;
+			if (current[i] > current[best]) {
+				best = i;
+			}
+		}
+		current[best] -= total;
+		pattern[n] = sizes[best];
+	}
+	free(current);
+	free(gen->sizes);
+	gen->sizes = pattern;
+	gen->num_sizes = total;
+	return 0;
+}
+
+uint64_t libmoon_generator_num_flows(struct libmoon_generator* gen) {
+	uint64_t flows = 1;
+	for (int i = 0; i < LIBMOON_GENERATOR_NUM_FIELDS; i++) {
+		flows *= gen->fields[i].count;
+	}
+	return flows;
+}
+
+static inline void update_value(struct libmoon_generator_worker* worker, int field) {
+	struct field* f = &worker->gen->fields[field];
+	uint64_t digit = worker->digits[field];
+	uint64_t val = (f->values ? f->values[digit] : f->min + digit * f->step) & field_mask(field);
+	worker->values[field] = val;
+	worker->csum[field] = (val >> 16) + (val & 0xFFFF);
+}
+
+static void seek(struct libmoon_generator_worker* worker, uint64_t flow) {
+	worker->flow = flow;
+	for (int i = 0; i < LIBMOON_GENERATOR_NUM_FIELDS; i++) {
+		uint64_t count = worker->gen->fields[i].count;
+		worker->digits[i] = flow % count;
+		flow /= count;
+		update_value(worker, i);
+	}
+}
+
+// mixed-radix increment, usually only the first varying field changes
+static inline void next_flow(struct libmoon_generator_worker* worker) {
+	if (unlikely(++worker->flow == worker->end_flow)) {
+		seek(worker, worker->first_flow);
+		return;
+	}
+	for (uint32_t i = 0; i < worker->num_varying; i++) {
+		int field = worker->varying[i];
+		if (++worker->digits[field] < worker->gen->fields[field].count) {
+			update_value(worker, field);
+			return;
+		}
+		worker->digits[field] = 0;
+		update_value(worker, field);
+	}
+}
+
+static inline void write_field(uint8_t* pkt, int field, uint64_t val) {
+	switch (field) {
+		case LIBMOON_GENERATOR_IP_SRC:
+			*(uint32_t*) (pkt + IP_OFFSET + 12) = rte_cpu_to_be_32(val);
+			break;
+		case LIBMOON_GENERATOR_IP_DST:
+			*(uint32_t*) (pkt + IP_OFFSET + 16) = rte_cpu_to_be_32(val);
+			break;
+		case LIBMOON_GENERATOR_UDP_SRC:
+			write16(pkt + UDP_OFFSET, val);
+			break;
+		case LIBMOON_GENERATOR_UDP_DST:
+			write16(pkt + UDP_OFFSET + 2, val);
+			break;
+		case LIBMOON_GENERATOR_ETH_DST:
+		case LIBMOON_GENERATOR_ETH_SRC: {
+			uint8_t* mac = pkt + (field == LIBMOON_GENERATOR_ETH_SRC ? 6 : 0);
+			for (int i = 0; i < 6; i++) {
+				mac[i] = val >> (40 - i * 8);
+			}
+			break;
+		}
+	}
+}
+
+struct prefill_args {
+	const uint8_t* template;
+	uint16_t size;
+};
+
+static void prefill(struct rte_mempool* mp, void* opaque, void* obj, unsigned obj_idx) {
+	struct prefill_args* args = opaque;
+	struct rte_mbuf* buf = obj;
+	memcpy(rte_pktmbuf_mtod(buf, uint8_t*), args->template, args->size);
+}
+
+struct libmoon_generator_worker* libmoon_generator_worker_create(struct libmoon_generator* gen, uint32_t worker_id, uint32_t num_workers, uint32_t socket, uint32_t pool_size) {
+	if (!num_workers || worker_id >= num_workers) {
+		return NULL;
+	}
+	struct libmoon_generator_worker* worker = calloc(1, sizeof(*worker));
+	if (!worker) {
+		return NULL;
+	}
+	worker->gen = gen;
+	uint64_t flows = libmoon_generator_num_flows(gen);
+	worker->first_flow = (unsigned __int128) flows * worker_id / num_workers;
+	worker->end_flow = (unsigned __int128) flows * (worker_id + 1) / num_workers;
+	if (worker->first_flow == worker->end_flow) {
+		// more workers than flows
+		worker->first_flow = worker_id % flows;
+		worker->end_flow = worker->first_flow + 1;
+	}
+	for (int i = 0; i < LIBMOON_GENERATOR_NUM_FIELDS; i++) {
+		if (gen->fields[i].count > 1) {
+			worker->varying[worker->num_varying++] = i;
+		}
+	}
+	worker->size_idx = worker_id % gen->num_sizes;
+	seek(worker, worker->first_flow);
+	worker->pool = init_mem(pool_size, socket, gen->max_size);
+	uint8_t* template = malloc(gen->max_size);
+	if (!worker->pool || !template) {
+		free(template);
+		free(worker);
+		return NULL;
+	}
+	memcpy(template, gen->template, gen->max_size);
+	// constant fields are only written here
+	for (int i = 0; i < LIBMOON_GENERATOR_NUM_FIELDS; i++) {
+		write_field(template, i, worker->values[i]);
+	}
+	write16(template + IP_CSUM_OFFSET, 0);
+	write16(template + UDP_CSUM_OFFSET, 0);
+	struct prefill_args args = { .template = template, .size = gen->max_size };
+	rte_mempool_obj_iter(worker->pool, prefill, &args);
+	free(template);
+	return worker;
+}
+
+void libmoon_generator_worker_delete(struct libmoon_generator_worker* worker) {
+	// the mempool can't be freed in DPDK 17.08 as long as packets may be in flight
+	free(worker);
+}
+
+static inline void fill_packet(struct libmoon_generator_worker* worker, struct rte_mbuf* buf) {
+	struct libmoon_generator* gen = worker->gen;
+	uint8_t* pkt = rte_pktmbuf_mtod(buf, uint8_t*);
+	uint16_t size = gen->sizes[worker->size_idx];
+	if (++worker->size_idx == gen->num_sizes) {
+		worker->size_idx = 0;
+	}
+	buf->pkt_len = size;
+	buf->data_len = size;
+	for (uint32_t i = 0; i < worker->num_varying; i++) {
+		int field = worker->varying[i];
+		write_field(pkt, field, worker->values[field]);
+	}
+	uint16_t ip_len = size - IP_OFFSET;
+	uint16_t udp_len = size - UDP_OFFSET;
+	write16(pkt + IP_LEN_OFFSET, ip_len);
+	write16(pkt + UDP_LEN_OFFSET, udp_len);
+	uint32_t addr_sum = worker->csum[LIBMOON_GENERATOR_IP_SRC] + worker->csum[LIBMOON_GENERATOR_IP_DST];
+	if (gen->offload) {
+		buf->ol_flags = PKT_TX_IPV4 | PKT_TX_IP_CKSUM | (gen->udp_checksum ? PKT_TX_UDP_CKSUM : 0);
+		buf->l2_len = IP_OFFSET;
+		buf->l3_len = UDP_OFFSET - IP_OFFSET;
+		if (gen->udp_checksum) {
+			// the NIC expects the pseudo header checksum
+			write16(pkt + UDP_CSUM_OFFSET, fold(addr_sum + IPPROTO_UDP_NUM + udp_len));
+		}
+		return;
+	}
+	write16(pkt + IP_CSUM_OFFSET, ~fold(gen->ip_base + addr_sum + ip_len));
+	if (gen->udp_checksum) {
+		uint16_t payload_len = size - PAYLOAD_OFFSET;
+		uint64_t sum = addr_sum + IPPROTO_UDP_NUM + udp_len * 2
+			+ worker->csum[LIBMOON_GENERATOR_UDP_SRC] + worker->csum[LIBMOON_GENERATOR_UDP_DST]
+			+ gen->payload_sum[payload_len / 2];
+		if (payload_len & 1) {
+			sum += gen->template[PAYLOAD_OFFSET + payload_len - 1] << 8;
+		}
+		uint16_t csum = ~fold(sum);
+		write16(pkt + UDP_CSUM_OFFSET, csum ? csum : 0xFFFF);
+	}
+}
+
+uint32_t libmoon_generator_worker_fill(struct libmoon_generator_worker* worker, struct rte_mbuf** bufs, uint32_t num_bufs) {
+	if (rte_pktmbuf_alloc_bulk(worker->pool, bufs, num_bufs)) {
+		return 0;
+	}
+	for (uint32_t i = 0; i < num_bufs; i++) {
+		fill_packet(worker, bufs[i]);
+		next_flow(worker);
+	}
+	return num_bufs;
+}
+
+uint64_t libmoon_generator_worker_run(struct libmoon_generator_worker* worker, uint8_t port_id, uint16_t queue_id, uint32_t burst_size) {
+	struct rte_mbuf* bufs[MAX_BURST];
+	burst_size = RTE_MIN(RTE_MAX(burst_size, 1U), (uint32_t) MAX_BURST);
+	uint64_t sent = 0;
+	while (is_running(0)) {
+		uint32_t n = libmoon_generator_worker_fill(worker, bufs, burst_size);
+		if (n) {
+			sent += libmoon_tx_rate_send(port_id, queue_id, bufs, n);
+		}
+	}
+	return sent;
+}
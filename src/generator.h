@@ -0,0 +1,58 @@
+#ifndef MG_GENERATOR_H
+#define MG_GENERATOR_H
+
+#include <stdint.h>
+#include <rte_config.h>
+#include <rte_mbuf.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// native UDP/IPv4 packet generator
+// a generator describes the flows as the cartesian product of all field values and the packet sizes,
+// each worker (one per tx queue/core) generates a disjoint slice of the flows from a private, pre-filled mempool
+// only the varying fields, lengths, and checksums are written per packet, checksums are updated incrementally
+
+enum libmoon_generator_field {
+	LIBMOON_GENERATOR_IP_SRC,
+	LIBMOON_GENERATOR_IP_DST,
+	LIBMOON_GENERATOR_UDP_SRC,
+	LIBMOON_GENERATOR_UDP_DST,
+	LIBMOON_GENERATOR_ETH_SRC,
+	LIBMOON_GENERATOR_ETH_DST,
+	LIBMOON_GENERATOR_NUM_FIELDS
+};
+
+#define LIBMOON_GENERATOR_MAX_SIZES 4096
+
+struct libmoon_generator;
+struct libmoon_generator_worker;
+
+// template is a complete ethernet/IPv4/UDP packet without IP options of max_size bytes (excl. CRC), it is copied
+// offload uses IP and UDP checksum offloading, otherwise the IP checksum and (if udp_checksum is set) the UDP checksum are calculated in software
+struct libmoon_generator* libmoon_generator_create(const uint8_t* template, uint16_t max_size, uint8_t offload, uint8_t udp_checksum);
+void libmoon_generator_delete(struct libmoon_generator* gen);
+// values are in host byte order, MAC addresses as 48 bit numbers with the first byte as most significant byte
+// the field takes count values starting at min with the given step, the first value of the flow space is min
+int libmoon_generator_set_range(struct libmoon_generator* gen, enum libmoon_generator_field field, uint64_t min, uint64_t count, uint64_t step);
+int libmoon_generator_set_values(struct libmoon_generator* gen, enum libmoon_generator_field field, const uint64_t* values, uint32_t num_values);
+// packet sizes (excl. CRC) are cycled in an interleaved order according to their weights (weights may be NULL)
+int libmoon_generator_set_sizes(struct libmoon_generator* gen, const uint16_t* sizes, const uint32_t* weights, uint32_t num_sizes);
+uint64_t libmoon_generator_num_flows(struct libmoon_generator* gen);
+
+// worker worker_id of num_workers generates the flows [worker_id * flows / num_workers, (worker_id + 1) * flows / num_workers)
+// the mempool is allocated on the given socket and filled with the template
+struct libmoon_generator_worker* libmoon_generator_worker_create(struct libmoon_generator* gen, uint32_t worker_id, uint32_t num_workers, uint32_t socket, uint32_t pool_size);
+void libmoon_generator_worker_delete(struct libmoon_generator_worker* worker);
+// allocates and fills num_bufs packets, returns num_bufs or 0 (nothing allocated) if the pool does not have enough free buffers
+uint32_t libmoon_generator_worker_fill(struct libmoon_generator_worker* worker, struct rte_mbuf** bufs, uint32_t num_bufs);
+// generates and sends packets until libmoon is stopped, uses the software rate control if enabled on the queue (see tx_rate.h)
+// returns the number of sent packets
+uint64_t libmoon_generator_worker_run(struct libmoon_generator_worker* worker, uint8_t port_id, uint16_t queue_id, uint32_t burst_size);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,380 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include <rte_config.h>
+#include <rte_branch_prediction.h>
+
+#include "histogram.h"
+
+#define DEFAULT_PRECISION 10
+#define MIN_PRECISION 2
+#define MAX_PRECISION 16
+
+// serialization format: magic, version, precision, varints for count/min/max/sum/shift, raw double for the squares,
+// followed by (index delta, count) varint pairs for all non-empty buckets
+#define SERIALIZED_MAGIC "LMHG"
+#define SERIALIZED_VERSION 1
+
+struct libmoon_histogram {
+	uint8_t precision;
+	uint32_t num_buckets;
+	uint64_t count;
+	int64_t min;
+	int64_t max;
+	int64_t sum;
+	// variance is calculated on values shifted by the first value to avoid cancellation
+	int64_t shift;
+	double sum_squares;
+	uint64_t buckets[];
+};
+
+// only the recording thread writes, the atomic stores prevent torn reads
+static inline void store_u64(uint64_t* dst, uint64_t val) {
+	__atomic_store_n(dst, val, __ATOMIC_RELAXED);
+}
+
+static inline void store_i64(int64_t* dst, int64_t val) {
+	__atomic_store_n(dst, val, __ATOMIC_RELAXED);
+}
+
+static inline uint64_t load_u64(uint64_t* src) {
+	return __atomic_load_n(src, __ATOMIC_RELAXED);
+}
+
+static inline int64_t load_i64(int64_t* src) {
+	return __atomic_load_n(src, __ATOMIC_RELAXED);
+}
+
+static inline uint32_t get_index(uint8_t precision, int64_t value) {
+	if (unlikely(value < 0)) {
+		// negative values are counted in bucket 0, the min/sum statistics still see the real value
+		value = 0;
+	}
+	uint64_t v = value;
+	uint64_t sub_buckets = 1ULL << precision;
+	if (v < sub_buckets) {
+		return v;
+	}
+	uint32_t exp = 63 - __builtin_clzll(v) - precision;
+	return sub_buckets + exp * (sub_buckets / 2) + ((v >> (exp + 1)) - sub_buckets / 2);
+}
+
+static inline int64_t get_lower_bound(uint8_t precision, uint32_t idx, int64_t* width) {
+	uint64_t sub_buckets = 1ULL << precision;
+	if (idx < sub_buckets) {
+		*width = 1;
+		return idx;
+	}
+	uint32_t offset = idx - sub_buckets;
+	uint32_t exp = offset / (sub_buckets / 2);
+	uint64_t mantissa = offset % (sub_buckets / 2) + sub_buckets / 2;
+	*width = 1LL << (exp + 1);
+	return mantissa << (exp + 1);
+}
+
+// value reported for samples in a bucket, the middle of the bucket
+static inline int64_t get_value(uint8_t precision, uint32_t idx) {
+	int64_t width;
+	int64_t lower = get_lower_bound(precision, idx, &width);
+	return lower + (width - 1) / 2;
+}
+
+struct libmoon_histogram* libmoon_histogram_create(uint8_t precision) {
+	if (!precision) {
+		precision = DEFAULT_PRECISION;
+	}
+	if (precision < MIN_PRECISION || precision > MAX_PRECISION) {
+		return NULL;
+	}
+	// values are non-negative int64_t, so the largest index is for 2^63 - 1
+	uint32_t num_buckets = get_index(precision, INT64_MAX) + 1;
+	struct libmoon_histogram* h = calloc(1, sizeof(*h) + num_buckets * sizeof(uint64_t));
+	if (!h) {
+		return NULL;
+	}
+	h->precision = precision;
+	h->num_buckets = num_buckets;
+	libmoon_histogram_reset(h);
+	return h;
+}
+
+void libmoon_histogram_delete(struct libmoon_histogram* h) {
+	free(h);
+}
+
+void libmoon_histogram_reset(struct libmoon_histogram* h) {
+	store_u64(&h->count, 0);
+	memset(h->buckets, 0, h->num_buckets * sizeof(uint64_t));
+	store_i64(&h->min, INT64_MAX);
+	store_i64(&h->max, INT64_MIN);
+	store_i64(&h->sum, 0);
+	store_i64(&h->shift, 0);
+	double zero = 0;
+	__atomic_store(&h->sum_squares, &zero, __ATOMIC_RELAXED);
+}
+
+uint8_t libmoon_histogram_get_precision(struct libmoon_histogram* h) {
+	return h->precision;
+}
+
+static inline void add_stats(struct libmoon_histogram* h, int64_t min, int64_t max, int64_t sum, double sum_squares, uint64_t count) {
+	if (min < h->min) {
+		store_i64(&h->min, min);
+	}
+	if (max > h->max) {
+		store_i64(&h->max, max);
+	}
+	store_i64(&h->sum, h->sum + sum);
+	double squares = h->sum_squares + sum_squares;
+	__atomic_store(&h->sum_squares, &squares, __ATOMIC_RELAXED);
+	// count last, a reader seeing the new count sees the bucket
+	__atomic_store_n(&h->count, h->count + count, __ATOMIC_RELEASE);
+}
+
+void libmoon_histogram_record_n(struct libmoon_histogram* h, int64_t value, uint64_t count) {
+	if (unlikely(!h->count)) {
+		store_i64(&h->shift, value);
+	}
+	uint32_t idx = get_index(h->precision, value);
+	store_u64(&h->buckets[idx], h->buckets[idx] + count);
+	double shifted = (double) (value - h->shift);
+	add_stats(h, value, value, value * (int64_t) count, shifted * shifted * count, count);
+}
+
+void libmoon_histogram_record(struct libmoon_histogram* h, int64_t value) {
+	libmoon_histogram_record_n(h, value, 1);
+}
+
+void libmoon_histogram_record_bulk(struct libmoon_histogram* h, const int64_t* values, uint32_t num_values) {
+	for (uint32_t i = 0; i < num_values; i++) {
+		libmoon_histogram_record_n(h, values[i], 1);
+	}
+}
+
+uint64_t libmoon_histogram_count(struct libmoon_histogram* h) {
+	return __atomic_load_n(&h->count, __ATOMIC_ACQUIRE);
+}
+
+void libmoon_histogram_get_summary(struct libmoon_histogram* h, struct libmoon_histogram_summary* summary) {
+	uint64_t count = libmoon_histogram_count(h);
+	int64_t sum = load_i64(&h->sum);
+	int64_t shift = load_i64(&h->shift);
+	double sum_squares;
+	__atomic_load(&h->sum_squares, &sum_squares, __ATOMIC_RELAXED);
+	summary->count = count;
+	summary->sum = sum;
+	summary->min = load_i64(&h->min);
+	summary->max = load_i64(&h->max);
+	if (!count) {
+		summary->avg = NAN;
+		summary->std_dev = NAN;
+		return;
+	}
+	summary->avg = (double) sum / count;
+	double shifted_sum = (double) (sum - shift * (int64_t) count);
+	double variance = (sum_squares - shifted_sum * shifted_sum / count) / (count - 1);
+	summary->std_dev = count > 1 ? sqrt(variance > 0 ? variance : 0) : NAN;
+}
+
+// percentiles must be sorted in ascending order, each result is the value of the first sample at index >= count * p / 100
+void libmoon_histogram_percentiles(struct libmoon_histogram* h, const double* percentiles, int64_t* results, uint32_t num) {
+	uint64_t count = libmoon_histogram_count(h);
+	int64_t min = load_i64(&h->min);
+	int64_t max = load_i64(&h->max);
+	uint64_t seen = 0;
+	uint32_t idx = 0;
+	for (uint32_t i = 0; i < num; i++) {
+		if (!count) {
+			results[i] = 0;
+			continue;
+		}
+		uint64_t target = (uint64_t) ceil(count * percentiles[i] / 100);
+		if (target >= count - 1) {
+			results[i] = max;
+			continue;
+		} else if (target == 0) {
+			results[i] = min;
+			continue;
+		}
+		// a concurrent writer can make the buckets sum up to more than count, but never less
+		while (idx < h->num_buckets) {
+			uint64_t c = load_u64(&h->buckets[idx]);
+			if (seen + c > target) {
+				break;
+			}
+			seen += c;
+			idx++;
+		}
+		int64_t value = get_value(h->precision, idx < h->num_buckets ? idx : h->num_buckets - 1);
+		results[i] = value < min ? min : value > max ? max : value;
+	}
+}
+
+int64_t libmoon_histogram_percentile(struct libmoon_histogram* h, double percentile) {
+	int64_t result;
+	libmoon_histogram_percentiles(h, &percentile, &result, 1);
+	return result;
+}
+
+// iterates over all non-empty buckets, start with idx = 0, returns 0 at the end
+uint32_t libmoon_histogram_next_bucket(struct libmoon_histogram* h, uint32_t idx, int64_t* value, uint64_t* count) {
+	for (; idx < h->num_buckets; idx++) {
+		uint64_t c = load_u64(&h->buckets[idx]);
+		if (c) {
+			*value = get_value(h->precision, idx);
+			*count = c;
+			return idx + 1;
+		}
+	}
+	return 0;
+}
+
+static void merge_stats(struct libmoon_histogram* dst, uint64_t count, int64_t min, int64_t max, int64_t sum, int64_t shift, double sum_squares) {
+	if (!count) {
+		return;
+	}
+	if (!dst->count) {
+		store_i64(&dst->shift, shift);
+	}
+	// move the squares to the shift of dst: sum((v - s1)^2) = sum((v - s2)^2) + 2 d sum(v - s2) + n d^2 with d = s2 - s1
+	double d = (double) (shift - dst->shift);
+	double shifted_sum = (double) (sum - shift * (int64_t) count);
+	sum_squares += 2 * d * shifted_sum + count * d * d;
+	add_stats(dst, min, max, sum, sum_squares, count);
+}
+
+static inline void add_bucket(struct libmoon_histogram* dst, uint8_t precision, uint32_t idx, uint64_t count) {
+	uint32_t dst_idx = precision == dst->precision ? idx : get_index(dst->precision, get_value(precision, idx));
+	store_u64(&dst->buckets[dst_idx], dst->buckets[dst_idx] + count);
+}
+
+// adds all samples from src to dst, dst must not be written concurrently
+void libmoon_histogram_merge(struct libmoon_histogram* dst, struct libmoon_histogram* src) {
+	uint64_t count = libmoon_histogram_count(src);
+	for (uint32_t i = 0; i < src->num_buckets; i++) {
+		uint64_t c = load_u64(&src->buckets[i]);
+		if (c) {
+			add_bucket(dst, src->precision, i, c);
+		}
+	}
+	double sum_squares;
+	__atomic_load(&src->sum_squares, &sum_squares, __ATOMIC_RELAXED);
+	merge_stats(dst, count, load_i64(&src->min), load_i64(&src->max), load_i64(&src->sum), load_i64(&src->shift), sum_squares);
+}
+
+static inline uint64_t zigzag(int64_t v) {
+	return ((uint64_t) v << 1) ^ (uint64_t) (v >> 63);
+}
+
+static inline int64_t unzigzag(uint64_t v) {
+	return (int64_t) (v >> 1) ^ -(int64_t) (v & 1);
+}
+
+static inline size_t write_varint(uint8_t* buf, size_t len, size_t offset, uint64_t v) {
+	do {
+		uint8_t byte = v & 0x7F;
+		v >>= 7;
+		if (offset < len) {
+			buf[offset] = byte | (v ? 0x80 : 0);
+		}
+		offset++;
+	} while (v);
+	return offset;
+}
+
+static inline int read_varint(const uint8_t* buf, size_t len, size_t* offset, uint64_t* v) {
+	*v = 0;
+	for (int shift = 0; shift < 64; shift += 7) {
+		if (*offset >= len) {
+			return -1;
+		}
+		uint8_t byte = buf[(*offset)++];
+		*v |= (uint64_t) (byte & 0x7F) << shift;
+		if (!(byte & 0x80)) {
+			return 0;
+		}
+	}
+	return -1;
+}
+
+static inline size_t write_bytes(uint8_t* buf, size_t len, size_t offset, const void* data, size_t size) {
+	if (offset + size <= len) {
+		memcpy(buf + offset, data, size);
+	}
+	return offset + size;
+}
+
+// returns the size of the serialized histogram, the data is incomplete if this is larger than len
+size_t libmoon_histogram_serialize(struct libmoon_histogram* h, uint8_t* buf, size_t len) {
+	uint8_t header[6] = { SERIALIZED_MAGIC[0], SERIALIZED_MAGIC[1], SERIALIZED_MAGIC[2], SERIALIZED_MAGIC[3], SERIALIZED_VERSION, h->precision };
+	size_t offset = write_bytes(buf, len, 0, header, sizeof(header));
+	offset = write_varint(buf, len, offset, libmoon_histogram_count(h));
+	offset = write_varint(buf, len, offset, zigzag(load_i64(&h->min)));
+	offset = write_varint(buf, len, offset, zigzag(load_i64(&h->max)));
+	offset = write_varint(buf, len, offset, zigzag(load_i64(&h->sum)));
+	offset = write_varint(buf, len, offset, zigzag(load_i64(&h->shift)));
+	double sum_squares;
+	__atomic_load(&h->sum_squares, &sum_squares, __ATOMIC_RELAXED);
+	offset = write_bytes(buf, len, offset, &sum_squares, sizeof(sum_squares));
+	uint32_t last = 0;
+	for (uint32_t i = 0; i < h->num_buckets; i++) {
+		uint64_t c = load_u64(&h->buckets[i]);
+		if (c) {
+			offset = write_varint(buf, len, offset, i - last);
+			offset = write_varint(buf, len, offset, c);
+			last = i;
+		}
+	}
+	return offset;
+}
+
+// adds the samples of a serialized histogram to h, returns 0 on success
+int libmoon_histogram_deserialize(struct libmoon_histogram* h, const uint8_t* buf, size_t len) {
+	if (len < 6 || memcmp(buf, SERIALIZED_MAGIC, 4) || buf[4] != SERIALIZED_VERSION) {
+		return -1;
+	}
+	uint8_t precision = buf[5];
+	if (precision < MIN_PRECISION || precision > MAX_PRECISION) {
+		return -1;
+	}
+	uint32_t num_buckets = get_index(precision, INT64_MAX) + 1;
+	size_t offset = 6;
+	uint64_t count, min, max, sum, shift;
+	if (read_varint(buf, len, &offset, &count)
+	|| read_varint(buf, len, &offset, &min)
+	|| read_varint(buf, len, &offset, &max)
+	|| read_varint(buf, len, &offset, &sum)
+	|| read_varint(buf, len, &offset, &shift)
+	|| offset + sizeof(double) > len) {
+		return -1;
+	}
+	double sum_squares;
+	memcpy(&sum_squares, buf + offset, sizeof(sum_squares));
+	offset += sizeof(sum_squares);
+	// validate first to not leave a half-merged histogram behind
+	size_t buckets_start = offset;
+	uint64_t idx = 0;
+	while (offset < len) {
+		uint64_t delta, c;
+		if (read_varint(buf, len, &offset, &delta) || read_varint(buf, len, &offset, &c)) {
+			return -1;
+		}
+		idx += delta;
+		if (idx >= num_buckets) {
+			return -1;
+		}
+	}
+	offset = buckets_start;
+	idx = 0;
+	while (offset < len) {
+		uint64_t delta, c;
+		read_varint(buf, len, &offset, &delta);
+		read_varint(buf, len, &offset, &c);
+		idx += delta;
+		add_bucket(h, precision, idx, c);
+	}
+	merge_stats(h, count, unzigzag(min), unzigzag(max), unzigzag(sum), unzigzag(shift), sum_squares);
+	return 0;
+}
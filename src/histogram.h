@@ -0,0 +1,46 @@
+#ifndef MG_HISTOGRAM_H
+#define MG_HISTOGRAM_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// log-linear (HDR) histogram: values below 2^precision are stored exactly,
+// larger values in 2^(precision - 1) buckets per power of two, i.e., with a relative error below 2^-(precision - 1)
+// recording is done by a single thread, other threads can read concurrently
+// memory is (2^precision + (63 - precision) * 2^(precision - 1)) * 8 bytes, e.g., 12.8 MB at the maximum precision of 16
+struct libmoon_histogram;
+
+struct libmoon_histogram_summary {
+	uint64_t count;
+	int64_t sum;
+	int64_t min;
+	int64_t max;
+	double avg;
+	double std_dev;
+};
+
+struct libmoon_histogram* libmoon_histogram_create(uint8_t precision);
+void libmoon_histogram_delete(struct libmoon_histogram* h);
+void libmoon_histogram_reset(struct libmoon_histogram* h);
+void libmoon_histogram_record(struct libmoon_histogram* h, int64_t value);
+void libmoon_histogram_record_n(struct libmoon_histogram* h, int64_t value, uint64_t count);
+void libmoon_histogram_record_bulk(struct libmoon_histogram* h, const int64_t* values, uint32_t num_values);
+uint8_t libmoon_histogram_get_precision(struct libmoon_histogram* h);
+uint64_t libmoon_histogram_count(struct libmoon_histogram* h);
+void libmoon_histogram_get_summary(struct libmoon_histogram* h, struct libmoon_histogram_summary* summary);
+int64_t libmoon_histogram_percentile(struct libmoon_histogram* h, double percentile);
+void libmoon_histogram_percentiles(struct libmoon_histogram* h, const double* percentiles, int64_t* results, uint32_t num);
+uint32_t libmoon_histogram_next_bucket(struct libmoon_histogram* h, uint32_t idx, int64_t* value, uint64_t* count);
+void libmoon_histogram_merge(struct libmoon_histogram* dst, struct libmoon_histogram* src);
+size_t libmoon_histogram_serialize(struct libmoon_histogram* h, uint8_t* buf, size_t len);
+int libmoon_histogram_deserialize(struct libmoon_histogram* h, const uint8_t* buf, size_t len);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
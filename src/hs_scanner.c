@@ -0,0 +1,122 @@
+#include <stdint.h>
+#include <string.h>
+
+#include <rte_config.h>
+#include <rte_common.h>
+#include <rte_branch_prediction.h>
+#include <rte_lcore.h>
+#include <rte_malloc.h>
+#include <rte_mbuf.h>
+#include <rte_prefetch.h>
+
+#include "hs_scanner.h"
+
+#define PREFETCH_OFFSET 4
+
+struct lcore_state {
+	hs_scratch_t* scratch;
+	uint64_t errors;
+} __rte_cache_aligned;
+
+struct libmoon_hs_scanner {
+	const hs_database_t* db;
+	hs_scratch_t* prototype;
+	struct lcore_state lcores[RTE_MAX_LCORE];
+};
+
+struct match_context {
+	uint32_t first_id;
+	uint32_t max_id;
+	uint64_t* counts;
+	uint8_t all_matches;
+};
+
+static int on_match(unsigned int id, unsigned long long from, unsigned long long to, unsigned int flags, void* ctx) {
+	struct match_context* match = ctx;
+	if (match->first_id == UINT32_MAX) {
+		match->first_id = id;
+	}
+	if (match->counts && id <= match->max_id) {
+		match->counts[id]++;
+	}
+	// non-zero terminates the scan of this packet
+	return !match->all_matches;
+}
+
+struct libmoon_hs_scanner* libmoon_hs_scanner_create(const hs_database_t* db) {
+	struct libmoon_hs_scanner* scanner = rte_zmalloc("hs_scanner", sizeof(*scanner), RTE_CACHE_LINE_SIZE);
+	if (!scanner) {
+		return NULL;
+	}
+	scanner->db = db;
+	if (hs_alloc_scratch(db, &scanner->prototype) != HS_SUCCESS) {
+		rte_free(scanner);
+		return NULL;
+	}
+	// scratch spaces can't be shared between threads, clone it for all lcores that can run tasks
+	unsigned lcore;
+	RTE_LCORE_FOREACH(lcore) {
+		if (hs_clone_scratch(scanner->prototype, &scanner->lcores[lcore].scratch) != HS_SUCCESS) {
+			libmoon_hs_scanner_delete(scanner);
+			return NULL;
+		}
+	}
+	return scanner;
+}
+
+void libmoon_hs_scanner_delete(struct libmoon_hs_scanner* scanner) {
+	for (unsigned i = 0; i < RTE_MAX_LCORE; i++) {
+		if (scanner->lcores[i].scratch) {
+			hs_free_scratch(scanner->lcores[i].scratch);
+		}
+	}
+	hs_free_scratch(scanner->prototype);
+	rte_free(scanner);
+}
+
+int32_t libmoon_hs_scan_burst(struct libmoon_hs_scanner* scanner, struct rte_mbuf** bufs, uint32_t num_bufs, uint32_t offset, uint64_t* mask, uint32_t* ids, uint64_t* counts, uint32_t max_id, uint8_t all_matches) {
+	unsigned lcore = rte_lcore_id();
+	if (unlikely(lcore >= RTE_MAX_LCORE || !scanner->lcores[lcore].scratch)) {
+		return -1;
+	}
+	struct lcore_state* state = &scanner->lcores[lcore];
+	struct match_context ctx = {
+		.max_id = max_id,
+		.counts = counts,
+		.all_matches = all_matches
+	};
+	int32_t matches = 0;
+	memset(mask, 0, (num_bufs + 63) / 64 * sizeof(uint64_t));
+	for (uint32_t i = 0; i < RTE_MIN(num_bufs, (uint32_t) PREFETCH_OFFSET); i++) {
+		rte_prefetch0(rte_pktmbuf_mtod_offset(bufs[i], void*, offset));
+	}
+	for (uint32_t i = 0; i < num_bufs; i++) {
+		if (i + PREFETCH_OFFSET < num_bufs) {
+			rte_prefetch0(rte_pktmbuf_mtod_offset(bufs[i + PREFETCH_OFFSET], void*, offset));
+		}
+		struct rte_mbuf* buf = bufs[i];
+		ctx.first_id = UINT32_MAX;
+		if (buf->data_len > offset) {
+			hs_error_t rc = hs_scan(scanner->db, rte_pktmbuf_mtod_offset(buf, const char*, offset), buf->data_len - offset, 0, state->scratch, on_match, &ctx);
+			if (unlikely(rc != HS_SUCCESS && rc != HS_SCAN_TERMINATED)) {
+				__atomic_store_n(&state->errors, state->errors + 1, __ATOMIC_RELAXED);
+			}
+		}
+		if (ctx.first_id != UINT32_MAX) {
+			mask[i / 64] |= 1ULL << (i % 64);
+			matches++;
+		}
+		if (ids) {
+			ids[i] = ctx.first_id;
+		}
+	}
+	return matches;
+}
+
+uint64_t libmoon_hs_scanner_errors(struct libmoon_hs_scanner* scanner) {
+	uint64_t errors = 0;
+	for (unsigned i = 0; i < RTE_MAX_LCORE; i++) {
+		errors += __atomic_load_n(&scanner->lcores[i].errors, __ATOMIC_RELAXED);
+	}
+	return errors;
+}
@@ -0,0 +1,36 @@
+#ifndef MG_HS_SCANNER_H
+#define MG_HS_SCANNER_H
+
+#include <stdint.h>
+#include <rte_config.h>
+#include <rte_mbuf.h>
+#include <hs/hs.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// only built if Hyperscan was found by cmake
+
+// scans whole bursts in block mode without calling back into Lua
+// every lcore gets its own clone of the scratch space, so a scanner can be shared by all tasks
+struct libmoon_hs_scanner;
+
+// does not take ownership of the database, it must be compiled in block mode
+struct libmoon_hs_scanner* libmoon_hs_scanner_create(const hs_database_t* db);
+void libmoon_hs_scanner_delete(struct libmoon_hs_scanner* scanner);
+
+// scans the first segment of each mbuf starting at offset, bit i of mask (64 bit words) is set if bufs[i] matches
+// ids (optional) receives the id of the first match of each packet or UINT32_MAX
+// scanning a packet stops after its first match unless all_matches is set, counts (optional, indexed by pattern id,
+// max_id + 1 entries) is incremented for every match
+// returns the number of matching packets, or -1 if called from a thread without scratch space
+int32_t libmoon_hs_scan_burst(struct libmoon_hs_scanner* scanner, struct rte_mbuf** bufs, uint32_t num_bufs, uint32_t offset, uint64_t* mask, uint32_t* ids, uint64_t* counts, uint32_t max_id, uint8_t all_matches);
+// number of failed scans (other than terminated ones) of all lcores
+uint64_t libmoon_hs_scanner_errors(struct libmoon_hs_scanner* scanner);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,289 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <netinet/in.h>
+
+#include <rte_config.h>
+#include <rte_common.h>
+#include <rte_branch_prediction.h>
+#include <rte_malloc.h>
+#include <rte_mbuf.h>
+
+#include "hs_stream_table.h"
+#include "flow_table.h"
+#include "burst_parser.h"
+
+#define EXPIRE_BATCH 64
+#define TCP_FIN 0x01
+#define TCP_RST 0x04
+
+struct stream_slot {
+	struct libmoon_flow_key key;
+	// doubly linked LRU list, slot + 1, 0 terminates the list
+	uint32_t lru_prev;
+	uint32_t lru_next;
+	// 0 if the stream has not been scanned yet
+	uint32_t state_len;
+	uint32_t reserved;
+	char state[] __attribute__((aligned(8)));
+};
+
+struct libmoon_hs_stream_table {
+	const hs_database_t* db;
+	// maps the flow to its slot
+	struct libmoon_flow_table* flows;
+	hs_scratch_t* scratch;
+	// all flows are scanned by expanding their state into this stream
+	hs_stream_t* stream;
+	uint32_t max_flows;
+	uint32_t state_size;
+	uint32_t slot_size;
+	// most and least recently used slot + 1
+	uint32_t lru_head;
+	uint32_t lru_tail;
+	uint32_t num_free;
+	uint32_t* free_slots;
+	uint8_t* slots;
+	struct libmoon_hs_stream_stats stats;
+	struct libmoon_flow_key expired_keys[EXPIRE_BATCH];
+	uint32_t expired_slots[EXPIRE_BATCH];
+};
+
+struct match_context {
+	uint32_t first_id;
+	uint32_t matches;
+};
+
+static int on_match(unsigned int id, unsigned long long from, unsigned long long to, unsigned int flags, void* ctx) {
+	struct match_context* match = ctx;
+	if (match->first_id == UINT32_MAX) {
+		match->first_id = id;
+	}
+	match->matches++;
+	// terminating would make the stream unusable for the following packets of the flow
+	return 0;
+}
+
+static inline struct stream_slot* get_slot(struct libmoon_hs_stream_table* table, uint32_t idx) {
+	return (struct stream_slot*) (table->slots + (size_t) idx * table->slot_size);
+}
+
+static inline void lru_unlink(struct libmoon_hs_stream_table* table, uint32_t idx) {
+	struct stream_slot* slot = get_slot(table, idx);
+	if (slot->lru_prev) {
+		get_slot(table, slot->lru_prev - 1)->lru_next = slot->lru_next;
+	} else {
+		table->lru_head = slot->lru_next;
+	}
+	if (slot->lru_next) {
+		get_slot(table, slot->lru_next - 1)->lru_prev = slot->lru_prev;
+	} else {
+		table->lru_tail = slot->lru_prev;
+	}
+}
+
+static inline void lru_push_front(struct libmoon_hs_stream_table* table, uint32_t idx) {
+	struct stream_slot* slot = get_slot(table, idx);
+	slot->lru_prev = 0;
+	slot->lru_next = table->lru_head;
+	if (table->lru_head) {
+		get_slot(table, table->lru_head - 1)->lru_prev = idx + 1;
+	} else {
+		table->lru_tail = idx + 1;
+	}
+	table->lru_head = idx + 1;
+}
+
+static inline void release_slot(struct libmoon_hs_stream_table* table, uint32_t idx) {
+	lru_unlink(table, idx);
+	table->free_slots[table->num_free++] = idx;
+	table->stats.active_flows--;
+}
+
+static void evict_lru(struct libmoon_hs_stream_table* table) {
+	uint32_t idx = table->lru_tail - 1;
+	libmoon_flow_table_remove(table->flows, &get_slot(table, idx)->key);
+	release_slot(table, idx);
+	table->stats.evicted++;
+}
+
+// returns the slot of the flow, opens a new stream if necessary
+static uint32_t get_flow(struct libmoon_hs_stream_table* table, const struct libmoon_flow_key* key, uint32_t now) {
+	uint32_t* ref = libmoon_flow_table_lookup(table->flows, key, now);
+	if (ref) {
+		lru_unlink(table, *ref);
+		lru_push_front(table, *ref);
+		return *ref;
+	}
+	if (!table->num_free) {
+		evict_lru(table);
+	}
+	uint8_t is_new;
+	ref = libmoon_flow_table_insert(table->flows, key, now, &is_new);
+	if (unlikely(!ref)) {
+		return UINT32_MAX;
+	}
+	uint32_t idx = table->free_slots[--table->num_free];
+	struct stream_slot* slot = get_slot(table, idx);
+	*ref = idx;
+	slot->key = *key;
+	slot->state_len = 0;
+	lru_push_front(table, idx);
+	table->stats.flows++;
+	table->stats.active_flows++;
+	return idx;
+}
+
+// finds the L4 payload of TCP and UDP packets, returns 0 for other packets
+static inline int get_payload(struct rte_mbuf* buf, const struct libmoon_parsed_packet* pkt, uint32_t* offset, uint32_t* len, uint8_t* tcp_flags) {
+	uint8_t* data = rte_pktmbuf_mtod(buf, uint8_t*);
+	uint32_t l4 = pkt->l4_offset;
+	*tcp_flags = 0;
+	if (!l4) {
+		return 0;
+	}
+	if (pkt->key.proto == IPPROTO_TCP) {
+		if (buf->data_len < l4 + 20) {
+			return 0;
+		}
+		*offset = l4 + (data[l4 + 12] >> 4) * 4;
+		*tcp_flags = data[l4 + 13];
+	} else if (pkt->key.proto == IPPROTO_UDP) {
+		*offset = l4 + 8;
+	} else {
+		return 0;
+	}
+	*len = buf->data_len > *offset ? buf->data_len - *offset : 0;
+	return 1;
+}
+
+struct libmoon_hs_stream_table* libmoon_hs_stream_table_create(const hs_database_t* db, uint32_t max_flows, uint32_t timeout, uint32_t state_size, int socket) {
+	size_t stream_size;
+	if (!max_flows || hs_stream_size(db, &stream_size) != HS_SUCCESS) {
+		return NULL;
+	}
+	struct libmoon_hs_stream_table* table = rte_zmalloc_socket("hs_stream_table", sizeof(*table), RTE_CACHE_LINE_SIZE, socket);
+	if (!table) {
+		return NULL;
+	}
+	table->db = db;
+	table->max_flows = max_flows;
+	table->state_size = state_size ? state_size : stream_size;
+	table->slot_size = RTE_ALIGN(sizeof(struct stream_slot) + table->state_size, 8);
+	table->stats.state_size = table->state_size;
+	table->flows = libmoon_flow_table_create(max_flows, sizeof(uint32_t), timeout, 0, socket);
+	table->free_slots = rte_malloc_socket("hs_stream_free", max_flows * sizeof(uint32_t), RTE_CACHE_LINE_SIZE, socket);
+	table->slots = rte_malloc_socket("hs_stream_slots", (size_t) max_flows * table->slot_size, RTE_CACHE_LINE_SIZE, socket);
+	if (!table->flows || !table->free_slots || !table->slots
+	|| hs_alloc_scratch(db, &table->scratch) != HS_SUCCESS
+	|| hs_open_stream(db, 0, &table->stream) != HS_SUCCESS) {
+		libmoon_hs_stream_table_delete(table);
+		return NULL;
+	}
+	for (uint32_t i = 0; i < max_flows; i++) {
+		table->free_slots[i] = max_flows - i - 1;
+	}
+	table->num_free = max_flows;
+	return table;
+}
+
+void libmoon_hs_stream_table_delete(struct libmoon_hs_stream_table* table) {
+	if (table->stream) {
+		hs_close_stream(table->stream, table->scratch, NULL, NULL);
+	}
+	if (table->scratch) {
+		hs_free_scratch(table->scratch);
+	}
+	if (table->flows) {
+		libmoon_flow_table_delete(table->flows);
+	}
+	rte_free(table->free_slots);
+	rte_free(table->slots);
+	rte_free(table);
+}
+
+int32_t libmoon_hs_stream_scan_burst(struct libmoon_hs_stream_table* table, struct rte_mbuf** bufs, uint32_t num_bufs, uint32_t now, uint64_t* mask, uint32_t* ids) {
+	int32_t matches = 0;
+	memset(mask, 0, (num_bufs + 63) / 64 * sizeof(uint64_t));
+	for (uint32_t i = 0; i < num_bufs; i++) {
+		struct rte_mbuf* buf = bufs[i];
+		struct match_context ctx = { .first_id = UINT32_MAX, .matches = 0 };
+		struct libmoon_parsed_packet pkt;
+		uint32_t offset, len;
+		uint8_t tcp_flags;
+		if (ids) {
+			ids[i] = UINT32_MAX;
+		}
+		if (libmoon_parse_packet(buf, &pkt) || !get_payload(buf, &pkt, &offset, &len, &tcp_flags)) {
+			continue;
+		}
+		bool close = tcp_flags & (TCP_FIN | TCP_RST);
+		if (close && !len && !libmoon_flow_table_lookup(table->flows, &pkt.key, now)) {
+			// nothing to scan or close
+			continue;
+		}
+		uint32_t idx = get_flow(table, &pkt.key, now);
+		if (unlikely(idx == UINT32_MAX)) {
+			table->stats.errors++;
+			continue;
+		}
+		struct stream_slot* slot = get_slot(table, idx);
+		hs_error_t rc = HS_INVALID;
+		if (slot->state_len) {
+			// matches of the previously expanded flow were already reported when it was scanned
+			rc = hs_reset_and_expand_stream(table->stream, slot->state, slot->state_len, table->scratch, NULL, NULL);
+		}
+		if (rc != HS_SUCCESS) {
+			hs_reset_stream(table->stream, 0, table->scratch, NULL, NULL);
+		}
+		if (len) {
+			rc = hs_scan_stream(table->stream, rte_pktmbuf_mtod_offset(buf, const char*, offset), len, 0, table->scratch, on_match, &ctx);
+			if (unlikely(rc != HS_SUCCESS)) {
+				table->stats.errors++;
+			}
+		}
+		if (close) {
+			// resetting reports the matches at the end of the stream, e.g. patterns anchored with $
+			hs_reset_stream(table->stream, 0, table->scratch, on_match, &ctx);
+			libmoon_flow_table_remove(table->flows, &pkt.key);
+			release_slot(table, idx);
+			table->stats.closed++;
+		} else {
+			size_t used;
+			if (hs_compress_stream(table->stream, slot->state, table->state_size, &used) == HS_SUCCESS) {
+				slot->state_len = used;
+			} else {
+				// state does not fit, restart the stream with the next packet
+				slot->state_len = 0;
+				table->stats.errors++;
+			}
+		}
+		if (ctx.matches) {
+			mask[i / 64] |= 1ULL << (i % 64);
+			matches++;
+			table->stats.matches += ctx.matches;
+			if (ids) {
+				ids[i] = ctx.first_id;
+			}
+		}
+	}
+	return matches;
+}
+
+uint32_t libmoon_hs_stream_table_expire(struct libmoon_hs_stream_table* table, uint32_t now) {
+	uint32_t total = 0;
+	uint32_t n;
+	do {
+		n = libmoon_flow_table_expire(table->flows, now, table->expired_keys, table->expired_slots, EXPIRE_BATCH);
+		for (uint32_t i = 0; i < n; i++) {
+			release_slot(table, table->expired_slots[i]);
+		}
+		total += n;
+	} while (n == EXPIRE_BATCH);
+	table->stats.expired += total;
+	return total;
+}
+
+void libmoon_hs_stream_table_get_stats(struct libmoon_hs_stream_table* table, struct libmoon_hs_stream_stats* stats) {
+	*stats = table->stats;
+}
@@ -0,0 +1,50 @@
+#ifndef MG_HS_STREAM_TABLE_H
+#define MG_HS_STREAM_TABLE_H
+
+#include <stdint.h>
+#include <rte_config.h>
+#include <rte_mbuf.h>
+#include <hs/hs.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// only built if Hyperscan was found by cmake
+
+// per-flow Hyperscan streams for matches that span several packets of a TCP or UDP flow
+// streams are kept compressed (hs_compress_stream) in a fixed number of slots, a single working stream is expanded
+// for each packet, so memory is bounded by max_flows * state_size
+// the least recently used flow is evicted if all slots are in use, flows are closed on TCP FIN/RST and
+// removed after timeout ticks without packets (libmoon_hs_stream_table_expire())
+// segments are scanned in arrival order, there is no TCP reassembly
+// a table must only be used by a single thread
+struct libmoon_hs_stream_table;
+
+struct libmoon_hs_stream_stats {
+	uint64_t flows;
+	uint64_t closed;
+	uint64_t expired;
+	uint64_t evicted;
+	uint64_t matches;
+	// failed scans and states that did not fit into state_size
+	uint64_t errors;
+	uint32_t active_flows;
+	uint32_t state_size;
+};
+
+// db must be compiled in stream mode, state_size 0 uses the uncompressed stream size
+struct libmoon_hs_stream_table* libmoon_hs_stream_table_create(const hs_database_t* db, uint32_t max_flows, uint32_t timeout, uint32_t state_size, int socket);
+void libmoon_hs_stream_table_delete(struct libmoon_hs_stream_table* table);
+// bit i of mask is set if scanning bufs[i] (or closing its flow) raised a match, ids (optional) as for libmoon_hs_scan_burst()
+// returns the number of matching packets
+int32_t libmoon_hs_stream_scan_burst(struct libmoon_hs_stream_table* table, struct rte_mbuf** bufs, uint32_t num_bufs, uint32_t now, uint64_t* mask, uint32_t* ids);
+// returns the number of removed flows
+uint32_t libmoon_hs_stream_table_expire(struct libmoon_hs_stream_table* table, uint32_t now);
+void libmoon_hs_stream_table_get_stats(struct libmoon_hs_stream_table* table, struct libmoon_hs_stream_stats* stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -2,26 +2,58 @@
 #include <time.h>
 #include <csignal>
 #include <iostream>
+#include <chrono>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
 
 #include <rte_config.h>
 #include <rte_cycles.h>
+#include <rte_lcore.h>
 
 #include "lifecycle.hpp"
+#include "lifecycle.h"
 
 namespace libmoon {
-	// this code is, strictly speaking, incorrect as there are no memory fences
-	// and these variables are accessed by multiple threads
-	// however, memory fences are slow and this works in practice
-	static volatile uint64_t stop_at = -1;
-	static volatile uint64_t signal_at = -1;
+	// one token per lcore and the global token at index RTE_MAX_LCORE
+	static struct libmoon_stop_token tokens[RTE_MAX_LCORE + 1];
+	static struct libmoon_stop_token& global_token = tokens[RTE_MAX_LCORE];
+
+	// deadlines are enforced by a watcher thread, the tasks only ever check the stop flag
+	// never destroyed: destroying the condition variable at exit blocks while the detached watcher waits on it
+	static std::mutex& deadline_mutex = *new std::mutex;
+	static std::condition_variable& deadline_cond = *new std::condition_variable;
+	static bool watcher_started = false;
+	static volatile sig_atomic_t signal_received = 0;
+	// sleep until this close to the next deadline and spin for the rest
+	static const uint64_t SPIN_US = 200;
+
+	static void stop_token(struct libmoon_stop_token& token, uint64_t tsc) {
+		if (__atomic_load_n(&token.stop, __ATOMIC_RELAXED)) {
+			return;
+		}
+		token.stop_tsc = tsc;
+		__atomic_store_n(&token.stop, 1, __ATOMIC_RELEASE);
+	}
+
+	// only uses atomic stores, safe to call from the signal handler
+	static void stop_all(uint64_t tsc) {
+		stop_token(global_token, tsc);
+		// pairs with the fence in libmoon_init_task_token()
+		__atomic_thread_fence(__ATOMIC_SEQ_CST);
+		for (uint32_t i = 0; i < RTE_MAX_LCORE; i++) {
+			stop_token(tokens[i], tsc);
+		}
+	}
 
 	static void handler(int unused) {
-		if (signal_at != (uint64_t) -1) {
+		if (signal_received) {
 			// cancel was requested more than once, just bail out
 			std::cerr << "Received more than one SIGINT/SIGTERM, aborting" << std::endl;
 			std::abort();
 		}
-		signal_at = rte_rdtsc();
+		signal_received = 1;
+		stop_all(rte_rdtsc());
 	}
 
 	void install_signal_handlers() {
@@ -29,11 +61,66 @@ namespace libmoon {
 		signal(SIGTERM, handler);
 	}
 
+	static void watch_deadlines() {
+		std::unique_lock<std::mutex> lock(deadline_mutex);
+		while (true) {
+			uint64_t next = -1;
+			for (auto& token: tokens) {
+				if (!token.stop && token.deadline && token.deadline < next) {
+					next = token.deadline;
+				}
+			}
+			if (next == (uint64_t) -1) {
+				deadline_cond.wait(lock);
+				continue;
+			}
+			uint64_t hz = rte_get_tsc_hz();
+			uint64_t now = rte_rdtsc();
+			uint64_t spin_cycles = SPIN_US * hz / 1000000;
+			if (now + spin_cycles < next) {
+				deadline_cond.wait_for(lock, std::chrono::microseconds((next - now - spin_cycles) * 1000000 / hz));
+				continue;
+			}
+			lock.unlock();
+			while (rte_rdtsc() < next) {
+				rte_pause();
+			}
+			lock.lock();
+			// deadlines may have changed while spinning
+			now = rte_rdtsc();
+			if (!global_token.stop && global_token.deadline && global_token.deadline <= now) {
+				stop_all(global_token.deadline);
+			}
+			for (uint32_t i = 0; i < RTE_MAX_LCORE; i++) {
+				if (!tokens[i].stop && tokens[i].deadline && tokens[i].deadline <= now) {
+					stop_token(tokens[i], tokens[i].deadline);
+				}
+			}
+		}
+	}
+
+	static void set_deadline(struct libmoon_stop_token& token, uint64_t deadline) {
+		std::lock_guard<std::mutex> lock(deadline_mutex);
+		token.deadline = deadline;
+		if (!watcher_started) {
+			std::thread(watch_deadlines).detach();
+			watcher_started = true;
+		}
+		deadline_cond.notify_one();
+	}
+
+	static inline struct libmoon_stop_token& current_token() {
+		uint32_t lcore = rte_lcore_id();
+		return lcore < RTE_MAX_LCORE ? tokens[lcore] : global_token;
+	}
+
 	// do not change the return type to bool as luajit doesn't like this
 	uint8_t is_running(uint32_t extra_time) {
-		uint64_t extra_time_cycles = (uint64_t) extra_time * rte_get_tsc_hz() / 1000;
-		uint64_t time = rte_rdtsc() - extra_time_cycles;
-		return signal_at > time && stop_at > time;
+		struct libmoon_stop_token& token = current_token();
+		if (!__atomic_load_n(&token.stop, __ATOMIC_RELAXED)) {
+			return 1;
+		}
+		return extra_time && rte_rdtsc() < token.stop_tsc + (uint64_t) extra_time * (rte_get_tsc_hz() / 1000);
 	}
 }
 
@@ -43,7 +130,47 @@ extern "C" {
 	}
 
 	void set_runtime(uint32_t run_time) {
-		libmoon::stop_at = rte_rdtsc() + run_time * rte_get_tsc_hz() / 1000;
+		uint64_t now = rte_rdtsc();
+		if (run_time == 0) {
+			libmoon::stop_all(now);
+		} else {
+			libmoon::set_deadline(libmoon::global_token, now + run_time * (rte_get_tsc_hz() / 1000));
+		}
+	}
+
+	struct libmoon_stop_token* libmoon_get_stop_token(uint32_t lcore) {
+		return &libmoon::tokens[lcore < RTE_MAX_LCORE ? lcore : RTE_MAX_LCORE];
+	}
+
+	void libmoon_init_task_token(uint32_t lcore, uint64_t task_id) {
+		if (lcore >= RTE_MAX_LCORE) {
+			return;
+		}
+		struct libmoon_stop_token& token = libmoon::tokens[lcore];
+		{
+			std::lock_guard<std::mutex> lock(libmoon::deadline_mutex);
+			token.deadline = 0;
+		}
+		token.task_id = task_id;
+		__atomic_store_n(&token.stop, 0, __ATOMIC_SEQ_CST);
+		// a concurrent stop_all() either sees the reset token or we see its global stop
+		__atomic_thread_fence(__ATOMIC_SEQ_CST);
+		if (__atomic_load_n(&libmoon::global_token.stop, __ATOMIC_RELAXED)) {
+			libmoon::stop_token(token, libmoon::global_token.stop_tsc);
+		}
+	}
+
+	int libmoon_stop_task(uint32_t lcore, uint64_t task_id, uint32_t delay) {
+		if (lcore >= RTE_MAX_LCORE || libmoon::tokens[lcore].task_id != task_id) {
+			return -1;
+		}
+		uint64_t now = rte_rdtsc();
+		if (delay == 0) {
+			libmoon::stop_token(libmoon::tokens[lcore], now);
+		} else {
+			libmoon::set_deadline(libmoon::tokens[lcore], now + delay * (rte_get_tsc_hz() / 1000));
+		}
+		return 0;
 	}
 }
 
@@ -1,8 +1,35 @@
 #pragma once
+#include <stdint.h>
+
 #ifdef __cplusplus
 extern "C" {
 #endif
+
+// every lcore has a stop token on its own cache line, stopping libmoon sets all tokens
+// so a task only needs to look at its own token to see both global and per-task stop requests
+struct libmoon_stop_token {
+	// non-zero once the task should stop, written with release semantics, a relaxed load is enough to check it
+	volatile uint32_t stop;
+	// task currently running on this lcore, see libmoon_init_task_token()
+	uint64_t task_id;
+	// tsc at which the stop took effect (the deadline for timed stops), for extra_time in is_running()
+	volatile uint64_t stop_tsc;
+	// tsc at which the token is stopped automatically, 0 if none
+	volatile uint64_t deadline;
+} __attribute__((aligned(64)));
+
+// checks the token of the calling lcore (the global token on non-EAL threads)
+// extra_time in milliseconds keeps returning true for that long after the stop
 uint8_t is_running(uint32_t extra_time);
+// stops everything after run_time milliseconds, 0 stops immediately
+void set_runtime(uint32_t run_time);
+// token of an lcore, the global token for lcores >= RTE_MAX_LCORE
+struct libmoon_stop_token* libmoon_get_stop_token(uint32_t lcore);
+// resets the token of an lcore before a task is launched on it
+void libmoon_init_task_token(uint32_t lcore, uint64_t task_id);
+// stops the task after delay milliseconds (0 = now), fails if task_id is no longer running on the lcore
+int libmoon_stop_task(uint32_t lcore, uint64_t task_id, uint32_t delay);
+
 #ifdef __cplusplus
 }
 #endif
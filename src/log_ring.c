@@ -0,0 +1,359 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include <rte_config.h>
+#include <rte_common.h>
+#include <rte_branch_prediction.h>
+#include <rte_lcore.h>
+#include <rte_spinlock.h>
+
+#include "log_ring.h"
+
+#define RING_SIZE 4096
+#define MAX_FORMATS 4096
+#define STRING_SPACE 176
+#define MAX_LINE 4096
+#define WRITE_BUFFER_SIZE (64 * 1024)
+#define IDLE_SLEEP_US 1000
+#define FLUSH_TIMEOUT_US 1000000
+// one ring per lcore and one shared ring for non-EAL threads
+#define NUM_RINGS (RTE_MAX_LCORE + 1)
+
+struct log_record {
+	uint64_t time_us;
+	uint16_t format;
+	uint8_t level;
+	uint8_t num_args;
+	// bit i is set if argument i is a string, its value is the offset in strings
+	uint8_t string_args;
+	uint8_t reserved[3];
+	union {
+		double num;
+		uint32_t str;
+	} args[LIBMOON_LOG_MAX_ARGS];
+	char strings[STRING_SPACE];
+};
+
+// single producer (the owning lcore), single consumer (the writer thread)
+struct log_ring {
+	uint32_t head;
+	uint32_t tail __rte_cache_aligned;
+	struct log_record records[RING_SIZE] __rte_cache_aligned;
+};
+
+volatile uint8_t libmoon_log_file_level = LIBMOON_LOG_NO_LEVEL;
+
+static struct log_ring* rings[NUM_RINGS];
+static rte_spinlock_t shared_ring_lock = RTE_SPINLOCK_INITIALIZER;
+
+static char* formats[MAX_FORMATS];
+static uint32_t num_formats;
+static rte_spinlock_t format_lock = RTE_SPINLOCK_INITIALIZER;
+
+static uint64_t dropped;
+static uint64_t writer_passes;
+static bool writer_running;
+static int writer_fd = -1;
+static rte_spinlock_t writer_lock = RTE_SPINLOCK_INITIALIZER;
+
+static const char* level_names[] = { "[DEBUG] ", "[INFO]  ", "[WARN]  ", "[ERROR] ", "[FATAL] " };
+
+uint32_t libmoon_log_register_format(const char* format) {
+	rte_spinlock_lock(&format_lock);
+	uint32_t id = UINT32_MAX;
+	for (uint32_t i = 0; i < num_formats; i++) {
+		if (strcmp(formats[i], format) == 0) {
+			id = i;
+			break;
+		}
+	}
+	if (id == UINT32_MAX && num_formats < MAX_FORMATS) {
+		char* copy = strdup(format);
+		if (copy) {
+			formats[num_formats] = copy;
+			id = num_formats;
+			// the writer reads formats without the lock
+			__atomic_store_n(&num_formats, num_formats + 1, __ATOMIC_RELEASE);
+		}
+	}
+	rte_spinlock_unlock(&format_lock);
+	return id;
+}
+
+static struct log_ring* get_ring(uint32_t idx) {
+	struct log_ring* ring = __atomic_load_n(&rings[idx], __ATOMIC_ACQUIRE);
+	if (likely(ring)) {
+		return ring;
+	}
+	// only the owning lcore allocates its ring, the shared ring is allocated with the lock held
+	ring = aligned_alloc(RTE_CACHE_LINE_SIZE, sizeof(*ring));
+	if (!ring) {
+		return NULL;
+	}
+	memset(ring, 0, sizeof(*ring));
+	__atomic_store_n(&rings[idx], ring, __ATOMIC_RELEASE);
+	return ring;
+}
+
+static inline uint64_t now_us() {
+	struct timespec ts;
+	clock_gettime(CLOCK_REALTIME, &ts);
+	return (uint64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+void libmoon_log_write(uint8_t level, uint32_t format, uint32_t num_args, const double* nums, const char* const* strs) {
+	if (level != LIBMOON_LOG_NO_LEVEL && level < libmoon_log_file_level) {
+		return;
+	}
+	if (unlikely(format >= __atomic_load_n(&num_formats, __ATOMIC_ACQUIRE) || num_args > LIBMOON_LOG_MAX_ARGS)) {
+		return;
+	}
+	unsigned lcore = rte_lcore_id();
+	uint32_t idx = lcore < RTE_MAX_LCORE ? lcore : RTE_MAX_LCORE;
+	bool shared = idx == RTE_MAX_LCORE;
+	if (shared) {
+		rte_spinlock_lock(&shared_ring_lock);
+	}
+	struct log_ring* ring = get_ring(idx);
+	uint32_t head = ring ? ring->head : 0;
+	if (unlikely(!ring || head - __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) >= RING_SIZE)) {
+		__atomic_fetch_add(&dropped, 1, __ATOMIC_RELAXED);
+		if (shared) {
+			rte_spinlock_unlock(&shared_ring_lock);
+		}
+		return;
+	}
+	struct log_record* record = &ring->records[head & (RING_SIZE - 1)];
+	record->time_us = now_us();
+	record->format = format;
+	record->level = level;
+	record->num_args = num_args;
+	record->string_args = 0;
+	uint32_t offset = 0;
+	for (uint32_t i = 0; i < num_args; i++) {
+		if (strs[i]) {
+			// strings are truncated if they don't fit, the last byte is always a terminator
+			uint32_t len = RTE_MIN(strlen(strs[i]), (size_t) (STRING_SPACE - 1 - offset));
+			memcpy(record->strings + offset, strs[i], len);
+			record->strings[offset + len] = '\0';
+			record->args[i].str = offset;
+			record->string_args |= 1 << i;
+			offset = RTE_MIN(offset + len + 1, (uint32_t) STRING_SPACE - 1);
+		} else {
+			record->args[i].num = nums[i];
+		}
+	}
+	record->strings[STRING_SPACE - 1] = '\0';
+	__atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+	if (shared) {
+		rte_spinlock_unlock(&shared_ring_lock);
+	}
+}
+
+// formats a record like Lua's string.format would, returns the number of bytes written
+static uint32_t format_record(const struct log_record* record, char* out, uint32_t size) {
+	uint32_t len = 0;
+#define APPEND(...) do { \
+		int n = snprintf(out + len, size - len, __VA_ARGS__); \
+		len = n < 0 ? len : RTE_MIN(len + n, size - 1); \
+	} while (0)
+	uint64_t secs = record->time_us / 1000000;
+	APPEND("%02u:%02u:%02u.%06u ", (unsigned) (secs / 3600 % 24), (unsigned) (secs / 60 % 60), (unsigned) (secs % 60), (unsigned) (record->time_us % 1000000));
+	if (record->level < RTE_DIM(level_names)) {
+		APPEND("%s", level_names[record->level]);
+	}
+	const char* fmt = formats[record->format];
+	uint32_t arg = 0;
+	while (*fmt) {
+		if (*fmt != '%') {
+			const char* end = strchr(fmt, '%');
+			if (!end) {
+				end = fmt + strlen(fmt);
+			}
+			APPEND("%.*s", (int) (end - fmt), fmt);
+			fmt = end;
+			continue;
+		}
+		if (fmt[1] == '%') {
+			APPEND("%%");
+			fmt += 2;
+			continue;
+		}
+		// copy flags, width, and precision, Lua does not support length modifiers
+		char spec[32];
+		uint32_t spec_len = 0;
+		spec[spec_len++] = *fmt++;
+		while (*fmt && strchr("-+ #0123456789.", *fmt) && spec_len < sizeof(spec) - 4) {
+			spec[spec_len++] = *fmt++;
+		}
+		char conv = *fmt;
+		if (!conv) {
+			break;
+		}
+		fmt++;
+		if (arg >= record->num_args) {
+			APPEND("(missing)");
+			continue;
+		}
+		bool is_string = record->string_args & (1 << arg);
+		const char* str = record->strings + record->args[arg].str;
+		double num = record->args[arg].num;
+		arg++;
+		char num_str[32];
+		if (is_string || conv == 's' || conv == 'q') {
+			if (!is_string) {
+				snprintf(num_str, sizeof(num_str), "%.14g", num);
+				str = num_str;
+			}
+			spec[spec_len++] = 's';
+			spec[spec_len] = '\0';
+			APPEND(spec, str);
+		} else if (strchr("di", conv)) {
+			spec[spec_len++] = 'l';
+			spec[spec_len++] = 'l';
+			spec[spec_len++] = conv;
+			spec[spec_len] = '\0';
+			APPEND(spec, (long long) num);
+		} else if (strchr("ouxX", conv)) {
+			spec[spec_len++] = 'l';
+			spec[spec_len++] = 'l';
+			spec[spec_len++] = conv;
+			spec[spec_len] = '\0';
+			APPEND(spec, (unsigned long long) (long long) num);
+		} else if (conv == 'c') {
+			spec[spec_len++] = 'c';
+			spec[spec_len] = '\0';
+			APPEND(spec, (int) num);
+		} else if (strchr("eEfgGaA", conv)) {
+			spec[spec_len++] = conv;
+			spec[spec_len] = '\0';
+			APPEND(spec, num);
+		} else {
+			APPEND("(invalid format %c)", conv);
+		}
+	}
+	APPEND("\n");
+#undef APPEND
+	// truncated lines still end with a newline
+	out[len - 1] = '\n';
+	return len;
+}
+
+static void write_all(const char* buf, size_t len) {
+	while (len) {
+		ssize_t n = write(writer_fd, buf, len);
+		if (n <= 0) {
+			return;
+		}
+		buf += n;
+		len -= n;
+	}
+}
+
+static void* writer_main(void* arg) {
+	char* buf = malloc(WRITE_BUFFER_SIZE);
+	if (!buf) {
+		return NULL;
+	}
+	while (true) {
+		uint32_t used = 0;
+		uint32_t drained = 0;
+		for (uint32_t i = 0; i < NUM_RINGS; i++) {
+			struct log_ring* ring = __atomic_load_n(&rings[i], __ATOMIC_ACQUIRE);
+			if (!ring) {
+				continue;
+			}
+			uint32_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+			uint32_t tail = ring->tail;
+			while (tail != head) {
+				if (WRITE_BUFFER_SIZE - used < MAX_LINE) {
+					write_all(buf, used);
+					used = 0;
+				}
+				used += format_record(&ring->records[tail & (RING_SIZE - 1)], buf + used, MAX_LINE);
+				tail++;
+				drained++;
+			}
+			__atomic_store_n(&ring->tail, tail, __ATOMIC_RELEASE);
+		}
+		if (used) {
+			write_all(buf, used);
+		}
+		__atomic_store_n(&writer_passes, writer_passes + 1, __ATOMIC_RELEASE);
+		if (!drained) {
+			usleep(IDLE_SLEEP_US);
+		}
+	}
+	return NULL;
+}
+
+int libmoon_log_start(const char* path) {
+	if (__atomic_load_n(&writer_running, __ATOMIC_ACQUIRE)) {
+		return 0;
+	}
+	rte_spinlock_lock(&writer_lock);
+	int rc = 0;
+	if (!writer_running) {
+		writer_fd = open(path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+		pthread_t thread;
+		if (writer_fd < 0) {
+			rc = -1;
+		} else if (pthread_create(&thread, NULL, writer_main, NULL) != 0) {
+			close(writer_fd);
+			writer_fd = -1;
+			rc = -1;
+		} else {
+			rte_thread_setname(thread, "log writer");
+			pthread_detach(thread);
+			__atomic_store_n(&writer_running, true, __ATOMIC_RELEASE);
+		}
+	}
+	rte_spinlock_unlock(&writer_lock);
+	return rc;
+}
+
+void libmoon_log_set_file_level(uint8_t level) {
+	libmoon_log_file_level = level;
+}
+
+void libmoon_log_flush() {
+	if (!__atomic_load_n(&writer_running, __ATOMIC_ACQUIRE)) {
+		return;
+	}
+	uint32_t heads[NUM_RINGS];
+	for (uint32_t i = 0; i < NUM_RINGS; i++) {
+		struct log_ring* ring = __atomic_load_n(&rings[i], __ATOMIC_ACQUIRE);
+		heads[i] = ring ? __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE) : 0;
+	}
+	for (uint32_t waited = 0; waited < FLUSH_TIMEOUT_US; waited += 100) {
+		uint64_t pass = __atomic_load_n(&writer_passes, __ATOMIC_ACQUIRE);
+		bool done = true;
+		for (uint32_t i = 0; i < NUM_RINGS; i++) {
+			struct log_ring* ring = __atomic_load_n(&rings[i], __ATOMIC_ACQUIRE);
+			if (ring && (int32_t) (__atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) - heads[i]) < 0) {
+				done = false;
+				break;
+			}
+		}
+		// the pass that consumed the records writes them before it ends
+		if (done) {
+			while (__atomic_load_n(&writer_passes, __ATOMIC_ACQUIRE) == pass && waited < FLUSH_TIMEOUT_US) {
+				usleep(100);
+				waited += 100;
+			}
+			return;
+		}
+		usleep(100);
+	}
+}
+
+uint64_t libmoon_log_dropped() {
+	return __atomic_load_n(&dropped, __ATOMIC_RELAXED);
+}
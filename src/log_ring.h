@@ -0,0 +1,36 @@
+#ifndef MG_LOG_RING_H
+#define MG_LOG_RING_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// asynchronous file logging: tasks push binary records (format id + arguments) to a per-lcore ring,
+// a background thread formats them and writes them with batched I/O
+// records are ordered per lcore, records of different lcores may be interleaved out of order
+
+#define LIBMOON_LOG_MAX_ARGS 8
+// level for records that are written without a level prefix
+#define LIBMOON_LOG_NO_LEVEL 0xFF
+
+// minimum level that is written to the file, LIBMOON_LOG_NO_LEVEL if file logging is disabled
+extern volatile uint8_t libmoon_log_file_level;
+
+// returns the id of the format string (printf style as used by Lua's string.format), UINT32_MAX if there are too many
+uint32_t libmoon_log_register_format(const char* format);
+// strs[i] is the i-th argument if it is not NULL, nums[i] otherwise; never blocks, records are dropped if the ring is full
+void libmoon_log_write(uint8_t level, uint32_t format, uint32_t num_args, const double* nums, const char* const* strs);
+// starts the writer thread if it is not running, returns 0 on success
+int libmoon_log_start(const char* path);
+void libmoon_log_set_file_level(uint8_t level);
+// waits until all records written before this call are in the file
+void libmoon_log_flush();
+uint64_t libmoon_log_dropped();
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
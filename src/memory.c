@@ -4,9 +4,12 @@
 #include <rte_errno.h>
 #include <rte_spinlock.h>
 #include <sys/mman.h>
+#include <string.h>
 
 #include <stdint.h>
 
+#include "memory.h"
+
 #define MEMPOOL_CACHE_SIZE 256
 
 struct rte_mempool* init_mem(uint32_t nb_mbuf, uint32_t socket, uint32_t mbuf_size) {
@@ -72,6 +75,103 @@ void alloc_mbufs(struct rte_mempool* mp, struct rte_mbuf* bufs[], uint32_t len,
 	}
 }
 
+// allocates a packet with pkt_len bytes, packets that do not fit into a single buffer are chained
+struct rte_mbuf* alloc_mbuf_chain(struct rte_mempool* mp, uint32_t pkt_len) {
+	struct rte_mbuf* head = rte_pktmbuf_alloc(mp);
+	if (!head) {
+		return NULL;
+	}
+	struct rte_mbuf* tail = head;
+	uint32_t remaining = pkt_len;
+	while (1) {
+		uint16_t len = RTE_MIN(remaining, (uint32_t) rte_pktmbuf_tailroom(tail));
+		tail->data_len = len;
+		remaining -= len;
+		if (!remaining) {
+			break;
+		}
+		struct rte_mbuf* seg = rte_pktmbuf_alloc(mp);
+		if (!seg) {
+			rte_pktmbuf_free(head);
+			return NULL;
+		}
+		tail->next = seg;
+		head->nb_segs++;
+		tail = seg;
+	}
+	head->pkt_len = pkt_len;
+	return head;
+}
+
+uint32_t alloc_mbuf_chains(struct rte_mempool* mp, struct rte_mbuf* bufs[], uint32_t len, uint32_t pkt_len) {
+	for (uint32_t i = 0; i < len; i++) {
+		bufs[i] = alloc_mbuf_chain(mp, pkt_len);
+		if (!bufs[i]) {
+			return i;
+		}
+	}
+	return len;
+}
+
+// copies a chained packet into its first segment if it fits, returns 0 on success
+int linearize_mbufs(struct rte_mbuf* bufs[], uint32_t len) {
+	int rc = 0;
+	for (uint32_t i = 0; i < len; i++) {
+		if (bufs[i]->nb_segs > 1 && rte_pktmbuf_linearize(bufs[i])) {
+			rc = -1;
+		}
+	}
+	return rc;
+}
+
+// copies len bytes starting at offset from a possibly chained packet to dst, returns the number of bytes copied
+uint32_t read_mbuf_chain(const struct rte_mbuf* buf, uint32_t offset, uint32_t len, uint8_t* dst) {
+	uint32_t copied = 0;
+	for (const struct rte_mbuf* seg = buf; seg && copied < len; seg = seg->next) {
+		if (offset >= seg->data_len) {
+			offset -= seg->data_len;
+			continue;
+		}
+		uint32_t n = RTE_MIN(len - copied, (uint32_t) seg->data_len - offset);
+		memcpy(dst + copied, rte_pktmbuf_mtod_offset(seg, const uint8_t*, offset), n);
+		copied += n;
+		offset = 0;
+	}
+	return copied;
+}
+
+#define FREE_BULK_SIZE 64
+
+// frees all segments of all non-NULL packets, this is essentially rte_pktmbuf_free() in a loop
+// segments are returned with a single rte_mempool_put_bulk() per run of segments from the same mempool
+void free_mbufs(struct rte_mbuf* bufs[], uint32_t len) {
+	void* pending[FREE_BULK_SIZE];
+	uint32_t num_pending = 0;
+	struct rte_mempool* pool = NULL;
+	for (uint32_t i = 0; i < len; i++) {
+		struct rte_mbuf* seg = bufs[i];
+		while (seg) {
+			// prefree_seg() resets next
+			struct rte_mbuf* next = seg->next;
+			// handles the refcount and detaches indirect buffers, returns NULL if the segment is still in use
+			seg = rte_pktmbuf_prefree_seg(seg);
+			if (seg) {
+				if (seg->pool != pool || num_pending == FREE_BULK_SIZE) {
+					if (num_pending) {
+						rte_mempool_put_bulk(pool, pending, num_pending);
+					}
+					pool = seg->pool;
+					num_pending = 0;
+				}
+				pending[num_pending++] = seg;
+			}
+			seg = next;
+		}
+	}
+	if (num_pending) {
+		rte_mempool_put_bulk(pool, pending, num_pending);
+	}
+}
 
 uint16_t rte_mbuf_refcnt_read_export(struct rte_mbuf* m) {
 	return rte_mbuf_refcnt_read(m);
@@ -5,6 +5,19 @@
 #include <rte_mempool.h>
 #include <rte_mbuf.h>
 
-struct rte_mempool* init_mem(uint32_t nb_mbuf, int32_t socket);
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct rte_mempool* init_mem(uint32_t nb_mbuf, uint32_t socket, uint32_t mbuf_size);
+struct rte_mbuf* alloc_mbuf_chain(struct rte_mempool* mp, uint32_t pkt_len);
+uint32_t alloc_mbuf_chains(struct rte_mempool* mp, struct rte_mbuf* bufs[], uint32_t len, uint32_t pkt_len);
+void free_mbufs(struct rte_mbuf* bufs[], uint32_t len);
+int linearize_mbufs(struct rte_mbuf* bufs[], uint32_t len);
+uint32_t read_mbuf_chain(const struct rte_mbuf* buf, uint32_t offset, uint32_t len, uint8_t* dst);
+
+#ifdef __cplusplus
+}
+#endif
 
 #endif /* MEMORY_H__ */
@@ -0,0 +1,253 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "metric_sink.h"
+
+#define MIN_BACKOFF_MS 500
+#define MAX_BACKOFF_MS 30000
+
+enum sink_state {
+	DISCONNECTED,
+	CONNECTING,
+	CONNECTED
+};
+
+struct record {
+	struct record* next;
+	uint32_t len;
+	char data[];
+};
+
+struct libmoon_metric_sink {
+	struct sockaddr_in addr;
+	uint8_t udp;
+	// records consist of newline-terminated lines, see close_socket()
+	uint8_t lines;
+	enum sink_state state;
+	int fd;
+	uint32_t max_bytes;
+	uint64_t next_attempt;
+	uint64_t connect_deadline;
+	uint32_t backoff;
+	struct record* head;
+	struct record* tail;
+	// bytes of the head record that were already sent, the head can't be dropped if this is non-zero
+	uint32_t head_offset;
+	struct libmoon_metric_sink_stats stats;
+};
+
+struct libmoon_metric_sink* libmoon_metric_sink_create(const char* ip, uint16_t port, uint8_t udp, uint8_t lines, uint32_t max_bytes) {
+	struct libmoon_metric_sink* sink = calloc(1, sizeof(*sink));
+	if (!sink) {
+		return NULL;
+	}
+	sink->addr.sin_family = AF_INET;
+	sink->addr.sin_port = htons(port);
+	if (inet_pton(AF_INET, ip, &sink->addr.sin_addr) != 1) {
+		free(sink);
+		return NULL;
+	}
+	sink->udp = udp;
+	sink->lines = lines;
+	sink->fd = -1;
+	sink->max_bytes = max_bytes;
+	sink->backoff = MIN_BACKOFF_MS;
+	return sink;
+}
+
+static void close_socket(struct libmoon_metric_sink* sink) {
+	if (sink->fd >= 0) {
+		close(sink->fd);
+	}
+	sink->fd = -1;
+	sink->state = DISCONNECTED;
+	sink->stats.connected = 0;
+	// the collector discards the incomplete line (or message) at the end of the connection,
+	// continue with it after reconnecting but don't send the complete lines before it again
+	uint32_t offset = sink->head_offset;
+	if (sink->lines) {
+		while (offset && sink->head->data[offset - 1] != '\n') {
+			offset--;
+		}
+	} else {
+		offset = 0;
+	}
+	sink->head_offset = offset;
+}
+
+static void fail(struct libmoon_metric_sink* sink, uint64_t now) {
+	close_socket(sink);
+	sink->stats.errors++;
+	sink->next_attempt = now + sink->backoff;
+	sink->backoff = sink->backoff * 2 > MAX_BACKOFF_MS ? MAX_BACKOFF_MS : sink->backoff * 2;
+}
+
+static void pop_record(struct libmoon_metric_sink* sink) {
+	struct record* record = sink->head;
+	sink->head = record->next;
+	if (!sink->head) {
+		sink->tail = NULL;
+	}
+	sink->stats.queued_records--;
+	sink->stats.queued_bytes -= record->len;
+	sink->head_offset = 0;
+	free(record);
+}
+
+void libmoon_metric_sink_delete(struct libmoon_metric_sink* sink) {
+	while (sink->head) {
+		pop_record(sink);
+	}
+	close_socket(sink);
+	free(sink);
+}
+
+uint32_t libmoon_metric_sink_push(struct libmoon_metric_sink* sink, const char* data, uint32_t len) {
+	uint32_t dropped = 0;
+	if (len > sink->max_bytes) {
+		sink->stats.dropped_records++;
+		return 1;
+	}
+	// drop oldest first, a partially sent head must be completed to keep the stream intact
+	while (sink->stats.queued_bytes + len > sink->max_bytes) {
+		if (sink->head_offset) {
+			struct record* victim = sink->head->next;
+			if (!victim) {
+				break;
+			}
+			sink->head->next = victim->next;
+			if (sink->tail == victim) {
+				sink->tail = sink->head;
+			}
+			sink->stats.queued_records--;
+			sink->stats.queued_bytes -= victim->len;
+			free(victim);
+		} else {
+			pop_record(sink);
+		}
+		dropped++;
+	}
+	sink->stats.dropped_records += dropped;
+	struct record* record = malloc(sizeof(*record) + len);
+	if (!record) {
+		sink->stats.dropped_records++;
+		return dropped + 1;
+	}
+	record->next = NULL;
+	record->len = len;
+	memcpy(record->data, data, len);
+	if (sink->tail) {
+		sink->tail->next = record;
+	} else {
+		sink->head = record;
+	}
+	sink->tail = record;
+	sink->stats.records++;
+	sink->stats.queued_records++;
+	sink->stats.queued_bytes += len;
+	return dropped;
+}
+
+static void try_connect(struct libmoon_metric_sink* sink, uint64_t now) {
+	sink->fd = socket(AF_INET, (sink->udp ? SOCK_DGRAM : SOCK_STREAM) | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (sink->fd < 0) {
+		fail(sink, now);
+		return;
+	}
+	// connect on a UDP socket just sets the destination
+	if (connect(sink->fd, (struct sockaddr*) &sink->addr, sizeof(sink->addr)) == 0) {
+		sink->state = CONNECTED;
+	} else if (errno == EINPROGRESS) {
+		sink->state = CONNECTING;
+		sink->connect_deadline = now + MAX_BACKOFF_MS;
+		return;
+	} else {
+		fail(sink, now);
+		return;
+	}
+}
+
+static void check_connecting(struct libmoon_metric_sink* sink, uint64_t now) {
+	struct pollfd pfd = { .fd = sink->fd, .events = POLLOUT };
+	if (poll(&pfd, 1, 0) <= 0) {
+		if (now > sink->connect_deadline) {
+			fail(sink, now);
+		}
+		return;
+	}
+	int err = 0;
+	socklen_t len = sizeof(err);
+	if (getsockopt(sink->fd, SOL_SOCKET, SO_ERROR, &err, &len) || err) {
+		fail(sink, now);
+		return;
+	}
+	sink->state = CONNECTED;
+}
+
+// collectors never send anything, readable means the connection was closed or reset
+static bool peer_closed(struct libmoon_metric_sink* sink) {
+	char buf[64];
+	ssize_t n = recv(sink->fd, buf, sizeof(buf), MSG_DONTWAIT);
+	return n == 0 || (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK);
+}
+
+uint32_t libmoon_metric_sink_flush(struct libmoon_metric_sink* sink, uint64_t now) {
+	if (sink->state == DISCONNECTED) {
+		if (now < sink->next_attempt) {
+			return sink->stats.queued_records;
+		}
+		try_connect(sink, now);
+	}
+	if (sink->state == CONNECTING) {
+		check_connecting(sink, now);
+	}
+	if (sink->state != CONNECTED) {
+		return sink->stats.queued_records;
+	}
+	if (!sink->stats.connected) {
+		sink->stats.connected = 1;
+		sink->stats.connects++;
+		sink->backoff = MIN_BACKOFF_MS;
+	}
+	if (!sink->udp && peer_closed(sink)) {
+		fail(sink, now);
+		return sink->stats.queued_records;
+	}
+	while (sink->head) {
+		struct record* record = sink->head;
+		ssize_t n = send(sink->fd, record->data + sink->head_offset, record->len - sink->head_offset, MSG_DONTWAIT | MSG_NOSIGNAL);
+		if (n < 0) {
+			if (errno == EAGAIN || errno == EWOULDBLOCK) {
+				break;
+			}
+			if (sink->udp) {
+				// e.g. ECONNREFUSED from an earlier datagram, the record is lost anyways
+				sink->stats.errors++;
+				pop_record(sink);
+				continue;
+			}
+			fail(sink, now);
+			break;
+		}
+		sink->stats.sent_bytes += n;
+		sink->head_offset += n;
+		if (sink->head_offset == record->len) {
+			sink->stats.sent_records++;
+			pop_record(sink);
+		}
+	}
+	return sink->stats.queued_records;
+}
+
+void libmoon_metric_sink_get_stats(struct libmoon_metric_sink* sink, struct libmoon_metric_sink_stats* stats) {
+	*stats = sink->stats;
+}
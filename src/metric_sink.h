@@ -0,0 +1,46 @@
+#ifndef MG_METRIC_SINK_H
+#define MG_METRIC_SINK_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// non-blocking output for metric collectors (Graphite, StatsD)
+// records (complete batches) are queued in a bounded buffer and sent without blocking when flushed,
+// the oldest records are dropped if the buffer is full, broken TCP connections are re-established with exponential backoff
+// UDP sinks send each record as a single datagram
+// a TCP record that was partially sent when the connection broke is continued after reconnecting:
+// line-based sinks resend its incomplete line, other sinks resend the whole record
+// lines the kernel accepted before a connection reset may still be lost, but no line is sent twice
+// a sink must only be used by one thread
+struct libmoon_metric_sink;
+
+struct libmoon_metric_sink_stats {
+	uint64_t records;
+	uint64_t sent_records;
+	uint64_t sent_bytes;
+	uint64_t dropped_records;
+	uint64_t connects;
+	uint64_t errors;
+	uint32_t queued_records;
+	uint32_t queued_bytes;
+	uint8_t connected;
+};
+
+// lines: records consist of complete, newline-terminated lines (e.g. Graphite plaintext)
+struct libmoon_metric_sink* libmoon_metric_sink_create(const char* ip, uint16_t port, uint8_t udp, uint8_t lines, uint32_t max_bytes);
+void libmoon_metric_sink_delete(struct libmoon_metric_sink* sink);
+// copies the record to the queue, returns the number of records dropped to make room
+uint32_t libmoon_metric_sink_push(struct libmoon_metric_sink* sink, const char* data, uint32_t len);
+// (re-)connects if necessary and sends as much as possible without blocking, now is a timestamp in milliseconds
+// returns the number of queued records that are left
+uint32_t libmoon_metric_sink_flush(struct libmoon_metric_sink* sink, uint64_t now);
+void libmoon_metric_sink_get_stats(struct libmoon_metric_sink* sink, struct libmoon_metric_sink_stats* stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,506 @@
+#include <stdint.h>
+#include <inttypes.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include <rte_config.h>
+#include <rte_common.h>
+#include <rte_ethdev.h>
+#include <rte_malloc.h>
+#include <rte_spinlock.h>
+
+#include "metrics_exporter.h"
+#include "core_stats.h"
+
+#define MAX_COUNTERS 256
+#define MAX_HISTOGRAMS 64
+#define NAME_SIZE 128
+#define REQUEST_SIZE 2048
+#define IO_TIMEOUT_MS 1000
+#define INITIAL_BUFFER_SIZE (64 * 1024)
+
+struct device_entry {
+	uint8_t port;
+	// xstat names are only re-read if the number of xstats changes, e.g. after configuring more queues
+	int num_xstats;
+	struct rte_eth_xstat_name* xstat_names;
+	struct rte_eth_xstat* xstats;
+	struct rte_eth_stats stats;
+	uint16_t rx_queues;
+	uint16_t tx_queues;
+};
+
+struct counter_entry {
+	char name[NAME_SIZE];
+	char help[NAME_SIZE];
+	char labels[NAME_SIZE];
+	const volatile uint64_t* value;
+	uint8_t is_gauge;
+};
+
+struct histogram_entry {
+	char name[NAME_SIZE];
+	char help[NAME_SIZE];
+	struct libmoon_histogram* histogram;
+	double scale;
+};
+
+struct output {
+	char* data;
+	size_t len;
+	size_t size;
+};
+
+struct libmoon_metrics_exporter {
+	int fd;
+	rte_spinlock_t lock;
+	uint8_t core_stats;
+	uint32_t num_devices;
+	uint32_t num_counters;
+	uint32_t num_histograms;
+	struct device_entry devices[RTE_MAX_ETHPORTS];
+	struct counter_entry counters[MAX_COUNTERS];
+	struct histogram_entry histograms[MAX_HISTOGRAMS];
+	struct libmoon_core_stats cores[RTE_MAX_LCORE];
+	// protected by the lock, results are copied out before it is released
+	struct output out;
+};
+
+struct stats_field {
+	const char* name;
+	const char* help;
+	size_t offset;
+	// per-queue fields only
+	uint8_t rx;
+};
+
+static const struct stats_field port_fields[] = {
+	{ "libmoon_port_rx_packets", "Packets received", offsetof(struct rte_eth_stats, ipackets), 1 },
+	{ "libmoon_port_tx_packets", "Packets sent", offsetof(struct rte_eth_stats, opackets), 0 },
+	{ "libmoon_port_rx_bytes", "Bytes received", offsetof(struct rte_eth_stats, ibytes), 1 },
+	{ "libmoon_port_tx_bytes", "Bytes sent", offsetof(struct rte_eth_stats, obytes), 0 },
+	{ "libmoon_port_rx_missed", "Packets dropped by the NIC because no rx descriptor was available", offsetof(struct rte_eth_stats, imissed), 1 },
+	{ "libmoon_port_rx_errors", "Erroneous received packets", offsetof(struct rte_eth_stats, ierrors), 1 },
+	{ "libmoon_port_tx_errors", "Failed transmitted packets", offsetof(struct rte_eth_stats, oerrors), 0 },
+	{ "libmoon_port_rx_nombuf", "Receive mbuf allocation failures", offsetof(struct rte_eth_stats, rx_nombuf), 1 },
+};
+
+// only the first RTE_ETHDEV_QUEUE_STAT_CNTRS queues have counters, all queues are covered by the xstats of most drivers
+static const struct stats_field queue_fields[] = {
+	{ "libmoon_queue_rx_packets", "Packets received by the queue", offsetof(struct rte_eth_stats, q_ipackets), 1 },
+	{ "libmoon_queue_tx_packets", "Packets sent by the queue", offsetof(struct rte_eth_stats, q_opackets), 0 },
+	{ "libmoon_queue_rx_bytes", "Bytes received by the queue", offsetof(struct rte_eth_stats, q_ibytes), 1 },
+	{ "libmoon_queue_tx_bytes", "Bytes sent by the queue", offsetof(struct rte_eth_stats, q_obytes), 0 },
+	{ "libmoon_queue_rx_errors", "Receive errors of the queue", offsetof(struct rte_eth_stats, q_errors), 1 },
+};
+
+static void append(struct output* out, const char* fmt, ...) __attribute__((format(printf, 2, 3)));
+
+static void append(struct output* out, const char* fmt, ...) {
+	while (true) {
+		va_list args;
+		va_start(args, fmt);
+		int n = vsnprintf(out->data + out->len, out->size - out->len, fmt, args);
+		va_end(args);
+		if (n < 0) {
+			return;
+		}
+		if (out->len + n < out->size) {
+			out->len += n;
+			return;
+		}
+		size_t size = RTE_MAX(out->size * 2, out->len + n + 1);
+		char* data = realloc(out->data, size);
+		if (!data) {
+			return;
+		}
+		out->data = data;
+		out->size = size;
+	}
+}
+
+// label values must escape backslashes, quotes, and newlines
+static void append_label_value(struct output* out, const char* value) {
+	for (; *value; value++) {
+		switch (*value) {
+			case '\\': append(out, "\\\\"); break;
+			case '"': append(out, "\\\""); break;
+			case '\n': append(out, "\\n"); break;
+			default: append(out, "%c", *value); break;
+		}
+	}
+}
+
+static void append_family(struct output* out, const char* name, const char* type, const char* help) {
+	append(out, "# TYPE %s %s\n", name, type);
+	if (help && *help) {
+		append(out, "# HELP %s %s\n", name, help);
+	}
+}
+
+static void copy_string(char* dst, const char* src) {
+	snprintf(dst, NAME_SIZE, "%s", src ? src : "");
+}
+
+struct libmoon_metrics_exporter* libmoon_metrics_exporter_create(const char* bind_addr, uint16_t port) {
+	struct sockaddr_in addr = {
+		.sin_family = AF_INET,
+		.sin_port = htons(port),
+		.sin_addr.s_addr = htonl(INADDR_ANY)
+	};
+	if (bind_addr && inet_pton(AF_INET, bind_addr, &addr.sin_addr) != 1) {
+		return NULL;
+	}
+	struct libmoon_metrics_exporter* exporter = rte_zmalloc("metrics_exporter", sizeof(*exporter), RTE_CACHE_LINE_SIZE);
+	if (!exporter) {
+		return NULL;
+	}
+	rte_spinlock_init(&exporter->lock);
+	exporter->out.data = malloc(INITIAL_BUFFER_SIZE);
+	exporter->out.size = INITIAL_BUFFER_SIZE;
+	exporter->fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	int one = 1;
+	if (!exporter->out.data || exporter->fd < 0
+	|| setsockopt(exporter->fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one))
+	|| bind(exporter->fd, (struct sockaddr*) &addr, sizeof(addr))
+	|| listen(exporter->fd, 16)
+	|| fcntl(exporter->fd, F_SETFL, O_NONBLOCK)) {
+		libmoon_metrics_exporter_delete(exporter);
+		return NULL;
+	}
+	return exporter;
+}
+
+void libmoon_metrics_exporter_delete(struct libmoon_metrics_exporter* exporter) {
+	if (exporter->fd >= 0) {
+		close(exporter->fd);
+	}
+	for (uint32_t i = 0; i < exporter->num_devices; i++) {
+		free(exporter->devices[i].xstat_names);
+		free(exporter->devices[i].xstats);
+	}
+	free(exporter->out.data);
+	rte_free(exporter);
+}
+
+int libmoon_metrics_exporter_add_device(struct libmoon_metrics_exporter* exporter, uint8_t port_id) {
+	int rc = 0;
+	rte_spinlock_lock(&exporter->lock);
+	for (uint32_t i = 0; i < exporter->num_devices; i++) {
+		if (exporter->devices[i].port == port_id) {
+			goto out;
+		}
+	}
+	if (exporter->num_devices >= RTE_MAX_ETHPORTS) {
+		rc = -1;
+		goto out;
+	}
+	struct device_entry* dev = &exporter->devices[exporter->num_devices++];
+	memset(dev, 0, sizeof(*dev));
+	dev->port = port_id;
+out:
+	rte_spinlock_unlock(&exporter->lock);
+	return rc;
+}
+
+void libmoon_metrics_exporter_add_core_stats(struct libmoon_metrics_exporter* exporter) {
+	exporter->core_stats = 1;
+}
+
+int libmoon_metrics_exporter_add_counter(struct libmoon_metrics_exporter* exporter, const char* name, const char* help, const char* labels, const volatile uint64_t* value, uint8_t is_gauge) {
+	rte_spinlock_lock(&exporter->lock);
+	if (exporter->num_counters >= MAX_COUNTERS) {
+		rte_spinlock_unlock(&exporter->lock);
+		return -1;
+	}
+	// samples of a metric family must be adjacent, insert after the last counter with the same name
+	uint32_t pos = exporter->num_counters;
+	for (uint32_t i = 0; i < exporter->num_counters; i++) {
+		if (strncmp(exporter->counters[i].name, name, NAME_SIZE) == 0) {
+			pos = i + 1;
+		}
+	}
+	memmove(&exporter->counters[pos + 1], &exporter->counters[pos], (exporter->num_counters - pos) * sizeof(struct counter_entry));
+	struct counter_entry* counter = &exporter->counters[pos];
+	copy_string(counter->name, name);
+	copy_string(counter->help, help);
+	copy_string(counter->labels, labels);
+	counter->value = value;
+	counter->is_gauge = is_gauge;
+	exporter->num_counters++;
+	rte_spinlock_unlock(&exporter->lock);
+	return 0;
+}
+
+int libmoon_metrics_exporter_add_histogram(struct libmoon_metrics_exporter* exporter, const char* name, const char* help, struct libmoon_histogram* histogram, double scale) {
+	rte_spinlock_lock(&exporter->lock);
+	if (exporter->num_histograms >= MAX_HISTOGRAMS) {
+		rte_spinlock_unlock(&exporter->lock);
+		return -1;
+	}
+	struct histogram_entry* entry = &exporter->histograms[exporter->num_histograms++];
+	copy_string(entry->name, name);
+	copy_string(entry->help, help);
+	entry->histogram = histogram;
+	entry->scale = scale;
+	rte_spinlock_unlock(&exporter->lock);
+	return 0;
+}
+
+static void read_device(struct device_entry* dev) {
+	struct rte_eth_dev_info info;
+	rte_eth_dev_info_get(dev->port, &info);
+	dev->rx_queues = RTE_MIN(info.nb_rx_queues, RTE_ETHDEV_QUEUE_STAT_CNTRS);
+	dev->tx_queues = RTE_MIN(info.nb_tx_queues, RTE_ETHDEV_QUEUE_STAT_CNTRS);
+	memset(&dev->stats, 0, sizeof(dev->stats));
+	rte_eth_stats_get(dev->port, &dev->stats);
+	int n = rte_eth_xstats_get(dev->port, dev->xstats, dev->num_xstats);
+	if (n != dev->num_xstats) {
+		free(dev->xstat_names);
+		free(dev->xstats);
+		dev->num_xstats = 0;
+		n = rte_eth_xstats_get_names(dev->port, NULL, 0);
+		dev->xstat_names = n > 0 ? malloc(n * sizeof(struct rte_eth_xstat_name)) : NULL;
+		dev->xstats = n > 0 ? malloc(n * sizeof(struct rte_eth_xstat)) : NULL;
+		if (!dev->xstat_names || !dev->xstats
+		|| rte_eth_xstats_get_names(dev->port, dev->xstat_names, n) != n
+		|| rte_eth_xstats_get(dev->port, dev->xstats, n) != n) {
+			return;
+		}
+		dev->num_xstats = n;
+	}
+}
+
+static void render_devices(struct libmoon_metrics_exporter* exporter, struct output* out) {
+	if (!exporter->num_devices) {
+		return;
+	}
+	for (uint32_t i = 0; i < exporter->num_devices; i++) {
+		read_device(&exporter->devices[i]);
+	}
+	for (uint32_t f = 0; f < RTE_DIM(port_fields); f++) {
+		append_family(out, port_fields[f].name, "counter", port_fields[f].help);
+		for (uint32_t i = 0; i < exporter->num_devices; i++) {
+			struct device_entry* dev = &exporter->devices[i];
+			uint64_t value = *(uint64_t*) ((uint8_t*) &dev->stats + port_fields[f].offset);
+			append(out, "%s_total{port=\"%u\"} %" PRIu64 "\n", port_fields[f].name, dev->port, value);
+		}
+	}
+	for (uint32_t f = 0; f < RTE_DIM(queue_fields); f++) {
+		append_family(out, queue_fields[f].name, "counter", queue_fields[f].help);
+		for (uint32_t i = 0; i < exporter->num_devices; i++) {
+			struct device_entry* dev = &exporter->devices[i];
+			uint64_t* values = (uint64_t*) ((uint8_t*) &dev->stats + queue_fields[f].offset);
+			uint16_t queues = queue_fields[f].rx ? dev->rx_queues : dev->tx_queues;
+			for (uint16_t q = 0; q < queues; q++) {
+				append(out, "%s_total{port=\"%u\",queue=\"%u\"} %" PRIu64 "\n", queue_fields[f].name, dev->port, q, values[q]);
+			}
+		}
+	}
+	append_family(out, "libmoon_port_xstats", "counter", "Extended device statistics, the meaning depends on the driver");
+	for (uint32_t i = 0; i < exporter->num_devices; i++) {
+		struct device_entry* dev = &exporter->devices[i];
+		for (int x = 0; x < dev->num_xstats; x++) {
+			uint64_t id = dev->xstats[x].id;
+			if (id >= (uint64_t) dev->num_xstats) {
+				continue;
+			}
+			append(out, "libmoon_port_xstats_total{port=\"%u\",stat=\"", dev->port);
+			append_label_value(out, dev->xstat_names[id].name);
+			append(out, "\"} %" PRIu64 "\n", dev->xstats[x].value);
+		}
+	}
+}
+
+static void render_cores(struct libmoon_metrics_exporter* exporter, struct output* out) {
+	static const struct {
+		const char* name;
+		const char* help;
+		size_t offset;
+	} fields[] = {
+		{ "libmoon_core_busy_cycles", "TSC cycles spent on calls that returned packets", offsetof(struct libmoon_core_stats, busy_cycles) },
+		{ "libmoon_core_idle_cycles", "TSC cycles spent on empty polls", offsetof(struct libmoon_core_stats, idle_cycles) },
+		{ "libmoon_core_packets", "Packets handled by rx, tx, and pipe calls", offsetof(struct libmoon_core_stats, packets) },
+		{ "libmoon_core_busy_calls", "Calls that returned packets", offsetof(struct libmoon_core_stats, busy_calls) },
+		{ "libmoon_core_empty_calls", "Calls that returned no packets", offsetof(struct libmoon_core_stats, empty_calls) },
+	};
+	if (!exporter->core_stats) {
+		return;
+	}
+	uint8_t active[RTE_MAX_LCORE];
+	for (uint32_t i = 0; i < RTE_MAX_LCORE; i++) {
+		active[i] = libmoon_core_stats_get(i, &exporter->cores[i]);
+	}
+	for (uint32_t f = 0; f < RTE_DIM(fields); f++) {
+		append_family(out, fields[f].name, "counter", fields[f].help);
+		for (uint32_t i = 0; i < RTE_MAX_LCORE; i++) {
+			if (!active[i]) {
+				continue;
+			}
+			uint64_t value = *(uint64_t*) ((uint8_t*) &exporter->cores[i] + fields[f].offset);
+			append(out, "%s_total{lcore=\"%u\",task=\"", fields[f].name, i);
+			append_label_value(out, exporter->cores[i].task_name);
+			append(out, "\"} %" PRIu64 "\n", value);
+		}
+	}
+}
+
+static void render_counters(struct libmoon_metrics_exporter* exporter, struct output* out) {
+	for (uint32_t i = 0; i < exporter->num_counters; i++) {
+		struct counter_entry* counter = &exporter->counters[i];
+		if (i == 0 || strcmp(counter->name, exporter->counters[i - 1].name) != 0) {
+			append_family(out, counter->name, counter->is_gauge ? "gauge" : "counter", counter->help);
+		}
+		uint64_t value = __atomic_load_n(counter->value, __ATOMIC_RELAXED);
+		append(out, "%s%s", counter->name, counter->is_gauge ? "" : "_total");
+		if (*counter->labels) {
+			append(out, "{%s}", counter->labels);
+		}
+		append(out, " %" PRIu64 "\n", value);
+	}
+}
+
+static void render_histograms(struct libmoon_metrics_exporter* exporter, struct output* out) {
+	for (uint32_t i = 0; i < exporter->num_histograms; i++) {
+		struct histogram_entry* entry = &exporter->histograms[i];
+		append_family(out, entry->name, "histogram", entry->help);
+		// the representative value of a bucket decides which power of two it is counted in
+		uint64_t cumulative = 0;
+		int64_t bound = 1;
+		int64_t value;
+		uint64_t count;
+		uint32_t idx = libmoon_histogram_next_bucket(entry->histogram, 0, &value, &count);
+		while (idx) {
+			while (value > bound && bound <= INT64_MAX / 2) {
+				append(out, "%s_bucket{le=\"%.15g\"} %" PRIu64 "\n", entry->name, bound * entry->scale, cumulative);
+				bound *= 2;
+			}
+			cumulative += count;
+			idx = libmoon_histogram_next_bucket(entry->histogram, idx, &value, &count);
+		}
+		append(out, "%s_bucket{le=\"%.15g\"} %" PRIu64 "\n", entry->name, bound * entry->scale, cumulative);
+		append(out, "%s_bucket{le=\"+Inf\"} %" PRIu64 "\n", entry->name, cumulative);
+		struct libmoon_histogram_summary summary;
+		libmoon_histogram_get_summary(entry->histogram, &summary);
+		// the count must match the +Inf bucket even if values are recorded concurrently
+		append(out, "%s_count %" PRIu64 "\n", entry->name, cumulative);
+		append(out, "%s_sum %.15g\n", entry->name, summary.sum * entry->scale);
+	}
+}
+
+// requires the lock
+static void render(struct libmoon_metrics_exporter* exporter) {
+	struct output* out = &exporter->out;
+	out->len = 0;
+	render_devices(exporter, out);
+	render_cores(exporter, out);
+	render_counters(exporter, out);
+	render_histograms(exporter, out);
+	append(out, "# EOF\n");
+}
+
+uint32_t libmoon_metrics_exporter_render(struct libmoon_metrics_exporter* exporter, char* buf, uint32_t len) {
+	rte_spinlock_lock(&exporter->lock);
+	render(exporter);
+	uint32_t result = exporter->out.len;
+	memcpy(buf, exporter->out.data, RTE_MIN(result, len));
+	rte_spinlock_unlock(&exporter->lock);
+	return result;
+}
+
+static int send_all(int fd, const char* data, size_t len) {
+	while (len) {
+		ssize_t n = send(fd, data, len, MSG_NOSIGNAL);
+		if (n <= 0) {
+			return -1;
+		}
+		data += n;
+		len -= n;
+	}
+	return 0;
+}
+
+static int send_response(int fd, const char* status, const char* content_type, const char* body, uint32_t len) {
+	char header[256];
+	int n = snprintf(header, sizeof(header), "HTTP/1.1 %s\r\nContent-Type: %s\r\nContent-Length: %u\r\nConnection: close\r\n\r\n", status, content_type, len);
+	if (send_all(fd, header, n) || send_all(fd, body, len)) {
+		return -1;
+	}
+	return 0;
+}
+
+static int serve(struct libmoon_metrics_exporter* exporter, int fd) {
+	struct timeval timeout = { .tv_sec = IO_TIMEOUT_MS / 1000, .tv_usec = IO_TIMEOUT_MS % 1000 * 1000 };
+	setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+	setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+	char request[REQUEST_SIZE];
+	size_t len = 0;
+	// the request body (if any) is ignored, only the request line matters
+	while (len < sizeof(request) - 1) {
+		ssize_t n = recv(fd, request + len, sizeof(request) - 1 - len, 0);
+		if (n <= 0) {
+			return -1;
+		}
+		len += n;
+		request[len] = '\0';
+		if (strstr(request, "\r\n\r\n")) {
+			break;
+		}
+	}
+	request[len] = '\0';
+	static const char text_plain[] = "text/plain; charset=utf-8";
+	if (strncmp(request, "GET ", 4) != 0) {
+		return send_response(fd, "405 Method Not Allowed", text_plain, "", 0);
+	}
+	const char* path = request + 4;
+	size_t path_len = strcspn(path, " ?\r\n");
+	if (!(path_len == 1 && path[0] == '/') && !(path_len == 8 && strncmp(path, "/metrics", 8) == 0)) {
+		return send_response(fd, "404 Not Found", text_plain, "", 0);
+	}
+	// copy the body to send it without holding the lock
+	rte_spinlock_lock(&exporter->lock);
+	render(exporter);
+	uint32_t body_len = exporter->out.len;
+	char* body = malloc(body_len);
+	if (body) {
+		memcpy(body, exporter->out.data, body_len);
+	}
+	rte_spinlock_unlock(&exporter->lock);
+	if (!body) {
+		return send_response(fd, "500 Internal Server Error", text_plain, "", 0);
+	}
+	int rc = send_response(fd, "200 OK", "application/openmetrics-text; version=1.0.0; charset=utf-8", body, body_len);
+	free(body);
+	return rc;
+}
+
+int libmoon_metrics_exporter_poll(struct libmoon_metrics_exporter* exporter, int timeout_ms) {
+	struct pollfd pfd = { .fd = exporter->fd, .events = POLLIN };
+	int rc = poll(&pfd, 1, timeout_ms);
+	if (rc < 0) {
+		return errno == EINTR ? 0 : -1;
+	}
+	int served = 0;
+	while (rc > 0) {
+		int client = accept(exporter->fd, NULL, NULL);
+		if (client < 0) {
+			break;
+		}
+		if (serve(exporter, client) == 0) {
+			served++;
+		}
+		close(client);
+	}
+	return served;
+}
@@ -0,0 +1,39 @@
+#ifndef MG_METRICS_EXPORTER_H
+#define MG_METRICS_EXPORTER_H
+
+#include <stdint.h>
+
+#include "histogram.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// HTTP endpoint serving device, queue, xstats, core, and user counters as OpenMetrics text (Prometheus)
+// metrics are read directly from DPDK and the native counters when a scrape arrives, nothing is sampled in between
+// metrics can be registered by any thread, serving is done by the thread calling poll (e.g., a shared task)
+struct libmoon_metrics_exporter;
+
+// bind_addr may be NULL to listen on all addresses
+struct libmoon_metrics_exporter* libmoon_metrics_exporter_create(const char* bind_addr, uint16_t port);
+void libmoon_metrics_exporter_delete(struct libmoon_metrics_exporter* exporter);
+
+// port, per-queue, and extended stats of a device; the xstat names are only read here
+int libmoon_metrics_exporter_add_device(struct libmoon_metrics_exporter* exporter, uint8_t port_id);
+// busy/idle cycles and packets of all lcores, see core_stats.h
+void libmoon_metrics_exporter_add_core_stats(struct libmoon_metrics_exporter* exporter);
+// value must stay valid while the exporter is running, labels is either NULL or preformatted, e.g. 'queue="1"'
+int libmoon_metrics_exporter_add_counter(struct libmoon_metrics_exporter* exporter, const char* name, const char* help, const char* labels, const volatile uint64_t* value, uint8_t is_gauge);
+// buckets are powers of two (in the unit of the recorded values) up to the maximum value, multiplied by scale
+int libmoon_metrics_exporter_add_histogram(struct libmoon_metrics_exporter* exporter, const char* name, const char* help, struct libmoon_histogram* histogram, double scale);
+
+// waits up to timeout_ms for scrapes, serves them, returns the number of served requests or -1 on error
+int libmoon_metrics_exporter_poll(struct libmoon_metrics_exporter* exporter, int timeout_ms);
+// renders all metrics into buf (not null-terminated), returns the full length which may exceed len
+uint32_t libmoon_metrics_exporter_render(struct libmoon_metrics_exporter* exporter, char* buf, uint32_t len);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -7,6 +7,8 @@
 #include <rte_mbuf.h>
 #include <rte_mempool.h>
 
+#include "memory.h"
+
 struct pcapRecHeader {
 	uint32_t ts_sec;   /* timestamp seconds */
 	uint32_t ts_usec;  /* timestamp microseconds */
@@ -20,42 +22,58 @@ extern "C" {
 		dst->ts_sec = ts_sec;
 		dst->ts_usec = ts_usec;
 		dst->incl_len = len;
-		dst->orig_len = len;
+		dst->orig_len = orig_len;
 		memcpy(&dst->data, packet, len);
 	}
 
-	rte_mbuf* libmoon_read_pcap(rte_mempool* mp, const pcapRecHeader* src, uint64_t remaining, uint32_t mempool_buf_size) {
-		if (src->incl_len >= remaining) {
+	// writes up to snap_len bytes of a possibly chained mbuf, returns the number of bytes written (excluding the header)
+	uint32_t libmoon_write_pcap_mbuf(pcapRecHeader* dst, const rte_mbuf* buf, uint32_t snap_len, uint32_t ts_sec, uint32_t ts_usec) {
+		uint32_t len = std::min(buf->pkt_len, snap_len);
+		dst->ts_sec = ts_sec;
+		dst->ts_usec = ts_usec;
+		dst->incl_len = read_mbuf_chain(buf, 0, len, dst->data);
+		dst->orig_len = buf->pkt_len;
+		return dst->incl_len;
+	}
+
+	// packets larger than a buffer are chained, bytes cut off by the snaplen are zero-filled up to the original length
+	rte_mbuf* libmoon_read_pcap(rte_mempool* mp, const pcapRecHeader* src, uint64_t remaining) {
+		if (remaining < sizeof(pcapRecHeader) || src->incl_len > remaining - sizeof(pcapRecHeader)) {
 			return nullptr;
 		}
-		uint32_t copy_len = src->incl_len;
-		if (copy_len > mempool_buf_size - 128) {
-			copy_len = mempool_buf_size - 128;
-		}
-		uint32_t zero_fill_len = std::min(mempool_buf_size - copy_len - 128, src->orig_len - src->incl_len);
-		rte_mbuf* res = rte_pktmbuf_alloc(mp);
+		// orig_len is untrusted, don't allocate more than the largest possible IP packet
+		uint32_t pkt_len = std::max(src->incl_len, std::min<uint32_t>(src->orig_len, UINT16_MAX));
+		rte_mbuf* res = alloc_mbuf_chain(mp, pkt_len);
 		if (!res) {
 			return res;
 		}
-		res->pkt_len = src->incl_len;
-		res->data_len = copy_len + zero_fill_len;
 		res->udata64 = src->ts_sec * 1000000ULL + src->ts_usec;
-		uint8_t* data = rte_pktmbuf_mtod(res, uint8_t*);
-		memcpy(data, &src->data, copy_len);
-		memset(data + copy_len, 0, zero_fill_len);
+		const uint8_t* data = src->data;
+		uint32_t copy_len = src->incl_len;
+		for (rte_mbuf* seg = res; seg; seg = seg->next) {
+			uint8_t* dst = rte_pktmbuf_mtod(seg, uint8_t*);
+			uint32_t len = std::min<uint32_t>(copy_len, seg->data_len);
+			memcpy(dst, data, len);
+			memset(dst + len, 0, seg->data_len - len);
+			data += len;
+			copy_len -= len;
+		}
 		return res;
 	}
 
-	uint32_t libmoon_read_pcap_batch(rte_mempool* mp, rte_mbuf** bufs, uint32_t num_bufs, const uint8_t* pcap, uint64_t remaining, uint32_t mempool_buf_size) {
+	// stores the number of bytes consumed from the file in *read_bytes
+	uint32_t libmoon_read_pcap_batch(rte_mempool* mp, rte_mbuf** bufs, uint32_t num_bufs, const uint8_t* pcap, uint64_t remaining, uint64_t* read_bytes) {
 		uint64_t offset = 0;
-		for (uint32_t i = 0; i < num_bufs; ++i) {
+		uint32_t i = 0;
+		for (; i < num_bufs; ++i) {
 			const pcapRecHeader* header = reinterpret_cast<const pcapRecHeader*>(pcap + offset);
-			rte_mbuf* buf = libmoon_read_pcap(mp, header, remaining, mempool_buf_size);
+			rte_mbuf* buf = libmoon_read_pcap(mp, header, remaining);
 			bufs[i] = buf;
-			if (!buf) return i;
+			if (!buf) break;
 			offset += header->incl_len + sizeof(pcapRecHeader);
 			remaining -= header->incl_len + sizeof(pcapRecHeader);
 		}
-		return num_bufs;
+		*read_bytes = offset;
+		return i;
 	}
 }
@@ -5,6 +5,8 @@
 #include "spsc-queue/readerwriterqueue.h"
 #include "concurrentqueue/concurrentqueue.h"
 
+#include "core_stats.h"
+
 using namespace moodycamel;
 
 extern "C" {
@@ -28,6 +30,7 @@ extern "C" {
 	void* pipe_spsc_try_dequeue(ReaderWriterQueue<void*>* queue) {
 		void* data;
 		bool ok = queue->try_dequeue(data);
+		libmoon_core_stats_record(ok);
 		return ok ? data : nullptr;
 	}
 
@@ -54,6 +57,7 @@ extern "C" {
 	void* pipe_mpmc_try_dequeue(ConcurrentQueue<void*>* queue) {
 		void* data;
 		bool ok = queue->try_dequeue(data);
+		libmoon_core_stats_record(ok);
 		return ok ? data : nullptr;
 	}
 
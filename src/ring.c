@@ -3,6 +3,7 @@
 #include <rte_common.h>
 #include <rte_ring.h>
 #include "ring.h"
+#include "core_stats.h"
 
 // DPDK SPSC bounded ring buffer
 
@@ -22,7 +23,9 @@ int ring_enqueue(struct rte_ring* r, void* const* obj, int n) {
 }
 
 int ring_dequeue(struct rte_ring* r, void** obj, int n) {
-	return rte_ring_sc_dequeue_bulk(r, obj, n, NULL);
+	int rc = rte_ring_sc_dequeue_bulk(r, obj, n, NULL);
+	libmoon_core_stats_record(rc ? n : 0);
+	return rc;
 }
 
 int ring_count(struct rte_ring* r) {
@@ -0,0 +1,245 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <errno.h>
+
+#include <rte_config.h>
+#include <rte_common.h>
+#include <rte_cycles.h>
+#include <rte_ethdev.h>
+#include <rte_errno.h>
+#include <rte_interrupts.h>
+#include <rte_malloc.h>
+
+#include "rx_adaptive.h"
+#include "lifecycle.h"
+#include "core_stats.h"
+
+// defaults, can be changed with libmoon_rx_adaptive_configure()
+#define DEFAULT_IDLE_POLLS 256
+#define DEFAULT_MAX_SLEEP_US 100
+#define DEFAULT_BUSY_THRESHOLD_PPS 100000
+
+// usleep() has a slack of ~50us, spin for shorter sleeps
+#define MIN_USLEEP_US 20
+// upper bound for a single wait, we need to wake up regularly to check is_running()
+#define MAX_INTERRUPT_WAIT_MS 10
+
+struct rx_queue_state {
+	struct libmoon_rx_adaptive_config cfg;
+	struct libmoon_rx_queue_stats stats;
+	// tsc when the last call returned, the time until the next call is spent processing packets
+	uint64_t last_return;
+	// packet rate measurement
+	uint64_t window_start;
+	uint64_t window_packets;
+	uint32_t empty_streak;
+	uint32_t sleep_us;
+	uint8_t high_load;
+	uint8_t intr_registered;
+	uint8_t intr_failed;
+} __rte_cache_aligned;
+
+struct rx_port_state {
+	uint16_t num_queues;
+	struct rx_queue_state queues[];
+};
+
+static struct rx_port_state* rx_ports[RTE_MAX_ETHPORTS];
+
+static struct rx_queue_state* get_queue_state(uint8_t port_id, uint16_t queue_id) {
+	if (port_id >= RTE_MAX_ETHPORTS) {
+		return NULL;
+	}
+	struct rx_port_state* port = __atomic_load_n(&rx_ports[port_id], __ATOMIC_ACQUIRE);
+	if (unlikely(!port)) {
+		struct rte_eth_dev_info dev_info;
+		rte_eth_dev_info_get(port_id, &dev_info);
+		struct rx_port_state* new_port = rte_zmalloc("rx_adaptive", sizeof(*new_port) + dev_info.nb_rx_queues * sizeof(struct rx_queue_state), RTE_CACHE_LINE_SIZE);
+		if (!new_port) {
+			return NULL;
+		}
+		new_port->num_queues = dev_info.nb_rx_queues;
+		for (int i = 0; i < new_port->num_queues; i++) {
+			new_port->queues[i].cfg.idle_polls = DEFAULT_IDLE_POLLS;
+			new_port->queues[i].cfg.max_sleep_us = DEFAULT_MAX_SLEEP_US;
+			new_port->queues[i].cfg.busy_threshold_pps = DEFAULT_BUSY_THRESHOLD_PPS;
+		}
+		struct rx_port_state* expected = NULL;
+		if (__atomic_compare_exchange_n(&rx_ports[port_id], &expected, new_port, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+			port = new_port;
+		} else {
+			// another thread was faster
+			rte_free(new_port);
+			port = expected;
+		}
+	}
+	if (queue_id >= port->num_queues) {
+		return NULL;
+	}
+	return &port->queues[queue_id];
+}
+
+// counters are only written by the receiving thread, the atomic store just prevents torn reads
+static inline void add_stat(uint64_t* ctr, uint64_t val) {
+	__atomic_store_n(ctr, *ctr + val, __ATOMIC_RELAXED);
+}
+
+int libmoon_rx_adaptive_configure(uint8_t port_id, uint16_t queue_id, const struct libmoon_rx_adaptive_config* cfg) {
+	struct rx_queue_state* q = get_queue_state(port_id, queue_id);
+	if (!q) {
+		return -EINVAL;
+	}
+	q->cfg = *cfg;
+	if (!q->cfg.idle_polls) {
+		q->cfg.idle_polls = 1;
+	}
+	if (!q->cfg.max_sleep_us) {
+		q->cfg.max_sleep_us = 1;
+	}
+	q->sleep_us = 0;
+	q->intr_failed = 0;
+	return 0;
+}
+
+int libmoon_rx_adaptive_disable(uint8_t port_id, uint16_t queue_id) {
+	struct rx_queue_state* q = get_queue_state(port_id, queue_id);
+	if (!q) {
+		return -EINVAL;
+	}
+	// the epoll fd is per thread, so this must be called by the receiving thread
+	if (q->intr_registered) {
+		rte_eth_dev_rx_intr_ctl_q(port_id, queue_id, RTE_EPOLL_PER_THREAD, RTE_INTR_EVENT_DEL, NULL);
+		q->intr_registered = 0;
+	}
+	// the configuration and stats are kept, the load estimate and backoff start over when enabling it again
+	q->last_return = 0;
+	q->window_start = 0;
+	q->window_packets = 0;
+	q->empty_streak = 0;
+	q->sleep_us = 0;
+	q->high_load = 0;
+	q->intr_failed = 0;
+	return 0;
+}
+
+int libmoon_rx_adaptive_get_stats(uint8_t port_id, uint16_t queue_id, struct libmoon_rx_queue_stats* stats) {
+	struct rx_queue_state* q = get_queue_state(port_id, queue_id);
+	if (!q) {
+		return -EINVAL;
+	}
+	stats->busy_cycles = __atomic_load_n(&q->stats.busy_cycles, __ATOMIC_RELAXED);
+	stats->idle_cycles = __atomic_load_n(&q->stats.idle_cycles, __ATOMIC_RELAXED);
+	stats->polls = __atomic_load_n(&q->stats.polls, __ATOMIC_RELAXED);
+	stats->empty_polls = __atomic_load_n(&q->stats.empty_polls, __ATOMIC_RELAXED);
+	stats->sleeps = __atomic_load_n(&q->stats.sleeps, __ATOMIC_RELAXED);
+	stats->interrupts = __atomic_load_n(&q->stats.interrupts, __ATOMIC_RELAXED);
+	stats->packets = __atomic_load_n(&q->stats.packets, __ATOMIC_RELAXED);
+	return 0;
+}
+
+static inline void update_load(struct rx_queue_state* q, uint16_t rx, uint64_t now, uint64_t hz) {
+	q->window_packets += rx;
+	uint64_t elapsed = now - q->window_start;
+	if (elapsed >= hz / 1000) {
+		q->high_load = q->window_packets * hz / elapsed >= q->cfg.busy_threshold_pps;
+		q->window_start = now;
+		q->window_packets = 0;
+	}
+}
+
+// the epoll fd is per thread, so a queue must always be used from the same thread
+static bool wait_for_interrupt(struct rx_queue_state* q, uint8_t port_id, uint16_t queue_id, uint32_t timeout_ms) {
+	if (!q->intr_registered) {
+		int rc = rte_eth_dev_rx_intr_ctl_q(port_id, queue_id, RTE_EPOLL_PER_THREAD, RTE_INTR_EVENT_ADD, NULL);
+		if (rc) {
+			printf("rx interrupts not available for port %d queue %d (%s), falling back to sleeping\n", port_id, queue_id, rte_strerror(-rc));
+			q->intr_failed = 1;
+			return false;
+		}
+		q->intr_registered = 1;
+	}
+	if (rte_eth_dev_rx_intr_enable(port_id, queue_id)) {
+		printf("could not enable rx interrupts for port %d queue %d, falling back to sleeping\n", port_id, queue_id);
+		q->intr_failed = 1;
+		return false;
+	}
+	// packets that arrived before enabling the interrupt don't trigger it, the bounded timeout takes care of them
+	struct rte_epoll_event event;
+	int n = rte_epoll_wait(RTE_EPOLL_PER_THREAD, &event, 1, timeout_ms);
+	rte_eth_dev_rx_intr_disable(port_id, queue_id);
+	if (n > 0) {
+		add_stat(&q->stats.interrupts, 1);
+	}
+	return true;
+}
+
+static void idle_wait(struct rx_queue_state* q, uint8_t port_id, uint16_t queue_id, uint64_t deadline, uint64_t hz) {
+	add_stat(&q->stats.sleeps, 1);
+	uint64_t now = rte_rdtsc();
+	uint64_t remaining_us = deadline == UINT64_MAX ? UINT64_MAX : (deadline - now) * 1000000 / hz;
+	if (q->cfg.use_interrupts && !q->intr_failed) {
+		uint64_t timeout_ms = RTE_MAX(RTE_MIN(remaining_us / 1000, (uint64_t) MAX_INTERRUPT_WAIT_MS), (uint64_t) 1);
+		if (wait_for_interrupt(q, port_id, queue_id, timeout_ms)) {
+			return;
+		}
+	}
+	q->sleep_us = q->sleep_us ? RTE_MIN(q->sleep_us * 2, q->cfg.max_sleep_us) : 1;
+	uint32_t sleep_us = RTE_MIN((uint64_t) q->sleep_us, remaining_us);
+	if (sleep_us < MIN_USLEEP_US) {
+		uint64_t end = now + sleep_us * hz / 1000000;
+		while (rte_rdtsc() < end) {
+			rte_pause();
+		}
+	} else {
+		usleep(sleep_us);
+	}
+}
+
+// polls without sleeping as long as packets arrive or the packet rate is above the threshold,
+// backs off (or waits for an interrupt) after idle_polls consecutive empty polls
+// timeout_us = LIBMOON_RX_WAIT_FOREVER waits until a packet arrives or libmoon is stopped, 0 polls once without waiting
+uint16_t libmoon_rx_adaptive_recv(uint8_t port_id, uint16_t queue_id, struct rte_mbuf** bufs, uint16_t num_bufs, uint32_t timeout_us) {
+	struct rx_queue_state* q = get_queue_state(port_id, queue_id);
+	if (unlikely(!q)) {
+		return rte_eth_rx_burst(port_id, queue_id, bufs, num_bufs);
+	}
+	uint64_t hz = rte_get_tsc_hz();
+	uint64_t entry = rte_rdtsc();
+	if (q->last_return) {
+		add_stat(&q->stats.busy_cycles, entry - q->last_return);
+	}
+	uint64_t deadline = timeout_us == LIBMOON_RX_WAIT_FOREVER ? UINT64_MAX : entry + (uint64_t) timeout_us * hz / 1000000;
+	uint16_t rx;
+	while (1) {
+		uint64_t start = rte_rdtsc();
+		rx = rte_eth_rx_burst(port_id, queue_id, bufs, num_bufs);
+		uint64_t end = rte_rdtsc();
+		add_stat(&q->stats.polls, 1);
+		update_load(q, rx, end, hz);
+		if (rx) {
+			add_stat(&q->stats.packets, rx);
+			add_stat(&q->stats.idle_cycles, start - entry);
+			add_stat(&q->stats.busy_cycles, end - start);
+			q->empty_streak = 0;
+			q->sleep_us = 0;
+			q->last_return = end;
+			libmoon_core_stats_record(rx);
+			return rx;
+		}
+		add_stat(&q->stats.empty_polls, 1);
+		q->empty_streak++;
+		if (end >= deadline || !is_running(0)) {
+			add_stat(&q->stats.idle_cycles, end - entry);
+			q->last_return = end;
+			libmoon_core_stats_record(0);
+			return 0;
+		}
+		if (q->high_load || q->empty_streak < q->cfg.idle_polls) {
+			rte_pause();
+		} else {
+			idle_wait(q, port_id, queue_id, deadline, hz);
+		}
+	}
+}
@@ -0,0 +1,46 @@
+#ifndef MG_RX_ADAPTIVE_H
+#define MG_RX_ADAPTIVE_H
+
+#include <stdint.h>
+#include <rte_config.h>
+#include <rte_mbuf.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct libmoon_rx_adaptive_config {
+	// consecutive empty polls before the queue goes to sleep
+	uint32_t idle_polls;
+	// upper bound for the exponential backoff
+	uint32_t max_sleep_us;
+	// packet rate above which the queue is polled without sleeping
+	uint64_t busy_threshold_pps;
+	// wait for rx interrupts instead of sleeping, requires a device configured with rxInterrupts
+	uint8_t use_interrupts;
+};
+
+// cycle accounting, written by the receiving thread only
+struct libmoon_rx_queue_stats {
+	uint64_t busy_cycles;
+	uint64_t idle_cycles;
+	uint64_t polls;
+	uint64_t empty_polls;
+	uint64_t sleeps;
+	uint64_t interrupts;
+	uint64_t packets;
+};
+
+#define LIBMOON_RX_WAIT_FOREVER UINT32_MAX
+
+int libmoon_rx_adaptive_configure(uint8_t port_id, uint16_t queue_id, const struct libmoon_rx_adaptive_config* cfg);
+// resets the backoff and load state and unregisters the rx interrupt, call from the receiving thread
+int libmoon_rx_adaptive_disable(uint8_t port_id, uint16_t queue_id);
+uint16_t libmoon_rx_adaptive_recv(uint8_t port_id, uint16_t queue_id, struct rte_mbuf** bufs, uint16_t num_bufs, uint32_t timeout_us);
+int libmoon_rx_adaptive_get_stats(uint8_t port_id, uint16_t queue_id, struct libmoon_rx_queue_stats* stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
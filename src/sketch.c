@@ -0,0 +1,304 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <math.h>
+
+#include <rte_config.h>
+#include <rte_common.h>
+#include <rte_branch_prediction.h>
+#include <rte_malloc.h>
+#include <rte_cycles.h>
+#include <rte_mbuf.h>
+
+#include "sketch.h"
+
+#define DEFAULT_ACCURACY 0.02
+#define DEFAULT_NUM_BINS 128
+#define MIN_ACCURACY 0.001
+#define MAX_BINS 4096
+
+// bins are 16 bit, all bins of a sketch are halved on overflow
+// this keeps the shape of the distribution, the exact count is kept separately
+struct sketch {
+	uint32_t seq;
+	// key of bins[0]
+	int16_t offset;
+	uint16_t reserved;
+	uint64_t count;
+	uint64_t sum;
+	uint64_t max;
+	uint16_t bins[];
+};
+
+struct libmoon_sketch_set {
+	uint32_t num_sketches;
+	uint16_t num_bins;
+	uint32_t stride;
+	double gamma;
+	double inv_log2_gamma;
+	uint8_t data[] __rte_cache_aligned;
+};
+
+static inline struct sketch* get_sketch(struct libmoon_sketch_set* set, uint32_t id) {
+	return (struct sketch*) (set->data + (size_t) id * set->stride);
+}
+
+struct libmoon_sketch_set* libmoon_sketch_set_create(uint32_t num_sketches, double accuracy, uint16_t num_bins, int socket) {
+	if (accuracy <= 0) {
+		accuracy = DEFAULT_ACCURACY;
+	}
+	if (!num_bins) {
+		num_bins = DEFAULT_NUM_BINS;
+	}
+	if (!num_sketches || accuracy < MIN_ACCURACY || accuracy >= 1 || num_bins > MAX_BINS) {
+		return NULL;
+	}
+	uint32_t stride = RTE_ALIGN(sizeof(struct sketch) + num_bins * sizeof(uint16_t), 16);
+	struct libmoon_sketch_set* set = rte_zmalloc_socket("sketch", sizeof(*set) + (size_t) num_sketches * stride, RTE_CACHE_LINE_SIZE, socket);
+	if (!set) {
+		return NULL;
+	}
+	set->num_sketches = num_sketches;
+	set->num_bins = num_bins;
+	set->stride = stride;
+	set->gamma = (1 + accuracy) / (1 - accuracy);
+	set->inv_log2_gamma = 1 / log2(set->gamma);
+	return set;
+}
+
+void libmoon_sketch_set_delete(struct libmoon_sketch_set* set) {
+	rte_free(set);
+}
+
+// must be called by the thread that inserts values (or while it does not insert)
+void libmoon_sketch_set_reset(struct libmoon_sketch_set* set) {
+	for (uint32_t i = 0; i < set->num_sketches; i++) {
+		struct sketch* s = get_sketch(set, i);
+		__atomic_store_n(&s->seq, s->seq + 1, __ATOMIC_RELAXED);
+		__atomic_thread_fence(__ATOMIC_RELEASE);
+		memset((uint8_t*) s + sizeof(s->seq), 0, set->stride - sizeof(s->seq));
+		__atomic_store_n(&s->seq, s->seq + 1, __ATOMIC_RELEASE);
+	}
+}
+
+uint32_t libmoon_sketch_set_size(struct libmoon_sketch_set* set) {
+	return set->num_sketches;
+}
+
+uint64_t libmoon_sketch_set_memory(struct libmoon_sketch_set* set) {
+	return sizeof(*set) + (uint64_t) set->num_sketches * set->stride;
+}
+
+static inline int32_t get_key(struct libmoon_sketch_set* set, uint64_t value) {
+	if (value <= 1) {
+		return 0;
+	}
+	return (int32_t) ceil(log2((double) value) * set->inv_log2_gamma);
+}
+
+// value reported for a bin, minimizes the relative error for all values in (gamma^(key - 1), gamma^key]
+static inline double get_value(struct libmoon_sketch_set* set, int32_t key) {
+	return 2 * pow(set->gamma, key) / (1 + set->gamma);
+}
+
+static void halve_bins(struct sketch* s, uint16_t num_bins) {
+	for (int i = 0; i < num_bins; i++) {
+		// round up to not lose rare values
+		s->bins[i] = (s->bins[i] + 1) / 2;
+	}
+}
+
+// moves the window up, bins below the new offset are collapsed into the lowest bin
+static void shift_up(struct sketch* s, uint16_t num_bins, int32_t new_offset) {
+	uint32_t delta = new_offset - s->offset;
+	uint32_t collapsed = 0;
+	if (delta >= num_bins) {
+		for (int i = 0; i < num_bins; i++) {
+			collapsed += s->bins[i];
+		}
+		memset(s->bins, 0, num_bins * sizeof(uint16_t));
+	} else {
+		for (uint32_t i = 0; i <= delta; i++) {
+			collapsed += s->bins[i];
+		}
+		memmove(&s->bins[1], &s->bins[delta + 1], (num_bins - delta - 1) * sizeof(uint16_t));
+		memset(&s->bins[num_bins - delta], 0, delta * sizeof(uint16_t));
+	}
+	while (collapsed > UINT16_MAX) {
+		halve_bins(s, num_bins);
+		collapsed = (collapsed + 1) / 2;
+	}
+	s->bins[0] = collapsed;
+	s->offset = new_offset;
+}
+
+// moves the window down as far as possible without losing the highest bin
+static void shift_down(struct sketch* s, uint16_t num_bins, int32_t key) {
+	int highest = num_bins - 1;
+	while (highest > 0 && !s->bins[highest]) {
+		highest--;
+	}
+	int32_t new_offset = RTE_MAX(key, s->offset + highest - num_bins + 1);
+	uint32_t delta = s->offset - new_offset;
+	if (delta) {
+		memmove(&s->bins[delta], &s->bins[0], (num_bins - delta) * sizeof(uint16_t));
+		memset(&s->bins[0], 0, delta * sizeof(uint16_t));
+		s->offset = new_offset;
+	}
+}
+
+static inline void insert(struct libmoon_sketch_set* set, struct sketch* s, uint64_t value) {
+	int32_t key = get_key(set, value);
+	uint16_t num_bins = set->num_bins;
+	// seqlock, readers retry if they see an odd or changed sequence number
+	__atomic_store_n(&s->seq, s->seq + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	if (unlikely(!s->count)) {
+		s->offset = RTE_MAX(key - num_bins / 2, 0);
+	} else if (unlikely(key >= s->offset + num_bins)) {
+		shift_up(s, num_bins, key - num_bins + 1);
+	} else if (unlikely(key < s->offset)) {
+		shift_down(s, num_bins, key);
+	}
+	// key can still be below the window, it goes to the lowest bin then
+	int32_t idx = RTE_MAX(key - s->offset, 0);
+	if (unlikely(s->bins[idx] == UINT16_MAX)) {
+		halve_bins(s, num_bins);
+	}
+	s->bins[idx]++;
+	s->count++;
+	s->sum += value;
+	if (value > s->max) {
+		s->max = value;
+	}
+	__atomic_store_n(&s->seq, s->seq + 1, __ATOMIC_RELEASE);
+}
+
+void libmoon_sketch_insert(struct libmoon_sketch_set* set, uint32_t sketch, uint64_t value) {
+	if (unlikely(sketch >= set->num_sketches)) {
+		return;
+	}
+	insert(set, get_sketch(set, sketch), value);
+}
+
+void libmoon_sketch_insert_bulk(struct libmoon_sketch_set* set, const uint32_t* sketches, const uint64_t* values, uint32_t num) {
+	for (uint32_t i = 0; i < num; i++) {
+		libmoon_sketch_insert(set, sketches[i], values[i]);
+	}
+}
+
+static inline uint32_t get_id(struct libmoon_sketch_set* set, struct rte_mbuf* buf, const uint32_t* ids, uint32_t i) {
+	return ids ? ids[i] : buf->hash.rss % set->num_sketches;
+}
+
+// latency is the difference between now and the timestamp in udata64, e.g. from a software timestamper
+void libmoon_sketch_insert_latencies(struct libmoon_sketch_set* set, struct rte_mbuf** bufs, uint32_t num_bufs, const uint32_t* ids, uint64_t now) {
+	for (uint32_t i = 0; i < num_bufs; i++) {
+		uint64_t ts = bufs[i]->udata64;
+		libmoon_sketch_insert(set, get_id(set, bufs[i], ids, i), now > ts ? now - ts : 0);
+	}
+}
+
+void libmoon_sketch_insert_sizes(struct libmoon_sketch_set* set, struct rte_mbuf** bufs, uint32_t num_bufs, const uint32_t* ids) {
+	for (uint32_t i = 0; i < num_bufs; i++) {
+		libmoon_sketch_insert(set, get_id(set, bufs[i], ids, i), bufs[i]->pkt_len);
+	}
+}
+
+// consistent copy of a sketch that may be written concurrently
+static void read_sketch(struct libmoon_sketch_set* set, uint32_t id, struct sketch* dst) {
+	struct sketch* src = get_sketch(set, id);
+	while (1) {
+		uint32_t seq = __atomic_load_n(&src->seq, __ATOMIC_ACQUIRE);
+		if (seq & 1) {
+			// a writer is updating the sketch, don't starve its hyperthread
+			rte_pause();
+			continue;
+		}
+		memcpy(dst, src, sizeof(struct sketch) + set->num_bins * sizeof(uint16_t));
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		if (seq == __atomic_load_n(&src->seq, __ATOMIC_RELAXED)) {
+			return;
+		}
+		rte_pause();
+	}
+}
+
+struct weighted_bin {
+	int32_t key;
+	double weight;
+};
+
+static int compare_bins(const void* a, const void* b) {
+	int32_t k1 = ((const struct weighted_bin*) a)->key;
+	int32_t k2 = ((const struct weighted_bin*) b)->key;
+	return (k1 > k2) - (k1 < k2);
+}
+
+int libmoon_sketch_query(struct libmoon_sketch_set** sets, uint32_t num_sets, uint32_t sketch, const double* quantiles, double* results, uint32_t num_quantiles, struct libmoon_sketch_stats* stats) {
+	if (!num_sets) {
+		return -EINVAL;
+	}
+	uint16_t num_bins = sets[0]->num_bins;
+	for (uint32_t i = 0; i < num_sets; i++) {
+		if (sketch >= sets[i]->num_sketches || sets[i]->gamma != sets[0]->gamma) {
+			return -EINVAL;
+		}
+		num_bins = RTE_MAX(num_bins, sets[i]->num_bins);
+	}
+	struct sketch* copy = malloc(sizeof(struct sketch) + num_bins * sizeof(uint16_t));
+	struct weighted_bin* bins = malloc(num_sets * num_bins * sizeof(*bins));
+	if (!copy || !bins) {
+		free(copy);
+		free(bins);
+		return -ENOMEM;
+	}
+	uint32_t num_entries = 0;
+	struct libmoon_sketch_stats total = { 0, 0, 0 };
+	for (uint32_t i = 0; i < num_sets; i++) {
+		read_sketch(sets[i], sketch, copy);
+		if (!copy->count) {
+			continue;
+		}
+		total.count += copy->count;
+		total.sum += copy->sum;
+		total.max = RTE_MAX(total.max, copy->max);
+		// bins may have been halved, scale them to the exact count to merge sketches correctly
+		uint64_t bin_total = 0;
+		for (int j = 0; j < sets[i]->num_bins; j++) {
+			bin_total += copy->bins[j];
+		}
+		double scale = (double) copy->count / bin_total;
+		for (int j = 0; j < sets[i]->num_bins; j++) {
+			if (copy->bins[j]) {
+				bins[num_entries].key = copy->offset + j;
+				bins[num_entries].weight = copy->bins[j] * scale;
+				num_entries++;
+			}
+		}
+	}
+	if (num_sets > 1) {
+		qsort(bins, num_entries, sizeof(*bins), compare_bins);
+	}
+	for (uint32_t q = 0; q < num_quantiles; q++) {
+		if (!total.count) {
+			results[q] = NAN;
+			continue;
+		}
+		double rank = quantiles[q] * (total.count - 1);
+		double seen = 0;
+		uint32_t i = 0;
+		while (i < num_entries - 1 && seen + bins[i].weight <= rank) {
+			seen += bins[i].weight;
+			i++;
+		}
+		results[q] = quantiles[q] >= 1 ? total.max : RTE_MIN(get_value(sets[0], bins[i].key), (double) total.max);
+	}
+	if (stats) {
+		*stats = total;
+	}
+	free(copy);
+	free(bins);
+	return 0;
+}
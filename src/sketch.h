@@ -0,0 +1,43 @@
+#ifndef MG_SKETCH_H
+#define MG_SKETCH_H
+
+#include <stdint.h>
+#include <rte_config.h>
+#include <rte_mbuf.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// set of DDSketch quantile sketches, e.g. one per flow
+// values are mapped to logarithmic bins, quantiles have a relative error of at most the configured accuracy
+// each sketch only keeps a fixed window of bins, the lowest bins are collapsed if the values span a larger range
+// a set is written by a single thread (use one set per core), any thread can query without locking
+struct libmoon_sketch_set;
+
+struct libmoon_sketch_stats {
+	uint64_t count;
+	uint64_t sum;
+	uint64_t max;
+};
+
+struct libmoon_sketch_set* libmoon_sketch_set_create(uint32_t num_sketches, double accuracy, uint16_t num_bins, int socket);
+void libmoon_sketch_set_delete(struct libmoon_sketch_set* set);
+void libmoon_sketch_set_reset(struct libmoon_sketch_set* set);
+uint32_t libmoon_sketch_set_size(struct libmoon_sketch_set* set);
+uint64_t libmoon_sketch_set_memory(struct libmoon_sketch_set* set);
+
+void libmoon_sketch_insert(struct libmoon_sketch_set* set, uint32_t sketch, uint64_t value);
+void libmoon_sketch_insert_bulk(struct libmoon_sketch_set* set, const uint32_t* sketches, const uint64_t* values, uint32_t num);
+// ids = NULL uses the RSS hash modulo the number of sketches
+void libmoon_sketch_insert_latencies(struct libmoon_sketch_set* set, struct rte_mbuf** bufs, uint32_t num_bufs, const uint32_t* ids, uint64_t now);
+void libmoon_sketch_insert_sizes(struct libmoon_sketch_set* set, struct rte_mbuf** bufs, uint32_t num_bufs, const uint32_t* ids);
+
+// merges the sketch with the given id from all sets, the sets must use the same accuracy
+int libmoon_sketch_query(struct libmoon_sketch_set** sets, uint32_t num_sets, uint32_t sketch, const double* quantiles, double* results, uint32_t num_quantiles, struct libmoon_sketch_stats* stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
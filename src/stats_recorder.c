@@ -0,0 +1,283 @@
+#include <stdint.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <rte_config.h>
+#include <rte_common.h>
+#include <rte_cycles.h>
+#include <rte_ethdev.h>
+
+#include "stats_recorder.h"
+#include "core_stats.h"
+#include "lifecycle.h"
+
+#define MAX_COLUMNS 256
+#define MAX_DEVICES 32
+#define DEVICE_COLUMNS 5
+// sleep if the next sample is further away than this and spin for the rest
+#define SLEEP_THRESHOLD_US 200
+#define PAGE_SIZE 4096
+
+struct column {
+	char name[LIBMOON_STATS_COLUMN_NAME_SIZE];
+	// NULL for columns filled by a device
+	const volatile uint64_t* value;
+};
+
+struct device_source {
+	uint8_t port;
+	uint32_t first_column;
+};
+
+struct libmoon_stats_recorder {
+	uint64_t interval_ns;
+	uint32_t num_columns;
+	uint32_t num_devices;
+	struct column columns[MAX_COLUMNS];
+	struct device_source devices[MAX_DEVICES];
+	int fd;
+	size_t size;
+	struct libmoon_stats_file_header* header;
+	uint64_t* samples;
+};
+
+struct libmoon_stats_recorder* libmoon_stats_recorder_create(uint64_t interval_ns) {
+	struct libmoon_stats_recorder* recorder = calloc(1, sizeof(*recorder));
+	if (!recorder) {
+		return NULL;
+	}
+	recorder->interval_ns = interval_ns ? interval_ns : 1;
+	recorder->fd = -1;
+	return recorder;
+}
+
+void libmoon_stats_recorder_delete(struct libmoon_stats_recorder* recorder) {
+	if (recorder->header) {
+		munmap(recorder->header, recorder->size);
+	}
+	if (recorder->fd >= 0) {
+		close(recorder->fd);
+	}
+	free(recorder);
+}
+
+static int add_column(struct libmoon_stats_recorder* recorder, const char* name, const volatile uint64_t* value) {
+	if (recorder->header || recorder->num_columns >= MAX_COLUMNS) {
+		return -1;
+	}
+	struct column* column = &recorder->columns[recorder->num_columns++];
+	snprintf(column->name, sizeof(column->name), "%s", name);
+	column->value = value;
+	return 0;
+}
+
+int libmoon_stats_recorder_add_counter(struct libmoon_stats_recorder* recorder, const char* name, const volatile uint64_t* value) {
+	return add_column(recorder, name, value);
+}
+
+int libmoon_stats_recorder_add_device(struct libmoon_stats_recorder* recorder, uint8_t port_id) {
+	static const char* fields[DEVICE_COLUMNS] = { "rx_packets", "rx_bytes", "tx_packets", "tx_bytes", "rx_missed" };
+	if (recorder->header || recorder->num_devices >= MAX_DEVICES || recorder->num_columns + DEVICE_COLUMNS > MAX_COLUMNS) {
+		return -1;
+	}
+	struct device_source* dev = &recorder->devices[recorder->num_devices++];
+	dev->port = port_id;
+	dev->first_column = recorder->num_columns;
+	for (int i = 0; i < DEVICE_COLUMNS; i++) {
+		char name[LIBMOON_STATS_COLUMN_NAME_SIZE];
+		snprintf(name, sizeof(name), "port%u_%s", port_id, fields[i]);
+		add_column(recorder, name, NULL);
+	}
+	return 0;
+}
+
+int libmoon_stats_recorder_add_core(struct libmoon_stats_recorder* recorder, uint32_t lcore) {
+	if (lcore >= RTE_MAX_LCORE || recorder->num_columns + 2 > MAX_COLUMNS) {
+		return -1;
+	}
+	char name[LIBMOON_STATS_COLUMN_NAME_SIZE];
+	snprintf(name, sizeof(name), "core%u_packets", lcore);
+	add_column(recorder, name, &libmoon_core_stats[lcore].packets);
+	snprintf(name, sizeof(name), "core%u_busy_cycles", lcore);
+	return add_column(recorder, name, &libmoon_core_stats[lcore].busy_cycles);
+}
+
+int libmoon_stats_recorder_start(struct libmoon_stats_recorder* recorder, const char* path, uint64_t capacity) {
+	if (recorder->header || !recorder->num_columns || !capacity) {
+		return -1;
+	}
+	uint64_t header_size = RTE_ALIGN(sizeof(struct libmoon_stats_file_header) + recorder->num_columns * LIBMOON_STATS_COLUMN_NAME_SIZE, PAGE_SIZE);
+	size_t size = header_size + capacity * (recorder->num_columns + 1) * sizeof(uint64_t);
+	recorder->fd = open(path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if (recorder->fd < 0 || ftruncate(recorder->fd, size)) {
+		return -1;
+	}
+	void* mem = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, recorder->fd, 0);
+	if (mem == MAP_FAILED) {
+		return -1;
+	}
+	recorder->size = size;
+	recorder->header = mem;
+	recorder->samples = (uint64_t*) ((uint8_t*) mem + header_size);
+	struct libmoon_stats_file_header* header = recorder->header;
+	memcpy(header->magic, LIBMOON_STATS_FILE_MAGIC, sizeof(LIBMOON_STATS_FILE_MAGIC));
+	header->version = LIBMOON_STATS_FILE_VERSION;
+	header->num_columns = recorder->num_columns;
+	header->capacity = capacity;
+	header->interval_ns = recorder->interval_ns;
+	header->tsc_hz = rte_get_tsc_hz();
+	header->header_size = header_size;
+	char* names = (char*) (header + 1);
+	for (uint32_t i = 0; i < recorder->num_columns; i++) {
+		memcpy(names + i * LIBMOON_STATS_COLUMN_NAME_SIZE, recorder->columns[i].name, LIBMOON_STATS_COLUMN_NAME_SIZE);
+	}
+	struct timespec ts;
+	clock_gettime(CLOCK_REALTIME, &ts);
+	header->start_tsc = rte_rdtsc();
+	header->start_unix_ns = (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+	return 0;
+}
+
+static inline void sample(struct libmoon_stats_recorder* recorder, uint64_t tsc, uint64_t idx) {
+	uint32_t n = recorder->num_columns;
+	uint64_t* slot = recorder->samples + (idx % recorder->header->capacity) * (n + 1);
+	slot[0] = tsc;
+	uint64_t* values = slot + 1;
+	for (uint32_t i = 0; i < recorder->num_devices; i++) {
+		struct device_source* dev = &recorder->devices[i];
+		struct rte_eth_stats stats;
+		rte_eth_stats_get(dev->port, &stats);
+		uint64_t* dst = values + dev->first_column;
+		dst[0] = stats.ipackets;
+		dst[1] = stats.ibytes;
+		dst[2] = stats.opackets;
+		dst[3] = stats.obytes;
+		dst[4] = stats.imissed;
+	}
+	for (uint32_t i = 0; i < n; i++) {
+		if (recorder->columns[i].value) {
+			values[i] = __atomic_load_n(recorder->columns[i].value, __ATOMIC_RELAXED);
+		}
+	}
+	// readers only look at samples below num_samples
+	__atomic_store_n(&recorder->header->num_samples, idx + 1, __ATOMIC_RELEASE);
+}
+
+uint64_t libmoon_stats_recorder_run(struct libmoon_stats_recorder* recorder) {
+	struct libmoon_stats_file_header* header = recorder->header;
+	if (!header) {
+		return 0;
+	}
+	uint64_t hz = rte_get_tsc_hz();
+	uint64_t interval = RTE_MAX((uint64_t) ((double) recorder->interval_ns * hz / 1e9), 1ULL);
+	uint64_t idx = header->num_samples;
+	uint64_t next = rte_rdtsc();
+	while (is_running(0)) {
+		uint64_t now = rte_rdtsc();
+		if (now < next) {
+			uint64_t wait_us = (next - now) * 1000000 / hz;
+			if (wait_us > SLEEP_THRESHOLD_US) {
+				// wake up early and spin for the rest to keep the jitter low
+				usleep(wait_us - SLEEP_THRESHOLD_US);
+			} else {
+				rte_pause();
+			}
+			continue;
+		}
+		sample(recorder, now, idx++);
+		next += interval;
+		if (now >= next) {
+			// sampling took too long or the thread was descheduled, skip the missed intervals
+			uint64_t missed = (now - next) / interval + 1;
+			__atomic_store_n(&header->missed, header->missed + missed, __ATOMIC_RELAXED);
+			next += missed * interval;
+		}
+	}
+	msync(header, recorder->size, MS_ASYNC);
+	return idx;
+}
+
+int64_t libmoon_stats_file_to_csv(const char* path, const char* csv_path, uint8_t deltas) {
+	int fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0) {
+		return -1;
+	}
+	struct stat st;
+	if (fstat(fd, &st) || (size_t) st.st_size < sizeof(struct libmoon_stats_file_header)) {
+		close(fd);
+		return -1;
+	}
+	void* mem = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (mem == MAP_FAILED) {
+		return -1;
+	}
+	const struct libmoon_stats_file_header* header = mem;
+	uint32_t n = header->num_columns;
+	if (memcmp(header->magic, LIBMOON_STATS_FILE_MAGIC, sizeof(LIBMOON_STATS_FILE_MAGIC))
+	|| header->version != LIBMOON_STATS_FILE_VERSION
+	|| !header->capacity
+	|| header->header_size + header->capacity * (n + 1) * sizeof(uint64_t) > (uint64_t) st.st_size) {
+		munmap(mem, st.st_size);
+		return -1;
+	}
+	// rows are copied before they are converted, the slots of a running recording are overwritten concurrently
+	uint64_t* rows = malloc(2 * (n + 1) * sizeof(uint64_t));
+	FILE* out = rows ? fopen(csv_path, "w") : NULL;
+	if (!out) {
+		free(rows);
+		munmap(mem, st.st_size);
+		return -1;
+	}
+	const char* names = (const char*) (header + 1);
+	const uint64_t* samples = (const uint64_t*) ((const uint8_t*) mem + header->header_size);
+	fprintf(out, "Time");
+	for (uint32_t i = 0; i < n; i++) {
+		fprintf(out, ",%.*s", LIBMOON_STATS_COLUMN_NAME_SIZE, names + i * LIBMOON_STATS_COLUMN_NAME_SIZE);
+	}
+	fprintf(out, "\n");
+	uint64_t capacity = header->capacity;
+	uint64_t num_samples = __atomic_load_n(&header->num_samples, __ATOMIC_ACQUIRE);
+	uint64_t idx = num_samples > capacity ? num_samples - capacity : 0;
+	uint64_t* slot = rows;
+	const uint64_t* prev = NULL;
+	int64_t written = 0;
+	while (idx < num_samples) {
+		memcpy(slot, samples + (idx % capacity) * (n + 1), (n + 1) * sizeof(uint64_t));
+		// the writer overwrites the slot with sample idx + capacity, see sample()
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		uint64_t current = __atomic_load_n(&header->num_samples, __ATOMIC_RELAXED);
+		if (current >= idx + capacity) {
+			// the copy may be torn, continue with the oldest sample that is still intact
+			idx = current - capacity + 1;
+			prev = NULL;
+			continue;
+		}
+		idx++;
+		if (deltas && !prev) {
+			prev = slot;
+			slot = slot == rows ? rows + n + 1 : rows;
+			continue;
+		}
+		uint64_t ns = header->start_unix_ns + (uint64_t) ((unsigned __int128) (slot[0] - header->start_tsc) * 1000000000 / header->tsc_hz);
+		fprintf(out, "%" PRIu64 ".%09" PRIu64, ns / 1000000000, ns % 1000000000);
+		for (uint32_t i = 0; i < n; i++) {
+			fprintf(out, ",%" PRIu64, deltas ? slot[i + 1] - prev[i + 1] : slot[i + 1]);
+		}
+		fprintf(out, "\n");
+		prev = slot;
+		slot = slot == rows ? rows + n + 1 : rows;
+		written++;
+	}
+	free(rows);
+	fclose(out);
+	munmap(mem, st.st_size);
+	return written;
+}
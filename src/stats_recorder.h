@@ -0,0 +1,58 @@
+#ifndef MG_STATS_RECORDER_H
+#define MG_STATS_RECORDER_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// samples counters at a fixed interval (down to ~1 us) into a fixed-size ring in a mmap'd file
+// the file stays valid while it is written, samples are published by incrementing num_samples after they are complete
+
+#define LIBMOON_STATS_FILE_MAGIC "LMSTATS"
+#define LIBMOON_STATS_FILE_VERSION 1
+#define LIBMOON_STATS_COLUMN_NAME_SIZE 64
+
+// file layout: header, column names (num_columns * LIBMOON_STATS_COLUMN_NAME_SIZE), padding to header_size,
+// capacity samples of (uint64_t tsc, uint64_t values[num_columns])
+struct libmoon_stats_file_header {
+	char magic[8];
+	uint32_t version;
+	uint32_t num_columns;
+	uint64_t capacity;
+	uint64_t interval_ns;
+	uint64_t tsc_hz;
+	uint64_t start_tsc;
+	uint64_t start_unix_ns;
+	uint64_t header_size;
+	// intervals without a sample because the previous one took too long
+	uint64_t missed;
+	// total number of samples, the ring holds the last min(num_samples, capacity) samples
+	uint64_t num_samples;
+};
+
+struct libmoon_stats_recorder;
+
+struct libmoon_stats_recorder* libmoon_stats_recorder_create(uint64_t interval_ns);
+void libmoon_stats_recorder_delete(struct libmoon_stats_recorder* recorder);
+// columns can only be added before the recorder is started, value must stay valid while it runs
+int libmoon_stats_recorder_add_counter(struct libmoon_stats_recorder* recorder, const char* name, const volatile uint64_t* value);
+// rx/tx packets and bytes and missed packets from rte_eth_stats_get(), this can take several microseconds per device
+int libmoon_stats_recorder_add_device(struct libmoon_stats_recorder* recorder, uint8_t port_id);
+// packets and busy cycles of an lcore, see core_stats.h
+int libmoon_stats_recorder_add_core(struct libmoon_stats_recorder* recorder, uint32_t lcore);
+// creates the file and maps it, the file size is fixed from here on
+int libmoon_stats_recorder_start(struct libmoon_stats_recorder* recorder, const char* path, uint64_t capacity);
+// samples until libmoon is stopped, returns the number of samples
+uint64_t libmoon_stats_recorder_run(struct libmoon_stats_recorder* recorder);
+
+// converts a (possibly still running) recording to CSV, deltas writes the difference to the previous sample instead of the value
+// returns the number of written samples or -1 on error
+int64_t libmoon_stats_file_to_csv(const char* path, const char* csv_path, uint8_t deltas);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
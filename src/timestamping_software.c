@@ -0,0 +1,302 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <rte_config.h>
+#include <rte_common.h>
+#include <rte_cycles.h>
+#include <rte_ethdev.h>
+#include <rte_mbuf.h>
+#include <rte_spinlock.h>
+
+#include "timestamping_software.h"
+#include "lifecycle.h"
+#include "core_stats.h"
+
+// preamble, start of frame delimiter, inter-frame gap, and the CRC stripped by the NIC
+#define WIRE_OVERHEAD 24
+// number of clock reads per calibration, the one with the smallest rdtsc window is used
+#define CALIBRATION_SAMPLES 16
+// assumed link speed if the driver does not report one (Mbit/s)
+#define DEFAULT_LINK_SPEED 10000
+
+// see clock_gettime(2) and linux/Documentation/ptp/testptp.c
+#define FD_TO_CLOCKID(fd) ((~(clockid_t) (fd) << 3) | 3)
+
+struct libmoon_sw_clock {
+	uint32_t seq;
+	rte_spinlock_t lock;
+	clockid_t clock_id;
+	int fd;
+	// ns = base_ns + ((tsc - base_tsc) * mult) >> 32
+	uint64_t base_tsc;
+	uint64_t base_ns;
+	uint64_t mult;
+	uint64_t uncertainty_ns;
+	// first calibration point, the tsc frequency is measured relative to it
+	uint64_t ref_tsc;
+	uint64_t ref_ns;
+};
+
+struct libmoon_sw_timestamper {
+	struct libmoon_sw_clock* clock;
+	uint8_t port_id;
+	uint16_t queue_id;
+	// 0 uses the speed reported by the device
+	uint32_t speed;
+	uint32_t link_speed;
+	double cycles_per_byte;
+	// start of the last poll that emptied the queue, packets received afterwards arrived after this point
+	uint64_t drained_tsc;
+};
+
+struct libmoon_sw_clock* libmoon_sw_clock_create(const char* ptp_device) {
+	struct libmoon_sw_clock* clock = calloc(1, sizeof(*clock));
+	if (!clock) {
+		return NULL;
+	}
+	rte_spinlock_init(&clock->lock);
+	clock->fd = -1;
+	clock->clock_id = CLOCK_REALTIME;
+	if (ptp_device) {
+		clock->fd = open(ptp_device, O_RDONLY);
+		if (clock->fd < 0) {
+			printf("could not open PTP clock %s: %s\n", ptp_device, strerror(errno));
+			free(clock);
+			return NULL;
+		}
+		clock->clock_id = FD_TO_CLOCKID(clock->fd);
+	}
+	if (libmoon_sw_clock_calibrate(clock)) {
+		libmoon_sw_clock_delete(clock);
+		return NULL;
+	}
+	return clock;
+}
+
+void libmoon_sw_clock_delete(struct libmoon_sw_clock* clock) {
+	if (clock->fd >= 0) {
+		close(clock->fd);
+	}
+	free(clock);
+}
+
+static int read_clock(struct libmoon_sw_clock* clock, uint64_t* tsc, uint64_t* ns, uint64_t* window) {
+	*window = UINT64_MAX;
+	for (int i = 0; i < CALIBRATION_SAMPLES; i++) {
+		struct timespec ts;
+		uint64_t before = rte_rdtsc_precise();
+		if (clock_gettime(clock->clock_id, &ts)) {
+			return -errno;
+		}
+		uint64_t after = rte_rdtsc_precise();
+		if (after - before < *window) {
+			*window = after - before;
+			*tsc = before + (after - before) / 2;
+			*ns = ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+		}
+	}
+	return 0;
+}
+
+static inline uint64_t convert(uint64_t tsc, uint64_t base_tsc, uint64_t base_ns, uint64_t mult) {
+	int64_t delta = tsc - base_tsc;
+	if (delta >= 0) {
+		return base_ns + (uint64_t) (((unsigned __int128) delta * mult) >> 32);
+	} else {
+		return base_ns - (uint64_t) (((unsigned __int128) -delta * mult) >> 32);
+	}
+}
+
+// reads a consistent snapshot of the conversion parameters
+static inline void read_params(struct libmoon_sw_clock* clock, uint64_t* base_tsc, uint64_t* base_ns, uint64_t* mult, uint64_t* uncertainty_ns) {
+	uint32_t seq;
+	do {
+		seq = __atomic_load_n(&clock->seq, __ATOMIC_ACQUIRE);
+		if (seq & 1) {
+			rte_pause();
+			continue;
+		}
+		*base_tsc = __atomic_load_n(&clock->base_tsc, __ATOMIC_RELAXED);
+		*base_ns = __atomic_load_n(&clock->base_ns, __ATOMIC_RELAXED);
+		*mult = __atomic_load_n(&clock->mult, __ATOMIC_RELAXED);
+		*uncertainty_ns = __atomic_load_n(&clock->uncertainty_ns, __ATOMIC_RELAXED);
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	} while ((seq & 1) || seq != __atomic_load_n(&clock->seq, __ATOMIC_RELAXED));
+}
+
+// measures the offset to the wall clock and the tsc frequency
+// call this regularly (e.g. once per second) to follow NTP/PTP adjustments, the error bound includes the drift since the last call
+int libmoon_sw_clock_calibrate(struct libmoon_sw_clock* clock) {
+	uint64_t tsc, ns, window;
+	int rc = read_clock(clock, &tsc, &ns, &window);
+	if (rc) {
+		return rc;
+	}
+	uint64_t hz = rte_get_tsc_hz();
+	rte_spinlock_lock(&clock->lock);
+	uint64_t mult;
+	if (!clock->ref_tsc) {
+		clock->ref_tsc = tsc;
+		clock->ref_ns = ns;
+		mult = (1000000000ULL << 32) / hz;
+	} else if (tsc - clock->ref_tsc < hz / 10 || ns <= clock->ref_ns) {
+		// too short to measure the frequency (or the wall clock jumped back)
+		mult = clock->mult;
+	} else {
+		mult = ((unsigned __int128) (ns - clock->ref_ns) << 32) / (tsc - clock->ref_tsc);
+	}
+	uint64_t uncertainty_ns = window * 1000000000ULL / hz / 2 + 1;
+	if (clock->base_tsc) {
+		// how far off the old parameters were, this is the error that accumulates between two calibrations
+		uint64_t predicted = convert(tsc, clock->base_tsc, clock->base_ns, clock->mult);
+		uncertainty_ns += predicted > ns ? predicted - ns : ns - predicted;
+	}
+	__atomic_store_n(&clock->seq, clock->seq + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	__atomic_store_n(&clock->base_tsc, tsc, __ATOMIC_RELAXED);
+	__atomic_store_n(&clock->base_ns, ns, __ATOMIC_RELAXED);
+	__atomic_store_n(&clock->mult, mult, __ATOMIC_RELAXED);
+	__atomic_store_n(&clock->uncertainty_ns, uncertainty_ns, __ATOMIC_RELAXED);
+	__atomic_store_n(&clock->seq, clock->seq + 1, __ATOMIC_RELEASE);
+	rte_spinlock_unlock(&clock->lock);
+	return 0;
+}
+
+uint64_t libmoon_sw_clock_tsc_to_ns(struct libmoon_sw_clock* clock, uint64_t tsc) {
+	uint64_t base_tsc, base_ns, mult, uncertainty_ns;
+	read_params(clock, &base_tsc, &base_ns, &mult, &uncertainty_ns);
+	return convert(tsc, base_tsc, base_ns, mult);
+}
+
+uint64_t libmoon_sw_clock_now(struct libmoon_sw_clock* clock) {
+	return libmoon_sw_clock_tsc_to_ns(clock, rte_rdtsc());
+}
+
+uint64_t libmoon_sw_clock_get_uncertainty(struct libmoon_sw_clock* clock) {
+	return __atomic_load_n(&clock->uncertainty_ns, __ATOMIC_RELAXED);
+}
+
+double libmoon_sw_clock_get_tsc_hz(struct libmoon_sw_clock* clock) {
+	return 1e9 * 4294967296.0 / __atomic_load_n(&clock->mult, __ATOMIC_RELAXED);
+}
+
+static double get_cycles_per_byte(uint32_t speed) {
+	return rte_get_tsc_hz() * 8.0 / (speed * 1000000.0);
+}
+
+// the last packet of the burst arrived in [lower_tsc + wire time of the burst, upper_tsc],
+// the ones before it back-to-back at line rate, i.e. the burst was buffered by the NIC
+// stores the end of the reception of each packet in udata64 and returns the error bound in cycles
+// lower_tsc = 0 means unknown, the last packet is stamped with upper_tsc then
+static uint64_t timestamp_burst(struct rte_mbuf** bufs, uint16_t num_bufs, uint64_t lower_tsc, uint64_t upper_tsc, double cycles_per_byte) {
+	double wire_cycles = 0;
+	for (int i = 0; i < num_bufs; i++) {
+		wire_cycles += (bufs[i]->pkt_len + WIRE_OVERHEAD) * cycles_per_byte;
+	}
+	uint64_t lower = lower_tsc + (uint64_t) wire_cycles;
+	if (!lower_tsc || lower > upper_tsc) {
+		// unknown lower bound (first poll), the link is faster than we think, or the packets were delayed in the NIC
+		lower = upper_tsc;
+	}
+	uint64_t ts = lower + (upper_tsc - lower) / 2;
+	bufs[num_bufs - 1]->udata64 = ts;
+	for (int i = num_bufs - 2; i >= 0; i--) {
+		ts -= (uint64_t) ((bufs[i + 1]->pkt_len + WIRE_OVERHEAD) * cycles_per_byte);
+		bufs[i]->udata64 = ts;
+	}
+	return (upper_tsc - lower) / 2;
+}
+
+void libmoon_sw_timestamp_burst(struct rte_mbuf** bufs, uint16_t num_bufs, uint64_t lower_tsc, uint64_t upper_tsc, double cycles_per_byte) {
+	if (num_bufs) {
+		timestamp_burst(bufs, num_bufs, lower_tsc, upper_tsc, cycles_per_byte);
+	}
+}
+
+struct libmoon_sw_timestamper* libmoon_sw_timestamper_create(struct libmoon_sw_clock* clock, uint8_t port_id, uint16_t queue_id, uint32_t speed) {
+	struct libmoon_sw_timestamper* ts = calloc(1, sizeof(*ts));
+	if (!ts) {
+		return NULL;
+	}
+	ts->clock = clock;
+	ts->port_id = port_id;
+	ts->queue_id = queue_id;
+	ts->speed = speed;
+	libmoon_sw_timestamper_update_link(ts);
+	return ts;
+}
+
+void libmoon_sw_timestamper_delete(struct libmoon_sw_timestamper* ts) {
+	free(ts);
+}
+
+// virtual devices like net_pcap or net_ring may report no speed or a made-up one (10 Gbit/s on net_pcap),
+// an explicitly set speed always wins, DEFAULT_LINK_SPEED is used if the link is down
+uint32_t libmoon_sw_timestamper_update_link(struct libmoon_sw_timestamper* ts) {
+	if (ts->speed) {
+		ts->link_speed = ts->speed;
+	} else {
+		struct rte_eth_link link;
+		memset(&link, 0, sizeof(link));
+		rte_eth_link_get_nowait(ts->port_id, &link);
+		ts->link_speed = link.link_status && link.link_speed ? link.link_speed : DEFAULT_LINK_SPEED;
+	}
+	ts->cycles_per_byte = get_cycles_per_byte(ts->link_speed);
+	return ts->link_speed;
+}
+
+// receives at least one packet (or returns 0 if libmoon is stopped), udata64 contains the wall clock time in nanoseconds
+// error_ns is the error bound of the burst (UINT64_MAX for the first burst as the queue might contain old packets)
+uint16_t libmoon_sw_timestamper_recv(struct libmoon_sw_timestamper* ts, struct rte_mbuf** bufs, uint16_t num_bufs, uint64_t* error_ns) {
+	while (is_running(0)) {
+		uint64_t poll_start = rte_rdtsc();
+		uint16_t rx = rte_eth_rx_burst(ts->port_id, ts->queue_id, bufs, num_bufs);
+		uint64_t poll_end = rte_rdtsc();
+		libmoon_core_stats_record(rx);
+		if (!rx) {
+			ts->drained_tsc = poll_start;
+			continue;
+		}
+		uint64_t error_cycles = timestamp_burst(bufs, rx, ts->drained_tsc, poll_end, ts->cycles_per_byte);
+		uint64_t base_tsc, base_ns, mult, uncertainty_ns;
+		read_params(ts->clock, &base_tsc, &base_ns, &mult, &uncertainty_ns);
+		for (int i = 0; i < rx; i++) {
+			bufs[i]->udata64 = convert(bufs[i]->udata64, base_tsc, base_ns, mult);
+		}
+		if (ts->drained_tsc) {
+			*error_ns = ((unsigned __int128) error_cycles * mult >> 32) + uncertainty_ns;
+		} else {
+			*error_ns = UINT64_MAX;
+		}
+		if (rx < num_bufs) {
+			ts->drained_tsc = poll_start;
+		}
+		return rx;
+	}
+	return 0;
+}
+
+// cached link speeds for dpdk_receive_with_timestamps_software()
+static double port_cycles_per_byte[RTE_MAX_ETHPORTS];
+
+double libmoon_sw_get_port_cycles_per_byte(uint8_t port_id) {
+	double cycles_per_byte = port_cycles_per_byte[port_id];
+	if (unlikely(!cycles_per_byte)) {
+		struct rte_eth_link link;
+		memset(&link, 0, sizeof(link));
+		rte_eth_link_get_nowait(port_id, &link);
+		if (!link.link_status || !link.link_speed) {
+			// don't cache, the link might not be up yet
+			return get_cycles_per_byte(DEFAULT_LINK_SPEED);
+		}
+		cycles_per_byte = get_cycles_per_byte(link.link_speed);
+		port_cycles_per_byte[port_id] = cycles_per_byte;
+	}
+	return cycles_per_byte;
+}
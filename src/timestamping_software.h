@@ -0,0 +1,41 @@
+#ifndef MG_TIMESTAMPING_SOFTWARE_H
+#define MG_TIMESTAMPING_SOFTWARE_H
+
+#include <stdint.h>
+#include <rte_config.h>
+#include <rte_mbuf.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// maps TSC values to a wall clock (CLOCK_REALTIME or a PTP hardware clock)
+// can be shared between threads, calibration and conversion are protected by a seqlock
+struct libmoon_sw_clock;
+
+// software rx timestamper for one queue, must only be used by one thread
+struct libmoon_sw_timestamper;
+
+struct libmoon_sw_clock* libmoon_sw_clock_create(const char* ptp_device);
+void libmoon_sw_clock_delete(struct libmoon_sw_clock* clock);
+int libmoon_sw_clock_calibrate(struct libmoon_sw_clock* clock);
+uint64_t libmoon_sw_clock_tsc_to_ns(struct libmoon_sw_clock* clock, uint64_t tsc);
+uint64_t libmoon_sw_clock_now(struct libmoon_sw_clock* clock);
+uint64_t libmoon_sw_clock_get_uncertainty(struct libmoon_sw_clock* clock);
+double libmoon_sw_clock_get_tsc_hz(struct libmoon_sw_clock* clock);
+
+struct libmoon_sw_timestamper* libmoon_sw_timestamper_create(struct libmoon_sw_clock* clock, uint8_t port_id, uint16_t queue_id, uint32_t speed);
+void libmoon_sw_timestamper_delete(struct libmoon_sw_timestamper* ts);
+uint32_t libmoon_sw_timestamper_update_link(struct libmoon_sw_timestamper* ts);
+uint16_t libmoon_sw_timestamper_recv(struct libmoon_sw_timestamper* ts, struct rte_mbuf** bufs, uint16_t num_bufs, uint64_t* error_ns);
+
+// low-level helper: stamps a burst received between the two tsc values with tsc values
+void libmoon_sw_timestamp_burst(struct rte_mbuf** bufs, uint16_t num_bufs, uint64_t lower_tsc, uint64_t upper_tsc, double cycles_per_byte);
+// cycles per byte at the current link speed of the port, cached once the link is up
+double libmoon_sw_get_port_cycles_per_byte(uint8_t port_id);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
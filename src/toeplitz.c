@@ -0,0 +1,164 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <rte_config.h>
+#include <rte_mbuf.h>
+#include <rte_ether.h>
+#include <rte_ip.h>
+#include <rte_byteorder.h>
+
+#include "toeplitz.h"
+
+// Software implementation of the Toeplitz hash function used by NICs for RSS.
+// The hash is linear (XOR) in its input, so we precompute the contribution of every possible byte value
+// at every position of the input tuple. Hashing is then just a XOR of one table lookup per input byte.
+
+struct libmoon_toeplitz* libmoon_toeplitz_create(const uint8_t* key, uint32_t key_len) {
+	if (key_len < 4 || key_len > TOEPLITZ_MAX_KEY_LEN) {
+		return NULL;
+	}
+	struct libmoon_toeplitz* ctx = calloc(1, sizeof(*ctx));
+	if (!ctx) {
+		return NULL;
+	}
+	memcpy(ctx->key, key, key_len);
+	ctx->key_len = key_len;
+	// the key must cover the input + 32 bit, shorter keys only support shorter inputs
+	ctx->max_input_len = key_len - 4 < TOEPLITZ_MAX_INPUT_LEN ? key_len - 4 : TOEPLITZ_MAX_INPUT_LEN;
+	for (uint32_t pos = 0; pos < ctx->max_input_len; pos++) {
+		for (uint32_t bit = 0; bit < 8; bit++) {
+			// 32 bit window of the key starting at bit position pos * 8 + bit
+			uint64_t window = ((uint64_t) key[pos] << 32) | ((uint64_t) key[pos + 1] << 24) | ((uint64_t) key[pos + 2] << 16) | ((uint64_t) key[pos + 3] << 8);
+			if (pos + 4 < key_len) {
+				window |= key[pos + 4];
+			}
+			uint32_t k = (uint32_t) (window >> (8 - bit));
+			for (uint32_t val = 0; val < 256; val++) {
+				if (val & (0x80 >> bit)) {
+					ctx->table[pos][val] ^= k;
+				}
+			}
+		}
+	}
+	// default: single queue
+	ctx->reta_size = 1;
+	ctx->reta[0] = 0;
+	return ctx;
+}
+
+void libmoon_toeplitz_delete(struct libmoon_toeplitz* ctx) {
+	free(ctx);
+}
+
+int libmoon_toeplitz_set_reta(struct libmoon_toeplitz* ctx, const uint16_t* reta, uint32_t reta_size) {
+	if (reta_size == 0 || reta_size > TOEPLITZ_MAX_RETA_SIZE || (reta_size & (reta_size - 1))) {
+		return -1;
+	}
+	memcpy(ctx->reta, reta, reta_size * sizeof(*reta));
+	ctx->reta_size = reta_size;
+	return 0;
+}
+
+uint32_t libmoon_toeplitz_hash(struct libmoon_toeplitz* ctx, const uint8_t* data, uint32_t len) {
+	return toeplitz_hash_inline(ctx, data, len);
+}
+
+uint16_t libmoon_toeplitz_get_queue(struct libmoon_toeplitz* ctx, uint32_t hash) {
+	return toeplitz_queue_inline(ctx, hash);
+}
+
+// builds the input tuple for the hash function in the order defined by the RSS spec:
+// src ip, dst ip, src port, dst port (everything in network byte order)
+// returns the length of the tuple or 0 if the packet is not an IP packet
+static inline uint32_t build_tuple(struct rte_mbuf* mbuf, uint32_t flags, uint8_t* tuple) {
+	uint8_t* data = rte_pktmbuf_mtod(mbuf, uint8_t*);
+	uint32_t len = mbuf->data_len;
+	uint32_t offset = sizeof(struct ether_hdr);
+	if (len < offset) {
+		return 0;
+	}
+	uint16_t ether_type = ((struct ether_hdr*) data)->ether_type;
+	if (ether_type == rte_cpu_to_be_16(ETHER_TYPE_VLAN)) {
+		if (len < offset + sizeof(struct vlan_hdr)) {
+			return 0;
+		}
+		ether_type = ((struct vlan_hdr*) (data + offset))->eth_proto;
+		offset += sizeof(struct vlan_hdr);
+	}
+	uint8_t proto;
+	uint32_t tuple_len;
+	if (ether_type == rte_cpu_to_be_16(ETHER_TYPE_IPv4)) {
+		if (len < offset + sizeof(struct ipv4_hdr)) {
+			return 0;
+		}
+		struct ipv4_hdr* ip = (struct ipv4_hdr*) (data + offset);
+		memcpy(tuple, &ip->src_addr, 8);
+		tuple_len = 8;
+		proto = ip->next_proto_id;
+		// fragments are hashed on the addresses only
+		if (ip->fragment_offset & rte_cpu_to_be_16(0x3FFF)) {
+			return tuple_len;
+		}
+		offset += (ip->version_ihl & 0x0F) * 4;
+	} else if (ether_type == rte_cpu_to_be_16(ETHER_TYPE_IPv6)) {
+		if (len < offset + sizeof(struct ipv6_hdr)) {
+			return 0;
+		}
+		struct ipv6_hdr* ip = (struct ipv6_hdr*) (data + offset);
+		memcpy(tuple, ip->src_addr, 32);
+		tuple_len = 32;
+		proto = ip->proto;
+		offset += sizeof(struct ipv6_hdr);
+	} else {
+		return 0;
+	}
+	if (((proto == IPPROTO_TCP && (flags & TOEPLITZ_L4_TCP)) || (proto == IPPROTO_UDP && (flags & TOEPLITZ_L4_UDP)))
+	&& len >= offset + 4) {
+		memcpy(tuple + tuple_len, data + offset, 4);
+		tuple_len += 4;
+	}
+	return tuple_len;
+}
+
+void libmoon_toeplitz_hash_bufs(struct libmoon_toeplitz* ctx, struct rte_mbuf** bufs, uint32_t num_bufs, uint32_t flags, uint32_t* hashes) {
+	uint8_t tuple[TOEPLITZ_MAX_INPUT_LEN];
+	for (uint32_t i = 0; i < num_bufs; i++) {
+		uint32_t tuple_len = build_tuple(bufs[i], flags, tuple);
+		hashes[i] = tuple_len ? toeplitz_hash_inline(ctx, tuple, tuple_len) : 0;
+	}
+}
+
+void libmoon_toeplitz_queue_bufs(struct libmoon_toeplitz* ctx, struct rte_mbuf** bufs, uint32_t num_bufs, uint32_t flags, uint16_t* queues) {
+	uint8_t tuple[TOEPLITZ_MAX_INPUT_LEN];
+	for (uint32_t i = 0; i < num_bufs; i++) {
+		uint32_t tuple_len = build_tuple(bufs[i], flags, tuple);
+		queues[i] = toeplitz_queue_inline(ctx, tuple_len ? toeplitz_hash_inline(ctx, tuple, tuple_len) : 0);
+	}
+}
+
+// Find a value for the 16 bit field at offset in tuple (e.g., the source port) such that the tuple is mapped to the given queue.
+// The search starts at start and wraps around; the tuple is modified in place.
+// Returns the found value or -1 if there is no such value (e.g., the queue is not in the RETA).
+int32_t libmoon_toeplitz_find_field(struct libmoon_toeplitz* ctx, uint8_t* tuple, uint32_t tuple_len, uint32_t offset, uint16_t start, uint16_t queue) {
+	if (offset + 2 > tuple_len || tuple_len > ctx->max_input_len) {
+		return -1;
+	}
+	tuple[offset] = 0;
+	tuple[offset + 1] = 0;
+	// the hash is linear: h(tuple with field = x) = h(tuple with field = 0) ^ h_field(x)
+	uint32_t base = toeplitz_hash_inline(ctx, tuple, tuple_len);
+	const uint32_t* hi = ctx->table[offset];
+	const uint32_t* lo = ctx->table[offset + 1];
+	uint32_t val = start;
+	for (uint32_t i = 0; i < 0x10000; i++, val = (val + 1) & 0xFFFF) {
+		uint32_t hash = base ^ hi[val >> 8] ^ lo[val & 0xFF];
+		if (toeplitz_queue_inline(ctx, hash) == queue) {
+			tuple[offset] = val >> 8;
+			tuple[offset + 1] = val & 0xFF;
+			return val;
+		}
+	}
+	return -1;
+}
+
@@ -0,0 +1,54 @@
+#pragma once
+#include <stdint.h>
+#include <rte_config.h>
+#include <rte_mbuf.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// 52 bytes is the largest key used by supported NICs (i40e), most use 40
+#define TOEPLITZ_MAX_KEY_LEN 52
+// IPv6 addresses + ports
+#define TOEPLITZ_MAX_INPUT_LEN 36
+#define TOEPLITZ_MAX_RETA_SIZE 512
+
+// flags for the mbuf hash functions: include L4 ports for these protocols
+#define TOEPLITZ_L4_TCP 1
+#define TOEPLITZ_L4_UDP 2
+
+struct libmoon_toeplitz {
+	uint32_t table[TOEPLITZ_MAX_INPUT_LEN][256];
+	uint16_t reta[TOEPLITZ_MAX_RETA_SIZE];
+	uint32_t reta_size;
+	uint32_t key_len;
+	uint32_t max_input_len;
+	uint8_t key[TOEPLITZ_MAX_KEY_LEN];
+};
+
+static inline uint32_t toeplitz_hash_inline(struct libmoon_toeplitz* ctx, const uint8_t* data, uint32_t len) {
+	uint32_t hash = 0;
+	for (uint32_t i = 0; i < len; i++) {
+		hash ^= ctx->table[i][data[i]];
+	}
+	return hash;
+}
+
+static inline uint16_t toeplitz_queue_inline(struct libmoon_toeplitz* ctx, uint32_t hash) {
+	// NICs use the least significant bits of the hash as index into the RETA
+	return ctx->reta[hash & (ctx->reta_size - 1)];
+}
+
+struct libmoon_toeplitz* libmoon_toeplitz_create(const uint8_t* key, uint32_t key_len);
+void libmoon_toeplitz_delete(struct libmoon_toeplitz* ctx);
+int libmoon_toeplitz_set_reta(struct libmoon_toeplitz* ctx, const uint16_t* reta, uint32_t reta_size);
+uint32_t libmoon_toeplitz_hash(struct libmoon_toeplitz* ctx, const uint8_t* data, uint32_t len);
+uint16_t libmoon_toeplitz_get_queue(struct libmoon_toeplitz* ctx, uint32_t hash);
+void libmoon_toeplitz_hash_bufs(struct libmoon_toeplitz* ctx, struct rte_mbuf** bufs, uint32_t num_bufs, uint32_t flags, uint32_t* hashes);
+void libmoon_toeplitz_queue_bufs(struct libmoon_toeplitz* ctx, struct rte_mbuf** bufs, uint32_t num_bufs, uint32_t flags, uint16_t* queues);
+int32_t libmoon_toeplitz_find_field(struct libmoon_toeplitz* ctx, uint8_t* tuple, uint32_t tuple_len, uint32_t offset, uint16_t start, uint16_t queue);
+
+#ifdef __cplusplus
+}
+#endif
+
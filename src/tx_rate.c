@@ -0,0 +1,404 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include <math.h>
+#include <unistd.h>
+#include <errno.h>
+
+#include <rte_config.h>
+#include <rte_common.h>
+#include <rte_cycles.h>
+#include <rte_ethdev.h>
+#include <rte_malloc.h>
+#include <rte_mbuf.h>
+
+#include "tx_rate.h"
+#include "lifecycle.h"
+#include "core_stats.h"
+
+#define DEFAULT_MAX_BURST 32
+#define DEFAULT_MAX_LAG_US 100
+// sleep if the next deadline is further away than this and spin for the rest
+#define SLEEP_THRESHOLD_US 200
+
+// packet costs are 40.24 fixed point TSC cycles, i.e. sub-cycle precision for a single packet and up to ~5 minutes between packets
+#define FRAC_BITS 24
+#define FRAC_MASK ((1ULL << FRAC_BITS) - 1)
+#define MAX_COST (1ULL << 63)
+
+// ethernet CRC and preamble, SFD, and inter-frame gap
+#define CRC_BYTES 4
+#define FRAMING_BYTES 20
+
+#define FILLER_BURST 64
+#define DEFAULT_MIN_FILLER_SIZE 60
+#define DEFAULT_MAX_FILLER_SIZE 1514
+// in byte times
+#define MAX_GAP_DEBT (64 * 1024)
+
+// defined by the CRC patch in our DPDK fork, see dpdk.lua
+#ifndef PKT_TX_NO_CRC_CSUM
+#define PKT_TX_NO_CRC_CSUM (1ULL << 48)
+#endif
+
+struct tx_queue_state {
+	struct libmoon_tx_rate_config cfg;
+	struct libmoon_tx_rate_stats stats;
+	uint8_t enabled;
+	uint64_t cycles_per_packet;
+	uint64_t cycles_per_byte;
+	uint64_t max_lag;
+	// deadline of the next packet, 0 if not yet started
+	uint64_t next;
+	uint64_t next_frac;
+	uint64_t rand_state;
+	// CRC filler mode: byte times per packet at link rate (fixed part and per byte of the packet)
+	double filler_period;
+	double filler_period_per_byte;
+	// part of the last gap that was too small for a filler frame
+	double gap_carry;
+} __rte_cache_aligned;
+
+struct tx_port_state {
+	uint16_t num_queues;
+	struct tx_queue_state queues[];
+};
+
+static struct tx_port_state* tx_ports[RTE_MAX_ETHPORTS];
+
+static struct tx_queue_state* get_queue_state(uint8_t port_id, uint16_t queue_id) {
+	if (port_id >= RTE_MAX_ETHPORTS) {
+		return NULL;
+	}
+	struct tx_port_state* port = __atomic_load_n(&tx_ports[port_id], __ATOMIC_ACQUIRE);
+	if (unlikely(!port)) {
+		struct rte_eth_dev_info dev_info;
+		rte_eth_dev_info_get(port_id, &dev_info);
+		struct tx_port_state* new_port = rte_zmalloc("tx_rate", sizeof(*new_port) + dev_info.nb_tx_queues * sizeof(struct tx_queue_state), RTE_CACHE_LINE_SIZE);
+		if (!new_port) {
+			return NULL;
+		}
+		new_port->num_queues = dev_info.nb_tx_queues;
+		struct tx_port_state* expected = NULL;
+		if (__atomic_compare_exchange_n(&tx_ports[port_id], &expected, new_port, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+			port = new_port;
+		} else {
+			// another thread was faster
+			rte_free(new_port);
+			port = expected;
+		}
+	}
+	if (queue_id >= port->num_queues) {
+		return NULL;
+	}
+	return &port->queues[queue_id];
+}
+
+// counters are only written by the sending thread, the atomic store just prevents torn reads
+static inline void add_stat(uint64_t* ctr, uint64_t val) {
+	__atomic_store_n(ctr, *ctr + val, __ATOMIC_RELAXED);
+}
+
+static uint64_t to_fixed(double cycles) {
+	double fixed = cycles * (1ULL << FRAC_BITS);
+	return fixed >= (double) MAX_COST ? MAX_COST : (uint64_t) fixed;
+}
+
+int libmoon_tx_rate_configure(uint8_t port_id, uint16_t queue_id, const struct libmoon_tx_rate_config* cfg) {
+	struct tx_queue_state* q = get_queue_state(port_id, queue_id);
+	if (!q) {
+		return -EINVAL;
+	}
+	double hz = rte_get_tsc_hz();
+	q->cfg = *cfg;
+	if (!q->cfg.max_burst) {
+		q->cfg.max_burst = DEFAULT_MAX_BURST;
+	}
+	if (!q->cfg.max_lag_us) {
+		q->cfg.max_lag_us = DEFAULT_MAX_LAG_US;
+	}
+	if (cfg->filler_pool) {
+		if (cfg->link_bps <= 0) {
+			return -EINVAL;
+		}
+		if (!q->cfg.min_filler_size) {
+			q->cfg.min_filler_size = DEFAULT_MIN_FILLER_SIZE;
+		}
+		if (!q->cfg.max_filler_size) {
+			q->cfg.max_filler_size = DEFAULT_MAX_FILLER_SIZE;
+		}
+		if (q->cfg.max_filler_size < q->cfg.min_filler_size) {
+			return -EINVAL;
+		}
+		if (cfg->bps > 0) {
+			q->filler_period_per_byte = cfg->link_bps / cfg->bps;
+			q->filler_period = q->filler_period_per_byte * (CRC_BYTES + (cfg->wire_rate ? FRAMING_BYTES : 0));
+		} else if (cfg->pps > 0) {
+			q->filler_period_per_byte = 0;
+			q->filler_period = cfg->link_bps / 8 / cfg->pps;
+		}
+		q->gap_carry = 0;
+	}
+	if (cfg->bps > 0) {
+		double cycles_per_byte = hz * 8 / cfg->bps;
+		q->cycles_per_byte = to_fixed(cycles_per_byte);
+		q->cycles_per_packet = to_fixed(cycles_per_byte * (CRC_BYTES + (cfg->wire_rate ? FRAMING_BYTES : 0)));
+	} else if (cfg->pps > 0) {
+		q->cycles_per_byte = 0;
+		q->cycles_per_packet = to_fixed(hz / cfg->pps);
+	}
+	q->max_lag = (uint64_t) q->cfg.max_lag_us * rte_get_tsc_hz() / 1000000;
+	q->next = 0;
+	q->next_frac = 0;
+	q->rand_state = rte_rdtsc() | 1;
+	__atomic_store_n(&q->enabled, cfg->bps > 0 || cfg->pps > 0, __ATOMIC_RELEASE);
+	return 0;
+}
+
+int libmoon_tx_rate_get_stats(uint8_t port_id, uint16_t queue_id, struct libmoon_tx_rate_stats* stats) {
+	struct tx_queue_state* q = get_queue_state(port_id, queue_id);
+	if (!q) {
+		return -EINVAL;
+	}
+	stats->packets = __atomic_load_n(&q->stats.packets, __ATOMIC_RELAXED);
+	stats->bytes = __atomic_load_n(&q->stats.bytes, __ATOMIC_RELAXED);
+	stats->bursts = __atomic_load_n(&q->stats.bursts, __ATOMIC_RELAXED);
+	stats->wait_cycles = __atomic_load_n(&q->stats.wait_cycles, __ATOMIC_RELAXED);
+	stats->late = __atomic_load_n(&q->stats.late, __ATOMIC_RELAXED);
+	stats->first_tsc = __atomic_load_n(&q->stats.first_tsc, __ATOMIC_RELAXED);
+	stats->last_tsc = __atomic_load_n(&q->stats.last_tsc, __ATOMIC_RELAXED);
+	stats->fillers = __atomic_load_n(&q->stats.fillers, __ATOMIC_RELAXED);
+	stats->filler_bytes = __atomic_load_n(&q->stats.filler_bytes, __ATOMIC_RELAXED);
+	stats->filler_alloc_failed = __atomic_load_n(&q->stats.filler_alloc_failed, __ATOMIC_RELAXED);
+	return 0;
+}
+
+// xorshift64*, uniform in (0, 1]
+static inline double next_random(struct tx_queue_state* q) {
+	uint64_t x = q->rand_state;
+	x ^= x >> 12;
+	x ^= x << 25;
+	x ^= x >> 27;
+	q->rand_state = x;
+	return ((x * 0x2545F4914F6CDD1DULL) >> 11) * (1.0 / (1ULL << 53)) + (1.0 / (1ULL << 54));
+}
+
+static inline void advance_deadline(struct tx_queue_state* q, uint32_t pkt_len) {
+	uint64_t cost = q->cycles_per_packet + pkt_len * q->cycles_per_byte;
+	if (q->cfg.poisson) {
+		cost = (uint64_t) (cost * -log(next_random(q)));
+	}
+	uint64_t total = q->next_frac + cost;
+	q->next += total >> FRAC_BITS;
+	q->next_frac = total & FRAC_MASK;
+}
+
+// returns false if libmoon was stopped while waiting
+static bool wait_until(struct tx_queue_state* q, uint64_t deadline) {
+	uint64_t hz = rte_get_tsc_hz();
+	uint64_t start = rte_rdtsc();
+	uint64_t now = start;
+	bool running = true;
+	while (now < deadline) {
+		if (!is_running(0)) {
+			running = false;
+			break;
+		}
+		uint64_t wait_us = (deadline - now) * 1000000 / hz;
+		if (wait_us > SLEEP_THRESHOLD_US) {
+			usleep(wait_us - SLEEP_THRESHOLD_US);
+		} else {
+			rte_pause();
+		}
+		now = rte_rdtsc();
+	}
+	add_stat(&q->stats.wait_cycles, now - start);
+	return running;
+}
+
+// returns the number of sent packets, less than num_bufs only if libmoon was stopped while the queue was full
+static inline uint32_t send_all(uint8_t port_id, uint16_t queue_id, struct rte_mbuf** bufs, uint32_t num_bufs) {
+	uint32_t done = 0;
+	while (done < num_bufs) {
+		done += rte_eth_tx_burst(port_id, queue_id, bufs + done, num_bufs - done);
+		if (done < num_bufs && !is_running(0)) {
+			break;
+		}
+	}
+	return done;
+}
+
+struct filler_totals {
+	uint32_t packets;
+	uint64_t bytes;
+	uint64_t fillers;
+	uint64_t filler_bytes;
+};
+
+// sends a burst of fillers and packets (bits set in pkts), returns false if libmoon was stopped
+// the unsent frames are freed and removed from the totals in this case
+static bool send_filler_burst(uint8_t port_id, uint16_t queue_id, struct rte_mbuf** burst, uint32_t num_burst, uint64_t pkts, struct filler_totals* totals) {
+	uint32_t done = send_all(port_id, queue_id, burst, num_burst);
+	if (likely(done == num_burst)) {
+		return true;
+	}
+	for (uint32_t i = done; i < num_burst; i++) {
+		if (pkts & (1ULL << i)) {
+			totals->packets--;
+			totals->bytes -= burst[i]->pkt_len + CRC_BYTES;
+		} else {
+			totals->fillers--;
+			totals->filler_bytes -= burst[i]->pkt_len + CRC_BYTES + FRAMING_BYTES;
+		}
+		rte_pktmbuf_free(burst[i]);
+	}
+	return false;
+}
+
+// the NIC sends at line rate, the gap before each packet is the difference between the
+// time a packet should take at the configured rate and at the link rate, all in byte times
+static uint32_t send_with_fillers(struct tx_queue_state* q, uint8_t port_id, uint16_t queue_id, struct rte_mbuf** bufs, uint32_t num_bufs) {
+	struct rte_mbuf* burst[FILLER_BURST];
+	uint32_t num_burst = 0;
+	// application packets in burst
+	uint64_t pkts = 0;
+	uint32_t min_wire = q->cfg.min_filler_size + CRC_BYTES + FRAMING_BYTES;
+	uint32_t max_wire = q->cfg.max_filler_size + CRC_BYTES + FRAMING_BYTES;
+	struct filler_totals totals = { 0 };
+	// first packet that is not in a burst yet
+	uint32_t next = 0;
+	bool running = true;
+	for (uint32_t i = 0; running && i < num_bufs; i++) {
+		struct rte_mbuf* pkt = bufs[i];
+		double period = q->filler_period + pkt->pkt_len * q->filler_period_per_byte;
+		if (q->cfg.poisson) {
+			period *= -log(next_random(q));
+		}
+		double gap = q->gap_carry + period - (pkt->pkt_len + CRC_BYTES + FRAMING_BYTES);
+		uint64_t filled = 0;
+		while (gap >= min_wire) {
+			// split large gaps such that the last filler is not below the minimum size
+			uint32_t size = gap <= max_wire ? (uint32_t) gap : gap - max_wire >= min_wire ? max_wire : (uint32_t) gap - min_wire;
+			struct rte_mbuf* filler = rte_pktmbuf_alloc(q->cfg.filler_pool);
+			if (unlikely(!filler)) {
+				// don't try to catch up later, this would just drain the pool again
+				add_stat(&q->stats.filler_alloc_failed, 1);
+				gap = 0;
+				break;
+			}
+			filler->data_len = size - CRC_BYTES - FRAMING_BYTES;
+			filler->pkt_len = filler->data_len;
+			filler->ol_flags |= PKT_TX_NO_CRC_CSUM;
+			burst[num_burst++] = filler;
+			gap -= size;
+			filled += size;
+			totals.fillers++;
+			totals.filler_bytes += size;
+			if (num_burst == FILLER_BURST) {
+				running = send_filler_burst(port_id, queue_id, burst, num_burst, pkts, &totals);
+				num_burst = 0;
+				pkts = 0;
+				if (!running) {
+					break;
+				}
+			}
+		}
+		if (!running) {
+			break;
+		}
+		// the remainder (or the overshoot of a packet that is larger than its slot) is added to the next gap, so the average rate is exact
+		// the bound keeps rates above line rate from accumulating an ever growing debt
+		q->gap_carry = RTE_MAX(gap, -(double) MAX_GAP_DEBT);
+		if (q->cfg.gap_histogram) {
+			libmoon_histogram_record(q->cfg.gap_histogram, filled);
+		}
+		pkts |= 1ULL << num_burst;
+		burst[num_burst++] = pkt;
+		next = i + 1;
+		totals.packets++;
+		totals.bytes += pkt->pkt_len + CRC_BYTES;
+		if (num_burst == FILLER_BURST) {
+			running = send_filler_burst(port_id, queue_id, burst, num_burst, pkts, &totals);
+			num_burst = 0;
+			pkts = 0;
+		}
+	}
+	if (running) {
+		send_filler_burst(port_id, queue_id, burst, num_burst, pkts, &totals);
+	}
+	// the packets belong to us, libmoon was stopped before they could be sent
+	for (uint32_t i = next; i < num_bufs; i++) {
+		rte_pktmbuf_free(bufs[i]);
+	}
+	libmoon_core_stats_record(totals.packets);
+	uint64_t now = rte_rdtsc();
+	if (unlikely(!q->stats.first_tsc)) {
+		add_stat(&q->stats.first_tsc, now);
+	}
+	__atomic_store_n(&q->stats.last_tsc, now, __ATOMIC_RELAXED);
+	add_stat(&q->stats.packets, totals.packets);
+	add_stat(&q->stats.bytes, totals.bytes);
+	add_stat(&q->stats.bursts, 1);
+	add_stat(&q->stats.fillers, totals.fillers);
+	add_stat(&q->stats.filler_bytes, totals.filler_bytes);
+	return totals.packets;
+}
+
+uint32_t libmoon_tx_rate_send(uint8_t port_id, uint16_t queue_id, struct rte_mbuf** bufs, uint32_t num_bufs) {
+	struct tx_queue_state* q = get_queue_state(port_id, queue_id);
+	bool paced = q && __atomic_load_n(&q->enabled, __ATOMIC_ACQUIRE);
+	if (paced && q->cfg.filler_pool) {
+		return send_with_fillers(q, port_id, queue_id, bufs, num_bufs);
+	}
+	uint32_t sent = 0;
+	while (sent < num_bufs) {
+		uint32_t burst = RTE_MIN(num_bufs - sent, (uint32_t) (paced ? q->cfg.max_burst : UINT16_MAX));
+		uint64_t now = rte_rdtsc();
+		uint64_t bytes = 0;
+		if (paced) {
+			if (unlikely(!q->next)) {
+				q->next = now;
+			} else if (now < q->next) {
+				if (!wait_until(q, q->next)) {
+					break;
+				}
+				now = rte_rdtsc();
+			} else if (now - q->next > q->max_lag) {
+				// the application didn't keep up, only catch up with the last max_lag cycles instead of one burst of everything
+				add_stat(&q->stats.late, 1);
+				q->next = now - q->max_lag;
+			}
+			// everything that is due goes out in one burst
+			uint32_t due = 0;
+			while (due < burst && q->next <= now) {
+				uint32_t len = bufs[sent + due]->pkt_len;
+				bytes += len + CRC_BYTES;
+				advance_deadline(q, len);
+				due++;
+			}
+			burst = due;
+		}
+		uint32_t done = send_all(port_id, queue_id, bufs + sent, burst);
+		libmoon_core_stats_record(done);
+		if (paced) {
+			for (uint32_t i = done; i < burst; i++) {
+				bytes -= bufs[sent + i]->pkt_len + CRC_BYTES;
+			}
+			if (unlikely(!q->stats.first_tsc)) {
+				add_stat(&q->stats.first_tsc, now);
+			}
+			__atomic_store_n(&q->stats.last_tsc, now, __ATOMIC_RELAXED);
+			add_stat(&q->stats.packets, done);
+			add_stat(&q->stats.bytes, bytes);
+			add_stat(&q->stats.bursts, 1);
+		}
+		sent += done;
+		if (done < burst) {
+			break;
+		}
+	}
+	// the packets belong to us, libmoon was stopped before they could be sent
+	for (uint32_t i = sent; i < num_bufs; i++) {
+		rte_pktmbuf_free(bufs[i]);
+	}
+	return sent;
+}
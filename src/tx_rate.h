@@ -0,0 +1,75 @@
+#ifndef MG_TX_RATE_H
+#define MG_TX_RATE_H
+
+#include <stdint.h>
+#include <rte_config.h>
+#include <rte_mbuf.h>
+#include <rte_mempool.h>
+
+#include "histogram.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// software rate control for tx queues of NICs without (usable) hardware rate limiters
+// every packet gets a TSC deadline, packets are sent as soon as their deadline has passed,
+// i.e. single packets at low rates and bursts of up to max_burst packets if the loop can't keep up with the rate
+// deadlines are accumulated with sub-cycle precision, so the average rate is exact as long as the queue keeps up
+//
+// alternatively, gaps are filled with frames with an invalid CRC that are dropped by the receiver (CRC filler mode)
+// the NIC sends at line rate, so the spacing is exact to the byte even for sub-microsecond gaps, the TSC is not used at all
+// this requires a NIC that can send frames without CRC (PKT_TX_NO_CRC_CSUM, the ixgbe, igb, and i40e drivers in our DPDK fork)
+
+struct libmoon_tx_rate_config {
+	// either a packet rate or a bit rate (based on the packet size incl. CRC, plus 20 bytes framing if wire_rate is set)
+	double pps;
+	double bps;
+	uint8_t wire_rate;
+	// exponentially distributed inter-departure times instead of constant ones
+	uint8_t poisson;
+	// upper bound for packets per rte_eth_tx_burst()
+	uint16_t max_burst;
+	// a sender that falls behind by more than this only catches up this much, otherwise it would send everything it is behind at line rate
+	uint32_t max_lag_us;
+	// enables the CRC filler mode, filler frames are allocated from this pool
+	struct rte_mempool* filler_pool;
+	// link rate in bit/s, required for the CRC filler mode
+	double link_bps;
+	// smallest and largest filler frame (excl. CRC) the NIC can send
+	uint16_t min_filler_size;
+	uint16_t max_filler_size;
+	// optional, records the gap before every packet in byte times (excl. the 20 bytes framing of the packet), CRC filler mode only
+	struct libmoon_histogram* gap_histogram;
+};
+
+// written by the sending thread only
+struct libmoon_tx_rate_stats {
+	uint64_t packets;
+	uint64_t bytes;
+	uint64_t bursts;
+	// cycles spent waiting for deadlines
+	uint64_t wait_cycles;
+	// number of times the sender fell behind by more than max_lag_us
+	uint64_t late;
+	// tsc of the first and last sent burst
+	uint64_t first_tsc;
+	uint64_t last_tsc;
+	// CRC filler mode: sent filler frames and their size on the wire (incl. framing)
+	uint64_t fillers;
+	uint64_t filler_bytes;
+	// gaps that could not be filled because the filler pool was empty
+	uint64_t filler_alloc_failed;
+};
+
+// a rate of 0 disables rate control for the queue
+int libmoon_tx_rate_configure(uint8_t port_id, uint16_t queue_id, const struct libmoon_tx_rate_config* cfg);
+// sends all packets paced according to the configuration, returns early (with the number of sent packets) if libmoon is stopped
+uint32_t libmoon_tx_rate_send(uint8_t port_id, uint16_t queue_id, struct rte_mbuf** bufs, uint32_t num_bufs);
+int libmoon_tx_rate_get_stats(uint8_t port_id, uint16_t queue_id, struct libmoon_tx_rate_stats* stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
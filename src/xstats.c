@@ -0,0 +1,96 @@
+#include <stdint.h>
+#include <string.h>
+
+#include <rte_config.h>
+#include <rte_common.h>
+#include <rte_cycles.h>
+#include <rte_ethdev.h>
+#include <rte_malloc.h>
+
+#include "xstats.h"
+
+struct libmoon_xstats {
+	uint8_t port;
+	uint32_t num;
+	uint64_t last_tsc;
+	uint64_t* ids;
+	uint64_t* values;
+	uint64_t* last_values;
+	double* rates;
+	struct rte_eth_xstat_name* names;
+};
+
+struct libmoon_xstats* libmoon_xstats_create(uint8_t port_id, const uint64_t* ids, uint32_t num_ids) {
+	if (!ids) {
+		int n = rte_eth_xstats_get_names(port_id, NULL, 0);
+		if (n <= 0) {
+			return NULL;
+		}
+		num_ids = n;
+	}
+	// all arrays share one allocation, 8 byte values first to keep them aligned
+	size_t size = sizeof(struct libmoon_xstats) + num_ids * (3 * sizeof(uint64_t) + sizeof(double) + sizeof(struct rte_eth_xstat_name));
+	struct libmoon_xstats* xstats = rte_zmalloc("xstats", size, RTE_CACHE_LINE_SIZE);
+	if (!xstats) {
+		return NULL;
+	}
+	xstats->port = port_id;
+	xstats->num = num_ids;
+	xstats->ids = (uint64_t*) (xstats + 1);
+	xstats->values = xstats->ids + num_ids;
+	xstats->last_values = xstats->values + num_ids;
+	xstats->rates = (double*) (xstats->last_values + num_ids);
+	xstats->names = (struct rte_eth_xstat_name*) (xstats->rates + num_ids);
+	for (uint32_t i = 0; i < num_ids; i++) {
+		xstats->ids[i] = ids ? ids[i] : i;
+	}
+	if (rte_eth_xstats_get_names_by_id(port_id, xstats->names, num_ids, xstats->ids) != (int) num_ids) {
+		rte_free(xstats);
+		return NULL;
+	}
+	return xstats;
+}
+
+void libmoon_xstats_delete(struct libmoon_xstats* xstats) {
+	rte_free(xstats);
+}
+
+uint32_t libmoon_xstats_count(struct libmoon_xstats* xstats) {
+	return xstats->num;
+}
+
+const char* libmoon_xstats_name(struct libmoon_xstats* xstats, uint32_t idx) {
+	return idx < xstats->num ? xstats->names[idx].name : NULL;
+}
+
+double libmoon_xstats_update(struct libmoon_xstats* xstats) {
+	uint64_t* tmp = xstats->last_values;
+	xstats->last_values = xstats->values;
+	xstats->values = tmp;
+	if (rte_eth_xstats_get_by_id(xstats->port, xstats->ids, xstats->values, xstats->num) != (int) xstats->num) {
+		// keep the previous values
+		xstats->values = xstats->last_values;
+		xstats->last_values = tmp;
+		return -1;
+	}
+	uint64_t now = rte_rdtsc();
+	double elapsed = 0;
+	if (xstats->last_tsc) {
+		elapsed = (double) (now - xstats->last_tsc) / rte_get_tsc_hz();
+		for (uint32_t i = 0; i < xstats->num; i++) {
+			// some counters are not monotonic, e.g. after a device reset
+			int64_t delta = xstats->values[i] - xstats->last_values[i];
+			xstats->rates[i] = elapsed > 0 ? delta / elapsed : 0;
+		}
+	}
+	xstats->last_tsc = now;
+	return elapsed;
+}
+
+const uint64_t* libmoon_xstats_values(struct libmoon_xstats* xstats) {
+	return xstats->values;
+}
+
+const double* libmoon_xstats_rates(struct libmoon_xstats* xstats) {
+	return xstats->rates;
+}
@@ -0,0 +1,29 @@
+#ifndef MG_XSTATS_H
+#define MG_XSTATS_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// collects a fixed set of extended device statistics (xstats) of a port
+// ids and names are resolved once, each update fetches all values with a single call and computes the rates
+struct libmoon_xstats;
+
+// ids as returned by rte_eth_xstats_get_names(), NULL for all xstats of the port
+struct libmoon_xstats* libmoon_xstats_create(uint8_t port_id, const uint64_t* ids, uint32_t num_ids);
+void libmoon_xstats_delete(struct libmoon_xstats* xstats);
+uint32_t libmoon_xstats_count(struct libmoon_xstats* xstats);
+const char* libmoon_xstats_name(struct libmoon_xstats* xstats, uint32_t idx);
+// returns the seconds since the last update, 0 for the first update (all rates are 0), negative on error
+double libmoon_xstats_update(struct libmoon_xstats* xstats);
+// results of the last update, rates are per second
+const uint64_t* libmoon_xstats_values(struct libmoon_xstats* xstats);
+const double* libmoon_xstats_rates(struct libmoon_xstats* xstats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif